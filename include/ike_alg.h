@@ -629,6 +629,12 @@ struct prf_ops {
 			     const char *name, const uint8_t *bytes, size_t sizeof_bytes);
 	PK11SymKey *(*final_symkey)(struct prf_context **prf);
 	void (*final_bytes)(struct prf_context **prf, uint8_t *bytes, size_t sizeof_bytes);
+	/*
+	 * Like final_symkey() but then restart PRF, with the same
+	 * key, ready to consume new data; cheaper than init_*() as
+	 * the key (and context) is re-used.
+	 */
+	PK11SymKey *(*final_symkey_restart)(struct prf_context *prf);
 };
 
 /*
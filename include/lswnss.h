@@ -54,6 +54,14 @@ char *lsw_nss_get_password(PK11SlotInfo *slot, PRBool retry, void *arg);
 
 PK11SlotInfo *lsw_nss_get_authenticated_slot(lsw_nss_buf_t err);
 
+/*
+ * Like PK11_GenerateRandom() but small requests are served from a
+ * per-thread buffer of NSS output.  For values that are sent in the
+ * clear (IVs, SPIs, message IDs); use PK11_GenerateRandom() for
+ * secrets.
+ */
+SECStatus lsw_nss_buffered_random(uint8_t *bytes, size_t size);
+
 /* _(SECERR: N (0xX): <error-string>) */
 size_t lswlog_nss_error(struct lswlog *log);
 
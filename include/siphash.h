@@ -0,0 +1,42 @@
+/* keyed hash function, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#include <stdint.h>
+#include <stddef.h>	/* size_t */
+
+/*
+ * SipHash-1-3 (one compression and three finalization rounds): a fast
+ * hash that, given a secret KEY, can't be steered by whoever chooses
+ * the data; use it for hash tables indexed by values from the
+ * network.
+ *
+ * Not a MAC.
+ */
+
+struct siphash_key {
+	uint64_t k[2];
+};
+
+uint64_t siphash13(const struct siphash_key *key, const void *data, size_t len);
+
+/*
+ * SipHash-2-4, the variant the paper publishes test vectors for;
+ * shares its code with the above so those vectors check both.
+ */
+
+uint64_t siphash24(const struct siphash_key *key, const void *data, size_t len);
+
+#endif
@@ -63,7 +63,7 @@
  */
 
 #define WHACK_BASIC_MAGIC (((((('w' << 8) + 'h') << 8) + 'k') << 8) + 25)
-#define WHACK_MAGIC (((((('o' << 8) + 'h') << 8) + 'k') << 8) + 46)
+#define WHACK_MAGIC (((((('o' << 8) + 'h') << 8) + 'k') << 8) + 48)
 
 /*
  * Where, if any, is the pubkey coming from.
@@ -124,6 +124,20 @@ struct whack_end {
 				 */
 };
 
+/*
+ * For --status and --trafficstatus: which connections and states to
+ * list, and which page of them.
+ */
+struct whack_status_filter {
+	char *name;		/* shell pattern matched against connection names */
+	char *state;		/* shell pattern matched against state names */
+	bool has_peer;
+	ip_subnet peer;		/* the remote address is within */
+	unsigned ike_version;	/* 1 or 2; 0 for both */
+	unsigned long offset;	/* skip this many */
+	unsigned long limit;	/* list at most this many; 0 for all */
+};
+
 enum whack_opt_set {
 	WHACK_ADJUSTOPTIONS=0,		/* normal case */
 	WHACK_SETDUMPDIR=1,		/* string1 contains new dumpdir */
@@ -159,6 +173,14 @@ struct whack_message {
 	lmod_t debugging;
 	lmod_t impairing;
 
+	/* limit DEBUGGING to a peer and/or a state (and its children) */
+	bool whack_debug_peer;
+	ip_subnet debug_peer;
+	long unsigned int debug_serialno;
+
+	/* for --status and --trafficstatus */
+	struct whack_status_filter status_filter;
+
 	/* what to impair and how */
 	struct whack_impair impairment;
 
@@ -383,6 +405,8 @@ struct whack_message {
 	 * 28 remote_host
 	 * 29 redirect_to
 	 * 30 accept_redirect_to
+	 * 36 status_filter.name
+	 * 37 status_filter.state
 	 * plus keyval (limit: 8K bits + overhead), a chunk.
 	 */
 	size_t str_size;
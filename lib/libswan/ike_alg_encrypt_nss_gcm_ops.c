@@ -16,6 +16,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <nss.h>		/* for NSS_VMAJOR et.al. */
+
 #include "lswlog.h"
 #include "lswnss.h"
 #include "prmem.h"
@@ -46,12 +48,20 @@ static bool ike_alg_nss_gcm(const struct encrypt_desc *alg,
 	};
 	chunk_t iv = clone_chunk_chunk(salt_chunk, wire_iv_chunk, "IV");
 
-	CK_GCM_PARAMS gcm_params;
-	gcm_params.pIv = iv.ptr;
-	gcm_params.ulIvLen = iv.len;
-	gcm_params.pAAD = aad;
-	gcm_params.ulAADLen = aad_size;
-	gcm_params.ulTagBits = tag_size * 8;
+	CK_GCM_PARAMS gcm_params = {
+		.pIv = iv.ptr,
+		.ulIvLen = iv.len,
+		.pAAD = aad,
+		.ulAADLen = aad_size,
+		.ulTagBits = tag_size * 8,
+	};
+#if (NSS_VMAJOR > 3 || (NSS_VMAJOR == 3 && NSS_VMINOR >= 52)) && !defined(NSS_PKCS11_2_0_COMPAT)
+	/*
+	 * Since 3.52, CK_GCM_PARAMS is the PKCS#11 v3 structure and
+	 * NSS rejects an IV whose length in bits doesn't match.
+	 */
+	gcm_params.ulIvBits = iv.len * 8;
+#endif
 
 	SECItem param;
 	param.type = siBuffer;
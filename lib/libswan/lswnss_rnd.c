@@ -0,0 +1,86 @@
+/*
+ * Buffered NSS random bytes, for libreswan.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <pthread.h>	/* pthread.h must be first include file */
+#include <stdlib.h>
+#include <string.h>
+
+#include <pk11pub.h>
+
+#include "lswnss.h"
+
+/*
+ * Every PK11_GenerateRandom() call, however small, takes the
+ * softoken's global DRBG lock; with the main thread asking for IVs
+ * and message IDs while the helpers ask for nonces it is contended.
+ * Instead, each thread pulls RND_BUFFER_SIZE bytes at a time and
+ * hands them out.
+ *
+ * The buffer is malloc()ed, not alloc_bytes()ed: the main thread's
+ * lives until exit and would otherwise be reported as a leak.
+ */
+
+#define RND_BUFFER_SIZE 1024
+
+struct rnd_buffer {
+	size_t used;	/* bytes already handed out */
+	uint8_t bytes[RND_BUFFER_SIZE];
+};
+
+static pthread_key_t rnd_buffer_key;
+static pthread_once_t rnd_buffer_once = PTHREAD_ONCE_INIT;
+
+static void free_rnd_buffer(void *arg)
+{
+	struct rnd_buffer *b = arg;
+	memset(b, 0, sizeof(*b));
+	free(b);
+}
+
+static void init_rnd_buffer_key(void)
+{
+	pthread_key_create(&rnd_buffer_key, free_rnd_buffer);
+}
+
+SECStatus lsw_nss_buffered_random(uint8_t *bytes, size_t size)
+{
+	if (size >= RND_BUFFER_SIZE / 4) {
+		/* not worth buffering */
+		return PK11_GenerateRandom(bytes, size);
+	}
+
+	pthread_once(&rnd_buffer_once, init_rnd_buffer_key);
+	struct rnd_buffer *b = pthread_getspecific(rnd_buffer_key);
+	if (b == NULL) {
+		b = malloc(sizeof(*b));
+		if (b == NULL) {
+			return PK11_GenerateRandom(bytes, size);
+		}
+		b->used = RND_BUFFER_SIZE;	/* empty */
+		pthread_setspecific(rnd_buffer_key, b);
+	}
+
+	if (b->used + size > RND_BUFFER_SIZE) {
+		SECStatus rv = PK11_GenerateRandom(b->bytes, RND_BUFFER_SIZE);
+		if (rv != SECSuccess) {
+			return rv;
+		}
+		b->used = 0;
+	}
+	memcpy(bytes, b->bytes + b->used, size);
+	/* never hand out the same bytes twice */
+	memset(b->bytes + b->used, 0, size);
+	b->used += size;
+	return SECSuccess;
+}
@@ -0,0 +1,93 @@
+/* keyed hash function, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+/*
+ * See "SipHash: a fast short-input PRF", Aumasson and Bernstein.
+ */
+
+#include "siphash.h"
+
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+#define SIPROUND(V)							\
+	{								\
+		V[0] += V[1]; V[1] = ROTL(V[1], 13); V[1] ^= V[0];	\
+		V[0] = ROTL(V[0], 32);					\
+		V[2] += V[3]; V[3] = ROTL(V[3], 16); V[3] ^= V[2];	\
+		V[0] += V[3]; V[3] = ROTL(V[3], 21); V[3] ^= V[0];	\
+		V[2] += V[1]; V[1] = ROTL(V[1], 17); V[1] ^= V[2];	\
+		V[2] = ROTL(V[2], 32);					\
+	}
+
+/* little endian, regardless of the host */
+static uint64_t le64(const uint8_t *p, size_t len)
+{
+	uint64_t m = 0;
+	for (size_t i = 0; i < len; i++) {
+		m |= (uint64_t)p[i] << (8 * i);
+	}
+	return m;
+}
+
+/*
+ * C compression and D finalization rounds; inlined into each variant
+ * so that the round counts are constants.
+ */
+
+static inline uint64_t siphash(const struct siphash_key *key,
+			       const void *data, size_t len,
+			       unsigned c, unsigned d)
+{
+	const uint8_t *p = data;
+	uint64_t v[4] = {
+		key->k[0] ^ UINT64_C(0x736f6d6570736575),
+		key->k[1] ^ UINT64_C(0x646f72616e646f6d),
+		key->k[0] ^ UINT64_C(0x6c7967656e657261),
+		key->k[1] ^ UINT64_C(0x7465646279746573),
+	};
+
+	size_t left = len;
+	for (; left >= 8; p += 8, left -= 8) {
+		uint64_t m = le64(p, 8);
+		v[3] ^= m;
+		for (unsigned r = 0; r < c; r++) {
+			SIPROUND(v);
+		}
+		v[0] ^= m;
+	}
+
+	uint64_t b = ((uint64_t)len << 56) | le64(p, left);
+	v[3] ^= b;
+	for (unsigned r = 0; r < c; r++) {
+		SIPROUND(v);
+	}
+	v[0] ^= b;
+
+	v[2] ^= 0xff;
+	for (unsigned r = 0; r < d; r++) {
+		SIPROUND(v);
+	}
+
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+uint64_t siphash13(const struct siphash_key *key, const void *data, size_t len)
+{
+	return siphash(key, data, len, 1, 3);
+}
+
+uint64_t siphash24(const struct siphash_key *key, const void *data, size_t len)
+{
+	return siphash(key, data, len, 2, 4);
+}
@@ -140,6 +140,8 @@ err_t pack_whack_msg(struct whackpacker *wp)
 	    !pack_str(wp, &wp->msg->remote_host) ||		/* string 33 */
 	    !pack_str(wp, &wp->msg->redirect_to) ||		/* string 34 */
 	    !pack_str(wp, &wp->msg->accept_redirect_to) ||	/* string 35 */
+	    !pack_str(wp, &wp->msg->status_filter.name) ||	/* string 36 */
+	    !pack_str(wp, &wp->msg->status_filter.state) ||	/* string 37 */
 	    wp->str_roof - wp->str_next < (ptrdiff_t)wp->msg->keyval.len)	/* key */
 	{
 		return "too many bytes of strings or key to fit in message to pluto";
@@ -211,6 +213,8 @@ err_t unpack_whack_msg(struct whackpacker *wp)
 	    !unpack_str(wp, &wp->msg->remote_host) ||		/* string 33 */
 	    !unpack_str(wp, &wp->msg->redirect_to) ||		/* string 34 */
 	    !unpack_str(wp, &wp->msg->accept_redirect_to) ||	/* string 35 */
+	    !unpack_str(wp, &wp->msg->status_filter.name) ||	/* string 36 */
+	    !unpack_str(wp, &wp->msg->status_filter.state) ||	/* string 37 */
 	    wp->str_roof - wp->str_next != (ptrdiff_t)wp->msg->keyval.len)
 	{
 		ugh = "message from whack contains bad string or key";
@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "lswlog.h"
 #include "lswtool.h"
@@ -11,6 +12,8 @@
 #include "ike_alg.h"
 #include "alg_info.h"
 
+#include "ike_alg_bench.h"
+
 static bool test_proposals = false;
 static bool test_algs = false;
 static bool verbose = false;
@@ -20,6 +23,12 @@ static bool ikev1 = false;
 static bool ikev2 = false;
 static bool fips = false;
 static bool pfs = false;
+static bool bench_algs = false;
+static struct ike_alg_bench bench = {
+	.seconds = 1,
+	.sizes = { 64, 1500, 9000, },
+	.threads = { 1, },
+};
 static int failures = 0;
 
 enum status { PASSED = 0, FAILED = 1, ERROR = 126, };
@@ -408,12 +417,39 @@ static void test(void)
 	ike(false, "aes_ccm"); /* ESP/AH only */
 }
 
+/*
+ * Parse a comma separated list of positive numbers into a zero
+ * terminated array.
+ */
+
+static void parse_list(const char *arg, unsigned list[], size_t nr)
+{
+	if (arg == NULL) {
+		fprintf(stderr, "missing list of numbers\n");
+		exit(ERROR);
+	}
+	unsigned i = 0;
+	for (const char *p = arg; *p != '\0'; ) {
+		char *end;
+		unsigned long u = strtoul(p, &end, 10);
+		if (end == p || u == 0 || u > UINT_MAX ||
+		    (*end != ',' && *end != '\0') || i + 1 >= nr) {
+			fprintf(stderr, "invalid list of numbers: %s\n", arg);
+			exit(ERROR);
+		}
+		list[i++] = u;
+		p = (*end == ',' ? end + 1 : end);
+	}
+	list[i] = 0;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
 		"Usage:\n"
 		"\n"
 		"    algparse [ <option> ... ] -tp | -ta | [<protocol>=][<proposal>{,<proposal>}] ...\n"
+		"    algparse [ <option> ... ] -bench [ <type> | <algorithm> ]\n"
 		"\n"
 		"Parse one or more proposals using the algorithm parser.\n"
 		"Either specify the proposals to be parsed on the command line\n"
@@ -430,6 +466,14 @@ static void usage(void)
 		"    -tp: run the proposal testsuite\n"
 		"    -ta: also run the algorithm testsuite\n"
 		"\n"
+		"or measure the throughput of the in-process algorithms, optionally\n"
+		"limited to one <type> (encrypt, prf, integ, dh or rnd) or <algorithm>:\n"
+		"\n"
+		"    -bench: print ops/s and MB/s for each algorithm, size and thread count\n"
+		"    -seconds <n>: duration of each measurement (default 1)\n"
+		"    -sizes <n>,...: message sizes in bytes (default 64,1500,9000)\n"
+		"    -threads <n>,...: number of threads (default 1)\n"
+		"\n"
 		"Additional options:\n"
 		"\n"
 		"    -v1 | -ikev1: require IKEv1 support\n"
@@ -454,6 +498,8 @@ static void usage(void)
 		"        (with IKEv1, this is the default algorithms, with IKEv2 it is not)\n"
 		"    algparse -v2 ike=aes-sha1-dh23\n"
 		"        expand 'aes-sha1-dh23' using the the IKEv2 'ike' parser\n"
+		"    algparse -bench -threads 1,4 encrypt\n"
+		"        measure the encryption algorithms using 1 and then 4 threads\n"
 		);
 }
 
@@ -483,6 +529,16 @@ int main(int argc, char *argv[])
 			test_proposals = true;
 		} else if (streq(arg, "ta")) {
 			test_algs = true;
+		} else if (streq(arg, "bench")) {
+			bench_algs = true;
+		} else if (streq(arg, "seconds")) {
+			unsigned seconds[2];
+			parse_list(*++argp, seconds, elemsof(seconds));
+			bench.seconds = seconds[0];
+		} else if (streq(arg, "sizes")) {
+			parse_list(*++argp, bench.sizes, elemsof(bench.sizes));
+		} else if (streq(arg, "threads")) {
+			parse_list(*++argp, bench.threads, elemsof(bench.threads));
 		} else if (streq(arg, "v1") || streq(arg, "ikev1")) {
 			ikev1 = true;
 		} else if (streq(arg, "v2") || streq(arg, "ikev2")) {
@@ -535,7 +591,7 @@ int main(int argc, char *argv[])
 	 * NSS directory.
 	 */
 	lsw_nss_buf_t err;
-	bool nss_ok = lsw_nss_setup((fips && test_algs) ? lsw_init_options()->nssdir : NULL,
+	bool nss_ok = lsw_nss_setup((fips && (test_algs || bench_algs)) ? lsw_init_options()->nssdir : NULL,
 				    LSW_NSS_READONLY, lsw_nss_get_password, err);
 	if (!nss_ok) {
 		fprintf(stderr, "unexpected %s\n", err);
@@ -565,7 +621,14 @@ int main(int argc, char *argv[])
 		test_ike_alg();
 	}
 
-	if (*argp) {
+	if (bench_algs) {
+		if (*argp != NULL && argp[1] != NULL) {
+			fprintf(stderr, "-bench accepts at most one algorithm\n");
+			exit(ERROR);
+		}
+		bench.filter = *argp;
+		bench_ike_alg(&bench);
+	} else if (*argp) {
 		if (test_proposals) {
 			fprintf(stderr, "-t conflicts with algorithm list\n");
 			exit(ERROR);
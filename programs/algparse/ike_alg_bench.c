@@ -0,0 +1,408 @@
+/* Benchmark algorithms, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <keyhi.h>
+
+#include "lswnss.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+#include "ike_alg.h"
+#include "ike_alg_dh.h"
+
+#include "crypt_symkey.h"
+
+#include "ike_alg_bench.h"
+
+/*
+ * A single measurement: one algorithm, one size, N threads.
+ */
+
+enum bench_type {
+	BENCH_ENCRYPT,
+	BENCH_PRF,
+	BENCH_INTEG,
+	BENCH_DH,
+	BENCH_RND_NSS,
+	BENCH_RND_BUFFERED,
+};
+
+static const char *const bench_type_name[] = {
+	[BENCH_ENCRYPT] = "encrypt",
+	[BENCH_PRF] = "prf",
+	[BENCH_INTEG] = "integ",
+	[BENCH_DH] = "dh",
+	[BENCH_RND_NSS] = "rnd",
+	[BENCH_RND_BUFFERED] = "rnd",
+};
+
+/*
+ * There's no algorithm for random bytes; print the source.  The size
+ * is that of an IV.
+ */
+static const char *const rnd_source_name[] = {
+	[BENCH_RND_NSS] = "PK11_GenerateRandom",
+	[BENCH_RND_BUFFERED] = "lsw_nss_buffered_random",
+};
+#define RND_BENCH_SIZE 16
+
+struct job {
+	enum bench_type type;
+	const struct ike_alg *alg;
+	size_t size;
+	unsigned seconds;
+	pthread_barrier_t barrier;
+};
+
+struct worker {
+	pthread_t thread;
+	struct job *job;
+	unsigned long ops;
+	double seconds;
+};
+
+/*
+ * Per-thread state, set up before the clock starts.
+ */
+
+struct bench_state {
+	PK11SymKey *key;
+	uint8_t *buf;
+	size_t buf_size;
+	uint8_t iv[MAX_CBC_BLOCK_SIZE];
+	uint8_t salt[16];
+	uint8_t aad[32];
+	uint8_t digest[MAX_DIGEST_LEN];
+	uint8_t *remote_ke;
+};
+
+static void fill(uint8_t *bytes, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		bytes[i] = i;
+	}
+}
+
+/*
+ * CBC wants whole blocks (round down, but to at least one); CTR and
+ * the AEAD algorithms take any size.
+ */
+static size_t encrypt_size(const struct encrypt_desc *encrypt, size_t size)
+{
+	if (!encrypt->pad_to_blocksize) {
+		return size;
+	}
+	size_t blocks = size / encrypt->enc_blocksize;
+	return (blocks > 0 ? blocks : 1) * encrypt->enc_blocksize;
+}
+
+static void setup(const struct job *job, struct bench_state *s)
+{
+	zero(s);
+	switch (job->type) {
+	case BENCH_ENCRYPT:
+	{
+		const struct encrypt_desc *encrypt = encrypt_desc(job->alg);
+		uint8_t key[BYTES_FOR_BITS(256) + 4];
+		size_t key_size = BYTES_FOR_BITS(encrypt->keydeflen);
+		passert(key_size <= sizeof(key));
+		fill(key, key_size);
+		s->key = encrypt_key_from_bytes("key", encrypt, key, key_size);
+		s->buf_size = encrypt_size(encrypt, job->size) + encrypt->aead_tag_size;
+		s->buf = alloc_bytes(s->buf_size, "buffer");
+		fill(s->buf, s->buf_size);
+		fill(s->iv, sizeof(s->iv));
+		fill(s->salt, sizeof(s->salt));
+		fill(s->aad, sizeof(s->aad));
+		break;
+	}
+	case BENCH_PRF:
+	case BENCH_INTEG:
+	{
+		const struct prf_desc *prf;
+		size_t key_size;
+		if (job->type == BENCH_PRF) {
+			prf = prf_desc(job->alg);
+			key_size = prf->prf_key_size;
+		} else {
+			prf = integ_desc(job->alg)->prf;
+			key_size = integ_desc(job->alg)->integ_keymat_size;
+		}
+		uint8_t *key = alloc_bytes(key_size, "key");
+		fill(key, key_size);
+		s->key = prf_key_from_bytes("key", prf, key, key_size);
+		pfree(key);
+		s->buf_size = job->size;
+		s->buf = alloc_bytes(s->buf_size, "buffer");
+		fill(s->buf, s->buf_size);
+		break;
+	}
+	case BENCH_DH:
+	{
+		/* the peer's public value */
+		const struct oakley_group_desc *group = oakley_group_desc(job->alg);
+		SECKEYPrivateKey *privk = NULL;
+		SECKEYPublicKey *pubk = NULL;
+		s->remote_ke = alloc_bytes(group->bytes, "remote KE");
+		group->dh_ops->calc_secret(group, &privk, &pubk,
+					   s->remote_ke, group->bytes);
+		SECKEY_DestroyPrivateKey(privk);
+		SECKEY_DestroyPublicKey(pubk);
+		s->buf_size = group->bytes;
+		s->buf = alloc_bytes(s->buf_size, "local KE");
+		break;
+	}
+	case BENCH_RND_NSS:
+	case BENCH_RND_BUFFERED:
+		s->buf_size = job->size;
+		s->buf = alloc_bytes(s->buf_size, "random");
+		break;
+	default:
+		bad_case(job->type);
+	}
+}
+
+static void cleanup(struct bench_state *s)
+{
+	release_symkey(__func__, "key", &s->key);
+	pfreeany(s->buf);
+	pfreeany(s->remote_ke);
+}
+
+/*
+ * The operation being measured; as performed by pluto for each
+ * message or exchange.
+ */
+
+static void op(const struct job *job, struct bench_state *s)
+{
+	switch (job->type) {
+	case BENCH_ENCRYPT:
+	{
+		const struct encrypt_desc *encrypt = encrypt_desc(job->alg);
+		if (encrypt_desc_is_aead(encrypt)) {
+			encrypt->encrypt_ops->do_aead(encrypt,
+						      s->salt, encrypt->salt_size,
+						      s->iv, encrypt->wire_iv_size,
+						      s->aad, sizeof(s->aad),
+						      s->buf, s->buf_size - encrypt->aead_tag_size,
+						      encrypt->aead_tag_size,
+						      s->key, true);
+		} else {
+			encrypt->encrypt_ops->do_crypt(encrypt, s->buf, s->buf_size,
+						       s->key, s->iv, true);
+		}
+		break;
+	}
+	case BENCH_PRF:
+	case BENCH_INTEG:
+	{
+		const struct prf_desc *prf = (job->type == BENCH_PRF
+					      ? prf_desc(job->alg)
+					      : integ_desc(job->alg)->prf);
+		struct prf_context *ctx = prf->prf_ops->init_symkey(prf, "bench",
+								    "key", s->key);
+		prf->prf_ops->digest_bytes(ctx, "data", s->buf, s->buf_size);
+		prf->prf_ops->final_bytes(&ctx, s->digest, prf->prf_output_size);
+		break;
+	}
+	case BENCH_DH:
+	{
+		const struct oakley_group_desc *group = oakley_group_desc(job->alg);
+		SECKEYPrivateKey *privk = NULL;
+		SECKEYPublicKey *pubk = NULL;
+		group->dh_ops->calc_secret(group, &privk, &pubk,
+					   s->buf, s->buf_size);
+		PK11SymKey *shared = group->dh_ops->calc_shared(group, privk, pubk,
+								s->remote_ke,
+								group->bytes);
+		release_symkey(__func__, "shared", &shared);
+		SECKEY_DestroyPrivateKey(privk);
+		SECKEY_DestroyPublicKey(pubk);
+		break;
+	}
+	case BENCH_RND_NSS:
+		passert(PK11_GenerateRandom(s->buf, s->buf_size) == SECSuccess);
+		break;
+	case BENCH_RND_BUFFERED:
+		passert(lsw_nss_buffered_random(s->buf, s->buf_size) == SECSuccess);
+		break;
+	default:
+		bad_case(job->type);
+	}
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct bench_state s;
+	setup(w->job, &s);
+	pthread_barrier_wait(&w->job->barrier);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		op(w->job, &s);
+		w->ops++;
+		w->seconds = seconds_since(&start);
+	} while (w->seconds < w->job->seconds);
+
+	cleanup(&s);
+	return NULL;
+}
+
+static void measure(enum bench_type type, const struct ike_alg *alg,
+		    size_t size, unsigned nr_threads, unsigned seconds)
+{
+	struct job job = {
+		.type = type,
+		.alg = alg,
+		.size = size,
+		.seconds = seconds,
+	};
+	pthread_barrier_init(&job.barrier, NULL, nr_threads);
+	struct worker *workers = alloc_things(struct worker, nr_threads, "workers");
+	for (unsigned t = 0; t < nr_threads; t++) {
+		workers[t].job = &job;
+		passert(pthread_create(&workers[t].thread, NULL,
+				       run_worker, &workers[t]) == 0);
+	}
+
+	unsigned long ops = 0;
+	double elapsed = 0;
+	for (unsigned t = 0; t < nr_threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		ops += workers[t].ops;
+		if (workers[t].seconds > elapsed) {
+			elapsed = workers[t].seconds;
+		}
+	}
+	pfree(workers);
+	pthread_barrier_destroy(&job.barrier);
+
+	double ops_per_second = ops / elapsed;
+	const char *name = (alg != NULL ? alg->fqn : rnd_source_name[type]);
+	if (type == BENCH_ENCRYPT) {
+		/* what was actually encrypted */
+		size = encrypt_size(encrypt_desc(alg), size);
+	}
+	if (type == BENCH_DH) {
+		printf("%-8s %-24s %8s %3u %12.1f %12s\n",
+		       bench_type_name[type], name, "-", nr_threads,
+		       ops_per_second, "-");
+	} else {
+		printf("%-8s %-24s %8zu %3u %12.1f %12.2f\n",
+		       bench_type_name[type], name, size, nr_threads,
+		       ops_per_second, ops_per_second * size / 1e6);
+	}
+	fflush(stdout);
+}
+
+static bool selected(const struct ike_alg_bench *bench, enum bench_type type,
+		     const struct ike_alg *alg)
+{
+	/* only algorithms implemented in-process can be measured */
+	if (!ike_alg_is_ike(alg)) {
+		return false;
+	}
+	if (bench->filter == NULL) {
+		return true;
+	}
+	if (strcaseeq(bench->filter, bench_type_name[type])) {
+		return true;
+	}
+	for (unsigned n = 0; n < elemsof(alg->names) && alg->names[n] != NULL; n++) {
+		if (strcaseeq(bench->filter, alg->names[n])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void bench_sizes(const struct ike_alg_bench *bench,
+			enum bench_type type, const struct ike_alg *alg)
+{
+	if (!selected(bench, type, alg)) {
+		return;
+	}
+	for (const unsigned *size = bench->sizes; *size != 0; size++) {
+		for (const unsigned *threads = bench->threads; *threads != 0; threads++) {
+			measure(type, alg, *size, *threads, bench->seconds);
+		}
+	}
+}
+
+void bench_ike_alg(const struct ike_alg_bench *bench)
+{
+	printf("%-8s %-24s %8s %3s %12s %12s\n",
+	       "type", "algorithm", "bytes", "thr", "ops/s", "MB/s");
+
+	for (const struct encrypt_desc **encrypt = next_encrypt_desc(NULL);
+	     encrypt != NULL; encrypt = next_encrypt_desc(encrypt)) {
+		if ((*encrypt)->encrypt_ops != NULL) {
+			bench_sizes(bench, BENCH_ENCRYPT, &(*encrypt)->common);
+		}
+	}
+
+	for (const struct prf_desc **prf = next_prf_desc(NULL);
+	     prf != NULL; prf = next_prf_desc(prf)) {
+		if ((*prf)->prf_ops != NULL) {
+			bench_sizes(bench, BENCH_PRF, &(*prf)->common);
+		}
+	}
+
+	for (const struct integ_desc **integ = next_integ_desc(NULL);
+	     integ != NULL; integ = next_integ_desc(integ)) {
+		if ((*integ)->prf != NULL && (*integ)->prf->prf_ops != NULL) {
+			bench_sizes(bench, BENCH_INTEG, &(*integ)->common);
+		}
+	}
+
+	for (const struct oakley_group_desc **group = next_oakley_group(NULL);
+	     group != NULL; group = next_oakley_group(group)) {
+		/* NONE has ops but nothing to compute */
+		if (*group != &ike_alg_dh_none &&
+		    (*group)->dh_ops != NULL &&
+		    selected(bench, BENCH_DH, &(*group)->common)) {
+			/* the size is fixed by the group */
+			for (const unsigned *threads = bench->threads; *threads != 0; threads++) {
+				measure(BENCH_DH, &(*group)->common, 0,
+					*threads, bench->seconds);
+			}
+		}
+	}
+
+	/* compare with more than one thread to see the RNG lock */
+	if (bench->filter == NULL ||
+	    strcaseeq(bench->filter, bench_type_name[BENCH_RND_NSS])) {
+		for (enum bench_type type = BENCH_RND_NSS;
+		     type <= BENCH_RND_BUFFERED; type++) {
+			for (const unsigned *threads = bench->threads; *threads != 0; threads++) {
+				measure(type, NULL, RND_BENCH_SIZE,
+					*threads, bench->seconds);
+			}
+		}
+	}
+}
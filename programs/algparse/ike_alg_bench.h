@@ -0,0 +1,32 @@
+/* Benchmark algorithms, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef IKE_ALG_BENCH_H
+#define IKE_ALG_BENCH_H
+
+struct ike_alg_bench {
+	unsigned seconds;	/* per measurement */
+	const char *filter;	/* NULL: all algorithms */
+	/* zero terminated */
+	unsigned sizes[16];
+	unsigned threads[16];
+};
+
+/*
+ * Measure the throughput of all the in-process algorithms using
+ * their ops tables, and then the NSS random number sources.  Print
+ * one line per algorithm, size and thread count.
+ */
+void bench_ike_alg(const struct ike_alg_bench *bench);
+
+#endif
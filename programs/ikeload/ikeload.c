@@ -0,0 +1,1812 @@
+/*
+ * IKEv2 load generator, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Act as many IKEv2 initiators talking to a single responder.
+ *
+ * New initiators are started on an open-loop schedule (RATE per
+ * second, regardless of how the responder is coping) and each then
+ * runs IKE_SA_INIT, IKE_AUTH (PSK or RSA, one Child SA) and, for
+ * any further Child SAs, CREATE_CHILD_SA.  Optionally the IKE SA is
+ * then held open - rekeying its Child SAs and sending liveness
+ * checks - before an INFORMATIONAL exchange deletes it; combined with
+ * RATE this gives a steady churn of RATE*HOLD IKE SAs.  Messages are
+ * built using pluto's packet.c encoders and crypto is performed using
+ * the same NSS ops that pluto uses.
+ *
+ * Everything runs in a single thread; there are no retransmits (a
+ * lost message is counted as a timeout) and requests from the
+ * responder are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <keyhi.h>
+#include <cert.h>
+#include <cryptohi.h>
+#include <pk11pub.h>
+
+#include "lswlog.h"
+#include "lswtool.h"
+#include "lswalloc.h"
+#include "lswnss.h"
+#include "lswconf.h"
+#include "monotime.h"
+#include "ip_address.h"
+
+#include "ike_alg.h"
+#include "ike_alg_integ.h"
+#include "alg_info.h"
+
+#include "defs.h"
+#include "packet.h"
+#include "crypto.h"		/* for struct hmac_ctx */
+#include "crypt_prf.h"
+#include "crypt_symkey.h"
+#include "ikev2_prf.h"
+
+enum status { PASSED = 0, FAILED = 1, ERROR = 126, };
+
+/*
+ * Options.
+ */
+
+static ip_address target;
+static unsigned target_port = IKE_UDP_PORT;
+static unsigned rate = 100;		/* new initiators per second */
+static unsigned count = 1000;		/* total initiators */
+static unsigned timeout = 10;		/* seconds to wait for a response */
+static const char *ike_string = "aes_gcm256-sha2_256-dh19";
+static const char *esp_string = "aes_gcm256";
+static const char *psk = NULL;		/* NULL: RSA or IKE_SA_INIT only */
+static const char *cert_nickname = NULL;	/* NULL: PSK or IKE_SA_INIT only */
+static const char *id = "ikeload";
+static unsigned children = 1;		/* Child SAs per IKE SA */
+static bool delete_ike = false;
+static unsigned hold = 0;		/* seconds before deleting the IKE SA */
+static unsigned rekey = 0;		/* seconds between Child SA rekeys */
+static unsigned dpd = 0;		/* seconds between liveness checks */
+static bool verbose = false;
+
+static CERTCertificate *cert;
+static SECKEYPrivateKey *cert_key;
+
+static const struct proposal_info *ike;
+static const struct proposal_info *esp;
+
+static int sock = -1;
+static ip_address local;
+
+/*
+ * Per-initiator state.
+ */
+
+enum exchange {
+	EXCHANGE_NONE,
+	EXCHANGE_IKE_SA_INIT,
+	EXCHANGE_IKE_AUTH,
+	EXCHANGE_NEW_CHILD_SA,
+	EXCHANGE_REKEY_CHILD_SA,
+	EXCHANGE_DELETE_CHILD_SA,
+	EXCHANGE_LIVENESS,
+	EXCHANGE_DELETE_IKE_SA,
+};
+
+static const struct {
+	const char *name;
+	enum isakmp_xchg_types xchg;
+} exchanges[] = {
+	[EXCHANGE_NONE] = { "none", ISAKMP_XCHG_NONE, },
+	[EXCHANGE_IKE_SA_INIT] = { "IKE_SA_INIT", ISAKMP_v2_IKE_SA_INIT, },
+	[EXCHANGE_IKE_AUTH] = { "IKE_AUTH", ISAKMP_v2_IKE_AUTH, },
+	[EXCHANGE_NEW_CHILD_SA] = { "CREATE_CHILD_SA", ISAKMP_v2_CREATE_CHILD_SA, },
+	[EXCHANGE_REKEY_CHILD_SA] = { "CREATE_CHILD_SA(rekey)", ISAKMP_v2_CREATE_CHILD_SA, },
+	[EXCHANGE_DELETE_CHILD_SA] = { "INFORMATIONAL(delete Child SA)", ISAKMP_v2_INFORMATIONAL, },
+	[EXCHANGE_LIVENESS] = { "INFORMATIONAL(liveness)", ISAKMP_v2_INFORMATIONAL, },
+	[EXCHANGE_DELETE_IKE_SA] = { "INFORMATIONAL(delete IKE SA)", ISAKMP_v2_INFORMATIONAL, },
+};
+
+struct initiator {
+	unsigned nr;
+	enum exchange exchange;		/* outstanding request */
+	uint32_t msgid;			/* of the outstanding request */
+	/* list of outstanding requests, oldest first */
+	bool on_list;
+	struct initiator *older;
+	struct initiator *newer;
+	monotime_t started;
+	monotime_t sent;
+	monotime_t established;
+	/* when idle: the next rekey, liveness check or delete */
+	monotime_t wake;
+	monotime_t next_rekey;
+	monotime_t next_dpd;
+	unsigned nr_children;		/* Child SAs established */
+	unsigned rekeying;		/* Child SAs left to rekey this round */
+	ipsec_spi_t new_spi;		/* inbound SPI being negotiated */
+	ipsec_spi_t old_spi;		/* inbound SPI being deleted */
+	ike_spis_t spis;
+	SECKEYPrivateKey *privk;
+	SECKEYPublicKey *pubk;
+	chunk_t gi;
+	chunk_t nonce_i;
+	chunk_t nonce_r;
+	chunk_t cookie;
+	chunk_t first_packet;
+	PK11SymKey *sk_ai;
+	PK11SymKey *sk_ar;
+	PK11SymKey *sk_ei;
+	PK11SymKey *sk_er;
+	PK11SymKey *sk_pi;
+	chunk_t salt_i;
+	chunk_t salt_r;
+};
+
+static struct initiator *initiators;
+static ipsec_spi_t *child_spis;		/* inbound SPIs, CHILDREN per initiator */
+
+static struct {
+	struct initiator *oldest;
+	struct initiator *newest;
+	unsigned len;
+} outstanding;
+
+/*
+ * Established IKE SAs waiting for their next rekey, liveness check or
+ * delete; a min-heap ordered by wake time.
+ */
+
+static struct {
+	struct initiator **heap;
+	unsigned len;
+} idle;
+
+/*
+ * Results.
+ */
+
+static unsigned nr_started;
+static unsigned nr_established;
+static unsigned nr_failed;
+static unsigned nr_deleted;
+static unsigned nr_cookies;
+static unsigned nr_children;
+static unsigned nr_rekeyed;
+static unsigned nr_liveness;
+
+static struct latencies {
+	const char *what;
+	double *ms;
+	unsigned nr;
+	unsigned len;
+} sa_init_ms = { .what = "IKE_SA_INIT", },	/* IKE_SA_INIT round trip */
+	handshake_ms = { .what = "handshake", },	/* start to IKE_AUTH response */
+	child_ms = { .what = "CREATE_CHILD_SA", };	/* CREATE_CHILD_SA round trip */
+
+static struct failure {
+	char cause[80];
+	unsigned count;
+} failures[64];
+static unsigned nr_failure_causes;
+
+static double ms_between(monotime_t start, monotime_t end)
+{
+	return ((end.mt.tv_sec - start.mt.tv_sec) * 1000.0 +
+		(end.mt.tv_usec - start.mt.tv_usec) / 1000.0);
+}
+
+static void add_latency(struct latencies *l, double ms)
+{
+	if (l->nr == l->len) {
+		unsigned len = (l->len == 0 ? 1024 : l->len * 2);
+		double *grown = alloc_things(double, len, l->what);
+		if (l->nr > 0) {
+			memcpy(grown, l->ms, l->nr * sizeof(l->ms[0]));
+		}
+		pfreeany(l->ms);
+		l->ms = grown;
+		l->len = len;
+	}
+	l->ms[l->nr++] = ms;
+}
+
+/*
+ * Outstanding requests time out in the order they were sent.
+ */
+
+static void add_outstanding(struct initiator *i)
+{
+	passert(!i->on_list);
+	i->on_list = true;
+	i->newer = NULL;
+	i->older = outstanding.newest;
+	if (outstanding.newest != NULL) {
+		outstanding.newest->newer = i;
+	} else {
+		outstanding.oldest = i;
+	}
+	outstanding.newest = i;
+	outstanding.len++;
+}
+
+static void remove_outstanding(struct initiator *i)
+{
+	passert(i->on_list);
+	i->on_list = false;
+	if (i->older != NULL) {
+		i->older->newer = i->newer;
+	} else {
+		outstanding.oldest = i->newer;
+	}
+	if (i->newer != NULL) {
+		i->newer->older = i->older;
+	} else {
+		outstanding.newest = i->older;
+	}
+	i->older = i->newer = NULL;
+	outstanding.len--;
+}
+
+static void add_idle(struct initiator *i)
+{
+	unsigned n = idle.len++;
+	while (n > 0) {
+		unsigned parent = (n - 1) / 2;
+		if (!monobefore(i->wake, idle.heap[parent]->wake)) {
+			break;
+		}
+		idle.heap[n] = idle.heap[parent];
+		n = parent;
+	}
+	idle.heap[n] = i;
+}
+
+static struct initiator *remove_idle(void)
+{
+	struct initiator *first = idle.heap[0];
+	struct initiator *last = idle.heap[--idle.len];
+	unsigned n = 0;
+	for (;;) {
+		unsigned child = 2 * n + 1;
+		if (child >= idle.len) {
+			break;
+		}
+		if (child + 1 < idle.len &&
+		    monobefore(idle.heap[child + 1]->wake, idle.heap[child]->wake)) {
+			child++;
+		}
+		if (!monobefore(idle.heap[child]->wake, last->wake)) {
+			break;
+		}
+		idle.heap[n] = idle.heap[child];
+		n = child;
+	}
+	idle.heap[n] = last;
+	return first;
+}
+
+static void release_initiator(struct initiator *i)
+{
+	if (i->privk != NULL) {
+		SECKEY_DestroyPrivateKey(i->privk);
+		i->privk = NULL;
+	}
+	if (i->pubk != NULL) {
+		SECKEY_DestroyPublicKey(i->pubk);
+		i->pubk = NULL;
+	}
+	freeanychunk(i->gi);
+	freeanychunk(i->nonce_i);
+	freeanychunk(i->nonce_r);
+	freeanychunk(i->cookie);
+	freeanychunk(i->first_packet);
+	release_symkey(__func__, "SK_ai", &i->sk_ai);
+	release_symkey(__func__, "SK_ar", &i->sk_ar);
+	release_symkey(__func__, "SK_ei", &i->sk_ei);
+	release_symkey(__func__, "SK_er", &i->sk_er);
+	release_symkey(__func__, "SK_pi", &i->sk_pi);
+	freeanychunk(i->salt_i);
+	freeanychunk(i->salt_r);
+	i->exchange = EXCHANGE_NONE;
+}
+
+static void fail(struct initiator *i, const char *cause)
+{
+	char buf[sizeof(failures[0].cause)];
+	snprintf(buf, sizeof(buf), "%s: %s", exchanges[i->exchange].name, cause);
+	if (verbose) {
+		fprintf(stderr, "initiator %u: %s\n", i->nr, buf);
+	}
+
+	struct failure *f;
+	for (f = failures; f < failures + nr_failure_causes; f++) {
+		if (streq(f->cause, buf)) {
+			break;
+		}
+	}
+	if (f == failures + nr_failure_causes) {
+		/* the last entry lumps the rest together */
+		if (nr_failure_causes == elemsof(failures)) {
+			f--;
+		} else {
+			jam_str(f->cause, sizeof(f->cause),
+				(nr_failure_causes == elemsof(failures) - 1 ? "other" : buf));
+			nr_failure_causes++;
+		}
+	}
+	f->count++;
+
+	nr_failed++;
+	/* i.e., the request was sent but not yet answered */
+	if (i->on_list) {
+		remove_outstanding(i);
+	}
+	release_initiator(i);
+}
+
+/*
+ * Send the message and add it to the outstanding list.
+ */
+
+static void send_request(struct initiator *i, pb_stream *packet)
+{
+	i->sent = mononow();
+	add_outstanding(i);
+	chunk_t msg = same_out_pbs_as_chunk(packet);
+	ssize_t n = sendto(sock, msg.ptr, msg.len, 0,
+			   sockaddrof(&target), sockaddrlenof(&target));
+	if (n != (ssize_t)msg.len) {
+		fail(i, n < 0 ? strerror(errno) : "short send");
+	}
+}
+
+static pb_stream open_message(pb_stream *packet, uint8_t *buf, size_t len,
+			      struct initiator *i)
+{
+	init_out_pbs(packet, buf, len, exchanges[i->exchange].name);
+	struct isakmp_hdr hdr = {
+		.isa_version = (IKEv2_MAJOR_VERSION << ISA_MAJ_SHIFT) | IKEv2_MINOR_VERSION,
+		.isa_xchg = exchanges[i->exchange].xchg,
+		.isa_flags = ISAKMP_FLAGS_v2_IKE_I,
+		.isa_ike_spis = i->spis,
+		.isa_msgid = i->msgid,
+	};
+	pb_stream body;
+	if (!out_struct(&hdr, &isakmp_hdr_desc, packet, &body)) {
+		return empty_pbs;
+	}
+	return body;
+}
+
+/*
+ * Emit an SA payload containing a single proposal.
+ */
+
+static bool emit_transform(pb_stream *proposal, enum ikev2_trans_type type,
+			   unsigned id, unsigned keylen, bool last)
+{
+	struct ikev2_trans trans = {
+		.isat_lt = last ? v2_TRANSFORM_LAST : v2_TRANSFORM_NON_LAST,
+		.isat_type = type,
+		.isat_transid = id,
+	};
+	pb_stream trans_pbs;
+	if (!out_struct(&trans, &ikev2_trans_desc, proposal, &trans_pbs)) {
+		return false;
+	}
+	if (keylen > 0) {
+		struct ikev2_trans_attr attr = {
+			.isatr_type = IKEv2_KEY_LENGTH | ISAKMP_ATTR_AF_TV,
+			.isatr_lv = keylen,
+		};
+		if (!out_struct(&attr, &ikev2_trans_attr_desc, &trans_pbs, NULL)) {
+			return false;
+		}
+	}
+	close_output_pbs(&trans_pbs);
+	return true;
+}
+
+static unsigned proposal_keylen(const struct proposal_info *p)
+{
+	if (p->encrypt->keylen_omitted) {
+		return 0;
+	}
+	return p->enckeylen > 0 ? p->enckeylen : p->encrypt->keydeflen;
+}
+
+static bool emit_sa(pb_stream *body, const struct proposal_info *p,
+		    enum ikev2_sec_proto_id protoid, const chunk_t *spi)
+{
+	bool integ = (p->integ != NULL && p->integ != &ike_alg_integ_none);
+	struct ikev2_sa sa = {
+		.isasa_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+	};
+	pb_stream sa_pbs;
+	if (!out_struct(&sa, &ikev2_sa_desc, body, &sa_pbs)) {
+		return false;
+	}
+	struct ikev2_prop prop = {
+		.isap_lp = v2_PROPOSAL_LAST,
+		.isap_propnum = 1,
+		.isap_protoid = protoid,
+		.isap_spisize = spi != NULL ? spi->len : 0,
+		/* ENCR [INTEG] PRF DH or ENCR [INTEG] ESN */
+		.isap_numtrans = (protoid == IKEv2_SEC_PROTO_IKE ? 3 : 2) + integ,
+	};
+	pb_stream prop_pbs;
+	if (!out_struct(&prop, &ikev2_prop_desc, &sa_pbs, &prop_pbs)) {
+		return false;
+	}
+	if (spi != NULL && !out_chunk(*spi, &prop_pbs, "SPI")) {
+		return false;
+	}
+	if (!emit_transform(&prop_pbs, IKEv2_TRANS_TYPE_ENCR,
+			    p->encrypt->common.id[IKEv2_ALG_ID],
+			    proposal_keylen(p), false)) {
+		return false;
+	}
+	if (protoid == IKEv2_SEC_PROTO_IKE &&
+	    !emit_transform(&prop_pbs, IKEv2_TRANS_TYPE_PRF,
+			    p->prf->common.id[IKEv2_ALG_ID], 0, false)) {
+		return false;
+	}
+	if (integ &&
+	    !emit_transform(&prop_pbs, IKEv2_TRANS_TYPE_INTEG,
+			    p->integ->common.id[IKEv2_ALG_ID], 0, false)) {
+		return false;
+	}
+	if (protoid == IKEv2_SEC_PROTO_IKE) {
+		if (!emit_transform(&prop_pbs, IKEv2_TRANS_TYPE_DH,
+				    p->dh->common.id[IKEv2_ALG_ID], 0, true)) {
+			return false;
+		}
+	} else {
+		if (!emit_transform(&prop_pbs, IKEv2_TRANS_TYPE_ESN,
+				    IKEv2_ESN_DISABLED, 0, true)) {
+			return false;
+		}
+	}
+	close_output_pbs(&prop_pbs);
+	close_output_pbs(&sa_pbs);
+	return true;
+}
+
+static bool emit_generic(pb_stream *body, struct_desc *sd, chunk_t data,
+			 const char *name)
+{
+	struct ikev2_generic gen = {
+		.isag_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+	};
+	pb_stream pbs;
+	if (!out_struct(&gen, sd, body, &pbs) ||
+	    !out_chunk(data, &pbs, name)) {
+		return false;
+	}
+	close_output_pbs(&pbs);
+	return true;
+}
+
+/*
+ * IKE_SA_INIT request: [N(COOKIE)] SA KE Ni
+ */
+
+static void send_ike_sa_init(struct initiator *i)
+{
+	static uint8_t buf[MAX_OUTPUT_UDP_SIZE];
+	pb_stream packet;
+	i->exchange = EXCHANGE_IKE_SA_INIT;
+	i->msgid = 0;
+	pb_stream body = open_message(&packet, buf, sizeof(buf), i);
+	if (!pbs_ok(&body)) {
+		fail(i, "emitting header");
+		return;
+	}
+
+	if (i->cookie.ptr != NULL) {
+		struct ikev2_notify n = {
+			.isan_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+			.isan_type = v2N_COOKIE,
+		};
+		pb_stream n_pbs;
+		if (!out_struct(&n, &ikev2_notify_desc, &body, &n_pbs) ||
+		    !out_chunk(i->cookie, &n_pbs, "cookie")) {
+			fail(i, "emitting N(COOKIE)");
+			return;
+		}
+		close_output_pbs(&n_pbs);
+	}
+
+	if (!emit_sa(&body, ike, IKEv2_SEC_PROTO_IKE, NULL)) {
+		fail(i, "emitting SA");
+		return;
+	}
+
+	struct ikev2_ke ke = {
+		.isak_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isak_group = ike->dh->common.id[IKEv2_ALG_ID],
+	};
+	pb_stream ke_pbs;
+	if (!out_struct(&ke, &ikev2_ke_desc, &body, &ke_pbs) ||
+	    !out_chunk(i->gi, &ke_pbs, "g^i")) {
+		fail(i, "emitting KE");
+		return;
+	}
+	close_output_pbs(&ke_pbs);
+
+	if (!emit_generic(&body, &ikev2_nonce_desc, i->nonce_i, "Ni")) {
+		fail(i, "emitting Ni");
+		return;
+	}
+
+	close_output_pbs(&body);
+	close_output_pbs(&packet);
+
+	/* AUTH signs the IKE_SA_INIT request */
+	freeanychunk(i->first_packet);
+	i->first_packet = clone_out_pbs_as_chunk(&packet, "first packet");
+
+	send_request(i, &packet);
+}
+
+static void start_initiator(struct initiator *i)
+{
+	nr_started++;
+	i->started = mononow();
+
+	/* make the SPI unique, and easy to map back to the initiator */
+	if (PK11_GenerateRandom(i->spis.initiator.bytes, 4) != SECSuccess) {
+		fail(i, "generating SPIi");
+		return;
+	}
+	i->spis.initiator.bytes[4] = i->nr >> 24;
+	i->spis.initiator.bytes[5] = i->nr >> 16;
+	i->spis.initiator.bytes[6] = i->nr >> 8;
+	i->spis.initiator.bytes[7] = i->nr;
+	memset(&i->spis.responder, 0, sizeof(i->spis.responder));
+
+	const struct oakley_group_desc *dh = ike->dh;
+	i->gi = alloc_chunk(dh->bytes, "g^i");
+	dh->dh_ops->calc_secret(dh, &i->privk, &i->pubk, i->gi.ptr, i->gi.len);
+	if (i->privk == NULL) {
+		fail(i, "generating KE");
+		return;
+	}
+
+	i->nonce_i = alloc_chunk(ike->prf->prf_output_size < 16 ? 16 : ike->prf->prf_output_size,
+			    "Ni");
+	if (PK11_GenerateRandom(i->nonce_i.ptr, i->nonce_i.len) != SECSuccess) {
+		fail(i, "generating Ni");
+		return;
+	}
+
+	send_ike_sa_init(i);
+}
+
+/*
+ * Compute the IKE SA's keys; see calc_skeyseed_v2().
+ */
+
+static bool derive_keys(struct initiator *i, PK11SymKey *shared)
+{
+	const struct prf_desc *prf = ike->prf;
+	const struct encrypt_desc *encrypt = ike->encrypt;
+	size_t key_size = proposal_keylen(ike) / BITS_PER_BYTE;
+	if (key_size == 0) {
+		key_size = encrypt->keydeflen / BITS_PER_BYTE;
+	}
+	size_t salt_size = encrypt->salt_size;
+	size_t integ_size = (ike->integ != NULL ? ike->integ->integ_keymat_size : 0);
+
+	PK11SymKey *skeyseed = ikev2_ike_sa_skeyseed(prf, i->nonce_i, i->nonce_r, shared);
+	if (skeyseed == NULL) {
+		return false;
+	}
+	size_t total = (prf->prf_key_size * 3 + 2 * key_size +
+			2 * salt_size + 2 * integ_size);
+	PK11SymKey *keymat = ikev2_ike_sa_keymat(prf, skeyseed, i->nonce_i, i->nonce_r,
+						 &i->spis, total);
+	release_symkey(__func__, "skeyseed", &skeyseed);
+	if (keymat == NULL) {
+		return false;
+	}
+
+	/* SK_d | SK_ai | SK_ar | SK_ei | salt_i | SK_er | salt_r | SK_pi | SK_pr */
+	size_t next = prf->prf_key_size;
+	i->sk_ai = key_from_symkey_bytes(keymat, next, integ_size);
+	next += integ_size;
+	i->sk_ar = key_from_symkey_bytes(keymat, next, integ_size);
+	next += integ_size;
+	i->sk_ei = encrypt_key_from_symkey_bytes("SK_ei", encrypt, next,
+						 key_size, keymat);
+	next += key_size;
+	PK11SymKey *salt_i = key_from_symkey_bytes(keymat, next, salt_size);
+	i->salt_i = chunk_from_symkey("initiator salt", salt_i);
+	release_symkey(__func__, "initiator salt", &salt_i);
+	next += salt_size;
+	i->sk_er = encrypt_key_from_symkey_bytes("SK_er", encrypt, next,
+						 key_size, keymat);
+	next += key_size;
+	PK11SymKey *salt_r = key_from_symkey_bytes(keymat, next, salt_size);
+	i->salt_r = chunk_from_symkey("responder salt", salt_r);
+	release_symkey(__func__, "responder salt", &salt_r);
+	next += salt_size;
+	i->sk_pi = key_from_symkey_bytes(keymat, next, prf->prf_key_size);
+
+	release_symkey(__func__, "keymat", &keymat);
+	return true;
+}
+
+/*
+ * Encrypt, in place, the SK payload; see ikev2_encrypt_msg().
+ */
+
+static void construct_enc_iv(uint8_t enc_iv[], const uint8_t *wire_iv,
+			     chunk_t salt, const struct encrypt_desc *encrypt)
+{
+	size_t counter_size = (encrypt->enc_blocksize - encrypt->salt_size -
+			       encrypt->wire_iv_size);
+	memcpy(enc_iv, salt.ptr, salt.len);
+	memcpy(enc_iv + salt.len, wire_iv, encrypt->wire_iv_size);
+	if (counter_size > 0) {
+		memset(enc_iv + encrypt->enc_blocksize - counter_size, 0,
+		       counter_size - 1);
+		enc_iv[encrypt->enc_blocksize - 1] = 1;
+	}
+}
+
+static size_t integ_size(void)
+{
+	return (encrypt_desc_is_aead(ike->encrypt)
+		? ike->encrypt->aead_tag_size
+		: ike->integ->integ_output_size);
+}
+
+static bool encrypt_message(struct initiator *i, uint8_t *auth_start,
+			    uint8_t *iv_start, uint8_t *enc_start,
+			    uint8_t *integ_start)
+{
+	const struct encrypt_desc *encrypt = ike->encrypt;
+	size_t enc_size = integ_start - enc_start;
+	if (encrypt_desc_is_aead(encrypt)) {
+		return encrypt->encrypt_ops->do_aead(encrypt,
+						     i->salt_i.ptr, i->salt_i.len,
+						     iv_start, encrypt->wire_iv_size,
+						     auth_start, iv_start - auth_start,
+						     enc_start, enc_size,
+						     encrypt->aead_tag_size,
+						     i->sk_ei, true);
+	}
+	uint8_t enc_iv[MAX_CBC_BLOCK_SIZE];
+	construct_enc_iv(enc_iv, iv_start, i->salt_i, encrypt);
+	encrypt->encrypt_ops->do_crypt(encrypt, enc_start, enc_size,
+				       i->sk_ei, enc_iv, true);
+	uint8_t td[MAX_DIGEST_LEN];
+	struct hmac_ctx ctx;
+	hmac_init(&ctx, ike->integ->prf, i->sk_ai);
+	hmac_update(&ctx, auth_start, integ_start - auth_start);
+	hmac_final(td, &ctx);
+	memcpy(integ_start, td, integ_size());
+	return true;
+}
+
+/*
+ * Verify and decrypt, in place, the SK payload; return the
+ * cleartext.  See ikev2_verify_and_decrypt_sk_payload().
+ */
+
+static bool decrypt_message(struct initiator *i, uint8_t *auth_start,
+			    uint8_t *iv_start, uint8_t *payload_end,
+			    chunk_t *cleartext)
+{
+	const struct encrypt_desc *encrypt = ike->encrypt;
+	size_t isize = integ_size();
+	if (payload_end < iv_start + encrypt->wire_iv_size + 1 + isize) {
+		return false;
+	}
+	uint8_t *enc_start = iv_start + encrypt->wire_iv_size;
+	uint8_t *integ_start = payload_end - isize;
+	size_t enc_size = integ_start - enc_start;
+	if (encrypt->pad_to_blocksize && enc_size % encrypt->enc_blocksize != 0) {
+		return false;
+	}
+
+	if (encrypt_desc_is_aead(encrypt)) {
+		if (!encrypt->encrypt_ops->do_aead(encrypt,
+						   i->salt_r.ptr, i->salt_r.len,
+						   iv_start, encrypt->wire_iv_size,
+						   auth_start, iv_start - auth_start,
+						   enc_start, enc_size, isize,
+						   i->sk_er, false)) {
+			return false;
+		}
+	} else {
+		uint8_t td[MAX_DIGEST_LEN];
+		struct hmac_ctx ctx;
+		hmac_init(&ctx, ike->integ->prf, i->sk_ar);
+		hmac_update(&ctx, auth_start, integ_start - auth_start);
+		hmac_final(td, &ctx);
+		if (!memeq(td, integ_start, isize)) {
+			return false;
+		}
+		uint8_t enc_iv[MAX_CBC_BLOCK_SIZE];
+		construct_enc_iv(enc_iv, iv_start, i->salt_r, encrypt);
+		encrypt->encrypt_ops->do_crypt(encrypt, enc_start, enc_size,
+					       i->sk_er, enc_iv, false);
+	}
+
+	size_t padding = enc_start[enc_size - 1] + 1;
+	if (padding > enc_size) {
+		return false;
+	}
+	*cleartext = chunk(enc_start, enc_size - padding);
+	return true;
+}
+
+/*
+ * Wrap the payloads emitted by EMIT_PAYLOADS in an SK payload, encrypt,
+ * and send.
+ */
+
+typedef bool emit_payloads_fn(struct initiator *i, pb_stream *sk);
+
+static void send_encrypted_request(struct initiator *i, enum exchange exchange,
+				   emit_payloads_fn *emit_payloads)
+{
+	const struct encrypt_desc *encrypt = ike->encrypt;
+	static uint8_t buf[MAX_OUTPUT_UDP_SIZE];
+	pb_stream packet;
+	i->exchange = exchange;
+	i->msgid++;
+	pb_stream body = open_message(&packet, buf, sizeof(buf), i);
+	if (!pbs_ok(&body)) {
+		fail(i, "emitting header");
+		return;
+	}
+
+	struct ikev2_generic e = {
+		.isag_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+	};
+	pb_stream sk;
+	if (!out_struct(&e, &ikev2_sk_desc, &body, &sk)) {
+		fail(i, "emitting SK");
+		return;
+	}
+	uint8_t *iv_start = sk.cur;
+	if (!out_zero(encrypt->wire_iv_size, &sk, "IV") ||
+	    PK11_GenerateRandom(iv_start, encrypt->wire_iv_size) != SECSuccess) {
+		fail(i, "emitting IV");
+		return;
+	}
+	uint8_t *enc_start = sk.cur;
+
+	if (!emit_payloads(i, &sk)) {
+		fail(i, "emitting payloads");
+		return;
+	}
+
+	size_t padding = 1;
+	if (encrypt->pad_to_blocksize) {
+		padding = pad_up(sk.cur - enc_start, encrypt->enc_blocksize);
+		if (padding == 0) {
+			padding = encrypt->enc_blocksize;
+		}
+	}
+	for (unsigned p = 0; p < padding; p++) {
+		if (!out_repeated_byte(p, 1, &sk, "padding and length")) {
+			fail(i, "emitting padding");
+			return;
+		}
+	}
+	uint8_t *integ_start = sk.cur;
+	if (!out_zero(integ_size(), &sk, "integrity")) {
+		fail(i, "emitting integrity");
+		return;
+	}
+	close_output_pbs(&sk);
+	close_output_pbs(&body);
+	close_output_pbs(&packet);
+
+	if (!encrypt_message(i, packet.start, iv_start, enc_start, integ_start)) {
+		fail(i, "encrypting");
+		return;
+	}
+
+	send_request(i, &packet);
+}
+
+/*
+ * IKE_AUTH request: SK{IDi [CERT] AUTH SA TSi TSr}
+ */
+
+static bool emit_ts(pb_stream *sk, struct_desc *sd, const ip_address *addr)
+{
+	struct ikev2_ts ts = {
+		.isat_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isat_num = 1,
+	};
+	pb_stream ts_pbs;
+	if (!out_struct(&ts, sd, sk, &ts_pbs)) {
+		return false;
+	}
+	const unsigned char *bytes;
+	size_t len = addrbytesptr_read(addr, &bytes);
+	struct ikev2_ts1 ts1 = {
+		.isat1_type = (len == 4 ? IKEv2_TS_IPV4_ADDR_RANGE
+			       : IKEv2_TS_IPV6_ADDR_RANGE),
+		.isat1_ipprotoid = 0,
+		.isat1_startport = 0,
+		.isat1_endport = 65535,
+	};
+	pb_stream ts1_pbs;
+	if (!out_struct(&ts1, &ikev2_ts1_desc, &ts_pbs, &ts1_pbs) ||
+	    !out_raw(bytes, len, &ts1_pbs, "start address") ||
+	    !out_raw(bytes, len, &ts1_pbs, "end address")) {
+		return false;
+	}
+	close_output_pbs(&ts1_pbs);
+	close_output_pbs(&ts_pbs);
+	return true;
+}
+
+/*
+ * SA [Ni] TSi TSr, proposing a new inbound SPI.
+ */
+
+static bool emit_child_sa(struct initiator *i, pb_stream *sk, bool nonce)
+{
+	if (PK11_GenerateRandom((uint8_t *)&i->new_spi,
+				sizeof(i->new_spi)) != SECSuccess) {
+		return false;
+	}
+	chunk_t spi = chunk(&i->new_spi, sizeof(i->new_spi));
+	if (!emit_sa(sk, esp, IKEv2_SEC_PROTO_ESP, &spi)) {
+		return false;
+	}
+
+	if (nonce) {
+		/* IKE_AUTH is done with Ni; reuse its buffer */
+		if (PK11_GenerateRandom(i->nonce_i.ptr, i->nonce_i.len) != SECSuccess ||
+		    !emit_generic(sk, &ikev2_nonce_desc, i->nonce_i, "Ni")) {
+			return false;
+		}
+	}
+
+	return (emit_ts(sk, &ikev2_ts_i_desc, &local) &&
+		emit_ts(sk, &ikev2_ts_r_desc, &target));
+}
+
+/* AUTH = prf(prf(PSK, "Key Pad for IKEv2"), RealMessage1 | Nr | prf(SK_pi, IDi')) */
+
+static bool emit_psk_auth(struct initiator *i, pb_stream *sk,
+			  const uint8_t *idhash)
+{
+	const struct prf_desc *prf = ike->prf;
+
+	static const char key_pad[] = "Key Pad for IKEv2";
+	struct crypt_prf *ctx = crypt_prf_init_chunk("prf(PSK, pad)", prf, "PSK",
+						     chunk((void *)psk, strlen(psk)));
+	crypt_prf_update_bytes(ctx, "pad", key_pad, sizeof(key_pad) - 1);
+	PK11SymKey *psk_key = crypt_prf_final_symkey(&ctx);
+
+	uint8_t auth[MAX_DIGEST_LEN];
+	ctx = crypt_prf_init_symkey("AUTH", prf, "prf(PSK, pad)", psk_key);
+	crypt_prf_update_chunk(ctx, "RealMessage1", i->first_packet);
+	crypt_prf_update_chunk(ctx, "Nr", i->nonce_r);
+	crypt_prf_update_bytes(ctx, "MACedIDForI", idhash, prf->prf_output_size);
+	crypt_prf_final_bytes(&ctx, auth, prf->prf_output_size);
+	release_symkey(__func__, "psk", &psk_key);
+
+	struct ikev2_a a = {
+		.isaa_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isaa_type = IKEv2_AUTH_PSK,
+	};
+	pb_stream a_pbs;
+	if (!out_struct(&a, &ikev2_a_desc, sk, &a_pbs) ||
+	    !out_raw(auth, prf->prf_output_size, &a_pbs, "AUTH")) {
+		return false;
+	}
+	close_output_pbs(&a_pbs);
+	return true;
+}
+
+/* AUTH = RSA-SHA1(RealMessage1 | Nr | prf(SK_pi, IDi')), preceded by CERT */
+
+static bool emit_rsa_auth(struct initiator *i, pb_stream *sk,
+			  const uint8_t *idhash)
+{
+	struct ikev2_cert c = {
+		.isac_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isac_enc = CERT_X509_SIGNATURE,
+	};
+	pb_stream c_pbs;
+	if (!out_struct(&c, &ikev2_certificate_desc, sk, &c_pbs) ||
+	    !out_raw(cert->derCert.data, cert->derCert.len, &c_pbs, "CERT")) {
+		return false;
+	}
+	close_output_pbs(&c_pbs);
+
+	size_t idhash_len = ike->prf->prf_output_size;
+	size_t len = i->first_packet.len + i->nonce_r.len + idhash_len;
+	uint8_t *octets = alloc_bytes(len, "signed octets");
+	memcpy(octets, i->first_packet.ptr, i->first_packet.len);
+	memcpy(octets + i->first_packet.len, i->nonce_r.ptr, i->nonce_r.len);
+	memcpy(octets + len - idhash_len, idhash, idhash_len);
+	SECItem sig = { .data = NULL, };
+	SECStatus s = SEC_SignData(&sig, octets, len, cert_key,
+				   SEC_OID_PKCS1_SHA1_WITH_RSA_ENCRYPTION);
+	pfree(octets);
+	if (s != SECSuccess) {
+		return false;
+	}
+
+	struct ikev2_a a = {
+		.isaa_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isaa_type = IKEv2_AUTH_RSA,
+	};
+	pb_stream a_pbs;
+	bool ok = (out_struct(&a, &ikev2_a_desc, sk, &a_pbs) &&
+		   out_raw(sig.data, sig.len, &a_pbs, "AUTH"));
+	SECITEM_FreeItem(&sig, PR_FALSE);
+	if (!ok) {
+		return false;
+	}
+	close_output_pbs(&a_pbs);
+	return true;
+}
+
+static bool emit_ike_auth_payloads(struct initiator *i, pb_stream *sk)
+{
+	const struct prf_desc *prf = ike->prf;
+
+	/* IDi; remember the body for the AUTH hash */
+	struct ikev2_id idi = {
+		.isai_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isai_type = (cert != NULL ? ID_DER_ASN1_DN : ID_FQDN),
+	};
+	pb_stream id_pbs;
+	if (!out_struct(&idi, &ikev2_id_i_desc, sk, &id_pbs)) {
+		return false;
+	}
+	if (cert != NULL
+	    ? !out_raw(cert->derSubject.data, cert->derSubject.len, &id_pbs, "IDi")
+	    : !out_raw(id, strlen(id), &id_pbs, "IDi")) {
+		return false;
+	}
+	close_output_pbs(&id_pbs);
+	/* IDi' is the payload less the generic header */
+	uint8_t *id_start = id_pbs.start + NSIZEOF_isakmp_generic;
+	size_t id_len = id_pbs.cur - id_start;
+
+	uint8_t idhash[MAX_DIGEST_LEN];
+	struct crypt_prf *ctx = crypt_prf_init_symkey("prf(SK_pi, IDi')", prf,
+						      "SK_pi", i->sk_pi);
+	crypt_prf_update_bytes(ctx, "IDi'", id_start, id_len);
+	crypt_prf_final_bytes(&ctx, idhash, prf->prf_output_size);
+
+	if (cert != NULL
+	    ? !emit_rsa_auth(i, sk, idhash)
+	    : !emit_psk_auth(i, sk, idhash)) {
+		return false;
+	}
+
+	return emit_child_sa(i, sk, false);
+}
+
+/*
+ * CREATE_CHILD_SA request: SK{[N(REKEY_SA)] SA Ni TSi TSr}
+ *
+ * There's no KE payload; Child SAs are created without PFS.
+ */
+
+static bool emit_new_child_sa_payloads(struct initiator *i, pb_stream *sk)
+{
+	return emit_child_sa(i, sk, true);
+}
+
+static bool emit_rekey_child_sa_payloads(struct initiator *i, pb_stream *sk)
+{
+	/* the SPI the responder sends to */
+	ipsec_spi_t spi = child_spis[i->nr * children + children - i->rekeying];
+	struct ikev2_notify n = {
+		.isan_critical = ISAKMP_PAYLOAD_NONCRITICAL,
+		.isan_protoid = IKEv2_SEC_PROTO_ESP,
+		.isan_spisize = sizeof(spi),
+		.isan_type = v2N_REKEY_SA,
+	};
+	pb_stream n_pbs;
+	if (!out_struct(&n, &ikev2_notify_desc, sk, &n_pbs) ||
+	    !out_raw(&spi, sizeof(spi), &n_pbs, "SPI")) {
+		return false;
+	}
+	close_output_pbs(&n_pbs);
+	return emit_child_sa(i, sk, true);
+}
+
+/*
+ * INFORMATIONAL requests: SK{D(ESP)}, SK{} and SK{D(IKE)}
+ */
+
+static bool emit_delete_child_sa_payloads(struct initiator *i, pb_stream *sk)
+{
+	struct ikev2_delete d = {
+		.isad_protoid = IKEv2_SEC_PROTO_ESP,
+		.isad_spisize = sizeof(i->old_spi),
+		.isad_nrspi = 1,
+	};
+	pb_stream d_pbs;
+	if (!out_struct(&d, &ikev2_delete_desc, sk, &d_pbs) ||
+	    !out_raw(&i->old_spi, sizeof(i->old_spi), &d_pbs, "SPI")) {
+		return false;
+	}
+	close_output_pbs(&d_pbs);
+	return true;
+}
+
+static bool emit_liveness_payloads(struct initiator *i UNUSED,
+				   pb_stream *sk UNUSED)
+{
+	return true;
+}
+
+static bool emit_delete_payloads(struct initiator *i UNUSED, pb_stream *sk)
+{
+	struct ikev2_delete d = {
+		.isad_protoid = IKEv2_SEC_PROTO_IKE,
+	};
+	pb_stream d_pbs;
+	if (!out_struct(&d, &ikev2_delete_desc, sk, &d_pbs)) {
+		return false;
+	}
+	close_output_pbs(&d_pbs);
+	return true;
+}
+
+/*
+ * What next for an established IKE SA: create the remaining Child SAs,
+ * finish a rekey round, or wait.
+ */
+
+static void next_request(struct initiator *i, monotime_t now)
+{
+	if (i->nr_children < children) {
+		send_encrypted_request(i, EXCHANGE_NEW_CHILD_SA,
+				       emit_new_child_sa_payloads);
+	} else if (i->rekeying > 0) {
+		send_encrypted_request(i, EXCHANGE_REKEY_CHILD_SA,
+				       emit_rekey_child_sa_payloads);
+	} else if (!delete_ike) {
+		release_initiator(i);
+	} else {
+		/* hold until the next rekey, liveness check or delete */
+		i->exchange = EXCHANGE_NONE;
+		i->wake = monotimesum(i->established, deltatime(hold));
+		if (rekey > 0 && monobefore(i->next_rekey, i->wake)) {
+			i->wake = i->next_rekey;
+		}
+		if (dpd > 0 && monobefore(i->next_dpd, i->wake)) {
+			i->wake = i->next_dpd;
+		}
+		if (monobefore(i->wake, now)) {
+			i->wake = now;
+		}
+		add_idle(i);
+	}
+}
+
+static void wake_initiator(struct initiator *i, monotime_t now)
+{
+	if (!monobefore(now, monotimesum(i->established, deltatime(hold)))) {
+		send_encrypted_request(i, EXCHANGE_DELETE_IKE_SA,
+				       emit_delete_payloads);
+	} else if (rekey > 0 && !monobefore(now, i->next_rekey)) {
+		i->rekeying = children;
+		send_encrypted_request(i, EXCHANGE_REKEY_CHILD_SA,
+				       emit_rekey_child_sa_payloads);
+	} else {
+		i->next_dpd = monotimesum(now, deltatime(dpd));
+		send_encrypted_request(i, EXCHANGE_LIVENESS,
+				       emit_liveness_payloads);
+	}
+}
+
+/*
+ * Process a response.
+ */
+
+static bool notify_failed(struct initiator *i, pb_stream *pbs)
+{
+	struct ikev2_notify n;
+	pb_stream n_pbs;
+	if (!in_struct(&n, &ikev2_notify_desc, pbs, &n_pbs)) {
+		fail(i, "malformed notify");
+		return true;
+	}
+	if (n.isan_type == v2N_COOKIE && i->exchange == EXCHANGE_IKE_SA_INIT) {
+		nr_cookies++;
+		freeanychunk(i->cookie);
+		i->cookie = clone_in_pbs_left_as_chunk(&n_pbs, "cookie");
+		send_ike_sa_init(i);
+		return true;
+	}
+	if (n.isan_type < v2N_STATUS_FLOOR) {
+		const char *name = enum_name(&ikev2_notify_names, n.isan_type);
+		char buf[40];
+		if (name == NULL) {
+			snprintf(buf, sizeof(buf), "notify %u", n.isan_type);
+			name = buf;
+		}
+		fail(i, name);
+		return true;
+	}
+	return false;
+}
+
+static void process_ike_sa_init_response(struct initiator *i,
+					 const struct isakmp_hdr *hdr,
+					 pb_stream *body, monotime_t now)
+{
+	const struct oakley_group_desc *dh = ike->dh;
+	chunk_t gr = empty_chunk;
+	for (unsigned np = hdr->isa_np; np != ISAKMP_NEXT_v2NONE; ) {
+		pb_stream pbs = *body;
+		struct ikev2_generic gen;
+		if (!in_struct(&gen, &ikev2_generic_desc, &pbs, NULL)) {
+			fail(i, "malformed payload");
+			return;
+		}
+		pb_stream payload;
+		switch (np) {
+		case ISAKMP_NEXT_v2N:
+			if (notify_failed(i, body)) {
+				return;
+			}
+			break;
+		case ISAKMP_NEXT_v2KE:
+		{
+			struct ikev2_ke ke;
+			if (!in_struct(&ke, &ikev2_ke_desc, body, &payload)) {
+				fail(i, "malformed KE");
+				return;
+			}
+			gr = same_in_pbs_left_as_chunk(&payload);
+			break;
+		}
+		case ISAKMP_NEXT_v2Nr:
+			if (!in_struct(&gen, &ikev2_nonce_desc, body, &payload)) {
+				fail(i, "malformed Nr");
+				return;
+			}
+			freeanychunk(i->nonce_r);
+			i->nonce_r = clone_in_pbs_left_as_chunk(&payload, "Nr");
+			break;
+		default:
+			if (!in_struct(&gen, &ikev2_generic_desc, body, NULL)) {
+				fail(i, "malformed payload");
+				return;
+			}
+			break;
+		}
+		np = gen.isag_np;
+	}
+
+	if (gr.ptr == NULL || i->nonce_r.ptr == NULL) {
+		fail(i, "missing KE or Nr");
+		return;
+	}
+	if (gr.len != dh->bytes) {
+		fail(i, "KE has wrong length");
+		return;
+	}
+
+	add_latency(&sa_init_ms, ms_between(i->sent, now));
+	i->spis.responder = hdr->isa_ike_responder_spi;
+
+	if (psk == NULL && cert == NULL) {
+		/* IKE_SA_INIT is the handshake */
+		nr_established++;
+		add_latency(&handshake_ms, ms_between(i->started, now));
+		release_initiator(i);
+		return;
+	}
+
+	PK11SymKey *shared = dh->dh_ops->calc_shared(dh, i->privk, i->pubk,
+						     gr.ptr, gr.len);
+	if (shared == NULL) {
+		fail(i, "computing g^ir");
+		return;
+	}
+	bool ok = derive_keys(i, shared);
+	release_symkey(__func__, "shared", &shared);
+	if (!ok) {
+		fail(i, "computing SKEYSEED");
+		return;
+	}
+
+	send_encrypted_request(i, EXCHANGE_IKE_AUTH, emit_ike_auth_payloads);
+}
+
+static void process_encrypted_response(struct initiator *i,
+				       const struct isakmp_hdr *hdr,
+				       pb_stream *packet, pb_stream *body,
+				       monotime_t now)
+{
+	if (hdr->isa_np != ISAKMP_NEXT_v2SK) {
+		fail(i, "response not encrypted");
+		return;
+	}
+	struct ikev2_generic sk;
+	pb_stream sk_pbs;
+	if (!in_struct(&sk, &ikev2_sk_desc, body, &sk_pbs)) {
+		fail(i, "malformed SK");
+		return;
+	}
+	chunk_t cleartext;
+	if (!decrypt_message(i, packet->start, sk_pbs.cur, sk_pbs.roof,
+			     &cleartext)) {
+		fail(i, "decrypting SK");
+		return;
+	}
+
+	bool auth = false;
+	bool sa = false;
+	pb_stream inner;
+	init_pbs(&inner, cleartext.ptr, cleartext.len, "cleartext");
+	for (unsigned np = sk.isag_np; np != ISAKMP_NEXT_v2NONE; ) {
+		pb_stream pbs = inner;
+		struct ikev2_generic gen;
+		if (!in_struct(&gen, &ikev2_generic_desc, &pbs, NULL)) {
+			fail(i, "malformed payload");
+			return;
+		}
+		if (np == ISAKMP_NEXT_v2N) {
+			if (notify_failed(i, &inner)) {
+				return;
+			}
+		} else {
+			auth |= (np == ISAKMP_NEXT_v2AUTH);
+			sa |= (np == ISAKMP_NEXT_v2SA);
+			inner = pbs;
+		}
+		np = gen.isag_np;
+	}
+
+	ipsec_spi_t *spis = &child_spis[i->nr * children];
+	switch (i->exchange) {
+	case EXCHANGE_IKE_AUTH:
+		if (!auth || !sa) {
+			fail(i, !auth ? "missing AUTH" : "missing SA");
+			return;
+		}
+		nr_established++;
+		nr_children++;
+		add_latency(&handshake_ms, ms_between(i->started, now));
+		i->established = now;
+		i->next_rekey = monotimesum(now, deltatime(rekey));
+		i->next_dpd = monotimesum(now, deltatime(dpd));
+		spis[0] = i->new_spi;
+		i->nr_children = 1;
+		next_request(i, now);
+		break;
+	case EXCHANGE_NEW_CHILD_SA:
+	case EXCHANGE_REKEY_CHILD_SA:
+		if (!sa) {
+			fail(i, "missing SA");
+			return;
+		}
+		add_latency(&child_ms, ms_between(i->sent, now));
+		if (i->exchange == EXCHANGE_NEW_CHILD_SA) {
+			nr_children++;
+			spis[i->nr_children++] = i->new_spi;
+			next_request(i, now);
+		} else {
+			/* replace the old Child SA, then delete it */
+			ipsec_spi_t *old = &spis[children - i->rekeying];
+			i->old_spi = *old;
+			*old = i->new_spi;
+			send_encrypted_request(i, EXCHANGE_DELETE_CHILD_SA,
+					       emit_delete_child_sa_payloads);
+		}
+		break;
+	case EXCHANGE_DELETE_CHILD_SA:
+		nr_rekeyed++;
+		if (--i->rekeying == 0) {
+			i->next_rekey = monotimesum(now, deltatime(rekey));
+		}
+		next_request(i, now);
+		break;
+	case EXCHANGE_LIVENESS:
+		nr_liveness++;
+		next_request(i, now);
+		break;
+	case EXCHANGE_DELETE_IKE_SA:
+		nr_deleted++;
+		release_initiator(i);
+		break;
+	default:
+		bad_case(i->exchange);
+	}
+}
+
+static void process_response(uint8_t *buf, size_t len)
+{
+	monotime_t now = mononow();
+	pb_stream packet;
+	init_pbs(&packet, buf, len, "response");
+	struct isakmp_hdr hdr;
+	pb_stream body;
+	if (!in_struct(&hdr, &isakmp_hdr_desc, &packet, &body)) {
+		return;
+	}
+
+	/* map the SPI back to an initiator */
+	const uint8_t *spi = hdr.isa_ike_initiator_spi.bytes;
+	unsigned nr = (spi[4] << 24) | (spi[5] << 16) | (spi[6] << 8) | spi[7];
+	if (nr >= count) {
+		return;
+	}
+	struct initiator *i = &initiators[nr];
+	if (!i->on_list ||
+	    !memeq(&hdr.isa_ike_initiator_spi, &i->spis.initiator,
+		   sizeof(i->spis.initiator)) ||
+	    (hdr.isa_flags & ISAKMP_FLAGS_v2_MSG_R) == 0 ||
+	    hdr.isa_xchg != exchanges[i->exchange].xchg ||
+	    hdr.isa_msgid != i->msgid) {
+		/* late, or not for us */
+		return;
+	}
+
+	remove_outstanding(i);
+	if (i->exchange == EXCHANGE_IKE_SA_INIT) {
+		process_ike_sa_init_response(i, &hdr, &body, now);
+	} else {
+		process_encrypted_response(i, &hdr, &packet, &body, now);
+	}
+}
+
+/*
+ * The event loop.
+ */
+
+static monotime_t arrival(monotime_t start, unsigned nr)
+{
+	return monotimesum(start, deltatime_ms((intmax_t)nr * 1000 / rate));
+}
+
+static void run(void)
+{
+	monotime_t start = mononow();
+	monotime_t next_report = monotimesum(start, deltatime(1));
+	unsigned next = 0;
+
+	while (next < count || outstanding.len > 0 || idle.len > 0) {
+		monotime_t now = mononow();
+
+		while (next < count && !monobefore(now, arrival(start, next))) {
+			start_initiator(&initiators[next++]);
+		}
+
+		monotime_t expire = monotimesum(now, deltatime(-(time_t)timeout));
+		while (outstanding.oldest != NULL &&
+		       monobefore(outstanding.oldest->sent, expire)) {
+			fail(outstanding.oldest, "timeout");
+		}
+
+		while (idle.len > 0 && !monobefore(now, idle.heap[0]->wake)) {
+			wake_initiator(remove_idle(), now);
+		}
+
+		if (verbose && !monobefore(now, next_report)) {
+			fprintf(stderr, "%.0fs: started %u established %u failed %u outstanding %u idle %u\n",
+				ms_between(start, now) / 1000,
+				nr_started, nr_established, nr_failed,
+				outstanding.len, idle.len);
+			next_report = monotimesum(next_report, deltatime(1));
+		}
+
+		/* sleep until the next arrival or timeout */
+		monotime_t wake = monotimesum(now, deltatime(1));
+		if (next < count && monobefore(arrival(start, next), wake)) {
+			wake = arrival(start, next);
+		}
+		if (outstanding.oldest != NULL) {
+			monotime_t t = monotimesum(outstanding.oldest->sent,
+						   deltatime(timeout));
+			if (monobefore(t, wake)) {
+				wake = t;
+			}
+		}
+		if (idle.len > 0 && monobefore(idle.heap[0]->wake, wake)) {
+			wake = idle.heap[0]->wake;
+		}
+		double ms = ms_between(now, wake);
+		struct pollfd pfd = { .fd = sock, .events = POLLIN, };
+		if (poll(&pfd, 1, ms < 0 ? 0 : (int)ms + 1) < 0 && errno != EINTR) {
+			fprintf(stderr, "%s: poll failed: %s\n", progname, strerror(errno));
+			exit(ERROR);
+		}
+
+		for (;;) {
+			static uint8_t buf[MAX_INPUT_UDP_SIZE];
+			ssize_t n = recv(sock, buf, sizeof(buf), 0);
+			if (n < 0) {
+				break;
+			}
+			process_response(buf, n);
+		}
+	}
+
+	double elapsed = ms_between(start, mononow()) / 1000;
+	printf("elapsed: %.3fs\n", elapsed);
+	printf("initiated: %u (%.1f/s)\n", nr_started, nr_started / elapsed);
+	printf("established: %u (%.1f/s)\n", nr_established, nr_established / elapsed);
+	if (children > 1 || rekey > 0) {
+		printf("Child SAs: %u\n", nr_children);
+	}
+	if (rekey > 0) {
+		printf("rekeyed: %u\n", nr_rekeyed);
+	}
+	if (dpd > 0) {
+		printf("liveness checks: %u\n", nr_liveness);
+	}
+	if (delete_ike) {
+		printf("deleted: %u\n", nr_deleted);
+	}
+	printf("cookies: %u\n", nr_cookies);
+	printf("failed: %u\n", nr_failed);
+	for (struct failure *f = failures; f < failures + nr_failure_causes; f++) {
+		printf("  %s: %u\n", f->cause, f->count);
+	}
+}
+
+static int cmp_double(const void *lhs, const void *rhs)
+{
+	double l = *(const double *)lhs;
+	double r = *(const double *)rhs;
+	return (l > r) - (l < r);
+}
+
+static void print_latency(struct latencies *l)
+{
+	unsigned nr = l->nr;
+	if (nr == 0) {
+		return;
+	}
+	double *ms = l->ms;
+	qsort(ms, nr, sizeof(ms[0]), cmp_double);
+	printf("%s latency (ms): min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+	       l->what, ms[0], ms[nr * 50 / 100], ms[nr * 90 / 100],
+	       ms[nr * 99 / 100], ms[nr - 1]);
+}
+
+/*
+ * Setup.
+ */
+
+static bool esp_alg_is_ok(const struct ike_alg *alg)
+{
+	if (alg->algo_type == &ike_alg_dh) {
+		/* require an in-process/ike implementation of DH */
+		return ike_alg_is_ike(alg);
+	} else {
+		/* the responder's kernel decides */
+		return TRUE;
+	}
+}
+
+static const struct proposal_info *parse_proposal(const char *what,
+						  const char *str)
+{
+	struct proposal_policy policy = {
+		.ikev2 = true,
+		.alg_is_ok = ike_alg_is_ike,
+		.warning = libreswan_log,
+	};
+	char err_buf[512] = "";
+	struct alg_info *alg_info;
+	if (streq(what, "ike")) {
+		struct alg_info_ike *alg_info_ike =
+			alg_info_ike_create_from_str(&policy, str, err_buf,
+						     sizeof(err_buf));
+		alg_info = (alg_info_ike != NULL ? &alg_info_ike->ai : NULL);
+	} else {
+		policy.alg_is_ok = esp_alg_is_ok;
+		struct alg_info_esp *alg_info_esp =
+			alg_info_esp_create_from_str(&policy, str, err_buf,
+						     sizeof(err_buf));
+		alg_info = (alg_info_esp != NULL ? &alg_info_esp->ai : NULL);
+	}
+	if (alg_info == NULL || alg_info->alg_info_cnt == 0) {
+		fprintf(stderr, "%s: invalid %s proposal '%s': %s\n",
+			progname, what, str, err_buf);
+		exit(ERROR);
+	}
+	/* only the first proposal is used */
+	return &alg_info->proposals[0];
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\n"
+		"    %s [ <option> ... ] <target-address>\n"
+		"\n"
+		"Act as many IKEv2 initiators establishing IKE SAs with the\n"
+		"responder at <target-address>.\n"
+		"\n"
+		"Options:\n"
+		"\n"
+		"    -port <port>: the responder's port (default %u)\n"
+		"    -local <address>: bind to <address>\n"
+		"    -rate <n>: start <n> new initiators per second (default %u)\n"
+		"    -count <n>: total number of initiators (default %u)\n"
+		"    -timeout <seconds>: give up waiting for a response (default %u)\n"
+		"    -ike <proposal>: the IKE proposal (default %s)\n"
+		"    -esp <proposal>: the Child SA proposal (default %s)\n"
+		"    -psk <secret>: authenticate using PSK\n"
+		"    -cert <nickname>: authenticate using the RSA certificate\n"
+		"        <nickname>, with its subject as the ID; when neither\n"
+		"        -psk nor -cert is given only the IKE_SA_INIT\n"
+		"        exchange is performed\n"
+		"    -id <fqdn>: the initiator's PSK ID (default %s)\n"
+		"    -children <n>: Child SAs per IKE SA; the first is created\n"
+		"        by IKE_AUTH, the rest by CREATE_CHILD_SA (default 1)\n"
+		"    -delete: delete each IKE SA once it is established\n"
+		"    -hold <seconds>: delete each IKE SA <seconds> after it\n"
+		"        is established; with -rate this churns a steady\n"
+		"        state of about <rate>*<seconds> IKE SAs\n"
+		"    -rekey <seconds>: while held, rekey every Child SA each\n"
+		"        <seconds> (CREATE_CHILD_SA then a Delete)\n"
+		"    -dpd <seconds>: while held, send an empty INFORMATIONAL\n"
+		"        (liveness check) each <seconds>\n"
+		"    -v | -verbose: report progress and failures\n"
+		"    -d <dir> | -nssdir <dir>: directory containing crypto database\n"
+		"\n"
+		"Since all initiators share one address and ID, the\n"
+		"responder should be configured with uniqueids=no.\n",
+		progname, IKE_UDP_PORT, rate, count, timeout,
+		ike_string, esp_string, id);
+}
+
+static unsigned optarg_unsigned(char ***argp)
+{
+	const char *arg = *++(*argp);
+	unsigned long u;
+	if (arg == NULL || ttoulb(arg, 0, 0, UINT_MAX, &u) != NULL || u == 0) {
+		fprintf(stderr, "%s: option %s requires a positive number\n",
+			progname, (*argp)[-1]);
+		exit(ERROR);
+	}
+	return u;
+}
+
+static unsigned optarg_port(char ***argp)
+{
+	const char *arg = *++(*argp);
+	unsigned long u;
+	if (arg == NULL || ttoulb(arg, 0, 0, 65535, &u) != NULL || u == 0) {
+		fprintf(stderr, "%s: option %s requires a port number (1-65535)\n",
+			progname, (*argp)[-1]);
+		exit(ERROR);
+	}
+	return u;
+}
+
+static const char *optarg_string(char ***argp)
+{
+	const char *arg = *++(*argp);
+	if (arg == NULL) {
+		fprintf(stderr, "%s: option %s requires an argument\n",
+			progname, (*argp)[-1]);
+		exit(ERROR);
+	}
+	return arg;
+}
+
+static void parse_address(const char *what, const char *str, ip_address *addr)
+{
+	err_t e = ttoaddr(str, 0, AF_UNSPEC, addr);
+	if (e != NULL) {
+		fprintf(stderr, "%s: invalid %s address '%s': %s\n",
+			progname, what, str, e);
+		exit(ERROR);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	log_to_stderr = false;
+	tool_init_log(argv[0]);
+
+	if (argc == 1) {
+		usage();
+		exit(ERROR);
+	}
+
+	const char *local_string = NULL;
+	char **argp = argv + 1;
+	for (; *argp != NULL; argp++) {
+		const char *arg = *argp;
+		if (arg[0] != '-') {
+			break;
+		}
+		do {
+			arg++;
+		} while (arg[0] == '-');
+		if (streq(arg, "?") || streq(arg, "h") || streq(arg, "help")) {
+			usage();
+			exit(PASSED);
+		} else if (streq(arg, "port")) {
+			target_port = optarg_port(&argp);
+		} else if (streq(arg, "local")) {
+			local_string = optarg_string(&argp);
+		} else if (streq(arg, "rate")) {
+			rate = optarg_unsigned(&argp);
+		} else if (streq(arg, "count")) {
+			count = optarg_unsigned(&argp);
+		} else if (streq(arg, "timeout")) {
+			timeout = optarg_unsigned(&argp);
+		} else if (streq(arg, "ike")) {
+			ike_string = optarg_string(&argp);
+		} else if (streq(arg, "esp")) {
+			esp_string = optarg_string(&argp);
+		} else if (streq(arg, "psk")) {
+			psk = optarg_string(&argp);
+		} else if (streq(arg, "id")) {
+			id = optarg_string(&argp);
+		} else if (streq(arg, "cert")) {
+			cert_nickname = optarg_string(&argp);
+		} else if (streq(arg, "children")) {
+			children = optarg_unsigned(&argp);
+		} else if (streq(arg, "delete")) {
+			delete_ike = true;
+		} else if (streq(arg, "hold")) {
+			hold = optarg_unsigned(&argp);
+			delete_ike = true;
+		} else if (streq(arg, "rekey")) {
+			rekey = optarg_unsigned(&argp);
+		} else if (streq(arg, "dpd")) {
+			dpd = optarg_unsigned(&argp);
+		} else if (streq(arg, "v") || streq(arg, "verbose")) {
+			verbose = true;
+		} else if (streq(arg, "d") || streq(arg, "nssdir")) {
+			lsw_conf_nssdir(optarg_string(&argp));
+		} else {
+			fprintf(stderr, "%s: unknown option: %s\n", progname, *argp);
+			exit(ERROR);
+		}
+	}
+	if (argp[0] == NULL || argp[1] != NULL) {
+		usage();
+		exit(ERROR);
+	}
+	if (psk != NULL && cert_nickname != NULL) {
+		fprintf(stderr, "%s: -psk and -cert are mutually exclusive\n",
+			progname);
+		exit(ERROR);
+	}
+	if (psk == NULL && cert_nickname == NULL &&
+	    (children > 1 || delete_ike)) {
+		fprintf(stderr, "%s: -children, -delete and -hold require -psk or -cert\n",
+			progname);
+		exit(ERROR);
+	}
+	if (hold == 0 && (rekey > 0 || dpd > 0)) {
+		fprintf(stderr, "%s: -rekey and -dpd require -hold\n",
+			progname);
+		exit(ERROR);
+	}
+	parse_address("target", argp[0], &target);
+	setportof(htons(target_port), &target);
+
+	lsw_nss_buf_t err;
+	/* only -cert needs the database */
+	if (!lsw_nss_setup(cert_nickname != NULL ? lsw_init_options()->nssdir : NULL,
+			   LSW_NSS_READONLY, lsw_nss_get_password, err)) {
+		fprintf(stderr, "%s: unexpected %s\n", progname, err);
+		exit(ERROR);
+	}
+	init_ike_alg();
+
+	if (cert_nickname != NULL) {
+		cert = PK11_FindCertFromNickname(cert_nickname,
+						 lsw_return_nss_password_file_info());
+		if (cert == NULL) {
+			fprintf(stderr, "%s: certificate '%s' not found\n",
+				progname, cert_nickname);
+			exit(ERROR);
+		}
+		cert_key = PK11_FindKeyByAnyCert(cert,
+						 lsw_return_nss_password_file_info());
+		if (cert_key == NULL || SECKEY_GetPrivateKeyType(cert_key) != rsaKey) {
+			fprintf(stderr, "%s: certificate '%s' has no RSA private key\n",
+				progname, cert_nickname);
+			exit(ERROR);
+		}
+	}
+
+	ike = parse_proposal("ike", ike_string);
+	if (ike->dh == NULL || ike->prf == NULL) {
+		fprintf(stderr, "%s: IKE proposal '%s' requires a PRF and DH\n",
+			progname, ike_string);
+		exit(ERROR);
+	}
+	esp = parse_proposal("esp", esp_string);
+
+	sock = socket(addrtypeof(&target), SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		fprintf(stderr, "%s: socket failed: %s\n", progname, strerror(errno));
+		exit(ERROR);
+	}
+	if (local_string != NULL) {
+		parse_address("local", local_string, &local);
+		if (bind(sock, sockaddrof(&local), sockaddrlenof(&local)) < 0) {
+			fprintf(stderr, "%s: bind failed: %s\n", progname, strerror(errno));
+			exit(ERROR);
+		}
+	}
+	/* learn the local address for the TSi */
+	if (connect(sock, sockaddrof(&target), sockaddrlenof(&target)) < 0) {
+		fprintf(stderr, "%s: connect failed: %s\n", progname, strerror(errno));
+		exit(ERROR);
+	}
+	socklen_t local_len = sizeof(local.u);
+	if (getsockname(sock, (struct sockaddr *)&local.u, &local_len) < 0) {
+		fprintf(stderr, "%s: getsockname failed: %s\n", progname, strerror(errno));
+		exit(ERROR);
+	}
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+		fprintf(stderr, "%s: fcntl failed: %s\n", progname, strerror(errno));
+		exit(ERROR);
+	}
+
+	initiators = alloc_things(struct initiator, count, "initiators");
+	for (unsigned nr = 0; nr < count; nr++) {
+		initiators[nr].nr = nr;
+	}
+	child_spis = alloc_things(ipsec_spi_t, (size_t)count * children,
+				  "Child SA SPIs");
+	idle.heap = alloc_things(struct initiator *, count, "idle initiators");
+
+	run();
+	print_latency(&sa_init_ms);
+	print_latency(&handshake_ms);
+	print_latency(&child_ms);
+
+	pfree(initiators);
+	pfree(child_spis);
+	pfree(idle.heap);
+	pfreeany(sa_init_ms.ms);
+	pfreeany(handshake_ms.ms);
+	pfreeany(child_ms.ms);
+	if (cert_key != NULL) {
+		SECKEY_DestroyPrivateKey(cert_key);
+	}
+	if (cert != NULL) {
+		CERT_DestroyCertificate(cert);
+	}
+	close(sock);
+	lsw_nss_shutdown();
+
+	exit(nr_failed > 0 ? FAILED : PASSED);
+}
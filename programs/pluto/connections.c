@@ -90,6 +90,8 @@
 #include "ip_address.h"
 #include "af_info.h"
 #include "keyhi.h" /* for SECKEY_DestroyPublicKey */
+#include "status_filter.h"
+#include "proposal_cache.h"
 
 struct connection *connections = NULL;
 
@@ -204,6 +206,7 @@ void update_host_pairs(struct connection *c)
 			 */
 			if (!d->spd.that.has_client) {
 				addrtosubnet(&new_addr, &d->spd.that.client);
+				update_virtual_net_index(d);
 			}
 
 			d->spd.that.host_addr = new_addr;
@@ -302,6 +305,7 @@ void delete_connection(struct connection *c, bool relations)
 
 	/* find and delete c from connections list */
 	list_rm(struct connection, ac_next, c, connections);
+	remove_virtual_net_index(c);
 
 	/* find and delete c from the host pair list */
 	if (c->host_pair == NULL) {
@@ -355,17 +359,17 @@ void delete_connection(struct connection *c, bool relations)
 		sr = next_sr;
 	}
 
+	free_ikev2_proposals(&c->v2_ike_proposals);
 	if (c->alg_info_ike != NULL) {
-		alg_info_delref(&c->alg_info_ike->ai);
+		release_alg_info(&c->alg_info_ike->ai);
 		c->alg_info_ike = NULL;
 	}
-	free_ikev2_proposals(&c->v2_ike_proposals);
 
+	free_ikev2_proposals(&c->v2_ike_auth_child_proposals);
 	if (c->alg_info_esp != NULL) {
-		alg_info_delref(&c->alg_info_esp->ai);
+		release_alg_info(&c->alg_info_esp->ai);
 		c->alg_info_esp = NULL;
 	}
-	free_ikev2_proposals(&c->v2_ike_auth_child_proposals);
 	free_ikev2_proposals(&c->v2_create_child_proposals);
 	c->v2_create_child_proposals_default_dh = NULL; /* static pointer */
 
@@ -804,6 +808,9 @@ static void unshare_connection(struct connection *c)
 
 	c->vti_iface = clone_str(c->vti_iface, "connection vti_iface");
 
+	/* not indexed until it is on the connections list */
+	c->virtual_net = NULL;
+
 	c->redirect_to = clone_str(c->redirect_to,\
 					"connection redirect_to");
 	c->accept_redirect_to = clone_str(c->accept_redirect_to,\
@@ -823,6 +830,11 @@ static void unshare_connection(struct connection *c)
 	if (c->alg_info_esp != NULL)
 		alg_info_addref(&c->alg_info_esp->ai);
 
+	/* and to the proposals compiled from them, if any */
+	addref_ikev2_proposals(c->v2_ike_proposals);
+	addref_ikev2_proposals(c->v2_ike_auth_child_proposals);
+	addref_ikev2_proposals(c->v2_create_child_proposals);
+
 	if (c->pool !=  NULL)
 		reference_addresspool(c);
 }
@@ -1162,11 +1174,17 @@ static bool preload_wm_cert_secret(const char *side, const char *pubkey,
 	 * extract_end / load_end_nss_certificate.  It happens
 	 * because, at the point of this function's call, there is no
 	 * where to stash the certificate.  Caveat emptor.
+	 *
+	 * The NSS lookups are cached; forget this certificate first
+	 * so that adding (or replacing) the connection notices a
+	 * certificate renewed or removed since.  The second load
+	 * then hits the fresh entry.
 	 */
 	CERTCertificate *cert;
 	const char *cert_source;
 	switch (pubkey_type) {
 	case WHACK_PUBKEY_CERTIFICATE_NICKNAME:
+		forget_nss_cert_by_nickname(pubkey);
 		cert = get_cert_by_nickname_from_nss(pubkey);
 		cert_source = "nickname";
 		if (cert == NULL) {
@@ -1183,6 +1201,7 @@ static bool preload_wm_cert_secret(const char *side, const char *pubkey,
 		 * ignore this (ipsec.secrets RSA pubkeys get put in
 		 * pluto_secrets, sigh).
 		 */
+		forget_nss_cert_by_ckaid(pubkey);
 		cert = get_cert_by_ckaid_from_nss(pubkey);
 		cert_source = "CKAID";
 		if (cert == NULL) {
@@ -1593,8 +1612,8 @@ void add_connection(const struct whack_message *wm)
 				.warning = libreswan_log,
 			};
 
-			c->alg_info_ike = alg_info_ike_create_from_str(&proposal_policy, wm->ike,
-								    err_buf, sizeof(err_buf));
+			c->alg_info_ike = intern_alg_info_ike(&proposal_policy, wm->ike,
+							      err_buf, sizeof(err_buf));
 
 			if (c->alg_info_ike == NULL) {
 				pexpect(err_buf[0]); /* something */
@@ -1604,7 +1623,7 @@ void add_connection(const struct whack_message *wm)
 				return;
 			}
 
-			/* from here on, error returns should alg_info_free(&c->alg_info_ike->ai); */
+			/* from here on, error returns should forget_alg_info(&c->alg_info_ike->ai); */
 
 			LSWDBGP(DBG_CRYPT | DBG_CONTROL, buf) {
 				lswlogs(buf, "ike (phase1) algorithm values: ");
@@ -1614,7 +1633,7 @@ void add_connection(const struct whack_message *wm)
 				loglog(RC_FATAL,
 					"Failed to add connection \"%s\": got 0 transforms for ike=\"%s\"",
 					wm->name, wm->ike);
-				alg_info_free(&c->alg_info_ike->ai);
+				forget_alg_info(&c->alg_info_ike->ai);
 				pfree(c);
 				return;
 			}
@@ -1649,37 +1668,31 @@ void add_connection(const struct whack_message *wm)
 			 * POLICY_ENCRYPT and POLICY_AUTHENTICATE is on.
 			 * The only difference in processing is which
 			 * function is called (and those functions are
-			 * almost identical).
+			 * almost identical); c->policy selects it.
 			 */
-			c->alg_info_esp =
-				/* function: */
-					(c->policy & POLICY_ENCRYPT ?
-					 alg_info_esp_create_from_str :
-					 alg_info_ah_create_from_str)
-				/* arguments: */
-					(&proposal_policy,
-					 wm->esp, err_buf, sizeof(err_buf));
+			c->alg_info_esp = intern_alg_info_esp(&proposal_policy, c->policy,
+							      wm->esp, err_buf, sizeof(err_buf));
 
 			if (c->alg_info_esp == NULL) {
 				loglog(RC_FATAL,
 				       "Failed to add connection \"%s\", esp=\"%s\" is invalid: %s",
 				       wm->name, wm->esp, err_buf);
 				if (c->alg_info_ike != NULL)
-					alg_info_free(&c->alg_info_ike->ai);
+					forget_alg_info(&c->alg_info_ike->ai);
 				pfree(c);
 				return;
 			}
 
-			/* from here on, error returns should alg_info_free(&c->alg_info_esp->ai); */
+			/* from here on, error returns should forget_alg_info(&c->alg_info_esp->ai); */
 
 			if (c->alg_info_esp->ai.alg_info_cnt == 0) {
 				loglog(RC_FATAL,
 				       "Failed to add connection \"%s\", esp=\"%s\" contained 0 valid transforms",
 				       wm->name, wm->esp);
 				if (c->alg_info_ike != NULL)
-					alg_info_free(&c->alg_info_ike->ai);
+					forget_alg_info(&c->alg_info_ike->ai);
 				if (c->alg_info_esp != NULL) \
-					alg_info_free(&c->alg_info_esp->ai);
+					forget_alg_info(&c->alg_info_esp->ai);
 				pfree(c);
 				return;
 			}
@@ -1979,6 +1992,7 @@ void add_connection(const struct whack_message *wm)
 	unshare_connection(c);
 
 	(void)orient(c);
+	update_virtual_net_index(c);
 
 	connect_to_host_pair(c);
 
@@ -2086,6 +2100,7 @@ char *add_group_instance(struct connection *group, const ip_subnet *target,
 		/* add to connections list */
 		t->ac_next = connections;
 		connections = t;
+		update_virtual_net_index(t);
 
 		/* same host_pair as parent: stick after parent on list */
 		/* t->hp_next = group->hp_next; */	/* done by clone_thing */
@@ -2160,6 +2175,7 @@ struct connection *instantiate(struct connection *c, const ip_address *him,
 	/* set internal fields */
 	d->ac_next = connections;
 	connections = d;
+	update_virtual_net_index(d);
 	d->spd.routing = RT_UNROUTED;
 	d->newest_isakmp_sa = SOS_NOBODY;
 	d->newest_ipsec_sa = SOS_NOBODY;
@@ -2208,6 +2224,7 @@ struct connection *rw_instantiate(struct connection *c,
 		d->spd.that.client = *aftoinfo(subnettypeof(
 						&d->spd.that.client))->none;
 	}
+	update_virtual_net_index(d);
 	DBG(DBG_CONTROL, {
 		ipstr_buf b;
 		char inst[CONN_INST_BUF];
@@ -2502,6 +2519,7 @@ static struct connection *oppo_instantiate(struct connection *c,
 
 	/* opportunistic connections do not use port selectors */
 	setportof(0, &d->spd.that.client.addr);
+	update_virtual_net_index(d);
 
 	if (sameaddr(peer_client, &d->spd.that.host_addr))
 		d->spd.that.has_client = FALSE;
@@ -3511,91 +3529,116 @@ struct connection *refine_host_connection(const struct state *st,
  * With virtual addressing, we must not allow someone to use an already
  * used (by another id) addr/net.
  */
-static bool is_virtual_net_used(struct connection *c,
-				const ip_subnet *peer_net,
-				const struct id *peer_id)
+
+struct virtual_net_used {
+	struct connection *c;
+	const ip_subnet *peer_net;
+	const struct id *peer_id;
+};
+
+static virtual_net_overlap_cb virtual_net_overlaps;	/* type assertion */
+
+static bool virtual_net_overlaps(struct connection *d, void *arg)
 {
-	struct connection *d;
+	struct virtual_net_used *vu = arg;
+	struct connection *c = vu->c;
+	const ip_subnet *peer_net = vu->peer_net;
+	const struct id *peer_id = vu->peer_id;
 	char cbuf[CONN_INST_BUF];
 
-	for (d = connections; d != NULL; d = d->ac_next) {
-		switch (d->kind) {
-		case CK_PERMANENT:
-		case CK_TEMPLATE:
-		case CK_INSTANCE:
-			if ((subnetinsubnet(peer_net, &d->spd.that.client) ||
-					subnetinsubnet(&d->spd.that.client,
-						peer_net)) &&
-				!same_id(&d->spd.that.id, peer_id)) {
-				char buf[IDTOA_BUF];
-				char client[SUBNETTOT_BUF];
-				const char *cname;
-				const char *doesnot = " does not";
-				const char *esses = "";
-
-				subnettot(peer_net, 0, client, sizeof(client));
-				idtoa(&d->spd.that.id, buf, sizeof(buf));
-
-				libreswan_log(
-					"Virtual IP %s overlaps with connection \"%s\"%s (kind=%s) '%s'",
-					client,
-					d->name, fmt_conn_instance(d, cbuf),
-					enum_name(&connection_kind_names,
-						d->kind),
-					buf);
-
-				if (!kernel_ops->overlap_supported) {
-					libreswan_log(
-						"Kernel method '%s' does not support overlapping IP ranges",
-						kernel_ops->kern_name);
-					return TRUE;
-
-				} else if (LIN(POLICY_OVERLAPIP, c->policy) &&
-					LIN(POLICY_OVERLAPIP, d->policy)) {
-					libreswan_log(
-						"overlap is okay by mutual consent");
+	switch (d->kind) {
+	case CK_PERMANENT:
+	case CK_TEMPLATE:
+	case CK_INSTANCE:
+		if ((subnetinsubnet(peer_net, &d->spd.that.client) ||
+				subnetinsubnet(&d->spd.that.client,
+					peer_net)) &&
+			!same_id(&d->spd.that.id, peer_id)) {
+			char buf[IDTOA_BUF];
+			char client[SUBNETTOT_BUF];
+			const char *cname;
+			const char *doesnot = " does not";
+			const char *esses = "";
+
+			subnettot(peer_net, 0, client, sizeof(client));
+			idtoa(&d->spd.that.id, buf, sizeof(buf));
 
-					/*
-					 * Look for another overlap to report
-					 * on.
-					 */
-					break;
+			libreswan_log(
+				"Virtual IP %s overlaps with connection \"%s\"%s (kind=%s) '%s'",
+				client,
+				d->name, fmt_conn_instance(d, cbuf),
+				enum_name(&connection_kind_names,
+					d->kind),
+				buf);
 
-				} else if (LIN(POLICY_OVERLAPIP, c->policy) &&
-					!LIN(POLICY_OVERLAPIP, d->policy)) {
-					/* redundant */
-					cname = d->name;
-					fmt_conn_instance(d, cbuf);
-				} else if (!LIN(POLICY_OVERLAPIP, c->policy) &&
-					LIN(POLICY_OVERLAPIP, d->policy)) {
-					cname = c->name;
-					fmt_conn_instance(c, cbuf);
-				} else {
-					cbuf[0] = '\0';
-					doesnot = "";
-					esses = "s";
-					cname = "neither";
-				}
+			if (!kernel_ops->overlap_supported) {
+				libreswan_log(
+					"Kernel method '%s' does not support overlapping IP ranges",
+					kernel_ops->kern_name);
+				return TRUE;
 
+			} else if (LIN(POLICY_OVERLAPIP, c->policy) &&
+				LIN(POLICY_OVERLAPIP, d->policy)) {
 				libreswan_log(
-					"overlap is forbidden (%s%s%s agree%s to overlap)",
-					cname,
-					cbuf,
-					doesnot,
-					esses);
+					"overlap is okay by mutual consent");
 
-				idtoa(peer_id, buf, sizeof(buf));
-				libreswan_log("Your ID is '%s'", buf);
+				/*
+				 * Look for another overlap to report
+				 * on.
+				 */
+				break;
 
-				return TRUE; /* already used by another one */
+			} else if (LIN(POLICY_OVERLAPIP, c->policy) &&
+				!LIN(POLICY_OVERLAPIP, d->policy)) {
+				/* redundant */
+				cname = d->name;
+				fmt_conn_instance(d, cbuf);
+			} else if (!LIN(POLICY_OVERLAPIP, c->policy) &&
+				LIN(POLICY_OVERLAPIP, d->policy)) {
+				cname = c->name;
+				fmt_conn_instance(c, cbuf);
+			} else {
+				cbuf[0] = '\0';
+				doesnot = "";
+				esses = "s";
+				cname = "neither";
 			}
-			break;
-		case CK_GOING_AWAY:
-		default:
-			break;
+
+			libreswan_log(
+				"overlap is forbidden (%s%s%s agree%s to overlap)",
+				cname,
+				cbuf,
+				doesnot,
+				esses);
+
+			idtoa(peer_id, buf, sizeof(buf));
+			libreswan_log("Your ID is '%s'", buf);
+
+			return TRUE; /* already used by another one */
 		}
+		break;
+	case CK_GOING_AWAY:
+	default:
+		break;
 	}
-	return FALSE; /* you can safely use it */
+	return FALSE;
+}
+
+/*
+ * Rather than walking every connection, only look at those indexed
+ * (see virtual.c) with a client that overlaps PEER_NET.
+ */
+static bool is_virtual_net_used(struct connection *c,
+				const ip_subnet *peer_net,
+				const struct id *peer_id)
+{
+	struct virtual_net_used vu = {
+		.c = c,
+		.peer_net = peer_net,
+		.peer_id = peer_id,
+	};
+
+	return foreach_virtual_net_overlap(peer_net, virtual_net_overlaps, &vu);
 }
 
 /*
@@ -4395,7 +4438,7 @@ void show_one_connection(const struct connection *c)
 	kernel_alg_show_connection(c, instance);
 }
 
-void show_connections_status(void)
+void show_connections_status(const struct whack_status_filter *filter)
 {
 	int count = 0;
 	int active = 0;
@@ -4411,27 +4454,24 @@ void show_connections_status(void)
 			active++;
 	}
 
-	if (count != 0) {
-		/* make an array of connections, sort it, and report it */
-
-		struct connection **array =
-			alloc_bytes(sizeof(struct connection *) * count,
-				"connection array");
-		int i = 0;
-
-		for (c = connections; c != NULL; c = c->ac_next)
-			array[i++] = c;
-
-		/* sort it! */
-		qsort(array, count, sizeof(struct connection *),
-			connection_compare_qsort);
+	/* select the matching connections, in order, and report them */
+	struct status_page page;
+	init_status_page(&page, filter, connection_compare_qsort, count);
+	for (c = connections; c != NULL; c = c->ac_next) {
+		if (connection_matches_status_filter(c, filter))
+			status_page_add(&page, c);
+	}
 
-		for (i = 0; i < count; i++)
-			show_one_connection(array[i]);
+	size_t nr;
+	void **items = status_page_items(&page, &nr);
+	if (nr > 0) {
+		for (size_t i = 0; i < nr; i++)
+			show_one_connection(items[i]);
 
-		pfree(array);
 		whack_log(RC_COMMENT, " "); /* spacer */
 	}
+	show_status_page_summary(&page, filter, "connections");
+	free_status_page(&page);
 
 	whack_log(RC_COMMENT, "Total IPsec connections: loaded %d, active %d",
 		count, active);
@@ -363,6 +363,7 @@ struct connection {
 	struct connection *hp_next;
 
 	struct connection *ac_next;	/* all connections list link */
+	struct virtual_net_entry *virtual_net;	/* index by spd.that.client */
 
 	enum send_ca_policy send_ca;
 	char *dnshostname;
@@ -544,7 +545,8 @@ extern struct connection *eclipsed(const struct connection *c, struct spd_route
 /* print connection status */
 
 extern void show_one_connection(const struct connection *c);
-extern void show_connections_status(void);
+struct whack_status_filter;
+extern void show_connections_status(const struct whack_status_filter *filter);
 extern int connection_compare(const struct connection *ca,
 			      const struct connection *cb);
 
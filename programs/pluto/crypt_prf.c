@@ -185,6 +185,18 @@ PK11SymKey *crypt_prf_final_symkey(struct crypt_prf **prfp)
 	return tmp;
 }
 
+PK11SymKey *crypt_prf_final_symkey_restart(struct crypt_prf *prf)
+{
+	PK11SymKey *tmp = prf->desc->prf_ops->final_symkey_restart(prf->context);
+	if (DBGP(DBG_CRYPT)) {
+		DBG_log("%s PRF %s final-key@%p (size %zu), restarted",
+			prf->name, prf->desc->common.name,
+			tmp, sizeof_symkey(tmp));
+		DBG_symkey(prf->name, "key", tmp);
+	}
+	return tmp;
+}
+
 void crypt_prf_final_bytes(struct crypt_prf **prfp,
 			   void *bytes, size_t sizeof_bytes)
 {
@@ -82,4 +82,11 @@ void crypt_prf_final_bytes(struct crypt_prf **prfp,
 			   void *bytes, size_t sizeof_bytes);
 chunk_t crypt_prf_final_chunk(struct crypt_prf **prfp);
 
+/*
+ * Return the final result, as crypt_prf_final_symkey(), but keep PRF
+ * (and its key), ready to consume new data.  Cheaper than repeating
+ * crypt_prf_init_symkey() with the same key.
+ */
+PK11SymKey *crypt_prf_final_symkey_restart(struct crypt_prf *prf);
+
 #endif
@@ -22,6 +22,7 @@
 #include "lswcdefs.h"
 #include "lswalloc.h"
 #include "realtime.h"
+#include "fd.h"
 
 /*
  * Type of serial number of a state object.
@@ -61,6 +62,16 @@ extern const char *check_expiry(realtime_t expiration_date,
 extern volatile bool exiting_pluto;
 extern void exit_pluto(int /*status*/) NEVER_RETURNS;
 
+/*
+ * Delete all states, a batch at a time, and then exit_pluto().  Unless
+ * --shutdown-deadline is set this is exit_pluto().
+ *
+ * SHUTTING_DOWN_PLUTO is set while that is happening, so that states
+ * deleted because of the shutdown aren't mistaken for failures.
+ */
+extern bool shutting_down_pluto;
+extern void shutdown_pluto(fd_t whackfd);
+
 typedef uint32_t msgid_t;      /* Host byte ordered */
 #define PRI_MSGID "%"PRIu32
 #define v1_MAINMODE_MSGID  ((msgid_t) 0)		/* network and host order */
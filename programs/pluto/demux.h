@@ -70,6 +70,37 @@ struct payload_summary {
 	size_t data_size;
 };
 
+/*
+ * A payload that has been found, and its generic header checked, but
+ * not yet decoded; see md_payload_chain().
+ */
+struct lazy_payload {
+	struct lazy_payload *next;	/* in message order */
+	unsigned np;
+	struct_desc *sd;
+	pb_stream *container;
+	uint8_t *start;
+};
+
+/*
+ * Per-message storage for the payload digests and lazy payloads.
+ * The first few come from the msg_digest itself, the rest from
+ * blocks that are freed along with it.
+ */
+#define MD_ARENA_INLINE_DIGESTS 4
+
+struct md_arena_block;
+
+struct md_arena {
+	size_t used;
+	struct md_arena_block *blocks;
+	union {
+		uint8_t bytes[MD_ARENA_INLINE_DIGESTS * sizeof(struct payload_digest)];
+		void *align_ptr;
+		uint64_t align_u64;
+	} inline_space;
+};
+
 /* message digest
  * Note: raw_packet and packet_pbs are "owners" of space on heap.
  */
@@ -108,9 +139,18 @@ struct msg_digest {
 	pb_stream packet_pbs;			/* whole packet */
 	pb_stream message_pbs;			/* message to be processed */
 
+	/*
+	 * The decoded payloads, in the order they were decoded (see
+	 * alloc_md_digest()), and the payloads still waiting to be
+	 * decoded (see md_payload_chain()).  Together they are
+	 * limited to PAYLIMIT.
+	 */
 #   define PAYLIMIT 30
-	struct payload_digest digest[PAYLIMIT];
+	struct payload_digest *digest[PAYLIMIT];
 	unsigned digest_roof;
+	struct lazy_payload *lazy;
+	unsigned lazy_roof;
+	struct md_arena arena;
 
 	struct payload_summary message_payloads;	/* (v2) */
 	struct payload_summary encrypted_payloads;	/* (v2) */
@@ -149,6 +189,27 @@ void schedule_md_event(const char *name, struct msg_digest *md);
 
 extern void free_md_pool(void);
 
+/*
+ * Allocate the next payload digest; returns NULL, having logged,
+ * when the message has too many payloads.
+ */
+struct payload_digest *alloc_md_digest(struct msg_digest *md);
+
+/*
+ * Remember that there is a payload of type NP, described by SD,
+ * starting at START within CONTAINER, but leave decoding it until
+ * md_payload_chain() is called.  Returns false, having logged, when
+ * the message has too many payloads.
+ */
+bool add_lazy_payload(struct msg_digest *md, unsigned np, struct_desc *sd,
+		      pb_stream *container, uint8_t *start);
+
+/*
+ * Return md->chain[NP] after first decoding any lazy payloads of
+ * that type.
+ */
+struct payload_digest *md_payload_chain(struct msg_digest *md, unsigned np);
+
 extern void process_packet(struct msg_digest **mdp);
 
 extern char *cisco_stringify(pb_stream *pbs, const char *attr_name);
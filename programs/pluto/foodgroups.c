@@ -80,7 +80,6 @@ static struct fg_targets *targets = NULL;
 
 static struct fg_targets *new_targets;
 
-
 /* subnetcmp compares the two ip_subnet values a and b.
  * It returns -1, 0, or +1 if a is, respectively,
  * less than, equal to, or greater than b.
@@ -100,10 +99,264 @@ static int subnetcmp(const ip_subnet *a, const ip_subnet *b)
 	return r;
 }
 
+/*
+ * While the group files are being read, the plain subnet targets are
+ * compiled into a binary prefix trie, one per source subnet, shared
+ * by all the groups.  Each node that is a target records its group.
+ *
+ * The trie is then simplified without changing which group's policy
+ * matches any address (the most specific prefix wins):
+ *
+ * - a target whose closest enclosing target belongs to the same
+ *   group is redundant and dropped
+ *
+ * - two sibling targets of the same group, with nothing more specific
+ *   below them, are replaced by their parent
+ *
+ * so that large group files turn into fewer group instances and
+ * eroutes.
+ *
+ * Targets with a protocol and ports are left as is (on PENDING).
+ */
+
+struct fg_node {
+	struct fg_node *child[2];
+	struct fg_groups *group;	/* NULL: not a target */
+};
+
+struct fg_trie {
+	struct fg_trie *next;
+	ip_subnet source;
+	int af;
+	struct fg_node *root;
+};
+
+static struct fg_trie *tries;
+
+static struct fg_targets *pending;
+
+static struct fg_targets *new_fg_target(struct fg_groups *g, const ip_subnet *sn,
+					uint8_t proto, uint16_t sport, uint16_t dport)
+{
+	struct fg_targets *f = alloc_thing(struct fg_targets, "fg_target");
+	f->group = g;
+	f->subnet = *sn;
+	f->proto = proto;
+	f->sport = sport;
+	f->dport = dport;
+	f->name = NULL;
+	return f;
+}
+
+static void dup_fg_target(const ip_subnet *lsn, const ip_subnet *sn,
+			  uint8_t proto, uint16_t sport, uint16_t dport,
+			  const struct fg_groups *already)
+{
+	char source[SUBNETTOT_BUF];
+	char dest[SUBNETTOT_BUF];
+
+	subnettot(lsn, 0, source, sizeof(source));
+	subnettot(sn, 0, dest, sizeof(dest));
+	loglog(RC_LOG_SERIOUS,
+	       "\"%s\" line %d: subnet \"%s\", proto %d, sport %d dport %d, source %s, already \"%s\"",
+	       flp->filename,
+	       flp->lino,
+	       dest,
+	       proto, sport, dport,
+	       source,
+	       already->connection->name);
+}
+
+static bool fg_bit(const unsigned char *bytes, unsigned bit)
+{
+	return (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static struct fg_trie *fg_trie(const ip_subnet *lsn, int af)
+{
+	struct fg_trie *t;
+	for (t = tries; t != NULL; t = t->next) {
+		if (t->af == af && subnetcmp(&t->source, lsn) == 0)
+			return t;
+	}
+	t = alloc_thing(struct fg_trie, "fg_trie");
+	t->source = *lsn;
+	t->af = af;
+	t->root = alloc_thing(struct fg_node, "fg_node");
+	t->next = tries;
+	tries = t;
+	return t;
+}
+
+static void add_fg_target(struct fg_groups *g, const ip_subnet *sn,
+			  uint8_t proto, uint16_t sport, uint16_t dport)
+{
+	const ip_subnet *lsn = &g->connection->spd.this.client;
+
+	if (proto != 0) {
+		struct fg_targets *p;
+		for (p = pending; p != NULL; p = p->next) {
+			if (p->proto == proto && p->sport == sport && p->dport == dport &&
+			    subnetcmp(&p->subnet, sn) == 0 &&
+			    subnetcmp(&p->group->connection->spd.this.client, lsn) == 0) {
+				dup_fg_target(lsn, sn, proto, sport, dport, p->group);
+				return;
+			}
+		}
+		struct fg_targets *f = new_fg_target(g, sn, proto, sport, dport);
+		f->next = pending;
+		pending = f;
+		return;
+	}
+
+	ip_address net;
+	const unsigned char *bytes;
+	networkof(sn, &net);
+	addrbytesptr_read(&net, &bytes);
+
+	struct fg_node *n = fg_trie(lsn, subnettypeof(sn))->root;
+	for (int bit = 0; bit < sn->maskbits; bit++) {
+		struct fg_node **c = &n->child[fg_bit(bytes, bit)];
+		if (*c == NULL)
+			*c = alloc_thing(struct fg_node, "fg_node");
+		n = *c;
+	}
+	if (n->group != NULL) {
+		dup_fg_target(lsn, sn, proto, sport, dport, n->group);
+	} else {
+		n->group = g;
+	}
+}
+
+/* returns true when N should be freed */
+static bool simplify_fg_node(struct fg_node *n, struct fg_groups *enclosing)
+{
+	if (n->group != NULL && n->group == enclosing) {
+		/* redundant */
+		n->group = NULL;
+	}
+	struct fg_groups *inner = n->group != NULL ? n->group : enclosing;
+
+	for (unsigned i = 0; i < 2; i++) {
+		if (n->child[i] != NULL &&
+		    simplify_fg_node(n->child[i], inner)) {
+			pfree(n->child[i]);
+			n->child[i] = NULL;
+		}
+	}
+
+	struct fg_node *l = n->child[0];
+	struct fg_node *r = n->child[1];
+	if (n->group == NULL && l != NULL && r != NULL &&
+	    l->group != NULL && l->group == r->group &&
+	    l->child[0] == NULL && l->child[1] == NULL &&
+	    r->child[0] == NULL && r->child[1] == NULL &&
+	    l->group != enclosing) {
+		/* both halves go to the same group */
+		n->group = l->group;
+		pfree(l);
+		pfree(r);
+		n->child[0] = n->child[1] = NULL;
+	}
+
+	return n->group == NULL && n->child[0] == NULL && n->child[1] == NULL;
+}
+
+/* emit the targets below N onto PENDING, freeing the trie */
+static void emit_fg_node(struct fg_node *n, int af,
+			 unsigned char *bytes, int bits)
+{
+	if (n->group != NULL) {
+		ip_address net;
+		ip_subnet sn;
+		const struct af_info *afi = aftoinfo(af);
+		happy(initaddr(bytes, afi->ia_sz, af, &net));
+		happy(initsubnet(&net, bits, '0', &sn));
+		struct fg_targets *f = new_fg_target(n->group, &sn, 0, 0, 0);
+		f->next = pending;
+		pending = f;
+	}
+	for (unsigned i = 0; i < 2; i++) {
+		if (n->child[i] != NULL) {
+			if (i == 1)
+				bytes[bits / 8] |= 0x80 >> (bits % 8);
+			emit_fg_node(n->child[i], af, bytes, bits + 1);
+			bytes[bits / 8] &= ~(0x80 >> (bits % 8));
+		}
+	}
+	pfree(n);
+}
+
+static int fg_target_cmp(const void *l, const void *r)
+{
+	const struct fg_targets *a = *(const struct fg_targets *const *)l;
+	const struct fg_targets *b = *(const struct fg_targets *const *)r;
+	int d = subnetcmp(&a->group->connection->spd.this.client,
+			  &b->group->connection->spd.this.client);
+	if (d == 0)
+		d = subnetcmp(&a->subnet, &b->subnet);
+	if (d == 0)
+		d = a->proto - b->proto;
+	if (d == 0)
+		d = a->sport - b->sport;
+	if (d == 0)
+		d = a->dport - b->dport;
+	return d;
+}
+
+/*
+ * Turn the tries and PENDING into NEW_TARGETS, ordered as described
+ * above.
+ */
+static void compile_targets(void)
+{
+	unsigned nr_ported = 0;
+	struct fg_targets *p;
+
+	for (p = pending; p != NULL; p = p->next)
+		nr_ported++;
+
+	while (tries != NULL) {
+		struct fg_trie *t = tries;
+		unsigned char bytes[16];
+
+		tries = t->next;
+		zero(&bytes);
+		simplify_fg_node(t->root, NULL);
+		emit_fg_node(t->root, t->af, bytes, 0);
+		pfree(t);
+	}
+
+	unsigned nr = 0;
+	for (p = pending; p != NULL; p = p->next)
+		nr++;
+	if (nr == 0)
+		return;
+
+	struct fg_targets **sorted = alloc_things(struct fg_targets *, nr,
+						  "sorted fg_targets");
+	unsigned i = 0;
+	for (p = pending; p != NULL; p = p->next)
+		sorted[i++] = p;
+	pending = NULL;
+	qsort(sorted, nr, sizeof(sorted[0]), fg_target_cmp);
+
+	struct fg_targets **pp = &new_targets;
+	for (i = 0; i < nr; i++) {
+		*pp = sorted[i];
+		pp = &sorted[i]->next;
+	}
+	*pp = NULL;
+	pfree(sorted);
+
+	DBG(DBG_CONTROL,
+	    DBG_log("policy groups: %u targets with protocol and ports, %u targets after simplification",
+		    nr_ported, nr));
+}
+
 static void read_foodgroup(struct fg_groups *g)
 {
 	const char *fgn = g->connection->name;
-	const ip_subnet *lsn = &g->connection->spd.this.client;
 	const struct lsw_conf_options *oco = lsw_init_options();
 	size_t plen = strlen(oco->policies_dir) + 2 + strlen(fgn) + 1;
 	struct file_lex_position flp_space;
@@ -219,63 +472,7 @@ static void read_foodgroup(struct fg_groups *g)
 					}
 					flushline(NULL);
 
-					/* Find where new entry ought to go in new_targets. */
-					struct fg_targets **pp;
-					int r;
-
-					for (pp = &new_targets;;
-					     pp = &(*pp)->next) {
-						if (*pp == NULL) {
-							r = -1; /* end of list is infinite */
-							break;
-						}
-						r = subnetcmp(lsn,
-							      &(*pp)->group->connection->spd.this.client);
-						if (r == 0) {
-							r = subnetcmp(&sn, &(*pp)->subnet);
-						}
-						if (r != 0)
-							break;
-
-						if (proto == (*pp)->proto && sport == (*pp)->sport && dport == (*pp)->dport) {
-							/* ??? we know that r == 0: why set it again? */
-							r = 0;
-							break;
-						} else {
-							/* ??? since we are looping, r's value won't be used */
-							r = 1;
-						}
-					}
-
-					if (r == 0) {
-						char source[SUBNETTOT_BUF];
-						char dest[SUBNETTOT_BUF];
-
-						subnettot(lsn, 0, source, sizeof(source));
-						subnettot(&sn, 0, dest, sizeof(dest));
-						loglog(RC_LOG_SERIOUS,
-						       "\"%s\" line %d: subnet \"%s\", proto %d, sport %d dport %d, source %s, already \"%s\"",
-						       flp->filename,
-						       flp->lino,
-						       dest,
-						       proto, sport, dport,
-						       source,
-						       (*pp)->group->connection->name);
-					} else {
-						struct fg_targets *f =
-							alloc_thing(
-								struct fg_targets,
-								"fg_target");
-
-						f->next = *pp;
-						f->group = g;
-						f->subnet = sn;
-						f->proto = proto;
-						f->sport = sport;
-						f->dport = dport;
-						f->name = NULL;
-						*pp = f;
-					}
+					add_fg_target(g, &sn, proto, sport, dport);
 				}
 				continue;
 			}
@@ -317,6 +514,7 @@ void load_groups(void)
 			if (oriented(*g->connection))
 				read_foodgroup(g);
 	}
+	compile_targets();
 
 	/* dump new_targets */
 	DBG(DBG_CONTROL,
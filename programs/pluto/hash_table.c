@@ -18,8 +18,23 @@
 #include "lswlog.h"
 
 #include "defs.h"
+#include "log.h"
+#include "rnd.h"
+#include "siphash.h"
 #include "hash_table.h"
 
+static struct siphash_key hash_table_key;
+
+void init_hash_table_key(void)
+{
+	get_rnd_bytes((uint8_t *)&hash_table_key, sizeof(hash_table_key));
+}
+
+size_t hash_table_bytes(const void *data, size_t len)
+{
+	return siphash13(&hash_table_key, data, len);
+}
+
 void init_hash_table(struct hash_table *table)
 {
 	for (unsigned i = 0; i < table->nr_slots; i++) {
@@ -50,3 +65,23 @@ void del_hash_table_entry(struct hash_table *table,
 	table->nr_entries--;
 	remove_list_entry(entry);
 }
+
+void show_hash_table_status(const char *name, struct hash_table *table)
+{
+	unsigned long max_chain = 0;
+
+	for (unsigned long i = 0; i < table->nr_slots; i++) {
+		unsigned long chain = 0;
+		void *data;
+
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&table->slots[i], data) {
+			chain++;
+		}
+		if (chain > max_chain) {
+			max_chain = chain;
+		}
+	}
+	whack_log_comment("current.hash.%s.entries=%ld", name, table->nr_entries);
+	whack_log_comment("current.hash.%s.slots=%lu", name, table->nr_slots);
+	whack_log_comment("current.hash.%s.max_chain=%lu", name, max_chain);
+}
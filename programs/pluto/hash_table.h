@@ -55,4 +55,22 @@ void del_hash_table_entry(struct hash_table *table,
 struct list_head *hash_table_slot_by_hash(struct hash_table *table,
 					  unsigned long hash);
 
+/*
+ * Hash LEN bytes using a key chosen at startup.
+ *
+ * Use this for anything the peer can choose (SPIs, addresses) so
+ * that it can't arrange for everything to land in one slot.
+ * init_hash_table_key() needs the RNG, so call it after NSS is up.
+ */
+
+void init_hash_table_key(void);
+size_t hash_table_bytes(const void *data, size_t len);
+
+/*
+ * Report, as "current.hash.NAME.*=" lines for --globalstatus, how
+ * full TABLE is and its longest chain.
+ */
+
+void show_hash_table_status(const char *name, struct hash_table *table);
+
 #endif
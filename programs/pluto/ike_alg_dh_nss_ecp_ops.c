@@ -105,7 +105,7 @@ static void nss_ecp_calc_secret(const struct oakley_group_desc *group,
 		 * needs to go over the wire.
 		 */
 		passert((*pubk)->u.ec.publicValue.len == group->bytes);
-		DBG_log("putting NSS raw CURVE25519 public key blob on wire");
+		DBG(DBG_CRYPT, DBG_log("putting NSS raw CURVE25519 public key blob on wire"));
 		memcpy(ke, (*pubk)->u.ec.publicValue.data, group->bytes);
 	} else {
 #endif
@@ -151,7 +151,7 @@ static PK11SymKey *nss_ecp_calc_shared(const struct oakley_group_desc *group,
 		 * needs to go over the wire.
 		 */
 		passert(sizeof_remote_ke == local_pubk->u.ec.publicValue.len);
-		DBG_log("passing raw CURVE25519 public key blob to NSS");
+		DBG(DBG_CRYPT, DBG_log("passing raw CURVE25519 public key blob to NSS"));
 		memcpy(remote_pubk.u.ec.publicValue.data, remote_ke, sizeof_remote_ke);
 	} else {
 #endif
@@ -158,23 +158,40 @@ static PK11SymKey *compute_outer(struct prf_context *prf)
 	return outer;
 }
 
-static PK11SymKey *final_symkey(struct prf_context **prfp)
+static PK11SymKey *compute_final_symkey(struct prf_context *prf)
 {
-	passert(final_symkey == (*prfp)->desc->prf_ops->final_symkey);
-	PK11SymKey *outer = compute_outer(*prfp);
+	PK11SymKey *outer = compute_outer(prf);
 	/* Finally hash that */
 	PK11SymKey *hashed_outer = crypt_hash_symkey("PRF HMAC outer hash",
-						     (*prfp)->desc->hasher,
+						     prf->desc->hasher,
 						     "outer", outer);
-	release_symkey((*prfp)->name, "outer", &outer);
+	release_symkey(prf->name, "outer", &outer);
 	if (DBGP(DBG_CRYPT)) {
 		DBG_symkey("    ", " hashed-outer", hashed_outer);
 	}
+	return hashed_outer;
+}
+
+static PK11SymKey *final_symkey(struct prf_context **prfp)
+{
+	passert(final_symkey == (*prfp)->desc->prf_ops->final_symkey);
+	PK11SymKey *hashed_outer = compute_final_symkey(*prfp);
 	pfree(*prfp);
 	*prfp = NULL;
 	return hashed_outer;
 }
 
+static PK11SymKey *final_symkey_restart(struct prf_context *prf)
+{
+	passert(final_symkey_restart == prf->desc->prf_ops->final_symkey_restart);
+	/* compute_outer() releases KEY; it is already hashed or padded to size */
+	PK11SymKey *key = reference_symkey(prf->name, "key", prf->key);
+	PK11SymKey *hashed_outer = compute_final_symkey(prf);
+	prf->key = key;
+	prf_update(prf);
+	return hashed_outer;
+}
+
 static void final_bytes(struct prf_context **prfp,
 			uint8_t *bytes, size_t sizeof_bytes)
 {
@@ -204,4 +221,5 @@ const struct prf_ops ike_alg_prf_hmac_ops = {
 	digest_bytes,
 	final_symkey,
 	final_bytes,
+	final_symkey_restart,
 };
@@ -150,13 +150,18 @@ static void digest_bytes(struct prf_context *prf, const char *name UNUSED,
 	passert(rc == SECSuccess);
 }
 
-static void final(struct prf_context *prf, void *bytes, size_t sizeof_bytes)
+static void digest_final(struct prf_context *prf, void *bytes, size_t sizeof_bytes)
 {
 	unsigned bytes_out;
 	SECStatus rc = PK11_DigestFinal(prf->context, bytes,
 					&bytes_out, sizeof_bytes);
 	passert(rc == SECSuccess);
 	pexpect(bytes_out == sizeof_bytes);
+}
+
+static void final(struct prf_context *prf, void *bytes, size_t sizeof_bytes)
+{
+	digest_final(prf, bytes, sizeof_bytes);
 	PK11_DestroyContext(prf->context, PR_TRUE);
 	prf->context = NULL;
 }
@@ -179,6 +184,19 @@ static PK11SymKey *final_symkey(struct prf_context **prf)
 	return final;
 }
 
+static PK11SymKey *final_symkey_restart(struct prf_context *prf)
+{
+	size_t sizeof_bytes = prf->desc->prf_output_size;
+	uint8_t *bytes = alloc_things(uint8_t, sizeof_bytes, "bytes");
+	digest_final(prf, bytes, sizeof_bytes);
+	/* the context still has its key */
+	SECStatus rc = PK11_DigestBegin(prf->context);
+	passert(rc == SECSuccess);
+	PK11SymKey *final = symkey_from_bytes("final", bytes, sizeof_bytes);
+	pfree(bytes);
+	return final;
+}
+
 static void nss_prf_check(const struct prf_desc *prf)
 {
 	const struct ike_alg *alg = &prf->common;
@@ -193,4 +211,5 @@ const struct prf_ops ike_alg_prf_nss_ops = {
 	digest_bytes,
 	final_symkey,
 	final_bytes,
+	final_symkey_restart,
 };
@@ -288,6 +288,16 @@ static PK11SymKey *nss_xcbc_final_symkey(struct prf_context **prf)
 	return key;
 }
 
+static PK11SymKey *nss_xcbc_final_symkey_restart(struct prf_context *prf)
+{
+	/* KEY has already been padded or hashed to size; keep it */
+	chunk_t mac = xcbc_mac(prf->desc, prf->key, prf->bytes);
+	PK11SymKey *key = symkey_from_chunk("xcbc", mac);
+	freeanychunk(mac);
+	freeanychunk(prf->bytes);
+	return key;
+}
+
 static void nss_xcbc_check(const struct prf_desc *prf)
 {
 	const struct ike_alg *alg = &prf->common;
@@ -302,4 +312,5 @@ const struct prf_ops ike_alg_prf_nss_xcbc_ops = {
 	nss_xcbc_digest_bytes,
 	nss_xcbc_final_symkey,
 	nss_xcbc_final_bytes,
+	nss_xcbc_final_symkey_restart,
 };
@@ -56,7 +56,7 @@ ike_spi_t ike_initiator_spi(void)
 {
 	ike_spi_t spi;
 	do {
-		get_rnd_bytes(spi.bytes, sizeof(spi));
+		get_public_rnd_bytes(spi.bytes, sizeof(spi));
 	} while (ike_spi_is_zero(&spi)); /* probably never loops */
 	return spi;
 }
@@ -156,6 +156,7 @@
 #include "ikev1_dpd.h"
 #include "hostpair.h"
 #include "ip_address.h"
+#include "virtual.h"	/* needs connections.h */
 
 #ifdef HAVE_NM
 #include "kernel.h"
@@ -1063,6 +1064,7 @@ static stf_status informational(struct state *st, struct msg_digest *md)
 							ipstr(&new_peer, &b));
 					});
 					tmp_c->spd.that.client.addr = new_peer;
+					update_virtual_net_index(tmp_c);
 				}
 
 				/* ??? is this wise?  This may changes a lot of other connections. */
@@ -2034,17 +2036,6 @@ void process_packet_tail(struct msg_digest **mdp)
 		while (np != ISAKMP_NEXT_NONE) {
 			struct_desc *sd = v1_payload_desc(np);
 
-			if (md->digest_roof >= elemsof(md->digest)) {
-				loglog(RC_LOG_SERIOUS,
-				       "more than %zu payloads in message; ignored",
-				       elemsof(md->digest));
-				if (!md->encrypted) {
-					SEND_NOTIFICATION(PAYLOAD_MALFORMED);
-				}
-				return;
-			}
-			struct payload_digest *const pd = md->digest + md->digest_roof;
-
 			/*
 			 * only do this in main mode. In aggressive mode, there
 			 * is no negotiation of NAT-T method. Get it right.
@@ -2116,11 +2107,12 @@ void process_packet_tail(struct msg_digest **mdp)
 					 * body we must do some things ourself:
 					 * - demarshall the payload
 					 * - grab the next payload number (np)
-					 * - don't keep payload (don't increment pd)
+					 * - don't keep payload (don't allocate pd)
 					 * - skip rest of loop body
 					 */
-					if (!in_struct(&pd->payload, &isakmp_ignore_desc, &md->message_pbs,
-						       &pd->pbs)) {
+					struct payload_digest ignored;
+					if (!in_struct(&ignored.payload, &isakmp_ignore_desc, &md->message_pbs,
+						       &ignored.pbs)) {
 						loglog(RC_LOG_SERIOUS,
 						       "%smalformed payload in packet",
 						       excuse);
@@ -2129,8 +2121,7 @@ void process_packet_tail(struct msg_digest **mdp)
 						}
 						return;
 					}
-					np = pd->payload.generic.isag_np;
-					/* NOTE: we do not increment pd! */
+					np = ignored.payload.generic.isag_np;
 					continue;  /* skip rest of the loop */
 
 				default:
@@ -2146,6 +2137,14 @@ void process_packet_tail(struct msg_digest **mdp)
 				passert(sd != NULL);
 			}
 
+			struct payload_digest *const pd = alloc_md_digest(md);
+			if (pd == NULL) {
+				if (!md->encrypted) {
+					SEND_NOTIFICATION(PAYLOAD_MALFORMED);
+				}
+				return;
+			}
+
 			passert(np < LELEM_ROOF);
 
 			{
@@ -2217,7 +2216,6 @@ void process_packet_tail(struct msg_digest **mdp)
 			}
 
 			np = pd->payload.generic.isag_np;
-			md->digest_roof++;
 
 			/* since we've digested one payload happily, it is probably
 			 * the case that any decryption worked.  So we will not suggest
@@ -2296,7 +2294,7 @@ void process_packet_tail(struct msg_digest **mdp)
 			p = md->chain[ISAKMP_NEXT_SA];
 			i = 1;
 			while (p != NULL) {
-				if (p != &md->digest[i]) {
+				if (p != md->digest[i]) {
 					loglog(RC_LOG_SERIOUS,
 					       "malformed Quick Mode message: SA payload is in wrong position");
 					if (!md->encrypted) {
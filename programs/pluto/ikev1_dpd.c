@@ -255,9 +255,14 @@ static void dpd_outI(struct state *p1st, struct state *st, bool eroute_care,
 	/*
 	 * check the phase 2, if we are supposed to,
 	 * and return if it is active recently
+	 *
+	 * With --dpd-inbound-traffic, traffic from the peer over the
+	 * IPsec SA (for phase 1, the newest one) is enough, NAT or no
+	 * NAT.
 	 */
-	if (eroute_care && st->hidden_variables.st_nat_traversal == LEMPTY &&
-			!was_eroute_idle(st, delay))
+	if ((eroute_care && st->hidden_variables.st_nat_traversal == LEMPTY &&
+	     !was_eroute_idle(st, delay)) ||
+	    peer_recently_active(st, delay))
 	{
 		DBG(DBG_DPD, DBG_log("DPD: out event not sent, phase 2 active"));
 
@@ -291,8 +296,8 @@ static void dpd_outI(struct state *p1st, struct state *st, bool eroute_care,
 
 	if (p1st->st_dpd_seqno == 0) {
 		/* Get a non-zero random value that has room to grow */
-		get_rnd_bytes((u_char *)&p1st->st_dpd_seqno,
-			      sizeof(p1st->st_dpd_seqno));
+		get_public_rnd_bytes(&p1st->st_dpd_seqno,
+				     sizeof(p1st->st_dpd_seqno));
 		p1st->st_dpd_seqno &= 0x7fff;
 		p1st->st_dpd_seqno++;
 	}
@@ -101,7 +101,7 @@ msgid_t generate_msgid(const struct state *st)
 	passert(IS_ISAKMP_ENCRYPTED(st->st_state));
 
 	for (;; ) {
-		get_rnd_bytes((void *) &msgid, sizeof(msgid));
+		get_public_rnd_bytes(&msgid, sizeof(msgid));
 		if (msgid != v1_MAINMODE_MSGID && unique_msgid(st, msgid))
 			break;
 
@@ -1341,6 +1341,7 @@ static stf_status quick_inI1_outR1_tail(struct verify_oppo_bundle *b)
 		if (c->spd.that.has_client_wildcard) {
 			c->spd.that.client = *his_net;
 			c->spd.that.has_client_wildcard = FALSE;
+			update_virtual_net_index(c);
 		}
 
 		/* fill in the client's true port */
@@ -1360,6 +1361,7 @@ static stf_status quick_inI1_outR1_tail(struct verify_oppo_bundle *b)
 			c->spd.that.client = *his_net;
 			c->spd.that.has_client = TRUE;
 			c->spd.that.virt = NULL;	/* ??? leak? */
+			update_virtual_net_index(c);
 
 			if (subnetishost(his_net) &&
 			    addrinsubnet(&c->spd.that.host_addr, his_net)) {
@@ -58,6 +58,7 @@
 
 #include "ip_endpoint.h"
 #include "nat_traversal.h"
+#include "proposal_cache.h"
 
 #ifdef HAVE_LABELED_IPSEC
 
@@ -366,6 +367,219 @@ static bool ikev1_verify_ah(const struct connection *c,
 	return false;
 }
 
+/*
+ * Emitting an SA payload means building a db_sa from the connection's
+ * alg_info and then walking it a struct at a time.  The proposals
+ * only depend on the inputs in struct v1_sa_key, so they are saved,
+ * along with where each SPI (or CPI) goes, and copied into later SAs
+ * with the same inputs.
+ *
+ * The templates hang off the connection's alg_info in the proposal
+ * cache so that connections sharing an ike=/esp= share them too.
+ */
+
+#define V1_SA_TEMPLATE_SPIS 8
+#define V1_SA_TEMPLATES_MAX 8	/* per alg_info */
+
+struct v1_sa_key {
+	const struct db_sa *sadb;
+	bool oakley_mode;
+	bool aggressive_mode;
+	lset_t connection_policy;
+	lset_t state_policy;	/* just TUNNEL and COMPRESS */
+	const struct oakley_group_desc *pfs_group;
+	unsigned encapsulation;
+	intmax_t life_seconds;
+};
+
+struct v1_sa_spi {
+	size_t offset;		/* from the first proposal */
+	uint8_t protoid;
+	bool tunnel_mode;
+};
+
+struct v1_sa_template {
+	struct v1_sa_template *next;	/* most recently used first */
+	struct v1_sa_key key;
+	unsigned nr_spis;
+	struct v1_sa_spi spis[V1_SA_TEMPLATE_SPIS];
+	size_t len;
+	uint8_t *proposals;
+};
+
+static bool same_v1_sa_key(const struct v1_sa_key *l, const struct v1_sa_key *r)
+{
+	return l->sadb == r->sadb &&
+		l->oakley_mode == r->oakley_mode &&
+		l->aggressive_mode == r->aggressive_mode &&
+		l->connection_policy == r->connection_policy &&
+		l->state_policy == r->state_policy &&
+		l->pfs_group == r->pfs_group &&
+		l->encapsulation == r->encapsulation &&
+		l->life_seconds == r->life_seconds;
+}
+
+void free_v1_sa_templates(struct v1_sa_template **templates)
+{
+	while (*templates != NULL) {
+		struct v1_sa_template *t = *templates;
+		*templates = t->next;
+		pfree(t->proposals);
+		pfree(t);
+	}
+}
+
+static const struct v1_sa_template *find_v1_sa_template(struct v1_sa_template **templates,
+							 const struct v1_sa_key *key)
+{
+	for (struct v1_sa_template **tp = templates; *tp != NULL; tp = &(*tp)->next) {
+		struct v1_sa_template *t = *tp;
+		if (same_v1_sa_key(&t->key, key)) {
+			/* move to front */
+			*tp = t->next;
+			t->next = *templates;
+			*templates = t;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static void save_v1_sa_template(struct v1_sa_template **templates,
+				const struct v1_sa_key *key,
+				const uint8_t *start, const uint8_t *end,
+				const struct v1_sa_spi *spis, unsigned nr_spis)
+{
+	passert(nr_spis <= V1_SA_TEMPLATE_SPIS);
+	struct v1_sa_template *t = alloc_thing(struct v1_sa_template,
+					       "IKEv1 SA template");
+	t->key = *key;
+	t->len = end - start;
+	t->proposals = clone_bytes(start, t->len, "IKEv1 SA template proposals");
+	t->nr_spis = nr_spis;
+	memcpy(t->spis, spis, nr_spis * sizeof(spis[0]));
+	t->next = *templates;
+	*templates = t;
+
+	unsigned n = 0;
+	for (struct v1_sa_template **tp = templates; *tp != NULL; tp = &(*tp)->next) {
+		if (++n == V1_SA_TEMPLATES_MAX) {
+			free_v1_sa_templates(&(*tp)->next);
+			break;
+		}
+	}
+}
+
+/*
+ * Impaired or labeled SAs vary in ways the key doesn't capture; and
+ * with DBG_EMITTING each struct should be logged as it is emitted.
+ */
+static bool v1_sa_templatable(const struct state *st, bool oakley_mode)
+{
+	if (DBGP(DBG_EMITTING)) {
+		return false;
+	}
+	if ((oakley_mode ? impair_ike_key_length_attribute :
+	     impair_child_key_length_attribute) != SEND_NORMAL) {
+		return false;
+	}
+#ifdef HAVE_LABELED_IPSEC
+	if (!oakley_mode && st->sec_ctx != NULL &&
+	    st->st_connection->labeled_ipsec) {
+		return false;
+	}
+#else
+	(void)st;
+#endif
+	return true;
+}
+
+/*
+ * Return the SPI (CPI for IPCOMP), in network order, for PROTOID,
+ * allocating it on first use, and set *SIZE.  Returns NULL when a
+ * CPI can't be had.
+ *
+ * All ESPs in an SA will share a single SPI.
+ * All AHs in an SA will share a single SPI.
+ * AHs' SPI will be distinct from ESPs'.
+ * This latter is needed because KLIPS doesn't
+ * use the protocol when looking up a (dest, protocol, spi).
+ * ??? If multiple ESPs are composed, how should their SPIs
+ * be allocated?
+ */
+static const uint8_t *v1_sa_spi(struct state *st, uint8_t protoid,
+				bool tunnel_mode, bool generated[PROTO_IPCOMP + 1],
+				size_t *size)
+{
+	switch (protoid) {
+	case PROTO_IPSEC_AH:
+		if (!generated[protoid]) {
+			st->st_ah.our_spi = get_ipsec_spi(0, IPPROTO_AH,
+							  &st->st_connection->spd,
+							  tunnel_mode);
+			generated[protoid] = TRUE;
+		}
+		*size = IPSEC_DOI_SPI_SIZE;
+		return (const uint8_t *)&st->st_ah.our_spi;
+
+	case PROTO_IPSEC_ESP:
+		if (!generated[protoid]) {
+			st->st_esp.our_spi = get_ipsec_spi(0, IPPROTO_ESP,
+							   &st->st_connection->spd,
+							   tunnel_mode);
+			generated[protoid] = TRUE;
+		}
+		*size = IPSEC_DOI_SPI_SIZE;
+		return (const uint8_t *)&st->st_esp.our_spi;
+
+	case PROTO_IPCOMP:
+		/*
+		 * a CPI isn't quite the same as an SPI
+		 * so we use specialized code to emit it.
+		 */
+		if (!generated[protoid]) {
+			st->st_ipcomp.our_spi = get_my_cpi(&st->st_connection->spd,
+							   tunnel_mode);
+			if (st->st_ipcomp.our_spi == 0)
+				return NULL; /* problem generating CPI */
+			generated[protoid] = TRUE;
+		}
+		/*
+		 * CPI is stored in network low order end of an
+		 * ipsec_spi_t.  So we start a couple of bytes in.
+		 */
+		*size = IPCOMP_CPI_SIZE;
+		return (const uint8_t *)&st->st_ipcomp.our_spi +
+			IPSEC_DOI_SPI_SIZE - IPCOMP_CPI_SIZE;
+
+	default:
+		bad_case(protoid);
+	}
+}
+
+/*
+ * Copy the saved proposals and fill in this SA's SPIs.
+ */
+static bool out_v1_sa_template(pb_stream *sa_pbs, const struct v1_sa_template *t,
+			       struct state *st)
+{
+	uint8_t *proposals = sa_pbs->cur;
+	if (!out_raw(t->proposals, t->len, sa_pbs, "saved proposals"))
+		return FALSE;
+
+	bool spi_generated[PROTO_IPCOMP + 1] = { FALSE, };
+	for (unsigned i = 0; i < t->nr_spis; i++) {
+		const struct v1_sa_spi *s = &t->spis[i];
+		size_t size;
+		const uint8_t *spi = v1_sa_spi(st, s->protoid, s->tunnel_mode,
+					       spi_generated, &size);
+		if (spi == NULL)
+			return FALSE;
+		memcpy(proposals + s->offset, spi, size);
+	}
+	return TRUE;
+}
+
 /**
  * Output an SA, as described by a db_sa.
  * This has the side-effect of allocating SPIs for us.
@@ -378,9 +592,35 @@ bool ikev1_out_sa(pb_stream *outs,
 	    bool aggressive_mode,
 	    enum next_payload_types_ikev1 np)
 {
-	struct db_sa *revised_sadb;
+	const struct connection *c = st->st_connection;
+	const struct v1_sa_key key = {
+		.sadb = sadb,
+		.oakley_mode = oakley_mode,
+		.aggressive_mode = aggressive_mode,
+		.connection_policy = c->policy,
+		.state_policy = st->st_policy & (POLICY_TUNNEL | POLICY_COMPRESS),
+		.pfs_group = st->st_pfs_group,
+		.encapsulation = NAT_T_ENCAPSULATION_MODE(st, st->st_policy),
+		.life_seconds = deltasecs(oakley_mode ? c->sa_ike_life_seconds :
+					  c->sa_ipsec_life_seconds),
+	};
+	struct v1_sa_template **templates = NULL;
+	const struct v1_sa_template *template = NULL;
+	if (v1_sa_templatable(st, oakley_mode)) {
+		const struct alg_info *ai =
+			oakley_mode ? (c->alg_info_ike == NULL ? NULL : &c->alg_info_ike->ai) :
+			(c->alg_info_esp == NULL ? NULL : &c->alg_info_esp->ai);
+		templates = shared_v1_sa_templates(ai);
+		if (templates != NULL) {
+			template = find_v1_sa_template(templates, &key);
+		}
+	}
 
-	if (oakley_mode) {
+	struct db_sa *revised_sadb = NULL;
+
+	if (template != NULL) {
+		dbg("copying saved %s SA proposals", oakley_mode ? "ISAKMP" : "IPsec");
+	} else if (oakley_mode) {
 		/*
 		 * Construct the proposals by combining ALG_INFO_IKE
 		 * with the AUTH (proof of identity) extracted from
@@ -470,6 +710,13 @@ bool ikev1_out_sa(pb_stream *outs,
 			goto fail;
 	}
 
+	if (template != NULL) {
+		if (!out_v1_sa_template(&sa_pbs, template, st))
+			goto fail;
+		close_output_pbs(&sa_pbs);
+		return TRUE;
+	}
+
 	/* within SA: Proposal Payloads
 	 *
 	 * Multiple Proposals with the same number are simultaneous
@@ -480,9 +727,10 @@ bool ikev1_out_sa(pb_stream *outs,
 	 * See RFC 2408 "ISAKMP" 4.2
 	 */
 
-	bool ah_spi_generated = FALSE,
-	     esp_spi_generated = FALSE,
-	     ipcomp_cpi_generated = FALSE;
+	bool spi_generated[PROTO_IPCOMP + 1] = { FALSE, };
+	uint8_t *proposals = sa_pbs.cur;
+	struct v1_sa_spi spis[V1_SA_TEMPLATE_SPIS];
+	unsigned nr_spis = 0;
 
 	for (unsigned pcn = 0; pcn < sadb->prop_conj_cnt; pcn++) {
 		const struct db_prop_conj *const pc = &sadb->prop_conjs[pcn];
@@ -543,109 +791,71 @@ bool ikev1_out_sa(pb_stream *outs,
 			 * Set attr_desc.
 			 * Set attr_val_descs.
 			 * If not oakley_mode, emit SPI.
-			 * We allocate SPIs on demand.
-			 * All ESPs in an SA will share a single SPI.
-			 * All AHs in an SAwill share a single SPI.
-			 * AHs' SPI will be distinct from ESPs'.
-			 * This latter is needed because KLIPS doesn't
-			 * use the protocol when looking up a (dest, protocol, spi).
-			 * ??? If multiple ESPs are composed, how should their SPIs
-			 * be allocated?
+			 * We allocate SPIs on demand (see v1_sa_spi()).
 			 */
 			const struct_desc *trans_desc;
 			const struct_desc *attr_desc;
 			enum_names *const *attr_val_descs;
 
-			{
-				ipsec_spi_t *spi_ptr = NULL;
-				int proto = 0;
-				bool *spi_generated = NULL;
-
-				switch (p->protoid) {
-				case PROTO_ISAKMP:
-					passert(oakley_mode);
-					trans_desc =
-						&isakmp_isakmp_transform_desc;
-					attr_desc =
-						&isakmp_oakley_attribute_desc;
-					attr_val_descs = oakley_attr_val_descs;
-					/* no SPI needed */
-					break;
-
-				case PROTO_IPSEC_AH:
-					passert(!oakley_mode);
-					trans_desc = &isakmp_ah_transform_desc;
-					attr_desc =
-						&isakmp_ipsec_attribute_desc;
-					attr_val_descs = ipsec_attr_val_descs;
-					spi_ptr = &st->st_ah.our_spi;
-					spi_generated = &ah_spi_generated;
-					proto = IPPROTO_AH;
-					break;
+			switch (p->protoid) {
+			case PROTO_ISAKMP:
+				passert(oakley_mode);
+				trans_desc =
+					&isakmp_isakmp_transform_desc;
+				attr_desc =
+					&isakmp_oakley_attribute_desc;
+				attr_val_descs = oakley_attr_val_descs;
+				/* no SPI needed */
+				break;
 
-				case PROTO_IPSEC_ESP:
-					passert(!oakley_mode);
-					trans_desc =
-						&isakmp_esp_transform_desc;
-					attr_desc =
-						&isakmp_ipsec_attribute_desc;
-					attr_val_descs = ipsec_attr_val_descs;
-					spi_ptr = &st->st_esp.our_spi;
-					spi_generated = &esp_spi_generated;
-					proto = IPPROTO_ESP;
-					break;
+			case PROTO_IPSEC_AH:
+				passert(!oakley_mode);
+				trans_desc = &isakmp_ah_transform_desc;
+				attr_desc =
+					&isakmp_ipsec_attribute_desc;
+				attr_val_descs = ipsec_attr_val_descs;
+				break;
 
-				case PROTO_IPCOMP:
-					passert(!oakley_mode);
-					trans_desc =
-						&isakmp_ipcomp_transform_desc;
-					attr_desc =
-						&isakmp_ipsec_attribute_desc;
-					attr_val_descs = ipsec_attr_val_descs;
+			case PROTO_IPSEC_ESP:
+				passert(!oakley_mode);
+				trans_desc =
+					&isakmp_esp_transform_desc;
+				attr_desc =
+					&isakmp_ipsec_attribute_desc;
+				attr_val_descs = ipsec_attr_val_descs;
+				break;
 
-					/*
-					 * a CPI isn't quite the same as an SPI
-					 * so we use specialized code to emit it.
-					 */
-					if (!ipcomp_cpi_generated) {
-						st->st_ipcomp.our_spi =
-							get_my_cpi(
-								&st->st_connection->spd,
-								tunnel_mode);
-						if (st->st_ipcomp.our_spi == 0)
-							goto fail; /* problem generating CPI */
-
-						ipcomp_cpi_generated = TRUE;
-					}
-					/*
-					 * CPI is stored in network low order end of an
-					 * ipsec_spi_t.  So we start a couple of bytes in.
-					 */
-					if (!out_raw((u_char *)&st->st_ipcomp.our_spi +
-						     IPSEC_DOI_SPI_SIZE -
-						     IPCOMP_CPI_SIZE,
-						     IPCOMP_CPI_SIZE,
-						     &proposal_pbs, "CPI"))
-						goto fail;
-					break;
+			case PROTO_IPCOMP:
+				passert(!oakley_mode);
+				trans_desc =
+					&isakmp_ipcomp_transform_desc;
+				attr_desc =
+					&isakmp_ipsec_attribute_desc;
+				attr_val_descs = ipsec_attr_val_descs;
+				break;
 
-				default:
-					bad_case(p->protoid);
-				}
+			default:
+				bad_case(p->protoid);
+			}
 
-				if (spi_ptr != NULL) {
-					if (!*spi_generated) {
-						*spi_ptr = get_ipsec_spi(0,
-									 proto,
-									 &st->st_connection->spd,
-									 tunnel_mode);
-						*spi_generated = TRUE;
-					}
-					if (!out_raw((u_char *)spi_ptr,
-						     IPSEC_DOI_SPI_SIZE,
-						     &proposal_pbs, "SPI"))
-						goto fail;
+			if (!oakley_mode) {
+				size_t spi_size;
+				const uint8_t *spi = v1_sa_spi(st, p->protoid, tunnel_mode,
+							       spi_generated, &spi_size);
+				if (spi == NULL)
+					goto fail;
+				if (nr_spis < elemsof(spis)) {
+					spis[nr_spis++] = (struct v1_sa_spi) {
+						.offset = proposal_pbs.cur - proposals,
+						.protoid = p->protoid,
+						.tunnel_mode = tunnel_mode,
+					};
+				} else {
+					templates = NULL; /* too many to save */
 				}
+				if (!out_raw(spi, spi_size, &proposal_pbs,
+					     p->protoid == PROTO_IPCOMP ? "CPI" : "SPI"))
+					goto fail;
 			}
 
 			/* within proposal: Transform Payloads */
@@ -852,6 +1062,10 @@ bool ikev1_out_sa(pb_stream *outs,
 		}
 		/* end of a conjunction of proposals */
 	}
+	if (templates != NULL) {
+		save_v1_sa_template(templates, &key, proposals, sa_pbs.cur,
+				    spis, nr_spis);
+	}
 	close_output_pbs(&sa_pbs);
 	free_sa(&revised_sadb);
 	return TRUE;
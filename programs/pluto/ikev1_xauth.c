@@ -440,6 +440,7 @@ static stf_status modecfg_resp(struct state *st,
 				c->spd.that.has_client = TRUE;
 				if (has_lease)
 					c->spd.that.has_lease = TRUE;
+				update_virtual_net_index(c);
 			}
 		}
 
@@ -1928,6 +1929,7 @@ stf_status modecfg_inR1(struct state *st, struct msg_digest *md)
 						}
 					}
 				}
+				update_virtual_net_index(c);
 
 				/*
 				 * ??? this won't work because CISCO_SPLIT_INC is way bigger than LELEM_ROOF
@@ -253,6 +253,7 @@ enum smf2_flags {
 
 static const lset_t everywhere_payloads = P(N) | P(V);	/* can appear in any packet */
 static const lset_t repeatable_payloads = P(N) | P(D) | P(CP) | P(V) | P(CERT) | P(CERTREQ);	/* if one can appear, many can appear */
+static const lset_t v2_lazy_payloads = P(V);	/* only decoded when asked for, see md_payload_chain() */
 
 /*
  * IKEv2 State transitions (aka microcodes).
@@ -797,23 +798,6 @@ static struct payload_summary ikev2_decode_payloads(struct msg_digest *md,
 		    DBG_log("Now let's proceed with payload (%s)",
 			    enum_show(&ikev2_payload_names, np)));
 
-		if (md->digest_roof >= elemsof(md->digest)) {
-			loglog(RC_LOG_SERIOUS,
-			       "more than %zu payloads in message; ignored",
-			       elemsof(md->digest));
-			summary.n = v2N_INVALID_SYNTAX;
-			break;
-		}
-
-		/*
-		 * *pd is the payload digest for this payload.
-		 * It has three fields:
-		 *	pbs is filled in by in_struct
-		 *	payload is filled in by in_struct
-		 *	next is filled in by list linking logic
-		 */
-		struct payload_digest *const pd = md->digest + md->digest_roof;
-
 		/* map the payload onto a way to decode it */
 		const struct_desc *sd = v2_payload_desc(np);
 
@@ -824,12 +808,13 @@ static struct payload_summary ikev2_decode_payloads(struct msg_digest *md,
 			 * the Critical Bit, we should be upset but if
 			 * it does not, we should just ignore it.
 			 */
-			if (!in_struct(&pd->payload, &ikev2_generic_desc, in_pbs, &pd->pbs)) {
+			struct payload_digest ignored;
+			if (!in_struct(&ignored.payload, &ikev2_generic_desc, in_pbs, &ignored.pbs)) {
 				loglog(RC_LOG_SERIOUS, "malformed payload in packet");
 				summary.n = v2N_INVALID_SYNTAX;
 				break;
 			}
-			if (pd->payload.v2gen.isag_critical & ISAKMP_PAYLOAD_CRITICAL) {
+			if (ignored.payload.v2gen.isag_critical & ISAKMP_PAYLOAD_CRITICAL) {
 				/*
 				 * It was critical.  See RFC 5996 1.5
 				 * "Version Numbers and Forward
@@ -857,7 +842,7 @@ static struct payload_summary ikev2_decode_payloads(struct msg_digest *md,
 			loglog(RC_COMMENT,
 				"non-critical payload ignored because it contains an unknown or unexpected payload type (%s) at the outermost level",
 				enum_show(&ikev2_payload_names, np));
-			np = pd->payload.generic.isag_np;
+			np = ignored.payload.generic.isag_np;
 			continue;
 		}
 
@@ -869,6 +854,40 @@ static struct payload_summary ikev2_decode_payloads(struct msg_digest *md,
 		summary.repeated |= (summary.present & LELEM(np));
 		summary.present |= LELEM(np);
 
+		if (LHAS(v2_lazy_payloads, np)) {
+			/*
+			 * Only step over the generic header; the
+			 * payload is decoded if and when someone asks
+			 * for it using md_payload_chain().
+			 */
+			uint8_t *start = in_pbs->cur;
+			struct ikev2_generic gen;
+			if (!in_struct(&gen, &ikev2_generic_desc, in_pbs, NULL)) {
+				loglog(RC_LOG_SERIOUS, "malformed payload in packet");
+				summary.n = v2N_INVALID_SYNTAX;
+				break;
+			}
+			if (!add_lazy_payload(md, np, sd, in_pbs, start)) {
+				summary.n = v2N_INVALID_SYNTAX;
+				break;
+			}
+			np = gen.isag_np;
+			continue;
+		}
+
+		/*
+		 * *pd is the payload digest for this payload.
+		 * It has three fields:
+		 *	pbs is filled in by in_struct
+		 *	payload is filled in by in_struct
+		 *	next is filled in by list linking logic
+		 */
+		struct payload_digest *const pd = alloc_md_digest(md);
+		if (pd == NULL) {
+			summary.n = v2N_INVALID_SYNTAX;
+			break;
+		}
+
 		if (!in_struct(&pd->payload, sd, in_pbs, &pd->pbs)) {
 			loglog(RC_LOG_SERIOUS, "malformed payload in packet");
 			summary.n = v2N_INVALID_SYNTAX;
@@ -927,8 +946,6 @@ static struct payload_summary ikev2_decode_payloads(struct msg_digest *md,
 			np = pd->payload.generic.isag_np;
 			break;
 		}
-
-		md->digest_roof++;
 	}
 
 	return summary;
@@ -101,6 +101,7 @@ void DBG_log_ikev2_proposal(const char *prefix, const struct ikev2_proposal *pro
 
 void free_ikev2_proposal(struct ikev2_proposal **proposal);
 void free_ikev2_proposals(struct ikev2_proposals **proposals);
+struct ikev2_proposals *addref_ikev2_proposals(struct ikev2_proposals *proposals);
 
 /*
  * On-demand, generate proposals for either the IKE SA or the CHILD
@@ -94,6 +94,7 @@ static stf_status ikev2_cp_reply_state(const struct msg_digest *md,
 	spd->that.client.addr = ipv4;
 	spd->that.client.maskbits = 32; /* export it as value */
 	spd->that.has_client = TRUE;
+	update_virtual_net_index(md->st->st_connection);
 
 	cst->st_ts_this = ikev2_end_to_ts(&spd->this);
 	cst->st_ts_that = ikev2_end_to_ts(&spd->that);
@@ -39,6 +39,7 @@
 #include "keys.h"
 #include "secrets.h"
 #include "ip_address.h"
+#include "oe_cache.h"
 
 struct p_dns_req;
 
@@ -522,6 +523,13 @@ static void idr_ipseckey_fetch_continue(struct p_dns_req *dnsr)
 		ikev2_ipseckey_log_dns_err(dnsr, parse_err);
 	}
 
+	if ((parse_err != NULL || dnsr->rcode != 0) &&
+	    (st->st_connection->policy & POLICY_OPPORTUNISTIC)) {
+		oe_cache_record(&st->st_connection->spd.that.host_addr,
+				OE_NO_IPSECKEY);
+		st->st_oe_failure_recorded = TRUE;
+	}
+
 	if (dnsr->cache_hit) {
 		if (dnsr->rcode == 0 && parse_err == NULL) {
 			 dnsr->stf_status = STF_OK;
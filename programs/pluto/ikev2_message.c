@@ -216,7 +216,7 @@ static bool emit_v2SK_iv(v2SK_payload_t *sk)
 		return false;
 	}
 	/* scribble on it */
-	fill_rnd_chunk(sk->iv);
+	fill_public_rnd_chunk(sk->iv);
 	return true;
 }
 
@@ -681,11 +681,6 @@ static bool ikev2_reassemble_fragments(struct state *st,
 		return false;
 	}
 
-	if (md->digest_roof >= elemsof(md->digest)) {
-		libreswan_log("packet contains too many payloads; discarded");
-		return false;
-	}
-
 	passert(st->st_v2_rfrags != NULL);
 
 	chunk_t plain[MAX_IKE_FRAGMENTS + 1];
@@ -727,7 +722,11 @@ static bool ikev2_reassemble_fragments(struct state *st,
 	 * Fake up an SK payload, and then kill the SKF payload list
 	 * and fragments.
 	 */
-	struct payload_digest *sk = &md->digest[md->digest_roof++];
+	struct payload_digest *sk = alloc_md_digest(md);
+	if (sk == NULL) {
+		release_fragments(st);
+		return false;
+	}
 	md->chain[ISAKMP_NEXT_v2SK] = sk;
 	sk->payload.generic.isag_np = st->st_v2_rfrags->first_np;
 	sk->pbs = same_chunk_as_in_pbs(md->raw_packet, "decrypted SFK payloads");
@@ -32,37 +32,52 @@
  * IKEv2 - RFC4306 2.14 SKEYSEED - calculation.
  */
 
+/*
+ * Return Tn, restarting PRF when another Tn is needed.
+ */
+static PK11SymKey *prfplus_final_t(struct crypt_prf **prf, bool more)
+{
+	if (more) {
+		return crypt_prf_final_symkey_restart(*prf);
+	} else {
+		return crypt_prf_final_symkey(prf);
+	}
+}
+
 PK11SymKey *ikev2_prfplus(const struct prf_desc *prf_desc,
 				 PK11SymKey *key, PK11SymKey *seed,
 				 size_t required_keymat)
 {
 	uint8_t count = 1;
+	size_t prf_size = prf_desc->prf_output_size;
+
+	/*
+	 * KEY is set up once; the PRF is then restarted, with the same
+	 * key, for each Tn.
+	 */
+	struct crypt_prf *prf = crypt_prf_init_symkey("prf+", prf_desc,
+						      "key", key);
 
 	/* T1(prfplus) = prf(KEY, SEED|1) */
-	PK11SymKey *prfplus;
-	{
-		struct crypt_prf *prf = crypt_prf_init_symkey("prf+0", prf_desc,
-							      "key", key);
-		crypt_prf_update_symkey(prf, "seed", seed);
-		crypt_prf_update_byte(prf, "1++", count++);
-		prfplus = crypt_prf_final_symkey(&prf);
-	}
+	crypt_prf_update_symkey(prf, "seed", seed);
+	crypt_prf_update_byte(prf, "1++", count++);
+	PK11SymKey *prfplus = prfplus_final_t(&prf, prf_size < required_keymat);
 
 	/* make a copy to keep things easy */
 	PK11SymKey *old_t = reference_symkey(__func__, "old_t[1]", prfplus);
 	while (sizeof_symkey(prfplus) < required_keymat) {
 		/* Tn = prf(KEY, Tn-1|SEED|n) */
-		struct crypt_prf *prf = crypt_prf_init_symkey("prf+N", prf_desc,
-							      "key", key);
 		crypt_prf_update_symkey(prf, "old_t", old_t);
 		crypt_prf_update_symkey(prf, "seed", seed);
 		crypt_prf_update_byte(prf, "N++", count++);
-		PK11SymKey *new_t = crypt_prf_final_symkey(&prf);
+		PK11SymKey *new_t = prfplus_final_t(&prf, (sizeof_symkey(prfplus) + prf_size
+							    < required_keymat));
 		append_symkey_symkey(&prfplus, new_t);
 		release_symkey(__func__, "old_t[N]", &old_t);
 		old_t = new_t;
 	}
 	release_symkey(__func__, "old_t[final]", &old_t);
+	pexpect(prf == NULL);
 	return prfplus;
 }
 
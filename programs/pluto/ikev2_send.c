@@ -25,6 +25,9 @@
  * for more details.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "defs.h"
 
 #include "send.h"
@@ -470,16 +473,14 @@ void send_v2N_response_from_md(struct msg_digest *md,
  * The code in delete_state would break if we actually did this.
  *
  * Deleting an IKE SA is a bigger deal than deleting an IPsec SA.
+ *
+ * When ST is NULL the message isn't recorded (so is never
+ * retransmitted); otherwise it is recorded against ST.
  */
 
-void send_v2_delete(struct state *const st)
+static void send_v2_delete_spis(struct ike_sa *ike, struct state *st,
+				const ipsec_spi_t *spis, unsigned nr_spis)
 {
-	struct ike_sa *ike = ike_sa(st);
-	if (ike == NULL) {
-		/* ike_sa() will have already complained loudly */
-		return;
-	}
-
 	/* make sure HDR is at start of a clean buffer */
 	uint8_t buf[MIN_OUTPUT_UDP_SIZE];
 	pb_stream packet = open_out_pbs("informational exchange delete request",
@@ -499,19 +500,14 @@ void send_v2_delete(struct state *const st)
 	{
 		pb_stream del_pbs;
 		struct ikev2_delete v2del_tmp;
-		/*
-		 * uint16_t i, j=0;
-		 * u_char *spi;
-		 * char spi_buf[1024];
-		 */
 
 		zero(&v2del_tmp);	/* OK: no pointer fields */
 		v2del_tmp.isad_np = ISAKMP_NEXT_v2NONE;
 
-		if (IS_CHILD_SA(st)) {
+		if (nr_spis > 0) {
 			v2del_tmp.isad_protoid = PROTO_IPSEC_ESP;
 			v2del_tmp.isad_spisize = sizeof(ipsec_spi_t);
-			v2del_tmp.isad_nrspi = 1;
+			v2del_tmp.isad_nrspi = nr_spis;
 		} else {
 			v2del_tmp.isad_protoid = PROTO_ISAKMP;
 			v2del_tmp.isad_spisize = 0;
@@ -524,10 +520,9 @@ void send_v2_delete(struct state *const st)
 			return;
 
 		/* Emit values of spi to be sent to the peer */
-		if (IS_CHILD_SA(st)) {
-			if (!out_raw((u_char *)&st->st_esp.our_spi,
-				     sizeof(ipsec_spi_t), &del_pbs,
-				     "local spis"))
+		if (nr_spis > 0) {
+			if (!out_raw(spis, nr_spis * sizeof(ipsec_spi_t),
+				     &del_pbs, "local spis"))
 				return;
 		}
 
@@ -546,12 +541,151 @@ void send_v2_delete(struct state *const st)
 		return;
 	}
 
-	record_and_send_v2_ike_msg(st, &packet,
-				   "packet for ikev2 delete informational");
+	if (st != NULL) {
+		record_and_send_v2_ike_msg(st, &packet,
+					   "packet for ikev2 delete informational");
+	} else {
+		send_chunk_using_state(&ike->sa, "packet for ikev2 delete informational",
+				       same_out_pbs_as_chunk(&packet));
+	}
 
 	/* increase message ID for next delete message */
 	/* ikev2_update_msgid_counters need an md */
 	ike->sa.st_msgid_nextuse++;
+}
+
+/*
+ * Batched Child SA deletes.
+ *
+ * While a batch is open, the Delete notification for each IKEv2 Child
+ * SA is queued instead of being sent as its own exchange.  When the
+ * batch is closed, the SPIs are sent using the fewest Delete payloads
+ * (RFC 7296 allows a Delete payload to list many SPIs).  Children
+ * whose IKE SA was also deleted are dropped - the IKE SA's Delete
+ * implicitly deletes them.
+ */
+
+struct v2_delete_entry {
+	so_serial_t ike;
+	unsigned seq;	/* keep the SPIs in order */
+	ipsec_spi_t spi;
+};
+
+static struct {
+	unsigned depth;
+	unsigned len;
+	unsigned size;
+	struct v2_delete_entry *entries;
+} v2_delete_batch;
+
+/*
+ * Allow for the IKE header, the SK payload's IV, padding, and
+ * checksum, and the Delete payload header.
+ */
+#define MAX_V2_DELETE_SPIS ((MIN_OUTPUT_UDP_SIZE - 128) / sizeof(ipsec_spi_t))
+
+void open_v2_delete_batch(void)
+{
+	v2_delete_batch.depth++;
+}
+
+static int v2_delete_entry_cmp(const void *l, const void *r)
+{
+	const struct v2_delete_entry *le = l;
+	const struct v2_delete_entry *re = r;
+	if (le->ike != re->ike) {
+		return le->ike < re->ike ? -1 : 1;
+	}
+	return le->seq < re->seq ? -1 : le->seq > re->seq ? 1 : 0;
+}
+
+void close_v2_delete_batch(void)
+{
+	passert(v2_delete_batch.depth > 0);
+	if (--v2_delete_batch.depth > 0 || v2_delete_batch.len == 0) {
+		return;
+	}
+
+	struct v2_delete_entry *entries = v2_delete_batch.entries;
+	unsigned len = v2_delete_batch.len;
+	v2_delete_batch.entries = NULL;
+	v2_delete_batch.len = v2_delete_batch.size = 0;
+
+	qsort(entries, len, sizeof(entries[0]), v2_delete_entry_cmp);
+
+	unsigned nr_messages = 0;
+	for (unsigned start = 0; start < len; ) {
+		so_serial_t serialno = entries[start].ike;
+		unsigned end = start;
+		while (end < len && entries[end].ike == serialno) {
+			end++;
+		}
+
+		struct state *ike_st = state_with_serialno(serialno);
+		if (ike_st == NULL || !IS_IKE_SA_ESTABLISHED(ike_st)) {
+			dbg("dropping %u batched Child SA deletes; IKE SA #%lu is gone",
+			    end - start, serialno);
+		} else {
+			struct ike_sa *ike = pexpect_ike_sa(ike_st);
+			ipsec_spi_t spis[MAX_V2_DELETE_SPIS];
+			unsigned nr_spis = 0;
+			for (unsigned i = start; i < end; i++) {
+				spis[nr_spis++] = entries[i].spi;
+				if (nr_spis == elemsof(spis) || i + 1 == end) {
+					dbg("#%lu sending Delete for %u Child SAs",
+					    serialno, nr_spis);
+					send_v2_delete_spis(ike, NULL, spis, nr_spis);
+					nr_spis = 0;
+					nr_messages++;
+				}
+			}
+		}
+		start = end;
+	}
+	dbg("batched %u Child SA deletes into %u messages", len, nr_messages);
+	pfree(entries);
+}
+
+static void queue_v2_delete(struct ike_sa *ike, struct state *st)
+{
+	dbg("#%lu batching Delete for Child SA #%lu",
+	    ike->sa.st_serialno, st->st_serialno);
+	if (v2_delete_batch.len == v2_delete_batch.size) {
+		unsigned size = v2_delete_batch.size == 0 ? 16 : v2_delete_batch.size * 2;
+		struct v2_delete_entry *entries = alloc_things(struct v2_delete_entry,
+							       size, "v2 delete batch");
+		if (v2_delete_batch.len > 0) {
+			memcpy(entries, v2_delete_batch.entries,
+			       v2_delete_batch.len * sizeof(entries[0]));
+		}
+		pfreeany(v2_delete_batch.entries);
+		v2_delete_batch.entries = entries;
+		v2_delete_batch.size = size;
+	}
+	v2_delete_batch.entries[v2_delete_batch.len] = (struct v2_delete_entry) {
+		.ike = ike->sa.st_serialno,
+		.seq = v2_delete_batch.len,
+		.spi = st->st_esp.our_spi,
+	};
+	v2_delete_batch.len++;
+}
+
+void send_v2_delete(struct state *const st)
+{
+	struct ike_sa *ike = ike_sa(st);
+	if (ike == NULL) {
+		/* ike_sa() will have already complained loudly */
+		return;
+	}
+
+	if (!IS_CHILD_SA(st)) {
+		send_v2_delete_spis(ike, st, NULL, 0);
+	} else if (v2_delete_batch.depth > 0) {
+		queue_v2_delete(ike, st);
+		return;
+	} else {
+		send_v2_delete_spis(ike, st, &st->st_esp.our_spi, 1);
+	}
 	st->st_msgid = ike->sa.st_msgid_nextuse;
 }
 
@@ -47,6 +47,14 @@ void send_v2N_response_from_md(struct msg_digest *md,
 
 void send_v2_delete(struct state *st);
 
+/*
+ * While open, Delete notifications for IKEv2 Child SAs are collected
+ * and, when the outermost batch is closed, sent using multi-SPI
+ * Delete payloads (one exchange per IKE SA, where possible).
+ */
+void open_v2_delete_batch(void);
+void close_v2_delete_batch(void);
+
 typedef bool payload_master_t(struct state *st, pb_stream *pbs);
 
 extern stf_status send_v2_informational_request(const char *name,
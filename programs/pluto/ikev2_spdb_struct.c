@@ -64,6 +64,7 @@
 #include "ikev2_message.h"		/* for build_ikev2_critical() */
 
 #include "nat_traversal.h"
+#include "proposal_cache.h"
 
 /*
  * Two possible attribute formats (fixed and variable).  In IKEv2 the
@@ -257,6 +258,11 @@ struct ikev2_proposals {
 	 * that makes initializing more messy.
 	 */
 	bool on_heap;
+	/*
+	 * When ON_HEAP, the number of pointers to this object (a
+	 * connection, its instances, the proposal cache).
+	 */
+	unsigned refcnt;
 };
 
 /*
@@ -1649,12 +1655,23 @@ void free_ikev2_proposals(struct ikev2_proposals **proposals)
 		return;
 	}
 	if ((*proposals)->on_heap) {
-		pfree((*proposals)->proposal);
-		pfree((*proposals));
+		passert((*proposals)->refcnt > 0);
+		if (--(*proposals)->refcnt == 0) {
+			pfree((*proposals)->proposal);
+			pfree((*proposals));
+		}
 	}
 	*proposals = NULL;
 }
 
+struct ikev2_proposals *addref_ikev2_proposals(struct ikev2_proposals *proposals)
+{
+	if (proposals != NULL && proposals->on_heap) {
+		proposals->refcnt++;
+	}
+	return proposals;
+}
+
 void free_ikev2_proposal(struct ikev2_proposal **proposal)
 {
 	if (proposal == NULL || *proposal == NULL) {
@@ -2022,11 +2039,18 @@ struct ikev2_proposals *get_v2_ike_proposals(struct connection *c, const char *w
 	}
 
 	const char *notes;
+	struct ikev2_proposals **shared = (c->alg_info_ike == NULL ? NULL :
+					   shared_v2_proposals(&c->alg_info_ike->ai, c->policy));
 	if (c->alg_info_ike == NULL) {
 		dbg("selecting default constructed local IKE proposals for connection %s (%s)",
 		     c->name, why);
 		c->v2_ike_proposals = &default_ikev2_ike_proposals;
 		notes = " (default)";
+	} else if (shared != NULL && *shared != NULL) {
+		dbg("sharing local IKE proposals for %s (%s) with connections using the same ike=",
+		    c->name, why);
+		c->v2_ike_proposals = addref_ikev2_proposals(*shared);
+		notes = "";
 	} else {
 		dbg("constructing local IKE proposals for %s (%s)",
 		     c->name, why);
@@ -2034,6 +2058,7 @@ struct ikev2_proposals *get_v2_ike_proposals(struct connection *c, const char *w
 		int proposals_roof = c->alg_info_ike->ai.alg_info_cnt + 1;
 		proposals->proposal = alloc_things(struct ikev2_proposal, proposals_roof, "propsal");
 		proposals->on_heap = TRUE;
+		proposals->refcnt = 1;
 		proposals->roof = 1;
 
 		FOR_EACH_IKE_INFO(c->alg_info_ike, ike_info) {
@@ -2054,6 +2079,9 @@ struct ikev2_proposals *get_v2_ike_proposals(struct connection *c, const char *w
 			}
 		}
 		c->v2_ike_proposals = proposals;
+		if (shared != NULL) {
+			*shared = addref_ikev2_proposals(proposals);
+		}
 		notes = "";
 	}
 
@@ -2204,6 +2232,7 @@ static struct ikev2_proposals *get_v2_child_proposals(struct ikev2_proposals **c
 		struct ikev2_proposals *proposals = alloc_thing(struct ikev2_proposals,
 								"cloned ESP/AH proposals");
 		proposals->on_heap = TRUE;
+		proposals->refcnt = 1;
 		proposals->roof = default_proposals_missing_esn->roof;
 		if (add_empty_msdh_duplicates) {
 			/* add space for duplicates, minus the empty first proposal */
@@ -2275,6 +2304,7 @@ static struct ikev2_proposals *get_v2_child_proposals(struct ikev2_proposals **c
 		proposals->proposal = alloc_things(struct ikev2_proposal, proposals_roof,
 						   "ESP/AH proposal");
 		proposals->on_heap = TRUE;
+		proposals->refcnt = 1;
 		proposals->roof = 1;
 
 		enum ikev2_sec_proto_id protoid;
@@ -2351,6 +2381,20 @@ static struct ikev2_proposals *get_v2_child_proposals(struct ikev2_proposals **c
 
 struct ikev2_proposals *get_v2_ike_auth_child_proposals(struct connection *c, const char *why)
 {
+	/*
+	 * Connections with the same esp= (and policy) can share the
+	 * one suite; compile it into the proposal cache.
+	 */
+	if (c->v2_ike_auth_child_proposals == NULL && c->alg_info_esp != NULL) {
+		struct ikev2_proposals **shared =
+			shared_v2_proposals(&c->alg_info_esp->ai, c->policy);
+		if (shared != NULL) {
+			if (*shared == NULL) {
+				get_v2_child_proposals(shared, c, why, &unset_group);
+			}
+			c->v2_ike_auth_child_proposals = addref_ikev2_proposals(*shared);
+		}
+	}
 	/* UNSET_GROUP means strip DH from the proposal. */
 	return get_v2_child_proposals(&c->v2_ike_auth_child_proposals, c,
 				      why, &unset_group);
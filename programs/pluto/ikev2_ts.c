@@ -1203,6 +1203,7 @@ bool v2_process_ts_response(struct child_sa *child,
 		  &c->spd.that.host_addr);
 	setportof(htons(c->spd.that.port),
 		  &c->spd.that.client.addr);
+	update_virtual_net_index(c);
 
 	c->spd.that.has_client =
 		!(subnetishost(&c->spd.that.client) &&
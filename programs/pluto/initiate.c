@@ -75,6 +75,7 @@
 #include "virtual.h"	/* needs connections.h */
 
 #include "hostpair.h"
+#include "oe_cache.h"
 
 /*
  * swap ends and try again.
@@ -89,6 +90,7 @@ static void swap_ends(struct connection *c)
 
 	sr->this = sr->that;
 	sr->that = t;
+	update_virtual_net_index(c);
 
 	/*
 	 * in case of asymetric auth c->policy contains left.authby
@@ -722,6 +724,15 @@ static void initiate_ondemand_body(struct find_oppo_bundle *b
 #endif
 				  );
 		b->whackfd = null_fd; /* protect from close */
+	} else if (b->held && oe_cache_negative(&b->peer_client)) {
+		/*
+		 * Opportunism with this peer failed recently; don't
+		 * spend more DNS and IKE on it.  Replace the kernel's
+		 * hold with the failure shunt.
+		 */
+		b->failure_shunt = shunt_policy_spi(c, FALSE);
+		b->negotiation_shunt = SPI_HOLD;	/* the acquire's */
+		cannot_oppo(NULL, b, "recently failed");
 	} else {
 		/* We are handling an opportunistic situation.
 		 * This involves several DNS lookup steps that require suspension.
@@ -1076,8 +1087,10 @@ static void connection_check_ddns1(struct connection *c)
 	 * XXX This may mean that the client's address family doesn't match
 	 * tunnel_addr_family.
 	 */
-	if (!c->spd.that.has_client)
+	if (!c->spd.that.has_client) {
 		addrtosubnet(&c->spd.that.host_addr, &c->spd.that.client);
+		update_virtual_net_index(c);
+	}
 
 	/*
 	 * reduce the work we do by updating all connections waiting for this
@@ -0,0 +1,288 @@
+/* throttle the initiation of connections, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * With thousands of "auto=start" connections, initiating them all at
+ * once (as happens at startup and after --rereadall) swamps the
+ * crypto helpers, triggers retransmits, and pushes the peers into
+ * cookie mode.  Instead, queue the initiations and start them
+ * INITIATE_RATE per second with at most INITIATE_CONCURRENCY in
+ * flight.
+ *
+ * An initiation is in flight until its connection has an IPsec SA,
+ * is no longer up, is deleted, or r_timeout has passed (at which
+ * point the retransmit and keyingtries code has taken over).
+ *
+ * Only asynchronous initiates from whack (what addconn sends for
+ * auto=start) are queued; an interactive "ipsec auto --up" is
+ * started immediately.
+ */
+
+#include <stdint.h>
+
+#include <libreswan.h>
+
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+
+#include "defs.h"
+#include "log.h"
+#include "connections.h"
+#include "server.h"
+#include "whack.h"
+#include "initiate_queue.h"
+
+unsigned initiate_concurrency = 0;	/* 0 is unlimited */
+unsigned initiate_rate = 0;		/* per second; 0 is unlimited */
+
+struct initiation {
+	char *name;
+	lmod_t more_debugging;
+	lmod_t more_impairing;
+	uint32_t priority;
+	monotime_t queued;
+	monotime_t started;
+	struct initiation *next;
+};
+
+static struct initiation *queued;
+static struct initiation *in_flight;
+static unsigned nr_queued;
+static unsigned nr_in_flight;
+static struct pluto_event *initiate_queue_event;
+
+/* initiations started during the current second */
+static struct {
+	intmax_t second;
+	unsigned started;
+} rate;
+
+static bool queue_enabled(void)
+{
+	return initiate_concurrency > 0 || initiate_rate > 0;
+}
+
+static void free_initiation(struct initiation **ip)
+{
+	struct initiation *i = *ip;
+	*ip = i->next;
+	pfree(i->name);
+	pfree(i);
+}
+
+/*
+ * priority=0 means "unset"; start those last.
+ */
+static uint32_t initiate_priority(const struct connection *c)
+{
+	return c->sa_priority == 0 ? UINT32_MAX : c->sa_priority;
+}
+
+static bool initiation_done(const struct initiation *i, monotime_t now)
+{
+	struct connection *c = conn_by_name(i->name, FALSE, FALSE);
+	if (c == NULL) {
+		dbg("initiate queue: \"%s\" deleted", i->name);
+		return true;
+	}
+	if (c->newest_ipsec_sa != SOS_NOBODY) {
+		dbg("initiate queue: \"%s\" established", i->name);
+		return true;
+	}
+	if (!(c->policy & POLICY_UP)) {
+		dbg("initiate queue: \"%s\" not up", i->name);
+		return true;
+	}
+	if (deltatime_cmp(monotimediff(now, i->started), c->r_timeout) >= 0) {
+		dbg("initiate queue: \"%s\" timed out", i->name);
+		return true;
+	}
+	return false;
+}
+
+static void schedule_initiate_queue(void);
+
+static void process_initiate_queue(void)
+{
+	monotime_t now = mononow();
+
+	/* reap */
+	for (struct initiation **ip = &in_flight; *ip != NULL; ) {
+		if (initiation_done(*ip, now)) {
+			free_initiation(ip);
+			nr_in_flight--;
+		} else {
+			ip = &(*ip)->next;
+		}
+	}
+
+	/* start */
+	intmax_t second = monosecs(now);
+	if (rate.second != second) {
+		rate.second = second;
+		rate.started = 0;
+	}
+	while (queued != NULL &&
+	       (initiate_concurrency == 0 || nr_in_flight < initiate_concurrency) &&
+	       (initiate_rate == 0 || rate.started < initiate_rate)) {
+		struct initiation *i = queued;
+		queued = i->next;
+		nr_queued--;
+		dbg("initiate queue: starting \"%s\"; %u queued, %u in flight",
+		    i->name, nr_queued, nr_in_flight);
+		initiate_connection(i->name, null_fd,
+				    i->more_debugging, i->more_impairing,
+				    NULL);
+		rate.started++;
+		i->started = now;
+		i->next = in_flight;
+		in_flight = i;
+		nr_in_flight++;
+	}
+
+	schedule_initiate_queue();
+}
+
+static void initiate_queue_cb(evutil_socket_t fd UNUSED,
+			      const short event UNUSED,
+			      void *arg UNUSED)
+{
+	process_initiate_queue();
+}
+
+/*
+ * Tick once a second while there is something queued or in flight.
+ */
+static void schedule_initiate_queue(void)
+{
+	if (queued == NULL && in_flight == NULL) {
+		if (initiate_queue_event != NULL) {
+			delete_pluto_event(&initiate_queue_event);
+		}
+	} else if (initiate_queue_event == NULL) {
+		static const deltatime_t tick = DELTATIME_INIT(1);
+		initiate_queue_event = pluto_event_add(NULL_FD, EV_TIMEOUT | EV_PERSIST,
+						       initiate_queue_cb, NULL,
+						       &tick, "PLUTO_INITIATE_QUEUE");
+	}
+}
+
+bool initiate_queued(const struct connection *c)
+{
+	const struct initiation *lists[] = { queued, in_flight, };
+	for (unsigned l = 0; l < elemsof(lists); l++) {
+		for (const struct initiation *i = lists[l]; i != NULL; i = i->next) {
+			if (streq(i->name, c->name)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+struct queue_stuff {
+	lmod_t more_debugging;
+	lmod_t more_impairing;
+};
+
+static int queue_a_connection(struct connection *c, void *arg)
+{
+	const struct queue_stuff *qs = arg;
+
+	/* --rereadall re-sends the lot */
+	if (initiate_queued(c)) {
+		dbg("initiate queue: \"%s\" already queued or in flight",
+		    c->name);
+		return 1;
+	}
+
+	struct initiation *new = alloc_thing(struct initiation, "initiation");
+	new->name = clone_str(c->name, "initiation name");
+	new->more_debugging = qs->more_debugging;
+	new->more_impairing = qs->more_impairing;
+	new->priority = initiate_priority(c);
+	new->queued = mononow();
+
+	/* after everything of the same or higher priority */
+	struct initiation **ip = &queued;
+	while (*ip != NULL && (*ip)->priority <= new->priority) {
+		ip = &(*ip)->next;
+	}
+	new->next = *ip;
+	*ip = new;
+	nr_queued++;
+	dbg("initiate queue: queued \"%s\" priority %"PRIu32"; %u queued, %u in flight",
+	    c->name, c->sa_priority, nr_queued, nr_in_flight);
+	return 1;
+}
+
+bool queue_initiate_connection(const char *name,
+			       lmod_t more_debugging,
+			       lmod_t more_impairing)
+{
+	if (!queue_enabled()) {
+		return false;
+	}
+
+	struct queue_stuff qs = {
+		.more_debugging = more_debugging,
+		.more_impairing = more_impairing,
+	};
+	struct connection *c = conn_by_name(name, FALSE, FALSE);
+	if (c != NULL) {
+		queue_a_connection(c, &qs);
+	} else if (foreach_connection_by_alias(name, queue_a_connection, &qs) == 0) {
+		whack_log(RC_UNKNOWN_NAME,
+			  "no connection named \"%s\"", name);
+		return true;
+	}
+
+	process_initiate_queue();
+	return true;
+}
+
+void show_initiate_queue_status(void)
+{
+	if (!queue_enabled()) {
+		return;
+	}
+
+	monotime_t now = mononow();
+	whack_log(RC_COMMENT, "initiate queue: concurrency=%u, rate=%u/s, in-flight=%u, queued=%u",
+		  initiate_concurrency, initiate_rate, nr_in_flight, nr_queued);
+	for (const struct initiation *i = in_flight; i != NULL; i = i->next) {
+		whack_log(RC_COMMENT, "\"%s\": in flight for %jds",
+			  i->name, deltasecs(monotimediff(now, i->started)));
+	}
+	for (const struct initiation *i = queued; i != NULL; i = i->next) {
+		whack_log(RC_COMMENT, "\"%s\": queued for %jds",
+			  i->name, deltasecs(monotimediff(now, i->queued)));
+	}
+	whack_log(RC_COMMENT, " ");	/* spacer */
+}
+
+void free_initiate_queue(void)
+{
+	while (queued != NULL) {
+		free_initiation(&queued);
+	}
+	while (in_flight != NULL) {
+		free_initiation(&in_flight);
+	}
+	nr_queued = nr_in_flight = 0;
+	if (initiate_queue_event != NULL) {
+		delete_pluto_event(&initiate_queue_event);
+	}
+}
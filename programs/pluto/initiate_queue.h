@@ -0,0 +1,58 @@
+/* throttle the initiation of connections, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef INITIATE_QUEUE_H
+#define INITIATE_QUEUE_H
+
+#include <stdbool.h>
+
+#include "lmod.h"
+
+struct connection;
+
+/*
+ * Limits, set from the command line; zero means unlimited.  When
+ * both are zero there is no queue.
+ *
+ * INITIATE_CONCURRENCY: the number of initiations in flight, that is
+ * started but not yet established (or given up on).
+ *
+ * INITIATE_RATE: the number of initiations started each second.
+ */
+extern unsigned initiate_concurrency;
+extern unsigned initiate_rate;
+
+/*
+ * Queue the asynchronous initiation of the connection (or alias)
+ * NAME, as requested by "auto=start".
+ *
+ * Connections with a numerically lower priority= are started first;
+ * otherwise they are started in the order they were queued.
+ *
+ * Returns false when there is no queue and the caller should call
+ * initiate_connection() itself.
+ */
+extern bool queue_initiate_connection(const char *name,
+				      lmod_t more_debugging,
+				      lmod_t more_impairing);
+
+/*
+ * Is C queued, or in flight (started but not yet established)?
+ */
+extern bool initiate_queued(const struct connection *c);
+
+extern void show_initiate_queue_status(void);
+
+extern void free_initiate_queue(void);
+
+#endif
@@ -70,6 +70,7 @@
 #include "server.h"
 #include "whack.h"      /* for RC_LOG_SERIOUS */
 #include "keys.h"
+#include "updown.h"
 
 #include "ike_alg.h"
 #include "ike_alg_encrypt.h"
@@ -80,6 +81,8 @@
 #include "ip_address.h"
 #include "af_info.h"
 #include "lswfips.h" /* for libreswan_fipsmode() */
+#include "oe_cache.h"
+#include "pluto_stats.h"
 
 /* which kernel interface to use */
 enum kernel_interface kern_interface = USE_NETKEY;
@@ -313,7 +316,7 @@ ipsec_spi_t get_ipsec_spi(ipsec_spi_t avoid,
 
 		spi++;
 		while (spi < IPSEC_DOI_SPI_OUR_MIN || spi == ntohl(avoid))
-			get_rnd_bytes((u_char *)&spi, sizeof(spi));
+			get_public_rnd_bytes(&spi, sizeof(spi));
 
 		DBG(DBG_CONTROL,
 			{
@@ -354,8 +357,8 @@ ipsec_spi_t get_my_cpi(const struct spd_route *sr, bool tunnel)
 
 		while (!(IPCOMP_FIRST_NEGOTIATED <= first_busy_cpi &&
 				first_busy_cpi < IPCOMP_LAST_NEGOTIATED)) {
-			get_rnd_bytes((u_char *)&first_busy_cpi,
-				sizeof(first_busy_cpi));
+			get_public_rnd_bytes(&first_busy_cpi,
+					     sizeof(first_busy_cpi));
 			latest_cpi = first_busy_cpi;
 		}
 
@@ -758,7 +761,8 @@ bool do_command(const struct connection *c,
 	return TRUE;
 }
 
-bool invoke_command(const char *verb, const char *verb_suffix, const char *cmd)
+bool invoke_command(const struct spd_route *sr,
+		    const char *verb, const char *verb_suffix, const char *cmd)
 {
 #	define CHUNK_WIDTH	80	/* units for cmd logging */
 	DBG(DBG_CONTROL, {
@@ -775,7 +779,15 @@ bool invoke_command(const char *verb, const char *verb_suffix, const char *cmd)
 	});
 #	undef CHUNK_WIDTH
 
+	bool ok;
+	if (updown_helper_command(sr, verb, verb_suffix, cmd, &ok)) {
+		return ok;
+	}
+	return popen_command(verb, verb_suffix, cmd);
+}
 
+bool popen_command(const char *verb, const char *verb_suffix, const char *cmd)
+{
 	{
 		/*
 		 * invoke the script, catching stderr and stdout
@@ -843,28 +855,10 @@ bool invoke_command(const char *verb, const char *verb_suffix, const char *cmd)
 				LOG_ERRNO(errno, "pclose failed for %s%s command",
 					  verb, verb_suffix);
 				return FALSE;
-			} else if (WIFEXITED(r)) {
-				if (WEXITSTATUS(r) != 0) {
-					loglog(RC_LOG_SERIOUS,
-						"%s%s command exited with status %d",
-						verb, verb_suffix,
-						WEXITSTATUS(r));
-					return FALSE;
-				}
-			} else if (WIFSIGNALED(r)) {
-				loglog(RC_LOG_SERIOUS,
-					"%s%s command exited with signal %d",
-					verb, verb_suffix, WTERMSIG(r));
-				return FALSE;
-			} else {
-				loglog(RC_LOG_SERIOUS,
-					"%s%s command exited with unknown status %d",
-					verb, verb_suffix, r);
-				return FALSE;
 			}
+			return updown_command_status(verb, verb_suffix, r);
 		}
 	}
-	return TRUE;
 }
 
 /* Check that we can route (and eroute).  Diagnose if we cannot. */
@@ -1160,6 +1154,11 @@ void unroute_connection(struct connection *c)
 	for (struct spd_route *sr = &c->spd; sr != NULL; sr = sr->spd_next) {
 		enum routing_t cr = sr->routing;
 
+		if (abandon_kernel_state) {
+			sr->routing = RT_UNROUTED;
+			continue;
+		}
+
 		if (erouted(cr)) {
 			/* cannot handle a live one */
 			passert(cr != RT_ROUTED_TUNNEL);
@@ -2723,9 +2722,11 @@ void init_kernel(void)
 	DBG(DBG_KERNEL, DBG_log("setup kernel fd callback"));
 
 	/* Note: kernel_ops is const but pluto_event_add cannot know that */
-	pluto_event_add(*kernel_ops->async_fdp, EV_READ | EV_PERSIST,
-			kernel_process_msg_cb, (void *)kernel_ops, NULL,
-			"KERNEL_XRM_FD");
+	if (kernel_ops->async_fdp != NULL) {
+		pluto_event_add(*kernel_ops->async_fdp, EV_READ | EV_PERSIST,
+				kernel_process_msg_cb, (void *)kernel_ops, NULL,
+				"KERNEL_XRM_FD");
+	}
 
 	if (kernel_ops->route_fdp != NULL && *kernel_ops->route_fdp  > NULL_FD) {
 		pluto_event_add(*kernel_ops->route_fdp, EV_READ | EV_PERSIST,
@@ -3317,6 +3318,9 @@ bool install_ipsec_sa(struct state *st, bool inbound_also)
 #ifdef USE_LINUX_AUDIT
 	linux_audit_conn(st, LAK_CHILD_START);
 #endif
+	if (st->st_connection->policy & POLICY_OPPORTUNISTIC) {
+		oe_cache_record(&st->st_connection->spd.that.host_addr, OE_SUCCESS);
+	}
 	statetime_stop(&start, "%s()", __func__);
 
 	return TRUE;
@@ -3355,6 +3359,8 @@ bool migrate_ipsec_sa(struct state *st)
  * the saref code changed to always install inbound before
  * outbound so this it was always false, and thus removed
  */
+bool abandon_kernel_state = FALSE;
+
 void delete_ipsec_sa(struct state *st)
 {
 #ifdef USE_LINUX_AUDIT
@@ -3362,6 +3368,18 @@ void delete_ipsec_sa(struct state *st)
 	if (IS_CHILD_SA(st))
 		linux_audit_conn(st, LAK_CHILD_DESTROY);
 #endif
+	if (abandon_kernel_state) {
+		/* let go of the routing; leave the SAs in the kernel */
+		struct connection *c = st->st_connection;
+
+		for (struct spd_route *sr = &c->spd; sr != NULL; sr = sr->spd_next) {
+			if (sr->eroute_owner == st->st_serialno) {
+				sr->eroute_owner = SOS_NOBODY;
+				sr->routing = RT_UNROUTED;
+			}
+		}
+		return;
+	}
 	switch (kern_interface) {
 	case USE_KLIPS:
 	case USE_NETKEY:
@@ -3440,6 +3458,28 @@ void delete_ipsec_sa(struct state *st)
 
 		break;
 	case NO_KERNEL:
+		{
+			/*
+			 * Nothing to remove from the kernel, but the
+			 * connection must stop claiming that the state
+			 * owns its eroute.
+			 */
+			struct connection *c = st->st_connection;
+			struct spd_route *sr;
+
+			for (sr = &c->spd; sr; sr = sr->spd_next) {
+				if (sr->eroute_owner == st->st_serialno &&
+					sr->routing == RT_ROUTED_TUNNEL) {
+					sr->eroute_owner = SOS_NOBODY;
+					sr->routing =
+						(c->policy &
+							POLICY_FAIL_MASK) ==
+						POLICY_FAIL_NONE ?
+						RT_ROUTED_PROSPECTIVE :
+						RT_ROUTED_FAILURE;
+				}
+			}
+		}
 		DBG(DBG_CONTROL,
 			DBG_log("No support required to delete_ipsec_sa with NoKernel support"));
 		break;
@@ -3562,6 +3602,36 @@ bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */)
 	return TRUE;
 }
 
+bool dpd_inbound_traffic = FALSE;
+
+bool peer_recently_active(struct state *st, deltatime_t idle_max)
+{
+	if (!dpd_inbound_traffic)
+		return FALSE;
+
+	struct state *cst = st;
+
+	if (!st->st_esp.present && !st->st_ah.present) {
+		cst = state_with_serialno(st->st_connection->newest_ipsec_sa);
+		if (cst == NULL)
+			return FALSE;
+	}
+
+	/*
+	 * get_sa_info() notes when the inbound byte count last went
+	 * up; that is, when it was last polled.
+	 */
+	deltatime_t ago;
+
+	if (!get_sa_info(cst, TRUE, &ago) || !deltaless(ago, idle_max))
+		return FALSE;
+
+	DBG(DBG_DPD, DBG_log("#%lu inbound traffic on #%lu %jd seconds ago",
+			     st->st_serialno, cst->st_serialno, deltasecs(ago)));
+	pstats_ike_dpd_suppressed++;
+	return TRUE;
+}
+
 bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 		int transport_proto, ipsec_spi_t failure_shunt)
 {
@@ -3569,6 +3639,9 @@ bool orphan_holdpass(const struct connection *c, struct spd_route *sr,
 			rn = ro;                 /* routing, new */
 	ipsec_spi_t negotiation_shunt = (c->policy & POLICY_NEGO_PASS) ? SPI_PASS : SPI_DROP;
 
+	if (abandon_kernel_state)
+		return TRUE;
+
 	if (negotiation_shunt != failure_shunt ) {
 		DBG(DBG_CONTROL,
 			DBG_log("failureshunt != negotiationshunt, needs replacing"));
@@ -247,6 +247,7 @@ struct kernel_ops {
 };
 
 extern int create_socket(struct raw_iface *ifp, const char *v_name, int port);
+extern void listen_on_raw_ifaces(struct raw_iface *rifaces, bool nat_t);
 
 #ifndef IPSECDEVPREFIX
 # define IPSECDEVPREFIX "ipsec"
@@ -269,8 +270,12 @@ extern int fmt_common_shell_out(char *buf, int blen, const struct connection *c,
 extern bool do_command(const struct connection *c, const struct spd_route *sr,
 		       const char *verb, struct state *st);
 
-extern bool invoke_command(const char *verb, const char *verb_suffix,
+extern bool invoke_command(const struct spd_route *sr,
+			   const char *verb, const char *verb_suffix,
 			   const char *cmd);
+/* invoke_command() without the updown helpers; popen() from pluto */
+extern bool popen_command(const char *verb, const char *verb_suffix,
+			  const char *cmd);
 
 /* information from /proc/net/ipsec_eroute */
 
@@ -396,12 +401,27 @@ extern ipsec_spi_t get_my_cpi(const struct spd_route *sr, bool tunnel_mode);
 extern bool install_inbound_ipsec_sa(struct state *st);
 extern bool install_ipsec_sa(struct state *st, bool inbound_also);
 extern void delete_ipsec_sa(struct state *st);
+
+/*
+ * Set when pluto gives up on tidying the kernel during shutdown:
+ * states and connections deleted after that are only forgotten, the
+ * kernel is left as is and updown isn't run.
+ */
+extern bool abandon_kernel_state;
 extern bool route_and_eroute(struct connection *c,
 			     struct spd_route *sr,
 			     struct state *st);
 
 extern bool was_eroute_idle(struct state *st, deltatime_t idle_max);
 extern bool get_sa_info(struct state *st, bool inbound, deltatime_t *ago /* OUTPUT */);
+
+/*
+ * With --dpd-inbound-traffic, has the peer sent anything over ST's
+ * IPsec SA (for an IKE SA, its connection's newest IPsec SA) within
+ * IDLE_MAX?  If so there is no point in a DPD/liveness probe.
+ */
+extern bool dpd_inbound_traffic;
+extern bool peer_recently_active(struct state *st, deltatime_t idle_max);
 extern bool migrate_ipsec_sa(struct state *st);
 extern bool del_spi(ipsec_spi_t spi,
 		    int proto,
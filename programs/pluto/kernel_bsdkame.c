@@ -90,160 +90,10 @@ static void bsdkame_init_pfkey(void)
 
 static void bsdkame_process_raw_ifaces(struct raw_iface *rifaces)
 {
-	struct raw_iface *ifp;
-
 	/*
 	 * There are no virtual interfaces, so all interfaces are valid
 	 */
-	for (ifp = rifaces; ifp != NULL; ifp = ifp->next) {
-		bool after = FALSE; /* has vfp passed ifp on the list? */
-		bool bad = FALSE;
-		struct raw_iface *vfp;
-
-		for (vfp = rifaces; vfp != NULL; vfp = vfp->next) {
-			if (vfp == ifp) {
-				after = TRUE;
-			} else if (sameaddr(&ifp->addr, &vfp->addr)) {
-				if (after) {
-					ipstr_buf b;
-
-					loglog(RC_LOG_SERIOUS,
-					       "IP interfaces %s and %s share address %s!",
-					       ifp->name, vfp->name,
-					       ipstr(&ifp->addr, &b));
-				}
-				bad = TRUE;
-			}
-		}
-
-		if (bad)
-			continue;
-
-		/* We've got all we need; see if this is a new thing:
-		 * search old interfaces list.
-		 */
-		{
-			struct iface_port **p = &interfaces;
-
-			for (;; ) {
-				struct iface_port *q = *p;
-				struct iface_dev *id = NULL;
-
-				/* search is over if at end of list */
-				if (q == NULL) {
-					/* matches nothing -- create a new entry */
-					int fd = create_socket(ifp, ifp->name,
-							       pluto_port);
-					ipstr_buf b;
-
-					if (fd < 0)
-						break;
-
-					q = alloc_thing(struct iface_port,
-							"struct iface_port");
-					id = alloc_thing(struct iface_dev,
-							 "struct iface_dev");
-
-					LIST_INSERT_HEAD(&interface_dev, id,
-							 id_entry);
-
-					q->ip_dev = id;
-					id->id_rname = clone_str(ifp->name,
-								 "real device name");
-					id->id_vname = clone_str(ifp->name,
-								 "virtual device name bsd");
-					id->id_count++;
-
-					q->ip_addr = ifp->addr;
-					q->fd = fd;
-					q->next = interfaces;
-					q->change = IFN_ADD;
-					q->port = pluto_port;
-					q->ike_float = FALSE;
-
-					interfaces = q;
-
-					libreswan_log(
-						"adding interface %s/%s %s:%d",
-						q->ip_dev->id_vname,
-						q->ip_dev->id_rname,
-						ipstr(&q->ip_addr, &b),
-						q->port);
-
-					/*
-					 * right now, we do not support NAT-T on IPv6, because
-					 * the kernel did not support it, and gave an error
-					 * it one tried to turn it on.
-					 */
-					if (nat_traversal_support_port_floating
-					    &&
-					    addrtypeof(&ifp->addr) == AF_INET)
-					{
-						fd = create_socket(ifp,
-								   id->id_vname,
-								   pluto_nat_port);
-						if (fd < 0)
-							break;
-						nat_traversal_espinudp_socket(
-							fd, "IPv4");
-						q = alloc_thing(
-							struct iface_port,
-							"struct iface_port");
-						q->ip_dev = id;
-						id->id_count++;
-
-						q->ip_addr = ifp->addr;
-						setportof(htons(pluto_nat_port),
-							  &q->ip_addr);
-						q->port = pluto_nat_port;
-						q->fd = fd;
-						q->next = interfaces;
-						q->change = IFN_ADD;
-						q->ike_float = TRUE;
-						interfaces = q;
-						libreswan_log(
-							"adding interface %s/%s %s:%d",
-							q->ip_dev->id_vname, q->ip_dev->id_rname,
-							ipstr(&q->ip_addr, &b),
-							q->port);
-					}
-					break;
-				}
-
-				/* search over if matching old entry found */
-				if (streq(q->ip_dev->id_rname, ifp->name) &&
-				    streq(q->ip_dev->id_vname, ifp->name) &&
-				    sameaddr(&q->ip_addr, &ifp->addr)) {
-					/* matches -- rejuvinate old entry */
-					q->change = IFN_KEEP;
-
-					/* look for other interfaces to keep (due to NAT-T) */
-					for (q = q->next; q; q = q->next) {
-						if (streq(q->ip_dev->id_rname,
-							  ifp->name) &&
-						    streq(q->ip_dev->id_vname,
-							  ifp->name) &&
-						    sameaddr(&q->ip_addr,
-							     &ifp->addr))
-							q->change = IFN_KEEP;
-					}
-
-					break;
-				}
-
-				/* try again */
-				p = &q->next;
-			} /* for (;;) */
-		}
-	}
-
-	/* delete the raw interfaces list */
-	while (rifaces != NULL) {
-		struct raw_iface *t = rifaces;
-
-		rifaces = t->next;
-		pfree(t);
-	}
+	listen_on_raw_ifaces(rifaces, nat_traversal_support_port_floating);
 }
 
 static bool bsdkame_do_command(const struct connection *c, const struct spd_route *sr,
@@ -273,7 +123,7 @@ static bool bsdkame_do_command(const struct connection *c, const struct spd_rout
 		return FALSE;
 	}
 
-	return invoke_command(verb, verb_suffix, cmd);
+	return invoke_command(sr, verb, verb_suffix, cmd);
 }
 
 static void bsdkame_algregister(int satype, int supp_exttype,
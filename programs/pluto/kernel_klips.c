@@ -316,7 +316,7 @@ static bool klips_do_command(const struct connection *c, const struct spd_route
 		return FALSE;
 	}
 
-	return invoke_command(verb, verb_suffix, cmd);
+	return invoke_command(sr, verb, verb_suffix, cmd);
 }
 
 const struct kernel_ops klips_kernel_ops = {
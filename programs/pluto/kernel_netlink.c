@@ -84,12 +84,26 @@
 #include "ike_alg_integ.h"
 #include "ike_alg_encrypt.h"
 #include "ip_address.h"
+#include "pluto_stats.h"
+#include "ikev2.h"	/* for ikev2_record_deladdr() */
+#include "initiate_queue.h"	/* for initiate_queued() */
 
 /* required for Linux 2.6.26 kernel and later */
 #ifndef XFRM_STATE_AF_UNSPEC
 #define XFRM_STATE_AF_UNSPEC 32
 #endif
 
+/*
+ * Kernel events (see netlink_process_msg()).
+ *
+ * NETLINK_EVENT_RCVBUF: receive buffer for the broadcast sockets.
+ * NETLINK_EVENT_BATCH: datagrams read per wakeup.
+ */
+#define NETLINK_EVENT_RCVBUF (4 * 1024 * 1024)
+#define NETLINK_EVENT_BATCH 64
+#define NETLINK_EVENT_BUFSIZE (sizeof(struct nlmsghdr) + MAX_NETLINK_DATA_SIZE)
+#define NETLINK_DUMP_BUFSIZE (64 * 1024)
+
 static int nl_send_fd = NULL_FD; /* to send to NETLINK_XFRM */
 static int nl_xfrm_fd = NULL_FD; /* listen to NETLINK_XFRM broadcast */
 static int nl_route_fd = NULL_FD; /* listen to NETLINK_ROUTE broadcast */
@@ -177,6 +191,20 @@ static void ip2xfrm(const ip_address *addr, xfrm_address_t *xaddr)
 		memcpy(xaddr->a6, &addr->u.v6.sin6_addr, sizeof(xaddr->a6));
 }
 
+/*
+ * An ACQUIRE storm can fill the default socket buffer in well under a
+ * second.  SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN;
+ * fall back to SO_RCVBUF, which the kernel clamps.
+ */
+static void set_netlink_rcvbuf(int fd, const char *what)
+{
+	int size = NETLINK_EVENT_RCVBUF;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+		LOG_ERRNO(errno, "setsockopt(SO_RCVBUF) for %s", what);
+	}
+}
+
 static void init_netlink_route_fd(void)
 {
 	struct sockaddr_nl addr;
@@ -194,6 +222,8 @@ static void init_netlink_route_fd(void)
 		EXIT_LOG_ERRNO(errno,
 				"fcntl(O_NONBLOCK) for bcast NETLINK_ROUTE");
 
+	set_netlink_rcvbuf(nl_route_fd, "NETLINK_ROUTE");
+
 	addr.nl_family = AF_NETLINK;
 	addr.nl_pid = getpid();
 	addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
@@ -235,6 +265,8 @@ static void init_netlink(void)
 		EXIT_LOG_ERRNO(errno,
 			"fcntl(O_NONBLOCK) for bcast in init_netlink()");
 
+	set_netlink_rcvbuf(nl_xfrm_fd, "NETLINK_XFRM");
+
 	addr.nl_family = AF_NETLINK;
 	addr.nl_pid = getpid();
 	addr.nl_pad = 0; /* make coverity happy */
@@ -1591,15 +1623,53 @@ static err_t xfrm_to_ip_address(unsigned family, const xfrm_address_t *src,
 	}
 }
 
-static void netlink_acquire(struct nlmsghdr *n)
+static err_t xfrm_sel_to_addresses(unsigned family,
+				   const struct xfrm_selector *sel,
+				   ip_address *src, ip_address *dst)
+{
+	err_t ugh = NULL;
+
+	/*
+	 * XXX also the type of src/dst should be checked to make sure
+	 *     that they aren't v4 to v6 or something goofy
+	 */
+	if (NULL == (ugh = xfrm_to_ip_address(family, &sel->saddr, src)) &&
+		NULL == (ugh = xfrm_to_ip_address(family, &sel->daddr, dst)) &&
+		NULL == (ugh = add_port(family, src, sel->sport)))
+		ugh = add_port(family, dst, sel->dport);
+	return ugh;
+}
+
+/*
+ * Start (or shunt) an opportunistic negotiation for the traffic
+ * described by an acquire's selector.
+ */
+static err_t initiate_from_selector(unsigned family,
+				    const struct xfrm_selector *sel,
+#ifdef HAVE_LABELED_IPSEC
+				    struct xfrm_user_sec_ctx_ike *uctx,
+#endif
+				    const char *why)
 {
-	struct xfrm_user_acquire *acquire;
-	const xfrm_address_t *srcx, *dstx;
-	int src_proto, dst_proto;
 	ip_address src, dst;
 	ip_subnet ours, his;
+	err_t ugh = NULL;
+
+	if (NULL == (ugh = xfrm_sel_to_addresses(family, sel, &src, &dst)) &&
+		NULL == (ugh = addrtosubnet(&src, &ours)) &&
+		NULL == (ugh = addrtosubnet(&dst, &his)))
+		record_and_initiate_opportunistic(&ours, &his, sel->proto,
+#ifdef HAVE_LABELED_IPSEC
+						uctx,
+#endif
+						why);
+	return ugh;
+}
+
+static void netlink_acquire(struct nlmsghdr *n)
+{
+	struct xfrm_user_acquire *acquire;
 	unsigned family;
-	unsigned transport_proto;
 	err_t ugh = NULL;
 
 #ifdef HAVE_LABELED_IPSEC
@@ -1637,10 +1707,7 @@ static void netlink_acquire(struct nlmsghdr *n)
 	 */
 	acquire = NLMSG_DATA(n);	/* insufficiently aligned */
 
-	srcx = &acquire->sel.saddr;
-	dstx = &acquire->sel.daddr;
 	family = acquire->policy.sel.family;
-	transport_proto = acquire->sel.proto;
 
 #ifdef HAVE_LABELED_IPSEC
 
@@ -1731,26 +1798,11 @@ static void netlink_acquire(struct nlmsghdr *n)
 	}
 #endif
 
-	src_proto = dst_proto = acquire->sel.proto;
-
-	/*
-	 * XXX also the type of src/dst should be checked to make sure
-	 *     that they aren't v4 to v6 or something goofy
-	 */
-	if (NULL == (ugh = xfrm_to_ip_address(family, srcx, &src)) &&
-		NULL == (ugh = xfrm_to_ip_address(family, dstx, &dst)) &&
-		NULL == (ugh = add_port(family, &src, acquire->sel.sport)) &&
-		NULL == (ugh = add_port(family, &dst, acquire->sel.dport)) &&
-		NULL == (ugh = src_proto == dst_proto ?
-			NULL : "src and dst protocols differ") &&
-		NULL == (ugh = addrtosubnet(&src, &ours)) &&
-		NULL == (ugh = addrtosubnet(&dst, &his)))
-		record_and_initiate_opportunistic(&ours, &his, transport_proto,
+	ugh = initiate_from_selector(family, &acquire->sel,
 #ifdef HAVE_LABELED_IPSEC
-						uctx,
+				     uctx,
 #endif
-						"%acquire-netlink");
-
+				     "%acquire-netlink");
 	if (ugh != NULL)
 		libreswan_log(
 			"XFRM_MSG_ACQUIRE message from kernel malformed: %s",
@@ -1907,25 +1959,357 @@ static void netlink_policy_expire(struct nlmsghdr *n)
 	}
 }
 
-/* returns FALSE iff EAGAIN */
-static bool netlink_get(int fd)
+static void netlink_dispatch(struct nlmsghdr *n)
 {
-	struct nlm_resp rsp;
+	pstats_kernel_netlink_msgs++;
+
+	DBG(DBG_KERNEL,
+		DBG_log("netlink_get: %s message",
+			sparse_val_show(xfrm_type_names, n->nlmsg_type)));
+
+	switch (n->nlmsg_type) {
+	case XFRM_MSG_ACQUIRE:
+		netlink_acquire(n);
+		break;
+	case XFRM_MSG_POLEXPIRE:
+		netlink_policy_expire(n);
+		break;
+
+	case RTM_NEWADDR:
+		process_addr_chage(n);
+		break;
+
+	case RTM_DELADDR:
+		process_addr_chage(n);
+		break;
+
+	default:
+		/* ignored */
+		break;
+	}
+}
+
+/*
+ * Dump a kernel table, for instance after an overrun, without
+ * blocking the event loop.
+ *
+ * The request is sent on a private socket, so that neither the event
+ * sockets nor nl_send_fd see its (multi-part) replies, and each reply
+ * datagram is processed as it arrives, from the event loop,
+ * interleaved with IKE.  While a dump is in progress, a further
+ * request for the same table is remembered and the dump is repeated
+ * once it finishes.
+ */
+typedef void netlink_dump_cb(struct nlmsghdr *n, void *arg);
+typedef void netlink_dump_done_cb(bool ok, void *arg);
+
+struct netlink_dump {
+	const char *what;
+	int protocol;
+	netlink_dump_cb *dump_cb;
+	netlink_dump_done_cb *done_cb;
+	void *arg;
+	/* the request; both are small */
+	union {
+		struct nlmsghdr n;
+		char data[128];
+	} req;
+	int fd;		/* -1 when idle */
+	struct pluto_event *pev;
+	bool again;
+};
+
+static void netlink_dump_start(struct netlink_dump *d);
+
+static void netlink_dump_finish(struct netlink_dump *d, bool ok)
+{
+	delete_pluto_event(&d->pev);
+	close(d->fd);
+	d->fd = -1;
+	if (d->done_cb != NULL)
+		d->done_cb(ok, d->arg);
+	if (d->again) {
+		d->again = FALSE;
+		netlink_dump_start(d);
+	}
+}
+
+static void netlink_dump_read(evutil_socket_t fd UNUSED, const short event UNUSED,
+			      void *arg)
+{
+	struct netlink_dump *d = arg;
+	static union {
+		struct nlmsghdr n;
+		char data[NETLINK_DUMP_BUFSIZE];
+	} buf;
+
+	ssize_t r = recv(d->fd, &buf, sizeof(buf), MSG_DONTWAIT);
+	if (r < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		LOG_ERRNO(errno, "netlink recv() of %s dump failed", d->what);
+		netlink_dump_finish(d, FALSE);
+		return;
+	}
+	size_t len = r;
+	for (struct nlmsghdr *n = &buf.n; NLMSG_OK(n, len);
+	     n = NLMSG_NEXT(n, len)) {
+		if (n->nlmsg_type == NLMSG_DONE) {
+			netlink_dump_finish(d, TRUE);
+			return;
+		}
+		if (n->nlmsg_type == NLMSG_ERROR) {
+			const struct nlmsgerr *e = NLMSG_DATA(n);
+			libreswan_log("netlink %s dump failed: %s",
+				      d->what, strerror(-e->error));
+			netlink_dump_finish(d, FALSE);
+			return;
+		}
+		d->dump_cb(n, d->arg);
+	}
+}
+
+static void netlink_dump_start(struct netlink_dump *d)
+{
+	if (d->fd >= 0) {
+		DBG(DBG_KERNEL, DBG_log("netlink %s dump in progress; will repeat it",
+					d->what));
+		d->again = TRUE;
+		return;
+	}
+
+	int fd = safe_socket(AF_NETLINK, SOCK_DGRAM, d->protocol);
+	if (fd < 0) {
+		LOG_ERRNO(errno, "socket() for %s dump", d->what);
+		return;
+	}
+
+	d->req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	d->req.n.nlmsg_seq = 1;
+	ssize_t r;
+	do {
+		r = write(fd, &d->req, d->req.n.nlmsg_len);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0 || (size_t)r != d->req.n.nlmsg_len) {
+		LOG_ERRNO(errno, "netlink write() of %s dump request failed", d->what);
+		close(fd);
+		return;
+	}
+
+	d->fd = fd;
+	d->pev = pluto_event_add(fd, EV_READ | EV_PERSIST, netlink_dump_read,
+				 d, NULL, d->what);
+}
+
+/*
+ * Was the ACQUIRE for this larval SA's flow seen after all?  Only
+ * some of the ACQUIREs are lost in an overrun; acting again on the
+ * rest would refuse a duplicate bare shunt (loudly) and re-run
+ * initiate_ondemand().
+ */
+static bool larval_sa_in_hand(const ip_address *src, const ip_address *dst,
+			      int transport_proto)
+{
+	/* the ACQUIRE's hold, or the (widened) OE negotiation shunt */
+	ip_address src_any_port = *src;
+	ip_address dst_any_port = *dst;
+	setportof(0, &src_any_port);
+	setportof(0, &dst_any_port);
+	if (has_bare_hold(src, dst, transport_proto) ||
+	    has_bare_hold(&src_any_port, &dst_any_port, transport_proto) ||
+	    has_bare_hold(&src_any_port, &dst_any_port, 0))
+		return TRUE;
+
+	struct spd_route *sr;
+	struct connection *c = find_connection_for_clients(&sr, src, dst,
+							   transport_proto);
+	if (c == NULL)
+		return FALSE;
+	/* an OE instance, or a connection holding the flow while negotiating */
+	if (c->kind == CK_INSTANCE || sr->routing == RT_ROUTED_HOLD)
+		return TRUE;
+	/* auto=start, waiting its turn */
+	return initiate_queued(c);
+}
+
+/*
+ * An XFRM SA with SPI 0 is the kernel's larval state for an ACQUIRE
+ * that hasn't been answered; while it lives, the kernel won't send
+ * another ACQUIRE for that flow.
+ */
+static void resync_acquire(struct nlmsghdr *n, void *arg UNUSED)
+{
+	if (n->nlmsg_type != XFRM_MSG_NEWSA ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(struct xfrm_usersa_info)))
+		return;
+
+	const struct xfrm_usersa_info *sa = NLMSG_DATA(n);
+	if (sa->id.spi != 0)
+		return;
+
+	ip_address src, dst;
+	err_t ugh = xfrm_sel_to_addresses(sa->family, &sa->sel, &src, &dst);
+	if (ugh != NULL) {
+		libreswan_log("larval SA from kernel malformed: %s", ugh);
+		return;
+	}
+	if (larval_sa_in_hand(&src, &dst, sa->sel.proto)) {
+		DBG(DBG_KERNEL, DBG_log("netlink resync: found larval SA; already in hand"));
+		return;
+	}
+
+	DBG(DBG_KERNEL, DBG_log("netlink resync: found larval SA; acquiring"));
+	pstats_kernel_netlink_resync_acquires++;
+	/* any security label was in the lost ACQUIRE */
+	ugh = initiate_from_selector(sa->family, &sa->sel,
+#ifdef HAVE_LABELED_IPSEC
+				     NULL,
+#endif
+				     "%acquire-netlink");
+	if (ugh != NULL)
+		libreswan_log("larval SA from kernel malformed: %s", ugh);
+}
+
+/*
+ * Lost POLEXPIREs don't need a resync: EVENT_SHUNT_SCAN ages the bare
+ * shunts they would have removed.
+ */
+static struct netlink_dump xfrm_sa_dump = {
+	.what = "XFRM SA",
+	.protocol = NETLINK_XFRM,
+	.dump_cb = resync_acquire,
+	.fd = -1,
+};
+
+static void netlink_resync_xfrm(void)
+{
+	struct netlink_dump *d = &xfrm_sa_dump;
+	zero(&d->req);
+	d->req.n.nlmsg_type = XFRM_MSG_GETSA;
+	d->req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct xfrm_usersa_id));
+	netlink_dump_start(d);
+}
+
+struct local_addrs {
+	ip_address *addrs;
+	unsigned len;
+	unsigned size;
+};
+
+static void resync_addr(struct nlmsghdr *n, void *arg)
+{
+	struct local_addrs *la = arg;
+
+	if (n->nlmsg_type != RTM_NEWADDR)
+		return;
+
+	/* MOBIKE states waiting for a new address */
+	process_addr_chage(n);
+
+	struct ifaddrmsg *nl_msg = NLMSG_DATA(n);
+	struct rtattr *rta = IFA_RTA(nl_msg);
+	size_t msg_size = IFA_PAYLOAD(n);
+	for (; RTA_OK(rta, msg_size); rta = RTA_NEXT(rta, msg_size)) {
+		ip_address ip;
+		if (rta->rta_type != IFA_LOCAL &&
+		    rta->rta_type != IFA_ADDRESS)
+			continue;
+		if (initaddr(RTA_DATA(rta), RTA_PAYLOAD(rta),
+			     nl_msg->ifa_family, &ip) != NULL)
+			continue;
+		if (la->len == la->size) {
+			unsigned size = la->size == 0 ? 16 : la->size * 2;
+			ip_address *addrs = alloc_bytes(size * sizeof(addrs[0]),
+							"local addresses");
+			if (la->len > 0)
+				memcpy(addrs, la->addrs, la->len * sizeof(addrs[0]));
+			pfreeany(la->addrs);
+			la->addrs = addrs;
+			la->size = size;
+		}
+		la->addrs[la->len++] = ip;
+	}
+}
+
+static void resync_deladdr(struct state *st, void *arg)
+{
+	const struct local_addrs *la = arg;
+
+	if (isanyaddr(&st->st_localaddr))
+		return;
+	for (unsigned i = 0; i < la->len; i++) {
+		if (sameaddr(&la->addrs[i], &st->st_localaddr))
+			return;
+	}
+	/* the address went away while the RTM_DELADDR was being lost */
+	ip_address gone = st->st_localaddr;
+	ikev2_record_deladdr(st, &gone);
+}
+
+static void resync_addrs_done(bool ok, void *arg)
+{
+	struct local_addrs *la = arg;
+
+	if (ok)
+		for_each_state(resync_deladdr, la);
+	pfreeany(la->addrs);
+	la->len = la->size = 0;
+}
+
+static struct local_addrs resync_local_addrs;
+
+static struct netlink_dump addr_dump = {
+	.what = "address",
+	.protocol = NETLINK_ROUTE,
+	.dump_cb = resync_addr,
+	.done_cb = resync_addrs_done,
+	.arg = &resync_local_addrs,
+	.fd = -1,
+};
+
+static void netlink_resync_route(void)
+{
+	struct netlink_dump *d = &addr_dump;
+	zero(&d->req);
+	d->req.n.nlmsg_type = RTM_GETADDR;
+	d->req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	struct ifaddrmsg *ifa = NLMSG_DATA(&d->req.n);
+	ifa->ifa_family = AF_UNSPEC;
+	netlink_dump_start(d);
+}
+
+/*
+ * Read one datagram from an event socket and process every message
+ * in it.
+ *
+ * Returns FALSE iff EAGAIN.  Sets *OVERRUN when the kernel reports,
+ * with ENOBUFS, that it dropped events because the socket's receive
+ * buffer was full.
+ */
+static bool netlink_get(int fd, bool *overrun)
+{
+	static union {
+		struct nlmsghdr n;
+		char data[NETLINK_EVENT_BUFSIZE];
+	} buf;
 	struct sockaddr_nl addr;
 	socklen_t alen = sizeof(addr);
-	ssize_t r = recvfrom(fd, &rsp, sizeof(rsp), 0,
+	ssize_t r = recvfrom(fd, &buf, sizeof(buf), MSG_TRUNC,
 		(struct sockaddr *)&addr, &alen);
 
 	if (r < 0) {
 		if (errno == EAGAIN)
 			return FALSE;
 
-		if (errno != EINTR) {
+		if (errno == ENOBUFS) {
+			/* messages queued before the overrun are still there */
+			*overrun = TRUE;
+		} else if (errno != EINTR) {
 			LOG_ERRNO(errno, "recvfrom() failed in netlink_get: errno(%d): %s",
 				errno, strerror(errno));
 		}
 		return TRUE;
-	} else if ((size_t)r < sizeof(rsp.n)) {
+	} else if ((size_t)r > sizeof(buf)) {
 		libreswan_log(
 			"netlink_get read truncated message: %zd bytes; ignore message",
 			r);
@@ -1935,47 +2319,50 @@ static bool netlink_get(int fd)
 		DBG(DBG_KERNEL,
 			DBG_log("netlink_get: ignoring %s message from process %u",
 				sparse_val_show(xfrm_type_names,
-						rsp.n.nlmsg_type),
+						buf.n.nlmsg_type),
 				addr.nl_pid));
 		return TRUE;
-	} else if ((size_t)r != rsp.n.nlmsg_len) {
-		libreswan_log(
-			"netlink_get read message with length %zd that doesn't equal nlmsg_len %zu bytes; ignore message",
-			r, (size_t) rsp.n.nlmsg_len);
-		return TRUE;
 	}
 
-	DBG(DBG_KERNEL,
-		DBG_log("netlink_get: %s message",
-			sparse_val_show(xfrm_type_names, rsp.n.nlmsg_type)));
-
-	switch (rsp.n.nlmsg_type) {
-	case XFRM_MSG_ACQUIRE:
-		netlink_acquire(&rsp.n);
-		break;
-	case XFRM_MSG_POLEXPIRE:
-		netlink_policy_expire(&rsp.n);
-		break;
-
-	case RTM_NEWADDR:
-		process_addr_chage(&rsp.n);
-		break;
-
-	case RTM_DELADDR:
-		process_addr_chage(&rsp.n);
-		break;
-
-	default:
-		/* ignored */
-		break;
+	size_t len = r;
+	struct nlmsghdr *n;
+	for (n = &buf.n; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+		netlink_dispatch(n);
+	}
+	if (len != 0) {
+		libreswan_log(
+			"netlink_get read message with %zu trailing bytes; ignore them",
+			len);
 	}
 
 	return TRUE;
 }
 
+/*
+ * Stop after NETLINK_EVENT_BATCH reads so that an ACQUIRE storm can't
+ * starve IKE; the socket is still readable so the event loop will call
+ * back.
+ */
 static void netlink_process_msg(int fd)
 {
-	do {} while (netlink_get(fd));
+	bool overrun = FALSE;
+	for (unsigned reads = 0; reads < NETLINK_EVENT_BATCH; reads++) {
+		if (!netlink_get(fd, &overrun))
+			break;
+	}
+
+	if (overrun) {
+		pstats_kernel_netlink_resyncs++;
+		if (fd == nl_route_fd) {
+			pstats_kernel_netlink_route_overruns++;
+			libreswan_log("kernel dropped NETLINK_ROUTE events; rereading addresses");
+			netlink_resync_route();
+		} else {
+			pstats_kernel_netlink_xfrm_overruns++;
+			libreswan_log("kernel dropped NETLINK_XFRM events; rereading pending acquires");
+			netlink_resync_xfrm();
+		}
+	}
 }
 
 static ipsec_spi_t netlink_get_spi(const ip_address *src,
@@ -2590,7 +2977,7 @@ static bool netkey_do_command(const struct connection *c, const struct spd_route
 		return FALSE;
 	}
 
-	return invoke_command(verb, verb_suffix, cmd);
+	return invoke_command(sr, verb, verb_suffix, cmd);
 }
 
 /* add bypass policies/holes icmp */
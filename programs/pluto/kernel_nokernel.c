@@ -18,11 +18,41 @@
  * for more details.
  */
 
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+
+#include "defs.h"
+#include "connections.h"
 #include "kernel.h"
 #include "kernel_nokernel.h"
+#include "kernel_alg.h"
+#include "log.h"
+#include "ike_alg.h"
+#include "ike_alg_integ.h"
+#include "ike_alg_encrypt.h"
 
 static void init_nokernel(void)
 {
+	/*
+	 * Pretend to support what the Linux kernel would (see
+	 * init_netlink()) so that connections using esp= can be
+	 * loaded and negotiated.
+	 */
+	for (const struct encrypt_desc **algp = next_encrypt_desc(NULL);
+	     algp != NULL; algp = next_encrypt_desc(algp)) {
+		const struct encrypt_desc *alg = *algp;
+		if (alg->encrypt_netlink_xfrm_name != NULL) {
+			kernel_encrypt_add(alg);
+		}
+	}
+	for (const struct integ_desc **algp = next_integ_desc(NULL);
+	     algp != NULL; algp = next_integ_desc(algp)) {
+		const struct integ_desc *alg = *algp;
+		if (alg->integ_netlink_xfrm_name != NULL) {
+			kernel_integ_add(alg);
+		}
+	}
 }
 
 /* asynchronous messages from our queue */
@@ -104,6 +134,15 @@ static void nokernel_scan_shunts(void)
 {
 }
 
+/*
+ * There is no kernel and so no virtual interfaces: listen on every
+ * real interface (or just the --listen one).
+ */
+static void nokernel_process_raw_ifaces(struct raw_iface *rifaces)
+{
+	listen_on_raw_ifaces(rifaces, TRUE);
+}
+
 const struct kernel_ops nokernel_kernel_ops = {
 	.type = NO_KERNEL,
 	.async_fdp = NULL,
@@ -125,6 +164,7 @@ const struct kernel_ops nokernel_kernel_ops = {
 	.inbound_eroute = FALSE,
 	.scan_shunts = nokernel_scan_shunts,
 	.exceptsocket = NULL,
+	.process_ifaces = nokernel_process_raw_ifaces,
 	.docommand = NULL,
 	.kern_name = "nokernel",
 	.overlap_supported = FALSE,
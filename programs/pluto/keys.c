@@ -74,6 +74,8 @@ static struct secret *pluto_secrets = NULL;
 void load_preshared_secrets(void)
 {
 	const struct lsw_conf_options *oco = lsw_init_options();
+	/* the certificates and keys may have changed too */
+	flush_nss_cert_cache();
 	lsw_load_preshared_secrets(&pluto_secrets, oco->secretsfile);
 }
 
@@ -178,47 +180,14 @@ int sign_hash_RSA(const struct RSA_private_key *k,
 		  u_char *sig_val, size_t sig_len,
 		  enum notify_payload_hash_algorithms hash_algo)
 {
-	SECKEYPrivateKey *privateKey = NULL;
 	SECItem signature;
 	SECItem data;
-	PK11SlotInfo *slot = NULL;
 
 	DBG(DBG_CRYPT, DBG_log("RSA_sign_hash: Started using NSS"));
 
-	slot = PK11_GetInternalKeySlot();
-	if (slot == NULL) {
-		loglog(RC_LOG_SERIOUS,
-		       "RSA_sign_hash: Unable to find (slot security) device (err %d)",
-		       PR_GetError());
-		return 0;
-	}
-
-	/* XXX: is there no way to detect if we _need_ to authenticate ?? */
-	if (PK11_Authenticate(slot, PR_FALSE,
-			       lsw_return_nss_password_file_info()) == SECSuccess) {
-		DBG(DBG_CRYPT,
-		    DBG_log("NSS: Authentication to NSS successful"));
-	} else {
-		DBG(DBG_CRYPT,
-		    DBG_log("NSS: Authentication to NSS either failed or not required,if NSS DB without password"));
-	}
-
-	privateKey = PK11_FindKeyByKeyID(slot, k->pub.ckaid.nss,
-					 lsw_return_nss_password_file_info());
+	SECKEYPrivateKey *privateKey = get_private_key_by_ckaid_t_from_nss(k->pub.ckaid);
 	if (privateKey == NULL) {
-		DBG(DBG_CRYPT,
-		    DBG_log("NSS: Can't find the private key from the NSS CKA_ID"));
-		CERTCertificate *cert = get_cert_by_ckaid_t_from_nss(k->pub.ckaid);
-		if (cert == NULL) {
-			loglog(RC_LOG_SERIOUS, "Can't find the certificate or private key from the NSS CKA_ID");
-			return 0;
-		}
-		privateKey = PK11_FindKeyByAnyCert(cert, lsw_return_nss_password_file_info());
-		CERT_DestroyCertificate(cert);
-		if (privateKey == NULL) {
-			loglog(RC_LOG_SERIOUS, "Can't find the private key from the certificate (found using NSS CKA_ID");
-			return 0;
-		}
+		return 0;
 	}
 
 	/*
@@ -235,8 +204,6 @@ int sign_hash_RSA(const struct RSA_private_key *k,
 	 */
 	pexpect((int)sig_len == PK11_SignatureLen(privateKey));
 
-	PK11_FreeSlot(slot);
-
 	data.type = siBuffer;
 	data.len = hash_len;
 	data.data = DISCARD_CONST(u_char *, hash_val);
@@ -253,6 +220,7 @@ int sign_hash_RSA(const struct RSA_private_key *k,
 				loglog(RC_LOG_SERIOUS,
 					"RSA_sign_hash: sign function failed (%d)",
 					PR_GetError());
+				SECKEY_DestroyPrivateKey(privateKey);
 				return 0;
 			}
 		}
@@ -282,6 +250,7 @@ int sign_hash_RSA(const struct RSA_private_key *k,
 				loglog(RC_LOG_SERIOUS,
 					"RSA_sign_hash: sign function failed (%d)",
 					PR_GetError());
+				SECKEY_DestroyPrivateKey(privateKey);
 				return 0;
 			}
 		}
@@ -298,60 +267,15 @@ int sign_hash_ECDSA(const struct ECDSA_private_key *k,
 		    u_char *sig_val, size_t sig_len,
 		    enum notify_payload_hash_algorithms hash_algo UNUSED)
 {
-	SECKEYPrivateKey *privateKey = NULL;
-	PK11SlotInfo *slot = NULL;
 	DBG(DBG_CRYPT, DBG_log("ECDSA_sign_hash: Started using NSS"));
 
-	slot = PK11_GetInternalKeySlot();
-	if (slot == NULL) {
-		loglog(RC_LOG_SERIOUS,
-		       "ECDSA_sign_hash: Unable to find (slot security) device (err %d)",
-		       PR_GetError());
-		return 0;
-	}
-
-	/* XXX: is there no way to detect if we _need_ to authenticate ?? */
-	if (PK11_Authenticate(slot, PR_FALSE,
-			       lsw_return_nss_password_file_info()) == SECSuccess) {
-		DBG(DBG_CRYPT,
-		    DBG_log("NSS: Authentication to NSS successful"));
-	} else {
-		DBG(DBG_CRYPT,
-		    DBG_log("NSS: Authentication to NSS either failed or not required,if NSS DB without password"));
-	}
-
 	DBG(DBG_CRYPT, DBG_dump("nss", k->pub.ckaid.nss->data, k->pub.ckaid.nss->len));
 
-	CERTCertificate *cert = get_cert_by_ckaid_t_from_nss(k->pub.ckaid);
-
-	LSWDBGP(DBG_BASE, buf) {
-		lswlogf(buf, "got cert form ckaid");
-		lswlog_nss_error(buf);
-	}
-
-	privateKey = PK11_FindKeyByAnyCert(cert, lsw_return_nss_password_file_info());
-	DBGF(DBG_CRYPT, "keyType %d",privateKey->keyType);
-
+	SECKEYPrivateKey *privateKey = get_private_key_by_ckaid_t_from_nss(k->pub.ckaid);
 	if (privateKey == NULL) {
-		LSWDBGP(DBG_CRYPT, buf) {
-		        lswlogf(buf, "NSS: Can't find the private key from the NSS CKA_ID");
-			lswlog_nss_error(buf);
-		}
-
-		CERTCertificate *cert = get_cert_by_ckaid_t_from_nss(k->pub.ckaid);
-		if (cert == NULL) {
-			loglog(RC_LOG_SERIOUS, "Can't find the certificate or private key from the NSS CKA_ID");
-			return 0;
-		}
-		privateKey = PK11_FindKeyByAnyCert(cert, lsw_return_nss_password_file_info());
-		CERT_DestroyCertificate(cert);
-		if (privateKey == NULL) {
-			loglog(RC_LOG_SERIOUS, "Can't find the private key from the certificate (found using NSS CKA_ID");
-			return 0;
-		}
+		return 0;
 	}
-
-	PK11_FreeSlot(slot);
+	DBGF(DBG_CRYPT, "keyType %d", privateKey->keyType);
 
 	/* point hash at HASH_VAL */
 	SECItem hash = {
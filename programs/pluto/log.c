@@ -98,9 +98,132 @@ static void update_extra(const char *what, enum_names *names,
 	}
 }
 
+/*
+ * Per-peer and per-state debugging.
+ */
+
+struct debug_selector {
+	bool has_peer;
+	ip_subnet peer;
+	so_serial_t serialno;
+	lmod_t debugging;
+	struct debug_selector *next;
+};
+
+static struct debug_selector *debug_selectors;
+
+static bool debug_selector_matches(const struct debug_selector *s,
+				   const struct state *st,
+				   const struct connection *c,
+				   const ip_address *from)
+{
+	if (s->serialno != SOS_NOBODY &&
+	    (st == NULL ||
+	     (st->st_serialno != s->serialno &&
+	      st->st_clonedfrom != s->serialno))) {
+		return false;
+	}
+	if (s->has_peer) {
+		const ip_address *peer = st != NULL ? &st->st_remoteaddr :
+			c != NULL ? &c->spd.that.host_addr :
+			from;
+		if (!isvalidaddr(peer) || !addrinsubnet(peer, &s->peer)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static lset_t selected_debugging(lset_t debugging,
+				 const struct state *st,
+				 const struct connection *c,
+				 const ip_address *from)
+{
+	for (const struct debug_selector *s = debug_selectors;
+	     s != NULL; s = s->next) {
+		if (debug_selector_matches(s, st, c, from)) {
+			debugging = lmod(debugging, s->debugging);
+		}
+	}
+	return debugging;
+}
+
+void set_debug_selector(const ip_subnet *peer, so_serial_t serialno,
+			lmod_t debugging)
+{
+	struct debug_selector **sp;
+
+	for (sp = &debug_selectors; *sp != NULL; sp = &(*sp)->next) {
+		struct debug_selector *s = *sp;
+		if (s->serialno == serialno &&
+		    s->has_peer == (peer != NULL) &&
+		    (peer == NULL || samesubnet(&s->peer, peer))) {
+			break;
+		}
+	}
+
+	/* "--debug none" only clears bits; treat it as removal */
+	bool remove = debugging.set == LEMPTY;
+
+	if (*sp == NULL) {
+		if (remove) {
+			return;
+		}
+		struct debug_selector *s = alloc_thing(struct debug_selector,
+						       "debug selector");
+		s->has_peer = peer != NULL;
+		if (peer != NULL) {
+			s->peer = *peer;
+		}
+		s->serialno = serialno;
+		*sp = s;
+	} else if (remove) {
+		struct debug_selector *s = *sp;
+		*sp = s->next;
+		pfree(s);
+		return;
+	}
+	(*sp)->debugging = debugging;
+}
+
+void show_debug_selectors(void)
+{
+	for (const struct debug_selector *s = debug_selectors;
+	     s != NULL; s = s->next) {
+		LSWLOG_WHACK(RC_COMMENT, buf) {
+			lswlogs(buf, "debug");
+			if (s->has_peer) {
+				ip_subnet_buf b;
+				lswlogf(buf, " peer %s", str_subnet(&s->peer, &b));
+			}
+			if (s->serialno != SOS_NOBODY) {
+				lswlogf(buf, " state #%lu", s->serialno);
+			}
+			lswlogs(buf, ": ");
+			lswlog_lmod(buf, &debug_names, "+", s->debugging);
+		}
+	}
+	if (debug_selectors != NULL) {
+		whack_log(RC_COMMENT, " ");	/* spacer */
+	}
+}
+
+void free_debug_selectors(void)
+{
+	while (debug_selectors != NULL) {
+		struct debug_selector *s = debug_selectors;
+		debug_selectors = s->next;
+		pfree(s);
+	}
+}
+
 static void update_debugging(void)
 {
 	struct connection *c = cur_state != NULL ? cur_state->st_connection : cur_connection;
+	if (debug_selectors != NULL) {
+		/* don't inherit the previous context's selection */
+		set_debugging(base_debugging);
+	}
 	if (c == NULL) {
 		set_debugging(base_debugging);
 	} else {
@@ -109,6 +232,11 @@ static void update_debugging(void)
 		update_extra("impairing", &impair_names,
 			     c->extra_impairing, IMPAIR_MASK);
 	}
+	if (debug_selectors != NULL) {
+		lset_t debugging = selected_debugging(cur_debugging & DBG_MASK,
+						      cur_state, c, &cur_from);
+		set_debugging(debugging | (cur_debugging & ~DBG_MASK));
+	}
 }
 
 /*
@@ -390,6 +518,9 @@ extern ip_address log_push_from(ip_address new_from,
 			       func, file, line);
 	}
 	cur_from = new_from;
+	if (debug_selectors != NULL) {
+		update_debugging();
+	}
 	if (isvalidaddr(&cur_from)) {
 		log_processing(START, current,
 			       NULL, NULL, &cur_from,
@@ -414,6 +545,9 @@ extern void log_pop_from(ip_address old_from,
 			       func, file, line);
 	}
 	cur_from = old_from;
+	if (debug_selectors != NULL) {
+		update_debugging();
+	}
 }
 
 
@@ -587,12 +721,14 @@ bool log_debugging(struct state *st, struct connection *c,
 	if (st != NULL) {
 		c = st->st_connection;
 	}
-	if (c == NULL) {
-		return base_debugging & debug;
-	} else {
-		lset_t debugging = lmod(base_debugging, c->extra_debugging);
-		return debugging & debug;
+	lset_t debugging = base_debugging;
+	if (c != NULL) {
+		debugging = lmod(debugging, c->extra_debugging);
+	}
+	if (debug_selectors != NULL) {
+		debugging = selected_debugging(debugging, st, c, &cur_from);
 	}
+	return debugging & debug;
 }
 
 static void log_raw(struct lswlog *buf, int severity)
@@ -25,6 +25,8 @@
 #include "lswlog.h"
 #include "fd.h"
 #include "ip_address.h"
+#include "ip_subnet.h"
+#include "lmod.h"
 
 struct state;
 struct connection;
@@ -64,6 +66,19 @@ extern void reset_debugging(void);
 
 extern lset_t base_debugging;	/* bits selecting what to report */
 
+/*
+ * Extra debugging for a single peer (PEER != NULL) and/or state
+ * (SERIALNO != SOS_NOBODY, includes its children).  The selectors
+ * are only evaluated when the current state, connection or source
+ * changes; when there are none nothing extra is done.  DEBUGGING
+ * that sets nothing (for instance "--debug none", which only clears)
+ * removes the selector.
+ */
+extern void set_debug_selector(const ip_subnet *peer, so_serial_t serialno,
+			       lmod_t debugging);
+extern void show_debug_selectors(void);
+extern void free_debug_selectors(void);
+
 extern void log_reset_globals(const char *func, const char *file, long line);
 #define reset_globals() log_reset_globals(__func__, PASSERT_BASENAME, __LINE__)
 
@@ -148,7 +163,8 @@ void whack_log(enum rc_type rc, const char *message, ...) PRINTF_LIKE(2);
 void whack_log_comment(const char *message, ...) PRINTF_LIKE(1);
 
 /* show status, usually on whack log */
-extern void show_status(void);
+struct whack_status_filter;
+extern void show_status(const struct whack_status_filter *filter);
 
 extern void show_setup_plutomain(void);
 extern void show_setup_natt(void);
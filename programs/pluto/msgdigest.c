@@ -91,6 +91,132 @@ struct msg_digest *alloc_md(const char *mdname)
 	return md;
 }
 
+/*
+ * Arena blocks are only needed by messages with more than
+ * MD_ARENA_INLINE_DIGESTS payloads.
+ */
+#define MD_ARENA_BLOCK_DIGESTS 8
+
+struct md_arena_block {
+	struct md_arena_block *next;
+	size_t used;
+	union {
+		uint8_t bytes[MD_ARENA_BLOCK_DIGESTS * sizeof(struct payload_digest)];
+		void *align_ptr;
+		uint64_t align_u64;
+	} space;
+};
+
+static void *alloc_md_bytes(struct msg_digest *md, size_t size)
+{
+	struct md_arena *arena = &md->arena;
+	/* keep everything pointer and uint64_t aligned */
+	size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	passert(size <= sizeof(arena->blocks->space.bytes));
+
+	void *ptr;
+	if (arena->used + size <= sizeof(arena->inline_space.bytes)) {
+		ptr = arena->inline_space.bytes + arena->used;
+		arena->used += size;
+	} else {
+		struct md_arena_block *block = arena->blocks;
+		if (block == NULL || block->used + size > sizeof(block->space.bytes)) {
+			block = alloc_thing(struct md_arena_block, "md arena block");
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+		ptr = block->space.bytes + block->used;
+		block->used += size;
+	}
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static void free_md_arena(struct md_arena *arena)
+{
+	while (arena->blocks != NULL) {
+		struct md_arena_block *block = arena->blocks;
+		arena->blocks = block->next;
+		pfree(block);
+	}
+}
+
+static bool md_payload_room(struct msg_digest *md)
+{
+	if (md->digest_roof + md->lazy_roof >= PAYLIMIT) {
+		loglog(RC_LOG_SERIOUS, "more than %d payloads in message; ignored",
+		       PAYLIMIT);
+		return false;
+	}
+	return true;
+}
+
+struct payload_digest *alloc_md_digest(struct msg_digest *md)
+{
+	if (!md_payload_room(md)) {
+		return NULL;
+	}
+	struct payload_digest *pd = alloc_md_bytes(md, sizeof(struct payload_digest));
+	md->digest[md->digest_roof++] = pd;
+	return pd;
+}
+
+bool add_lazy_payload(struct msg_digest *md, unsigned np, struct_desc *sd,
+		      pb_stream *container, uint8_t *start)
+{
+	if (!md_payload_room(md)) {
+		return false;
+	}
+	struct lazy_payload *lp = alloc_md_bytes(md, sizeof(struct lazy_payload));
+	lp->np = np;
+	lp->sd = sd;
+	lp->container = container;
+	lp->start = start;
+	struct lazy_payload **p = &md->lazy;
+	while (*p != NULL)
+		p = &(*p)->next;
+	*p = lp;
+	md->lazy_roof++;
+	return true;
+}
+
+struct payload_digest *md_payload_chain(struct msg_digest *md, unsigned np)
+{
+	passert(np < elemsof(md->chain));
+	struct payload_digest **tail = &md->chain[np];
+	while (*tail != NULL)
+		tail = &(*tail)->next;
+
+	for (struct lazy_payload **lpp = &md->lazy; *lpp != NULL; ) {
+		struct lazy_payload *lp = *lpp;
+		if (lp->np != np) {
+			lpp = &lp->next;
+			continue;
+		}
+		/* unlink; the arena owns the storage */
+		*lpp = lp->next;
+		md->lazy_roof--;
+
+		struct payload_digest *pd = alloc_md_digest(md);
+		/* the lazy payload's slot was just freed */
+		passert(pd != NULL);
+
+		pb_stream in = *lp->container;
+		in.cur = lp->start;
+		if (!in_struct(&pd->payload, lp->sd, &in, &pd->pbs)) {
+			/* the generic header was checked when it was indexed */
+			loglog(RC_LOG_SERIOUS, "malformed %s payload ignored",
+			       lp->sd->name);
+			continue;
+		}
+		pd->pbs.container = lp->container;
+		*tail = pd;
+		tail = &pd->next;
+	}
+
+	return md->chain[np];
+}
+
 struct msg_digest *clone_md(struct msg_digest *md, const char *name)
 {
 	struct msg_digest *clone = alloc_md(name);
@@ -109,6 +235,7 @@ void release_md(struct msg_digest *md)
 {
 	freeanychunk(md->raw_packet);
 	pfreeany(md->packet_pbs.start);
+	free_md_arena(&md->arena);
 
 	/* check that we are not creating a loop */
 	passert(md != md_pool);
@@ -35,15 +35,200 @@
 
 #include <nss.h>
 #include <pk11pub.h>
+#include <keyhi.h>
 #include <cert.h>
+#include <prerror.h>
 
+#include "defs.h"
+#include "log.h"
+#include "whack.h"	/* for RC_LOG_SERIOUS */
+#include "hash_table.h"
 #include "nss_cert_load.h"
 
+/*
+ * Thousands of connections typically use the one host certificate,
+ * and signing looked the private key up in NSS for every exchange.
+ * What was found, by nickname or by CKAID, is remembered until the
+ * secrets are re-read ("ipsec auto --rereadsecrets") or pluto exits.
+ * Misses aren't remembered.
+ *
+ * Adding a connection (which includes "ipsec auto --replace") first
+ * forgets the entries for its certificates, so that a certificate
+ * renewed or deleted in NSS is noticed.
+ *
+ * Callers get their own reference, as before, and must still destroy
+ * it.
+ */
+
+#define NSS_CERT_CACHE_TABLE_SIZE 1021
+
+enum nss_cert_cache_key {
+	BY_NICKNAME,
+	BY_CKAID,		/* binary */
+};
+
+struct nss_cert_cache_entry {
+	enum nss_cert_cache_key kind;
+	chunk_t key;
+	CERTCertificate *cert;		/* or NULL */
+	SECKEYPrivateKey *private_key;	/* or NULL; BY_CKAID only */
+	struct list_entry hash_entry;
+};
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long flushes;
+} nss_cert_cache_stats;
+
+static size_t log_nss_cert_cache_entry(struct lswlog *buf, void *data)
+{
+	if (data == NULL) {
+		return lswlogs(buf, "NSS cert cache entry");
+	}
+	struct nss_cert_cache_entry *e = data;
+	return lswlogf(buf, "NSS cert cache entry %s", e->kind == BY_NICKNAME ?
+		       "by nickname" : "by CKAID");
+}
+
+static size_t nss_cert_cache_hasher(enum nss_cert_cache_key kind,
+				    const void *key, size_t len)
+{
+	return hash_table_bytes(key, len) + kind;
+}
+
+static size_t nss_cert_cache_hash(void *data)
+{
+	struct nss_cert_cache_entry *e = data;
+	return nss_cert_cache_hasher(e->kind, e->key.ptr, e->key.len);
+}
+
+static struct list_head nss_cert_cache_slots[NSS_CERT_CACHE_TABLE_SIZE];
+static struct hash_table nss_cert_cache_table = {
+	.info = {
+		.name = "NSS cert cache table",
+		.log = log_nss_cert_cache_entry,
+	},
+	.hash = nss_cert_cache_hash,
+	.nr_slots = NSS_CERT_CACHE_TABLE_SIZE,
+	.slots = nss_cert_cache_slots,
+};
+
+static struct nss_cert_cache_entry *nss_cert_cache_entry(enum nss_cert_cache_key kind,
+							 const void *key, size_t len)
+{
+	struct list_head *slot = hash_table_slot_by_hash(&nss_cert_cache_table,
+							 nss_cert_cache_hasher(kind, key, len));
+	struct nss_cert_cache_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(slot, e) {
+		if (e->kind == kind && e->key.len == len &&
+		    memeq(e->key.ptr, key, len)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static struct nss_cert_cache_entry *add_nss_cert_cache_entry(enum nss_cert_cache_key kind,
+							     const void *key, size_t len)
+{
+	struct nss_cert_cache_entry *e = nss_cert_cache_entry(kind, key, len);
+	if (e == NULL) {
+		e = alloc_thing(struct nss_cert_cache_entry, "NSS cert cache entry");
+		e->kind = kind;
+		clonetochunk(e->key, key, len, "NSS cert cache key");
+		add_hash_table_entry(&nss_cert_cache_table, e, &e->hash_entry);
+	}
+	return e;
+}
+
+static CERTCertificate *cached_cert(enum nss_cert_cache_key kind,
+				    const void *key, size_t len)
+{
+	struct nss_cert_cache_entry *e = nss_cert_cache_entry(kind, key, len);
+	if (e == NULL || e->cert == NULL) {
+		return NULL;
+	}
+	nss_cert_cache_stats.hits++;
+	return CERT_DupCertificate(e->cert);
+}
+
+static void forget_nss_cert_cache_entry(enum nss_cert_cache_key kind,
+					const void *key, size_t len)
+{
+	struct nss_cert_cache_entry *e = nss_cert_cache_entry(kind, key, len);
+	if (e == NULL) {
+		return;
+	}
+	del_hash_table_entry(&nss_cert_cache_table, &e->hash_entry);
+	if (e->cert != NULL) {
+		CERT_DestroyCertificate(e->cert);
+	}
+	if (e->private_key != NULL) {
+		SECKEY_DestroyPrivateKey(e->private_key);
+	}
+	freeanychunk(e->key);
+	pfree(e);
+}
+
+static CERTCertificate *cache_cert(enum nss_cert_cache_key kind,
+				   const void *key, size_t len,
+				   CERTCertificate *cert)
+{
+	if (cert != NULL) {
+		nss_cert_cache_stats.misses++;
+		struct nss_cert_cache_entry *e = add_nss_cert_cache_entry(kind, key, len);
+		if (e->cert == NULL) {
+			e->cert = CERT_DupCertificate(cert);
+		}
+	}
+	return cert;
+}
+
+void init_nss_cert_cache(void)
+{
+	init_hash_table(&nss_cert_cache_table);
+}
+
+void flush_nss_cert_cache(void)
+{
+	if (nss_cert_cache_table.nr_entries > 0) {
+		nss_cert_cache_stats.flushes++;
+	}
+	for (unsigned long i = 0; i < nss_cert_cache_table.nr_slots; i++) {
+		struct nss_cert_cache_entry *e;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&nss_cert_cache_table.slots[i], e) {
+			forget_nss_cert_cache_entry(e->kind, e->key.ptr, e->key.len);
+		}
+	}
+}
+
+void show_nss_cert_cache_hash_status(void)
+{
+	show_hash_table_status("nss_cert_cache", &nss_cert_cache_table);
+}
+
+void show_nss_cert_cache_status(void)
+{
+	whack_log(RC_COMMENT, "NSS cert cache: %ld entries, hits=%lu, misses=%lu, flushes=%lu",
+		  nss_cert_cache_table.nr_entries,
+		  nss_cert_cache_stats.hits, nss_cert_cache_stats.misses,
+		  nss_cert_cache_stats.flushes);
+	whack_log(RC_COMMENT, " ");	/* spacer */
+}
+
 CERTCertificate *get_cert_by_nickname_from_nss(const char *nickname)
 {
-	return nickname == NULL ? NULL :
-		PK11_FindCertFromNickname(nickname,
-			lsw_return_nss_password_file_info());
+	if (nickname == NULL) {
+		return NULL;
+	}
+	CERTCertificate *cert = cached_cert(BY_NICKNAME, nickname, strlen(nickname));
+	if (cert != NULL) {
+		return cert;
+	}
+	cert = PK11_FindCertFromNickname(nickname,
+					 lsw_return_nss_password_file_info());
+	return cache_cert(BY_NICKNAME, nickname, strlen(nickname), cert);
 }
 
 struct ckaid_match_arg {
@@ -73,7 +258,8 @@ static SECStatus ckaid_match(CERTCertificate *cert, SECItem *ignore1 UNUSED, voi
 	return SECSuccess;
 }
 
-CERTCertificate *get_cert_by_ckaid_t_from_nss(ckaid_t ckaid)
+/* uncached; walks every certificate */
+static CERTCertificate *find_cert_by_ckaid(ckaid_t ckaid)
 {
 	struct ckaid_match_arg ckaid_match_arg = {
 		.cert = NULL,
@@ -84,21 +270,95 @@ CERTCertificate *get_cert_by_ckaid_t_from_nss(ckaid_t ckaid)
 	return ckaid_match_arg.cert;
 }
 
-CERTCertificate *get_cert_by_ckaid_from_nss(const char *ckaid)
+CERTCertificate *get_cert_by_ckaid_t_from_nss(ckaid_t ckaid)
 {
-	if (ckaid == NULL) {
+	CERTCertificate *cert = cached_cert(BY_CKAID, ckaid.nss->data, ckaid.nss->len);
+	if (cert != NULL) {
+		return cert;
+	}
+	return cache_cert(BY_CKAID, ckaid.nss->data, ckaid.nss->len,
+			  find_cert_by_ckaid(ckaid));
+}
+
+SECKEYPrivateKey *get_private_key_by_ckaid_t_from_nss(ckaid_t ckaid)
+{
+	struct nss_cert_cache_entry *e = nss_cert_cache_entry(BY_CKAID, ckaid.nss->data,
+								ckaid.nss->len);
+	if (e != NULL && e->private_key != NULL) {
+		nss_cert_cache_stats.hits++;
+		return SECKEY_CopyPrivateKey(e->private_key);
+	}
+
+	PK11SlotInfo *slot = PK11_GetInternalKeySlot();
+	if (slot == NULL) {
+		loglog(RC_LOG_SERIOUS,
+		       "Unable to find (slot security) device (err %d)",
+		       PR_GetError());
 		return NULL;
 	}
-	/* convert hex string ckaid to binary bin */
-	size_t binlen = (strlen(ckaid) + 1) / 2;
-	char *bin = alloc_bytes(binlen, "ckaid");
-	const char *ugh = ttodata(ckaid, 0, 16, bin, binlen, &binlen);
+
+	/* XXX: is there no way to detect if we _need_ to authenticate ?? */
+	if (PK11_Authenticate(slot, PR_FALSE,
+			       lsw_return_nss_password_file_info()) == SECSuccess) {
+		DBG(DBG_CRYPT,
+		    DBG_log("NSS: Authentication to NSS successful"));
+	} else {
+		DBG(DBG_CRYPT,
+		    DBG_log("NSS: Authentication to NSS either failed or not required,if NSS DB without password"));
+	}
+
+	SECKEYPrivateKey *private_key =
+		PK11_FindKeyByKeyID(slot, ckaid.nss,
+				    lsw_return_nss_password_file_info());
+	PK11_FreeSlot(slot);
+	if (private_key == NULL) {
+		DBG(DBG_CRYPT,
+		    DBG_log("NSS: Can't find the private key from the NSS CKA_ID"));
+		/* not get_cert_by_ckaid_t_from_nss(); this is one miss */
+		CERTCertificate *cert = find_cert_by_ckaid(ckaid);
+		if (cert == NULL) {
+			loglog(RC_LOG_SERIOUS, "Can't find the certificate or private key from the NSS CKA_ID");
+			return NULL;
+		}
+		private_key = PK11_FindKeyByAnyCert(cert, lsw_return_nss_password_file_info());
+		CERT_DestroyCertificate(cert);
+		if (private_key == NULL) {
+			loglog(RC_LOG_SERIOUS, "Can't find the private key from the certificate (found using NSS CKA_ID");
+			return NULL;
+		}
+	}
+
+	nss_cert_cache_stats.misses++;
+	e = add_nss_cert_cache_entry(BY_CKAID, ckaid.nss->data, ckaid.nss->len);
+	e->private_key = SECKEY_CopyPrivateKey(private_key);
+	return private_key;
+}
+
+/* convert hex string ckaid to binary; NULL (logged) when invalid */
+static char *ckaid_to_bin(const char *ckaid, size_t *binlen)
+{
+	*binlen = (strlen(ckaid) + 1) / 2;
+	char *bin = alloc_bytes(*binlen, "ckaid");
+	const char *ugh = ttodata(ckaid, 0, 16, bin, *binlen, binlen);
 	if (ugh != NULL) {
 		pfree(bin);
 		/* should have been rejected by whack? */
 		libreswan_log("invalid hex CKAID '%s': %s", ckaid, ugh);
 		return NULL;
 	}
+	return bin;
+}
+
+CERTCertificate *get_cert_by_ckaid_from_nss(const char *ckaid)
+{
+	if (ckaid == NULL) {
+		return NULL;
+	}
+	size_t binlen;
+	char *bin = ckaid_to_bin(ckaid, &binlen);
+	if (bin == NULL) {
+		return NULL;
+	}
 
 	SECItem ckaid_nss = {
 		.type = siBuffer,
@@ -112,3 +372,23 @@ CERTCertificate *get_cert_by_ckaid_from_nss(const char *ckaid)
 	pfree(bin);
 	return cert;
 }
+
+void forget_nss_cert_by_nickname(const char *nickname)
+{
+	if (nickname != NULL) {
+		forget_nss_cert_cache_entry(BY_NICKNAME, nickname, strlen(nickname));
+	}
+}
+
+void forget_nss_cert_by_ckaid(const char *ckaid)
+{
+	if (ckaid == NULL) {
+		return;
+	}
+	size_t binlen;
+	char *bin = ckaid_to_bin(ckaid, &binlen);
+	if (bin != NULL) {
+		forget_nss_cert_cache_entry(BY_CKAID, bin, binlen);
+		pfree(bin);
+	}
+}
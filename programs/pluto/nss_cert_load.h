@@ -21,9 +21,27 @@
 
 #include <libreswan.h>
 #include <secrets.h>
+#include <keythi.h>
 
+/*
+ * Certificates and private keys found in NSS are cached (see
+ * nss_cert_load.c); the caller still gets, and must release, its own
+ * reference.
+ */
 extern CERTCertificate *get_cert_by_nickname_from_nss(const char *nickname);
 extern CERTCertificate *get_cert_by_ckaid_from_nss(const char *ckaid);
 extern CERTCertificate *get_cert_by_ckaid_t_from_nss(ckaid_t ckaid);
 
+/* logs why when NULL; release with SECKEY_DestroyPrivateKey() */
+extern SECKEYPrivateKey *get_private_key_by_ckaid_t_from_nss(ckaid_t ckaid);
+
+extern void init_nss_cert_cache(void);
+/* forget everything; for --rereadsecrets and shutdown */
+extern void flush_nss_cert_cache(void);
+/* forget one certificate; for adding (or replacing) a connection */
+extern void forget_nss_cert_by_nickname(const char *nickname);
+extern void forget_nss_cert_by_ckaid(const char *ckaid);
+extern void show_nss_cert_cache_status(void);
+extern void show_nss_cert_cache_hash_status(void);
+
 #endif /* _NSS_CERT_LOAD_H */
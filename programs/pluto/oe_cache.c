@@ -0,0 +1,382 @@
+/* remember the outcome of opportunistic negotiations, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * A host talking to lots of destinations that don't do OE would,
+ * once each failure shunt expires, try each of them again (DNS
+ * lookups and IKE_SA_INIT retransmits) and fail again.  Remember,
+ * per peer address, how the last negotiation ended and, after a
+ * failure, don't try again until a backoff, doubling with each
+ * consecutive failure, has passed.  Success resets the backoff.
+ *
+ * Once the backoff has passed the entry is kept for a further
+ * OE_CACHE_MAX_TTL so that a repeat failure backs off for longer.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libreswan.h>
+
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+
+#include "defs.h"
+#include "log.h"
+#include "whack.h"
+#include "hash_table.h"
+#include "oe_cache.h"
+
+deltatime_t oe_cache_ttl = DELTATIME_INIT(0);	/* disabled */
+deltatime_t oe_cache_max_ttl = DELTATIME_INIT(3600);
+unsigned oe_cache_size = 65536;
+char *oe_cache_file = NULL;
+
+#define OE_CACHE_TABLE_SIZE 4093
+
+static const char *const oe_outcome_name[] = {
+	[OE_SUCCESS] = "success",
+	[OE_NO_IPSECKEY] = "no-ipseckey",
+	[OE_NO_RESPONSE] = "no-response",
+	[OE_AUTH_FAILED] = "auth-failed",
+};
+
+struct oe_entry {
+	ip_address peer;
+	enum oe_outcome outcome;
+	unsigned failures;	/* consecutive */
+	monotime_t retry;	/* don't negotiate before */
+	monotime_t forget;	/* drop the entry after */
+	struct list_entry peer_entry;
+	struct list_entry lru_entry;
+};
+
+static struct {
+	unsigned long skipped;
+	unsigned long recorded[elemsof(oe_outcome_name)];
+	unsigned long evicted;
+} oe_stats;
+
+static size_t log_oe_entry(struct lswlog *buf, void *data)
+{
+	if (data == NULL) {
+		return lswlogs(buf, "OE cache entry");
+	}
+	struct oe_entry *e = data;
+	ipstr_buf b;
+	return lswlogf(buf, "OE cache entry %s", ipstr(&e->peer, &b));
+}
+
+static size_t oe_peer_hasher(const ip_address *peer)
+{
+	const unsigned char *bytes;
+	size_t len = addrbytesptr_read(peer, &bytes);
+	return hash_table_bytes(bytes, len);
+}
+
+static size_t oe_peer_hash(void *data)
+{
+	struct oe_entry *e = data;
+	return oe_peer_hasher(&e->peer);
+}
+
+static struct list_head oe_peer_slots[OE_CACHE_TABLE_SIZE];
+static struct hash_table oe_peer_table = {
+	.info = {
+		.name = "OE cache table",
+		.log = log_oe_entry,
+	},
+	.hash = oe_peer_hash,
+	.nr_slots = OE_CACHE_TABLE_SIZE,
+	.slots = oe_peer_slots,
+};
+
+/* least recently updated first, when OLD2NEW */
+static const struct list_info oe_lru_info = {
+	.name = "OE cache LRU",
+	.log = log_oe_entry,
+};
+static struct list_head oe_lru;
+
+static bool oe_cache_enabled(void)
+{
+	return deltamillisecs(oe_cache_ttl) > 0;
+}
+
+static ip_address oe_key(const ip_address *peer)
+{
+	ip_address key = *peer;
+	setportof(0, &key);
+	return key;
+}
+
+static struct oe_entry *oe_entry_by_peer(const ip_address *peer)
+{
+	struct list_head *slot = hash_table_slot_by_hash(&oe_peer_table,
+							 oe_peer_hasher(peer));
+	struct oe_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(slot, e) {
+		if (sameaddr(&e->peer, peer)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void free_oe_entry(struct oe_entry *e)
+{
+	del_hash_table_entry(&oe_peer_table, &e->peer_entry);
+	remove_list_entry(&e->lru_entry);
+	pfree(e);
+}
+
+static void touch_oe_entry(struct oe_entry *e)
+{
+	remove_list_entry(&e->lru_entry);
+	insert_list_entry(&oe_lru, &e->lru_entry);
+}
+
+static struct oe_entry *add_oe_entry(const ip_address *peer)
+{
+	while (oe_peer_table.nr_entries >= (long)oe_cache_size) {
+		struct oe_entry *oldest = NULL;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&oe_lru, oldest) {
+			break;
+		}
+		if (oldest == NULL) {
+			break;
+		}
+		free_oe_entry(oldest);
+		oe_stats.evicted++;
+	}
+	struct oe_entry *e = alloc_thing(struct oe_entry, "OE cache entry");
+	e->peer = *peer;
+	add_hash_table_entry(&oe_peer_table, e, &e->peer_entry);
+	e->lru_entry = list_entry(&oe_lru_info, e);
+	insert_list_entry(&oe_lru, &e->lru_entry);
+	return e;
+}
+
+/*
+ * Backoff after the Nth consecutive failure: TTL*2**(N-1), capped.
+ * A missing IPSECKEY or an authentication failure is less likely to
+ * go away by itself than a lost packet so start higher.
+ */
+static deltatime_t oe_backoff(enum oe_outcome outcome, unsigned failures)
+{
+	intmax_t ms = deltamillisecs(oe_cache_ttl);
+	if (outcome != OE_NO_RESPONSE) {
+		ms *= 4;
+	}
+	intmax_t max = deltamillisecs(oe_cache_max_ttl);
+	for (unsigned i = 1; i < failures && ms < max; i++) {
+		ms *= 2;
+	}
+	return deltatime_ms(ms < max ? ms : max);
+}
+
+void oe_cache_record(const ip_address *peer, enum oe_outcome outcome)
+{
+	if (!oe_cache_enabled()) {
+		return;
+	}
+
+	ip_address key = oe_key(peer);
+	struct oe_entry *e = oe_entry_by_peer(&key);
+	if (e == NULL) {
+		e = add_oe_entry(&key);
+	} else {
+		touch_oe_entry(e);
+	}
+
+	monotime_t now = mononow();
+	e->outcome = outcome;
+	if (outcome == OE_SUCCESS) {
+		e->failures = 0;
+		e->retry = now;
+	} else {
+		e->failures++;
+		e->retry = monotimesum(now, oe_backoff(outcome, e->failures));
+	}
+	e->forget = monotimesum(e->retry, oe_cache_max_ttl);
+	oe_stats.recorded[outcome]++;
+
+	LSWDBGP(DBG_OPPO, buf) {
+		ipstr_buf b;
+		lswlogf(buf, "OE cache: %s: %s", ipstr(&key, &b),
+			oe_outcome_name[outcome]);
+		if (outcome != OE_SUCCESS) {
+			lswlogf(buf, " (failure %u); not retrying for ", e->failures);
+			lswlog_deltatime(buf, monotimediff(e->retry, now));
+			lswlogs(buf, " seconds");
+		}
+	}
+}
+
+bool oe_cache_negative(const ip_address *peer)
+{
+	if (!oe_cache_enabled()) {
+		return false;
+	}
+
+	ip_address key = oe_key(peer);
+	struct oe_entry *e = oe_entry_by_peer(&key);
+	if (e == NULL) {
+		return false;
+	}
+
+	monotime_t now = mononow();
+	if (!monobefore(now, e->forget)) {
+		free_oe_entry(e);
+		return false;
+	}
+	if (!monobefore(now, e->retry)) {
+		return false;
+	}
+
+	oe_stats.skipped++;
+	LSWDBGP(DBG_OPPO, buf) {
+		ipstr_buf b;
+		lswlogf(buf, "OE cache: %s: skipping, %s %u times; retry in ",
+			ipstr(&key, &b), oe_outcome_name[e->outcome],
+			e->failures);
+		lswlog_deltatime(buf, monotimediff(e->retry, now));
+		lswlogs(buf, " seconds");
+	}
+	return true;
+}
+
+/*
+ * Persistence; each line is:
+ *
+ *   <peer> <outcome> <failures> <retry-in-ms> <forget-in-ms>
+ *
+ * monotime is meaningless across restarts so store the remaining
+ * time.
+ */
+
+static void load_oe_cache(void)
+{
+	FILE *f = fopen(oe_cache_file, "r");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			LOG_ERRNO(errno, "cannot open OE cache file \"%s\"", oe_cache_file);
+		}
+		return;
+	}
+
+	monotime_t now = mononow();
+	unsigned loaded = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char addr[100];
+		char outcome_name[20];
+		unsigned failures;
+		intmax_t retry_ms;
+		intmax_t forget_ms;
+		ip_address peer;
+		if (sscanf(line, "%99s %19s %u %jd %jd", addr, outcome_name,
+			   &failures, &retry_ms, &forget_ms) != 5 ||
+		    ttoaddr_num(addr, 0, AF_UNSPEC, &peer) != NULL ||
+		    forget_ms <= 0) {
+			continue;
+		}
+		for (unsigned o = 0; o < elemsof(oe_outcome_name); o++) {
+			if (streq(outcome_name, oe_outcome_name[o])) {
+				struct oe_entry *e = oe_entry_by_peer(&peer);
+				if (e == NULL) {
+					e = add_oe_entry(&peer);
+				}
+				e->outcome = o;
+				e->failures = failures;
+				e->retry = monotimesum(now, deltatime_ms(retry_ms > 0 ? retry_ms : 0));
+				e->forget = monotimesum(now, deltatime_ms(forget_ms));
+				loaded++;
+				break;
+			}
+		}
+	}
+	fclose(f);
+	libreswan_log("loaded %u OE cache entries from \"%s\"", loaded, oe_cache_file);
+}
+
+static void save_oe_cache(void)
+{
+	FILE *f = fopen(oe_cache_file, "w");
+	if (f == NULL) {
+		LOG_ERRNO(errno, "cannot create OE cache file \"%s\"", oe_cache_file);
+		return;
+	}
+
+	monotime_t now = mononow();
+	struct oe_entry *e;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&oe_lru, e) {
+		if (!monobefore(now, e->forget)) {
+			continue;
+		}
+		ipstr_buf b;
+		fprintf(f, "%s %s %u %jd %jd\n",
+			ipstr(&e->peer, &b), oe_outcome_name[e->outcome],
+			e->failures,
+			deltamillisecs(monotimediff(e->retry, now)),
+			deltamillisecs(monotimediff(e->forget, now)));
+	}
+	if (fclose(f) != 0) {
+		LOG_ERRNO(errno, "cannot write OE cache file \"%s\"", oe_cache_file);
+	}
+}
+
+void init_oe_cache(void)
+{
+	init_list(&oe_lru_info, &oe_lru);
+	init_hash_table(&oe_peer_table);
+	if (oe_cache_enabled() && oe_cache_file != NULL) {
+		load_oe_cache();
+	}
+}
+
+void free_oe_cache(void)
+{
+	if (oe_cache_enabled() && oe_cache_file != NULL) {
+		save_oe_cache();
+	}
+	struct oe_entry *e;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(&oe_lru, e) {
+		free_oe_entry(e);
+	}
+}
+
+void show_oe_cache_hash_status(void)
+{
+	if (oe_cache_enabled()) {
+		show_hash_table_status("oe_cache", &oe_peer_table);
+	}
+}
+
+void show_oe_cache_status(void)
+{
+	if (!oe_cache_enabled()) {
+		return;
+	}
+	whack_log(RC_COMMENT, "OE cache: %ld entries (max %u), skipped=%lu, evicted=%lu, success=%lu, no-ipseckey=%lu, no-response=%lu, auth-failed=%lu",
+		  oe_peer_table.nr_entries, oe_cache_size,
+		  oe_stats.skipped, oe_stats.evicted,
+		  oe_stats.recorded[OE_SUCCESS],
+		  oe_stats.recorded[OE_NO_IPSECKEY],
+		  oe_stats.recorded[OE_NO_RESPONSE],
+		  oe_stats.recorded[OE_AUTH_FAILED]);
+	whack_log(RC_COMMENT, " ");	/* spacer */
+}
@@ -0,0 +1,62 @@
+/* remember the outcome of opportunistic negotiations, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef OE_CACHE_H
+#define OE_CACHE_H
+
+#include <stdbool.h>
+
+#include "deltatime.h"
+#include "monotime.h"
+#include "ip_address.h"
+
+enum oe_outcome {
+	OE_SUCCESS,
+	OE_NO_IPSECKEY,
+	OE_NO_RESPONSE,
+	OE_AUTH_FAILED,
+};
+
+/*
+ * Settings, from the command line.
+ *
+ * OE_CACHE_TTL: how long to wait before trying a peer again after its
+ * first failure; it doubles with each further failure up to
+ * OE_CACHE_MAX_TTL.  Zero disables the cache.
+ *
+ * OE_CACHE_SIZE: the maximum number of peers remembered; the least
+ * recently updated is forgotten first.
+ *
+ * OE_CACHE_FILE: when non-NULL, load the cache from this file at
+ * startup and save it there on exit.
+ */
+extern deltatime_t oe_cache_ttl;
+extern deltatime_t oe_cache_max_ttl;
+extern unsigned oe_cache_size;
+extern char *oe_cache_file;
+
+extern void init_oe_cache(void);
+extern void free_oe_cache(void);
+
+extern void oe_cache_record(const ip_address *peer, enum oe_outcome outcome);
+
+/*
+ * Should an opportunistic negotiation with PEER be skipped because
+ * it recently failed?
+ */
+extern bool oe_cache_negative(const ip_address *peer);
+
+extern void show_oe_cache_status(void);
+extern void show_oe_cache_hash_status(void);
+
+#endif
@@ -32,6 +32,19 @@
 
 #include "packet.h"
 
+static void start_next_payload_chain(pb_stream *message,
+				     struct_desc *sd, field_desc *fp,
+				     const uint8_t *inp, uint8_t *cur);
+static void update_next_payload_chain(pb_stream *outs,
+				      struct_desc *sd, field_desc *fp,
+				      const uint8_t *inp, uint8_t *cur);
+static void update_last_substructure(pb_stream *outs,
+				     struct_desc *sd, field_desc *fp,
+				     const uint8_t *inp, uint8_t *cur);
+
+/* in the build directory */
+#include "packet_codec.h"
+
 const pb_stream empty_pbs;
 
 /* ISAKMP Header: for all messages
@@ -68,6 +81,7 @@ static field_desc isa_fields[] = {
 struct_desc isakmp_hdr_desc = {
 	.name = "ISAKMP Message",
 	.fields = isa_fields,
+	.codec = &isa_fields_codec,
 	.size = sizeof(struct isakmp_hdr),
 	.pt = ISAKMP_NEXT_NONE,
 };
@@ -115,6 +129,7 @@ static field_desc isaat_fields_oakley[] = {
 struct_desc isakmp_oakley_attribute_desc = {
 	.name = "ISAKMP Oakley attribute",
 	.fields = isaat_fields_oakley,
+	.codec = &isaat_fields_oakley_codec,
 	.size = sizeof(struct isakmp_attribute),
 };
 
@@ -128,6 +143,7 @@ static field_desc isaat_fields_ipsec[] = {
 struct_desc isakmp_ipsec_attribute_desc = {
 	.name = "ISAKMP IPsec DOI attribute",
 	.fields = isaat_fields_ipsec,
+	.codec = &isaat_fields_ipsec_codec,
 	.size = sizeof(struct isakmp_attribute),
 };
 
@@ -179,6 +195,7 @@ static field_desc isasa_fields[] = {
 struct_desc isakmp_sa_desc = {
 	.name = "ISAKMP Security Association Payload",
 	.fields = isasa_fields,
+	.codec = &isasa_fields_codec,
 	.size = sizeof(struct isakmp_sa),
 	.pt = ISAKMP_NEXT_SA,
 	.nsst = ISAKMP_NEXT_P,
@@ -235,6 +252,7 @@ static field_desc isap_fields[] = {
 struct_desc isakmp_proposal_desc = {
 	.name = "ISAKMP Proposal Payload",
 	.fields = isap_fields,
+	.codec = &isap_fields_codec,
 	.size = sizeof(struct isakmp_proposal),
 	.nsst = ISAKMP_NEXT_T,
 };
@@ -282,6 +300,7 @@ static field_desc isat_fields_isakmp[] = {
 struct_desc isakmp_isakmp_transform_desc = {
 	.name = "ISAKMP Transform Payload (ISAKMP)",
 	.fields = isat_fields_isakmp,
+	.codec = &isat_fields_isakmp_codec,
 	.size = sizeof(struct isakmp_transform),
 };
 
@@ -316,6 +335,7 @@ static field_desc isat_fields_esp[] = {
 struct_desc isakmp_esp_transform_desc = {
 	.name = "ISAKMP Transform Payload (ESP)",
 	.fields = isat_fields_esp,
+	.codec = &isat_fields_esp_codec,
 	.size = sizeof(struct isakmp_transform),
 };
 
@@ -353,6 +373,7 @@ struct_desc isakmp_ipcomp_transform_desc = {
 struct_desc isakmp_keyex_desc =	{
 	.name = "ISAKMP Key Exchange Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_KE,
 };
@@ -387,6 +408,7 @@ static field_desc isaid_fields[] = {
 struct_desc isakmp_identification_desc = {
 	.name = "ISAKMP Identification Payload",
 	.fields = isaid_fields,
+	.codec = &isaid_fields_codec,
 	.size = sizeof(struct isakmp_id),
 	.pt = ISAKMP_NEXT_ID,
 };
@@ -506,6 +528,7 @@ struct_desc isakmp_ipsec_cert_req_desc = {
 struct_desc isakmp_hash_desc = {
 	.name = "ISAKMP Hash Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_HASH,
 };
@@ -527,6 +550,7 @@ struct_desc isakmp_hash_desc = {
 struct_desc isakmp_signature_desc = {
 	.name = "ISAKMP Signature Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_SIG,
 };
@@ -548,6 +572,7 @@ struct_desc isakmp_signature_desc = {
 struct_desc isakmp_nonce_desc =	{
 	.name = "ISAKMP Nonce Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_NONCE,
 };
@@ -589,6 +614,7 @@ static field_desc isan_fields[] = {
 struct_desc isakmp_notification_desc = {
 	.name = "ISAKMP Notification Payload",
 	.fields = isan_fields,
+	.codec = &isan_fields_codec,
 	.size = sizeof(struct isakmp_notification),
 	.pt = ISAKMP_NEXT_N,
 };
@@ -646,6 +672,7 @@ struct_desc isakmp_delete_desc = {
 struct_desc isakmp_vendor_id_desc = {
 	.name = "ISAKMP Vendor ID Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_VID,
 };
@@ -713,6 +740,7 @@ struct_desc isakmp_attr_desc = {
 struct_desc isakmp_nat_d = {
 	.name = "ISAKMP NAT-D Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_NATD_RFC,
 };
@@ -720,6 +748,7 @@ struct_desc isakmp_nat_d = {
 struct_desc isakmp_nat_d_drafts = {
 	.name = "ISAKMP NAT-D Payload (draft)",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_NATD_DRAFTS,
 };
@@ -764,6 +793,7 @@ struct_desc isakmp_nat_oa_drafts = {
 struct_desc isakmp_ignore_desc = {
 	.name = "ignored ISAKMP Generic Payload",
 	.fields = isag_fields,
+	.codec = &isag_fields_codec,
 	.size = sizeof(struct isakmp_generic),
 	.pt = ISAKMP_NEXT_NONE,
 };
@@ -813,6 +843,7 @@ static field_desc ikev2generic_fields[] = {
 struct_desc ikev2_generic_desc = {
 	.name = "IKEv2 Generic Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2NONE,	/* could be any unknown */
 };
@@ -820,6 +851,7 @@ struct_desc ikev2_generic_desc = {
 struct_desc ikev2_unknown_payload_desc = {
 	.name = "IKEv2 Unknown Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2UNKNOWN,
 };
@@ -844,6 +876,7 @@ struct_desc ikev2_unknown_payload_desc = {
 struct_desc ikev2_sa_desc = {
 	.name = "IKEv2 Security Association Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_sa),
 	.pt = ISAKMP_NEXT_v2SA,
 	.nsst = v2_PROPOSAL_NON_LAST,
@@ -884,6 +917,7 @@ static field_desc ikev2prop_fields[] = {
 struct_desc ikev2_prop_desc = {
 	.name = "IKEv2 Proposal Substructure Payload",
 	.fields = ikev2prop_fields,
+	.codec = &ikev2prop_fields_codec,
 	.size = sizeof(struct ikev2_prop),
 	.nsst = v2_TRANSFORM_NON_LAST,
 };
@@ -918,6 +952,7 @@ static field_desc ikev2trans_fields[] = {
 struct_desc ikev2_trans_desc = {
 	.name = "IKEv2 Transform Substructure Payload",
 	.fields = ikev2trans_fields,
+	.codec = &ikev2trans_fields_codec,
 	.size = sizeof(struct ikev2_trans),
 };
 
@@ -944,6 +979,7 @@ static field_desc ikev2_trans_attr_fields[] = {
 struct_desc ikev2_trans_attr_desc = {
 	.name = "IKEv2 Attribute Substructure Payload",
 	.fields = ikev2_trans_attr_fields,
+	.codec = &ikev2_trans_attr_fields_codec,
 	.size = sizeof(struct ikev2_trans_attr),
 };
 
@@ -981,6 +1017,7 @@ static field_desc ikev2ke_fields[] = {
 struct_desc ikev2_ke_desc = {
 	.name = "IKEv2 Key Exchange Payload",
 	.fields = ikev2ke_fields,
+	.codec = &ikev2ke_fields_codec,
 	.size = sizeof(struct ikev2_ke),
 	.pt = ISAKMP_NEXT_v2KE,
 };
@@ -1028,6 +1065,7 @@ static field_desc ikev2id_fields[] = {
 struct_desc ikev2_id_i_desc = {
 	.name ="IKEv2 Identification - Initiator - Payload",
 	.fields = ikev2id_fields,
+	.codec = &ikev2id_fields_codec,
 	.size = sizeof(struct ikev2_id),
 	.pt = ISAKMP_NEXT_v2IDi,
 };
@@ -1035,6 +1073,7 @@ struct_desc ikev2_id_i_desc = {
 struct_desc ikev2_id_r_desc = {
 	.name ="IKEv2 Identification - Responder - Payload",
 	.fields = ikev2id_fields,
+	.codec = &ikev2id_fields_codec,
 	.size = sizeof(struct ikev2_id),
 	.pt = ISAKMP_NEXT_v2IDr,
 };
@@ -1192,6 +1231,7 @@ static field_desc ikev2a_fields[] = {
 struct_desc ikev2_a_desc = {
 	.name = "IKEv2 Authentication Payload",
 	.fields = ikev2a_fields,
+	.codec = &ikev2a_fields_codec,
 	.size = sizeof(struct ikev2_a),
 	.pt = ISAKMP_NEXT_v2AUTH,
 };
@@ -1221,6 +1261,7 @@ struct_desc ikev2_a_desc = {
 struct_desc ikev2_nonce_desc = {
 	.name = "IKEv2 Nonce Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2Ni, /*==ISAKMP_NEXT_v2Nr*/
 };
@@ -1258,6 +1299,7 @@ static field_desc ikev2_notify_fields[] = {
 struct_desc ikev2_notify_desc = {
 	.name = "IKEv2 Notify Payload",
 	.fields = ikev2_notify_fields,
+	.codec = &ikev2_notify_fields_codec,
 	.size = sizeof(struct ikev2_notify),
 	.pt = ISAKMP_NEXT_v2N,
 };
@@ -1315,6 +1357,7 @@ struct_desc ikev2_delete_desc = {
 struct_desc ikev2_vendor_id_desc = {
 	.name = "IKEv2 Vendor ID Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2V,
 };
@@ -1351,12 +1394,14 @@ static field_desc ikev2ts_fields[] = {
 struct_desc ikev2_ts_i_desc = {
 	.name = "IKEv2 Traffic Selector - Initiator - Payload",
 	.fields = ikev2ts_fields,
+	.codec = &ikev2ts_fields_codec,
 	.size = sizeof(struct ikev2_ts),
 	.pt = ISAKMP_NEXT_v2TSi,
 };
 struct_desc ikev2_ts_r_desc = {
 	.name = "IKEv2 Traffic Selector - Responder - Payload",
 	.fields = ikev2ts_fields,
+	.codec = &ikev2ts_fields_codec,
 	.size = sizeof(struct ikev2_ts),
 	.pt = ISAKMP_NEXT_v2TSr,
 };
@@ -1393,6 +1438,7 @@ static field_desc ikev2ts1_fields[] = {
 struct_desc ikev2_ts1_desc = {
 	.name = "IKEv2 Traffic Selector",
 	.fields = ikev2ts1_fields,
+	.codec = &ikev2ts1_fields_codec,
 	.size = sizeof(struct ikev2_ts1),
 };
 
@@ -1420,6 +1466,7 @@ struct_desc ikev2_ts1_desc = {
 struct_desc ikev2_sk_desc = {
 	.name = "IKEv2 Encryption Payload",
 	.fields = ikev2generic_fields,
+	.codec = &ikev2generic_fields_codec,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2SK,
 };
@@ -1918,6 +1965,23 @@ bool in_struct(void *struct_ptr, struct_desc *sd,
 	err_t ugh = NULL;
 	uint8_t *cur = ins->cur;
 
+	/* the interpreter reports problems and does the debug output */
+	if (sd->codec != NULL && !DBGP(DBG_PARSING) &&
+	    ins->roof - cur >= (ptrdiff_t)sd->size) {
+		size_t len;
+		if (sd->codec->in(sd, cur, struct_ptr, &len) &&
+		    len >= sd->size && len <= pbs_left(ins)) {
+			if (obj_pbs != NULL) {
+				init_pbs(obj_pbs, cur, len, sd->name);
+				obj_pbs->container = ins;
+				obj_pbs->desc = sd;
+				obj_pbs->cur = cur + sd->size;
+			}
+			ins->cur = cur + len;
+			return TRUE;
+		}
+	}
+
 	if (ins->roof - cur < (ptrdiff_t)sd->size) {
 		ugh = builddiag("not enough room in input packet for %s (remain=%li, sd->size=%zu)",
 				sd->name, (long int)(ins->roof - cur),
@@ -2292,6 +2356,27 @@ static void update_next_payload_chain(pb_stream *outs,
 	message->next_payload_chain.fp = fp;
 }
 
+static void out_struct_done(pb_stream *outs, pb_stream *obj, uint8_t *cur,
+			    pb_stream *obj_pbs)
+{
+	obj->start = outs->cur;
+	obj->cur = cur;
+	obj->roof = outs->roof; /* limit of possible */
+	/* obj->lenfld* and obj->previous_np* already set */
+
+	if (obj_pbs == NULL) {
+		close_output_pbs(obj); /* fill in length field, if any */
+	} else {
+		/* We set outs->cur to outs->roof so that
+		 * any attempt to output something into outs
+		 * before obj is closed will trigger an error.
+		 */
+		outs->cur = outs->roof;
+
+		*obj_pbs = *obj;
+	}
+}
+
 /* "emit" a host struct into a network packet.
  *
  * This code assumes that the network and host structure
@@ -2346,6 +2431,13 @@ bool out_struct(const void *struct_ptr, struct_desc *sd,
 			/* .last_substructure = {0}, */
 		};
 
+		if (sd->codec != NULL &&
+		    sd->codec->out(sd, struct_ptr, outs, &obj)) {
+			out_struct_done(outs, &obj, outs->cur + sd->size,
+					obj_pbs);
+			return TRUE;
+		}
+
 		for (field_desc *fp = sd->fields; ugh == NULL; fp++) {
 			size_t i = fp->size;
 
@@ -2505,23 +2597,7 @@ bool out_struct(const void *struct_ptr, struct_desc *sd,
 
 			case ft_end: /* end of field list */
 				passert(cur == outs->cur + sd->size);
-
-				obj.start = outs->cur;
-				obj.cur = cur;
-				obj.roof = outs->roof; /* limit of possible */
-				/* obj.lenfld* and obj.previous_np* already set */
-
-				if (obj_pbs == NULL) {
-					close_output_pbs(&obj); /* fill in length field, if any */
-				} else {
-					/* We set outs->cur to outs->roof so that
-					 * any attempt to output something into outs
-					 * before obj is closed will trigger an error.
-					 */
-					outs->cur = outs->roof;
-
-					*obj_pbs = obj;
-				}
+				out_struct_done(outs, &obj, cur, obj_pbs);
 				return TRUE;
 
 			default:
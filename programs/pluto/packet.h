@@ -68,12 +68,16 @@ typedef const struct {
 	const void *desc;
 } field_desc;
 
+struct struct_codec;
+
 typedef const struct {
 	const char *name;
 	field_desc *fields;
 	size_t size;
 	int pt;	/* this payload type */
 	unsigned nsst; /* Nested Substructure Type */
+	/* generated from FIELDS; NULL: interpret FIELDS */
+	const struct struct_codec *codec;
 } struct_desc;
 
 /*
@@ -151,6 +155,19 @@ struct packet_byte_stream {
 
 typedef struct packet_byte_stream pb_stream;
 
+/*
+ * Straight-line versions of the in_struct() and out_struct() field
+ * loops, generated from a struct_desc's field table by
+ * packet_codec.awk.  Each returns false, having logged nothing, when
+ * a field needs the interpreter (for instance to report it).
+ */
+struct struct_codec {
+	bool (*in)(struct_desc *sd, const uint8_t *in,
+		   void *struct_ptr, size_t *len);
+	bool (*out)(struct_desc *sd, const void *struct_ptr,
+		    pb_stream *outs, pb_stream *obj);
+};
+
 extern const pb_stream empty_pbs;
 
 /*
@@ -0,0 +1,316 @@
+# generate straight-line struct codecs from packet.c, for libreswan
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+
+# Usage: awk -f packet_codec.awk packet.c > packet_codec.h
+#
+# For every field_desc table FIELDS that a struct_desc in packet.c
+# names with ".codec = &FIELDS_codec", emit:
+#
+#   in_FIELDS(): decode the wire bytes into the host struct, checking
+#   each field as in_struct() would; returns false, before logging
+#   anything, when in_struct() needs to handle (and report) it.
+#
+#   out_FIELDS(): check every field and then encode the host struct,
+#   including the next payload chain and length fix-ups, as
+#   out_struct() would; returns false, before changing anything, when
+#   out_struct() needs to handle (and report) it.
+#
+# The result is #included by packet.c so that the codecs can use its
+# static helpers.
+
+/^static field_desc [a-z0-9_]+\[\] = {/ {
+	name = $3
+	sub(/\[\]$/, "", name)
+	table = ""
+	in_table = 1
+	next
+}
+
+in_table && /^};/ {
+	tables[name] = table
+	in_table = 0
+	next
+}
+
+in_table {
+	line = $0
+	sub(/\/\*.*\*\//, "", line)
+	table = table " " line
+	next
+}
+
+/\.codec = &[a-z0-9_]+_codec,/ {
+	codec = $0
+	sub(/.*\.codec = &/, "", codec)
+	sub(/_codec,.*/, "", codec)
+	if (!(codec in wanted)) {
+		wanted[codec] = 1
+		order[nr_wanted++] = codec
+	}
+}
+
+# split TABLE into the arrays type[], size[] and off[]; return the count
+function parse(table,    n, entry, f, nf, s, num, sym)
+{
+	n = 0
+	num = 0
+	sym = ""
+	while (match(table, /{[^}]*}/)) {
+		entry = substr(table, RSTART + 1, RLENGTH - 2)
+		table = substr(table, RSTART + RLENGTH)
+		nf = split(entry, f, ",")
+		gsub(/[ \t]/, "", f[1])
+		s = f[2]
+		gsub(/^[ \t]+|[ \t]+$/, "", s)
+		type[n] = f[1]
+		off[n] = (sym == "" ? num : sym (num > 0 ? " + " num : ""))
+		if (type[n] == "ft_end")
+			return n
+		if (s ~ /^[0-9]+ *\/ *BITS_PER_BYTE$/) {
+			sub(/ *\/.*/, "", s)
+			size[n] = s / 8
+			num += size[n]
+		} else {
+			size[n] = s
+			sym = (sym == "" ? s : sym " + " s)
+		}
+		n++
+	}
+	print "packet_codec.awk: no ft_end in " name > "/dev/stderr"
+	exit 1
+}
+
+# does out_FIELDS() need the host value of a field of type T?
+function valued(t)
+{
+	return t != "ft_zig" && t != "ft_raw" && t != "ft_len" &&
+		t != "ft_mnpc" && t != "ft_pnpc" && t != "ft_lss"
+}
+
+# network-order load of field I from IN
+function load(i,    o)
+{
+	o = off[i]
+	if (size[i] == 1)
+		return "in[" o "]"
+	if (size[i] == 2)
+		return "(uint32_t)in[" o "] << 8 | in[" o " + 1]"
+	if (size[i] == 4)
+		return "(uint32_t)in[" o "] << 24 | (uint32_t)in[" o " + 1] << 16 | (uint32_t)in[" o " + 2] << 8 | in[" o " + 3]"
+	print "packet_codec.awk: bad size " size[i] " in " name > "/dev/stderr"
+	exit 1
+}
+
+function host_type(i)
+{
+	return "uint" (size[i] * 8) "_t"
+}
+
+function emit_in(name, n,    i, t, needs_enum, needs_immediate)
+{
+	needs_enum = 0
+	needs_immediate = 0
+	for (i = 0; i < n; i++) {
+		if (type[i] == "ft_loose_enum_enum")
+			needs_enum = 1
+		if (type[i] == "ft_lv")
+			needs_immediate = 1
+	}
+
+	print "static bool in_" name "(struct_desc *sd, const uint8_t *in,"
+	print "\t\t\tvoid *struct_ptr, size_t *len)"
+	print "{"
+	print "\tuint8_t *out = struct_ptr;"
+	print "\tuint32_t n;"
+	if (needs_enum)
+		print "\tuint32_t last_enum = 0;"
+	if (needs_immediate)
+		print "\tbool immediate = false;"
+	print "\t*len = sd->size;"
+	for (i = 0; i < n; i++) {
+		t = type[i]
+		print ""
+		print "\t/* " t " */"
+		if (t == "ft_zig") {
+			print "\tfor (size_t i = 0; i < " size[i] "; i++) {"
+			print "\t\tif (in[" off[i] " + i] != 0)"
+			print "\t\t\treturn false;"
+			print "\t\tout[" off[i] " + i] = 0;"
+			print "\t}"
+			continue
+		}
+		if (t == "ft_raw") {
+			print "\tmemcpy(out + " off[i] ", in + " off[i] ", " size[i] ");"
+			continue
+		}
+		print "\tn = " load(i) ";"
+		if (t == "ft_len") {
+			print "\t*len = n;"
+		} else if (t == "ft_lv") {
+			print "\t*len = immediate ? sd->size : n + sd->size;"
+		} else if (t == "ft_enum") {
+			print "\tif (enum_name(sd->fields[" i "].desc, n) == NULL)"
+			print "\t\treturn false;"
+			if (needs_enum)
+				print "\tlast_enum = n;"
+		} else if (t == "ft_af_enum" || t == "ft_af_loose_enum") {
+			if (needs_immediate)
+				print "\timmediate = (n & ISAKMP_ATTR_AF_MASK) == ISAKMP_ATTR_AF_TV;"
+			if (t == "ft_af_enum") {
+				print "\tif (enum_name(sd->fields[" i "].desc, n) == NULL)"
+				print "\t\treturn false;"
+			}
+			if (needs_enum)
+				print "\tlast_enum = n & ~ISAKMP_ATTR_AF_MASK;"
+		} else if (t == "ft_loose_enum_enum") {
+			print "\tif (enum_enum_table(sd->fields[" i "].desc, last_enum) == NULL)"
+			print "\t\treturn false;"
+		} else if (t == "ft_set") {
+			print "\tif (!testset(sd->fields[" i "].desc, n))"
+			print "\t\treturn false;"
+		} else if (t == "ft_loose_enum" || t == "ft_mnpc" || t == "ft_pnpc" || t == "ft_lss") {
+			if (needs_enum)
+				print "\tlast_enum = n;"
+		}
+		print "\t*(" host_type(i) " *)(out + " off[i] ") = n;"
+	}
+	print "\treturn true;"
+	print "}"
+	print ""
+}
+
+# network-order store of V into field I at CUR, indented by IND
+function store(i, v, ind,    o, b, s)
+{
+	o = off[i]
+	s = ""
+	for (b = 0; b < size[i]; b++) {
+		s = s ind "cur[" o " + " b "] = " v " >> " (size[i] - 1 - b) * 8 ";\n"
+	}
+	gsub(/ >> 0;/, ";", s)
+	gsub(/ \+ 0\]/, "]", s)
+	return substr(s, 1, length(s) - 1)
+}
+
+function emit_out(name, n,    i, t, ind, needs_enum, needs_immediate)
+{
+	needs_enum = 0
+	needs_immediate = 0
+	for (i = 0; i < n; i++) {
+		if (type[i] == "ft_loose_enum_enum")
+			needs_enum = 1
+		if (type[i] == "ft_lv")
+			needs_immediate = 1
+	}
+
+	print "static bool out_" name "(struct_desc *sd, const void *struct_ptr,"
+	print "\t\t\tpb_stream *outs, pb_stream *obj)"
+	print "{"
+	print "\tconst uint8_t *inp = struct_ptr;"
+	print "\tuint8_t *cur = outs->cur;"
+	if (needs_enum)
+		print "\tuint32_t last_enum = 0;"
+	if (needs_immediate)
+		print "\tbool immediate = false;"
+	for (i = 0; i < n; i++) {
+		if (valued(type[i]))
+			print "\tuint32_t v" i " = *(const " host_type(i) " *)(inp + " off[i] ");"
+	}
+
+	print ""
+	print "\t/* check */"
+	for (i = 0; i < n; i++) {
+		t = type[i]
+		if (t == "ft_enum") {
+			print "\tif (enum_name(sd->fields[" i "].desc, v" i ") == NULL)"
+			print "\t\treturn false;"
+			if (needs_enum)
+				print "\tlast_enum = v" i ";"
+		} else if (t == "ft_loose_enum") {
+			if (needs_enum)
+				print "\tlast_enum = v" i ";"
+		} else if (t == "ft_af_enum" || t == "ft_af_loose_enum") {
+			if (needs_immediate)
+				print "\timmediate = (v" i " & ISAKMP_ATTR_AF_MASK) == ISAKMP_ATTR_AF_TV;"
+			if (t == "ft_af_enum") {
+				print "\tif (enum_name(sd->fields[" i "].desc, v" i ") == NULL)"
+				print "\t\treturn false;"
+			}
+			if (needs_enum)
+				print "\tlast_enum = v" i " & ~ISAKMP_ATTR_AF_MASK;"
+		} else if (t == "ft_loose_enum_enum") {
+			print "\tif (enum_enum_table(sd->fields[" i "].desc, last_enum) == NULL)"
+			print "\t\treturn false;"
+		} else if (t == "ft_set") {
+			print "\tif (!testset(sd->fields[" i "].desc, v" i "))"
+			print "\t\treturn false;"
+		} else if (t == "ft_mnpc" || t == "ft_pnpc" || t == "ft_lss") {
+			if (needs_enum)
+				print "\tlast_enum = ISAKMP_NEXT_NONE;"
+		}
+	}
+
+	print ""
+	print "\t/* emit */"
+	for (i = 0; i < n; i++) {
+		t = type[i]
+		if (t == "ft_zig") {
+			print "\tmemset(cur + " off[i] ", 0, " size[i] ");"
+		} else if (t == "ft_raw") {
+			print "\tmemcpy(cur + " off[i] ", inp + " off[i] ", " size[i] ");"
+		} else if (t == "ft_mnpc") {
+			print "\tstart_next_payload_chain(outs, sd, &sd->fields[" i "], inp + " off[i] ", cur + " off[i] ");"
+		} else if (t == "ft_pnpc") {
+			print "\tupdate_next_payload_chain(outs, sd, &sd->fields[" i "], inp + " off[i] ", cur + " off[i] ");"
+		} else if (t == "ft_lss") {
+			print "\tupdate_last_substructure(outs, sd, &sd->fields[" i "], inp + " off[i] ", cur + " off[i] ");"
+		} else if (t == "ft_len" || t == "ft_lv") {
+			ind = "\t"
+			if (t == "ft_lv") {
+				print "\tif (immediate) {"
+				print store(i, "v" i, "\t\t")
+				print "\t} else {"
+				ind = "\t\t"
+			}
+			print ind "obj->lenfld = cur + " off[i] ";"
+			print ind "obj->lenfld_desc = &sd->fields[" i "];"
+			print ind "memset(cur + " off[i] ", 0xFA, " size[i] ");"
+			if (t == "ft_lv")
+				print "\t}"
+		} else {
+			print store(i, "v" i, "\t")
+		}
+	}
+	print "\treturn true;"
+	print "}"
+	print ""
+}
+
+END {
+	print "/* generated from packet.c by packet_codec.awk; do not edit */"
+	print ""
+	for (w = 0; w < nr_wanted; w++) {
+		name = order[w]
+		if (!(name in tables)) {
+			print "packet_codec.awk: no field_desc " name "[]" > "/dev/stderr"
+			exit 1
+		}
+		n = parse(tables[name])
+		emit_in(name, n)
+		emit_out(name, n)
+		print "static const struct struct_codec " name "_codec = {"
+		print "\t.in = in_" name ","
+		print "\t.out = out_" name ","
+		print "};"
+		print ""
+	}
+}
@@ -77,9 +77,18 @@ unsigned long pstats_ipsec_tfc;
 unsigned long pstats_ike_dpd_recv;
 unsigned long pstats_ike_dpd_sent;
 unsigned long pstats_ike_dpd_replied;
+unsigned long pstats_ike_dpd_suppressed;
+unsigned long pstats_ike_retransmits;
+unsigned long pstats_ike_retransmits_deferred;
+unsigned long pstats_ike_retransmits_dropped;
 unsigned long pstats_xauth_started;
 unsigned long pstats_xauth_stopped;
 unsigned long pstats_xauth_aborted;
+unsigned long pstats_kernel_netlink_msgs;
+unsigned long pstats_kernel_netlink_xfrm_overruns;
+unsigned long pstats_kernel_netlink_route_overruns;
+unsigned long pstats_kernel_netlink_resyncs;
+unsigned long pstats_kernel_netlink_resync_acquires;
 
 #define PLUTO_STAT(TYPE, NAMES, WHAT, FLOOR, ROOF)			\
 	static unsigned long pstats_##TYPE##_count[ROOF-FLOOR +1/*overflow*/]; \
@@ -189,6 +198,10 @@ void show_pluto_stats()
 	whack_log_comment("total.ike.dpd.sent=%lu", pstats_ike_dpd_sent);
 	whack_log_comment("total.ike.dpd.recv=%lu", pstats_ike_dpd_recv);
 	whack_log_comment("total.ike.dpd.replied=%lu", pstats_ike_dpd_replied);
+	whack_log_comment("total.ike.dpd.suppressed=%lu", pstats_ike_dpd_suppressed);
+	whack_log_comment("total.ike.retransmits.sent=%lu", pstats_ike_retransmits);
+	whack_log_comment("total.ike.retransmits.deferred=%lu", pstats_ike_retransmits_deferred);
+	whack_log_comment("total.ike.retransmits.dropped=%lu", pstats_ike_retransmits_dropped);
 	whack_log_comment("total.ike.traffic.in=%lu", pstats_ike_in_bytes);
 	whack_log_comment("total.ike.traffic.out=%lu", pstats_ike_out_bytes);
 
@@ -196,6 +209,12 @@ void show_pluto_stats()
 	whack_log_comment("total.xauth.stopped=%lu", pstats_xauth_stopped);
 	whack_log_comment("total.xauth.aborted=%lu", pstats_xauth_aborted);
 
+	whack_log_comment("total.kernel.netlink.messages=%lu", pstats_kernel_netlink_msgs);
+	whack_log_comment("total.kernel.netlink.xfrm.overruns=%lu", pstats_kernel_netlink_xfrm_overruns);
+	whack_log_comment("total.kernel.netlink.route.overruns=%lu", pstats_kernel_netlink_route_overruns);
+	whack_log_comment("total.kernel.netlink.resyncs=%lu", pstats_kernel_netlink_resyncs);
+	whack_log_comment("total.kernel.netlink.resync.acquires=%lu", pstats_kernel_netlink_resync_acquires);
+
 	ENUM_STATS(&oakley_enc_names, OAKLEY_3DES_CBC, "ikev1.encr", pstats_ikev1_encr);
 	ENUM_STATS(&oakley_hash_names, OAKLEY_MD5, "ikev1.integ", pstats_ikev1_integ);
 	ENUM_STATS(&oakley_group_names, OAKLEY_GROUP_MODP768, "ikev1.group", pstats_ikev1_groups);
@@ -245,7 +264,12 @@ void clear_pluto_stats()
 	pstats_ipsec_encap_yes = pstats_ipsec_encap_no = 0;
 	pstats_ipsec_esn = pstats_ipsec_tfc = 0;
 	pstats_ike_dpd_recv = pstats_ike_dpd_sent = pstats_ike_dpd_replied = 0;
+	pstats_ike_dpd_suppressed = 0;
+	pstats_ike_retransmits = pstats_ike_retransmits_deferred = pstats_ike_retransmits_dropped = 0;
 	pstats_xauth_started = pstats_xauth_stopped = pstats_xauth_aborted = 0;
+	pstats_kernel_netlink_msgs = 0;
+	pstats_kernel_netlink_xfrm_overruns = pstats_kernel_netlink_route_overruns = 0;
+	pstats_kernel_netlink_resyncs = pstats_kernel_netlink_resync_acquires = 0;
 
 	memset(pstats_ikev1_encr, 0, sizeof pstats_ikev1_encr);
 	memset(pstats_ikev2_encr, 0, sizeof pstats_ikev2_encr);
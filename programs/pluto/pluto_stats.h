@@ -70,11 +70,21 @@ extern unsigned long pstats_ipsec_tfc;
 extern unsigned long pstats_ike_dpd_recv;
 extern unsigned long pstats_ike_dpd_sent;
 extern unsigned long pstats_ike_dpd_replied;
+extern unsigned long pstats_ike_dpd_suppressed;
+extern unsigned long pstats_ike_retransmits;
+extern unsigned long pstats_ike_retransmits_deferred;
+extern unsigned long pstats_ike_retransmits_dropped;
 
 extern unsigned long pstats_xauth_started;
 extern unsigned long pstats_xauth_stopped;
 extern unsigned long pstats_xauth_aborted;
 
+extern unsigned long pstats_kernel_netlink_msgs;
+extern unsigned long pstats_kernel_netlink_xfrm_overruns;	/* ENOBUFS */
+extern unsigned long pstats_kernel_netlink_route_overruns;	/* ENOBUFS */
+extern unsigned long pstats_kernel_netlink_resyncs;
+extern unsigned long pstats_kernel_netlink_resync_acquires;
+
 extern void show_pluto_stats();
 extern void clear_pluto_stats();
 
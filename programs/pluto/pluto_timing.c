@@ -14,8 +14,13 @@
  *
  */
 
+#include <pthread.h>
+#include <ctype.h>
+
 #include "defs.h"
 #include "state.h"
+#include "log.h"
+#include "whack.h"		/* for RC_COMMENT */
 #include "pluto_timing.h"
 #include "lswlog.h"
 
@@ -24,7 +29,7 @@
 
 static const clockid_t clock_id = CLOCK_THREAD_CPUTIME_ID;
 
-static struct timespec now(void)
+static struct timespec clock_now(clockid_t clock_id)
 {
 	struct timespec now;
 	int e = clock_gettime(clock_id, &now);
@@ -35,6 +40,11 @@ static struct timespec now(void)
 	return now;
 }
 
+static struct timespec now(void)
+{
+	return clock_now(clock_id);
+}
+
 static double seconds_sub(struct timespec stop, const struct timespec start)
 {
 	/* compute seconds */
@@ -193,3 +203,103 @@ void statetime_stop(const statetime_t *start, const char *fmt, ...)
 		st->st_timing.approx_seconds += seconds;
 	}
 }
+
+/*
+ * Startup phases.
+ */
+
+#define MAX_STARTUP_PHASES 24
+
+static struct {
+	pthread_mutex_t mutex;
+	bool started;
+	bool ready;
+	struct timespec began;
+	double ready_seconds;
+	unsigned nr_phases;
+	struct {
+		const char *name;
+		double offset;		/* since BEGAN */
+		double seconds;
+	} phases[MAX_STARTUP_PHASES];
+} startup = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+startuptime_t startuptime_start(void)
+{
+	startuptime_t start = { .tt = clock_now(CLOCK_MONOTONIC), };
+	pthread_mutex_lock(&startup.mutex);
+	{
+		if (!startup.started) {
+			startup.started = true;
+			startup.began = start.tt;
+		}
+	}
+	pthread_mutex_unlock(&startup.mutex);
+	return start;
+}
+
+void startuptime_stop(const startuptime_t *start, const char *name)
+{
+	double seconds = seconds_sub(clock_now(CLOCK_MONOTONIC), start->tt);
+	bool recorded = false;
+	pthread_mutex_lock(&startup.mutex);
+	{
+		if (!startup.ready && startup.nr_phases < MAX_STARTUP_PHASES) {
+			unsigned i = startup.nr_phases++;
+			startup.phases[i].name = name;
+			startup.phases[i].offset = seconds_sub(start->tt, startup.began);
+			startup.phases[i].seconds = seconds;
+			recorded = true;
+		}
+	}
+	pthread_mutex_unlock(&startup.mutex);
+	if (recorded) {
+		dbg("startup: "PRI_CPU_USAGE" in %s", pri_cpu_usage(seconds), name);
+	}
+}
+
+bool startup_ready(void)
+{
+	bool first = false;
+	pthread_mutex_lock(&startup.mutex);
+	{
+		if (!startup.ready) {
+			startup.ready = first = true;
+			startup.ready_seconds = seconds_sub(clock_now(CLOCK_MONOTONIC),
+							    startup.began);
+		}
+	}
+	pthread_mutex_unlock(&startup.mutex);
+	if (first) {
+		libreswan_log("ready to serve, %.3f seconds after starting",
+			      startup.ready_seconds);
+	}
+	return first;
+}
+
+void show_startup_status(void)
+{
+	pthread_mutex_lock(&startup.mutex);
+	{
+		whack_log_comment("startup.ready=%s", startup.ready ? "yes" : "no");
+		if (startup.ready) {
+			whack_log_comment("startup.ready.seconds=%.3f",
+					  startup.ready_seconds);
+		}
+		for (unsigned i = 0; i < startup.nr_phases; i++) {
+			/* "tables and algorithms" -> tables_and_algorithms */
+			char key[64];
+			jam_str(key, sizeof(key), startup.phases[i].name);
+			for (char *c = key; *c != '\0'; c++) {
+				*c = isalnum((unsigned char)*c) ? tolower((unsigned char)*c) : '_';
+			}
+			whack_log_comment("startup.phase.%s.seconds=%.3f",
+					  key, startup.phases[i].seconds);
+			whack_log_comment("startup.phase.%s.offset=%.3f",
+					  key, startup.phases[i].offset);
+		}
+	}
+	pthread_mutex_unlock(&startup.mutex);
+}
@@ -97,4 +97,27 @@ typedef struct {
 statetime_t statetime_start(struct state *st);
 void statetime_stop(const statetime_t *start, const char *fmt, ...) PRINTF_LIKE(2);
 
+/*
+ * For pluto's startup, up to when it can first serve (the first
+ * --listen has found the interfaces and loaded the secrets).  Unlike
+ * the above, this is wall-clock time.
+ *
+ * startuptime_t start = startuptime_start();
+ * do something;
+ * startuptime_stop(&start, "something");
+ * ...
+ * startup_ready();
+ *
+ * A phase can run, and be stopped, on another thread.  The phases
+ * are shown by "whack --globalstatus"; anything stopped after
+ * startup_ready() isn't recorded.
+ */
+
+typedef struct { struct timespec tt; } startuptime_t;
+startuptime_t startuptime_start(void);
+void startuptime_stop(const startuptime_t *start, const char *name);
+/* returns true the first time */
+bool startup_ready(void);
+void show_startup_status(void);
+
 #endif
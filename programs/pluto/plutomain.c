@@ -46,6 +46,12 @@
 #include "nss_ocsp.h"
 #include "server.h"
 #include "kernel.h"	/* needs connections.h */
+#include "updown.h"
+#include "retransmit.h"	/* for retransmit_jitter et.al. */
+#include "initiate_queue.h"
+#include "oe_cache.h"
+#include "proposal_cache.h"
+#include "nss_cert_load.h"
 #include "log.h"
 #include "peerlog.h"
 #include "keys.h"
@@ -59,10 +65,12 @@
 #include "enum_names.h"
 #include "virtual.h"	/* needs connections.h */
 #include "state_db.h"	/* for init_state_db() */
+#include "hash_table.h"	/* for init_hash_table_key() */
 #include "nat_traversal.h"
 #include "ike_alg.h"
 #include "af_info.h"		/* for init_af_info() */
 #include "ikev2_redirect.h"
+#include "pluto_timing.h"
 
 #ifndef IPSECDIR
 #define IPSECDIR "/etc/ipsec.d"
@@ -91,6 +99,14 @@ bool in_main_thread(void)
 	return pthread_equal(pthread_self(), main_thread);
 }
 
+static void *test_ike_alg_thread(void *arg UNUSED)
+{
+	startuptime_t start = startuptime_start();
+	test_ike_alg();
+	startuptime_stop(&start, "algorithm self-tests");
+	return NULL;
+}
+
 static char *rundir = NULL;
 char *pluto_listen = NULL;
 static bool fork_desired = USE_FORK || USE_DAEMON;
@@ -106,6 +122,8 @@ static const struct lsw_conf_options *oco;
 static char *coredir;
 static int pluto_nss_seedbits;
 static int nhelpers = -1;
+static unsigned nr_updown_helpers = 0;
+static unsigned shutdown_deadline = 0;	/* seconds; 0: delete everything at once */
 static bool do_dnssec = FALSE;
 static char *pluto_dnssec_rootfile = NULL;
 static char *pluto_dnssec_trusted = NULL;
@@ -474,6 +492,17 @@ enum {
 	OPT_IMPAIR,
 	OPT_DNSSEC_ROOTKEY_FILE,
 	OPT_DNSSEC_TRUSTED,
+	OPT_UPDOWN_HELPERS,
+	OPT_SHUTDOWN_DEADLINE,
+	OPT_RETRANSMIT_JITTER,
+	OPT_RETRANSMIT_BUDGET,
+	OPT_INITIATE_CONCURRENCY,
+	OPT_INITIATE_RATE,
+	OPT_OE_CACHE_TTL,
+	OPT_OE_CACHE_MAX_TTL,
+	OPT_OE_CACHE_SIZE,
+	OPT_OE_CACHE_FILE,
+	OPT_DPD_INBOUND_TRAFFIC,
 };
 
 static const struct option long_opts[] = {
@@ -560,6 +589,17 @@ static const struct option long_opts[] = {
 	{ "virtual_private\0_", required_argument, NULL, '6' },	/* _ */
 	{ "virtual-private\0<network_list>", required_argument, NULL, '6' },
 	{ "nhelpers\0<number>", required_argument, NULL, 'j' },
+	{ "updown-helpers\0<number>", required_argument, NULL, OPT_UPDOWN_HELPERS },
+	{ "shutdown-deadline\0<secs>", required_argument, NULL, OPT_SHUTDOWN_DEADLINE },
+	{ "retransmit-jitter\0<percent>", required_argument, NULL, OPT_RETRANSMIT_JITTER },
+	{ "retransmit-budget\0<number>", required_argument, NULL, OPT_RETRANSMIT_BUDGET },
+	{ "initiate-concurrency\0<number>", required_argument, NULL, OPT_INITIATE_CONCURRENCY },
+	{ "initiate-rate\0<number>", required_argument, NULL, OPT_INITIATE_RATE },
+	{ "oe-cache-ttl\0<secs>", required_argument, NULL, OPT_OE_CACHE_TTL },
+	{ "oe-cache-max-ttl\0<secs>", required_argument, NULL, OPT_OE_CACHE_MAX_TTL },
+	{ "oe-cache-size\0<number>", required_argument, NULL, OPT_OE_CACHE_SIZE },
+	{ "oe-cache-file\0<filename>", required_argument, NULL, OPT_OE_CACHE_FILE },
+	{ "dpd-inbound-traffic\0", no_argument, NULL, OPT_DPD_INBOUND_TRAFFIC },
 	{ "expire-shunt-interval\0<secs>", required_argument, NULL, '9' },
 	{ "seedbits\0<number>", required_argument, NULL, 'c' },
 #ifdef HAVE_LABELED_IPSEC
@@ -669,6 +709,9 @@ int main(int argc, char **argv)
 	 */
 	main_thread = pthread_self();
 
+	/* also marks the start of startup */
+	startuptime_t start = startuptime_start();
+
 	int lockfd;
 
 	/*
@@ -804,6 +847,78 @@ int main(int argc, char **argv)
 				nhelpers = u;
 			}
 			continue;
+		case OPT_UPDOWN_HELPERS:	/* --updown-helpers */
+			ugh = ttoulb(optarg, 0, 10, 64, &u);
+			if (ugh != NULL)
+				break;
+			nr_updown_helpers = u;
+			continue;
+
+		case OPT_SHUTDOWN_DEADLINE:	/* --shutdown-deadline */
+			ugh = ttoulb(optarg, 0, 10, 3600, &u);
+			if (ugh != NULL)
+				break;
+			shutdown_deadline = u;
+			continue;
+
+		case OPT_RETRANSMIT_JITTER:	/* --retransmit-jitter */
+			ugh = ttoulb(optarg, 0, 10, 50, &u);
+			if (ugh != NULL)
+				break;
+			retransmit_jitter = u;
+			continue;
+
+		case OPT_RETRANSMIT_BUDGET:	/* --retransmit-budget */
+			ugh = ttoulb(optarg, 0, 10, 1000000, &u);
+			if (ugh != NULL)
+				break;
+			retransmit_budget = u;
+			continue;
+
+		case OPT_INITIATE_CONCURRENCY:	/* --initiate-concurrency */
+			ugh = ttoulb(optarg, 0, 10, 1000000, &u);
+			if (ugh != NULL)
+				break;
+			initiate_concurrency = u;
+			continue;
+
+		case OPT_INITIATE_RATE:	/* --initiate-rate */
+			ugh = ttoulb(optarg, 0, 10, 1000000, &u);
+			if (ugh != NULL)
+				break;
+			initiate_rate = u;
+			continue;
+
+		case OPT_OE_CACHE_TTL:	/* --oe-cache-ttl */
+			ugh = ttoulb(optarg, 0, 10, 86400, &u);
+			if (ugh != NULL)
+				break;
+			oe_cache_ttl = deltatime(u);
+			continue;
+
+		case OPT_OE_CACHE_MAX_TTL:	/* --oe-cache-max-ttl */
+			ugh = ttoulb(optarg, 1, 10, 7 * 86400, &u);
+			if (ugh != NULL)
+				break;
+			oe_cache_max_ttl = deltatime(u);
+			continue;
+
+		case OPT_OE_CACHE_SIZE:	/* --oe-cache-size */
+			ugh = ttoulb(optarg, 1, 10, 10000000, &u);
+			if (ugh != NULL)
+				break;
+			oe_cache_size = u;
+			continue;
+
+		case OPT_OE_CACHE_FILE:	/* --oe-cache-file */
+			pfreeany(oe_cache_file);
+			oe_cache_file = clone_str(optarg, "oe_cache_file");
+			continue;
+
+		case OPT_DPD_INBOUND_TRAFFIC:	/* --dpd-inbound-traffic */
+			dpd_inbound_traffic = TRUE;
+			continue;
+
 		case 'c':	/* --seedbits */
 			pluto_nss_seedbits = atoi(optarg);
 			if (pluto_nss_seedbits == 0) {
@@ -1589,6 +1704,9 @@ int main(int argc, char **argv)
 	}
 #endif
 
+	startuptime_stop(&start, "options and logging");
+
+	start = startuptime_start();
 	if (!pluto_init_nss(oco->nssdir)) {
 		loglog(RC_LOG_SERIOUS, "FATAL: NSS initialization failure");
 		exit_pluto(PLUTO_EXIT_NSS_FAIL);
@@ -1606,6 +1724,7 @@ int main(int argc, char **argv)
 			libreswan_log("NSS OCSP started");
 		}
 	}
+	startuptime_stop(&start, "NSS");
 
 #ifdef FIPS_CHECK
 	/*
@@ -1616,6 +1735,7 @@ int main(int argc, char **argv)
 	 */
 	libreswan_log("FIPS HMAC integrity support [enabled]");
 	{
+		start = startuptime_start();
 		bool nss_fips_mode = PK11_IsFIPS();
 
 		/*
@@ -1659,6 +1779,7 @@ int main(int argc, char **argv)
 		if (pluto_fips_mode == LSW_FIPS_ON && !fips_files) {
 			exit_pluto(PLUTO_EXIT_FIPS_FAIL);
 		}
+		startuptime_stop(&start, "FIPS checks");
 	}
 #else
 	libreswan_log("FIPS HMAC integrity support [disabled]");
@@ -1738,7 +1859,12 @@ int main(int argc, char **argv)
 
 /* Initialize all of the various features */
 
+	start = startuptime_start();
+	init_hash_table_key();
 	init_state_db();
+	init_oe_cache();
+	init_proposal_cache();
+	init_nss_cert_cache();
 
 	init_nat_traversal(keep_alive);
 
@@ -1749,9 +1875,10 @@ int main(int argc, char **argv)
 	init_states();
 	init_connections();
 	init_ike_alg();
-	test_ike_alg();
+	startuptime_stop(&start, "tables and algorithms");
 
 	if (selftest_only) {
+		test_ike_alg();
 		/*
 		 * skip pluto_exit()
 		 * Not all components were initialized and
@@ -1760,12 +1887,37 @@ int main(int argc, char **argv)
 		exit(PLUTO_EXIT_OK);
 	}
 
+	/* before any threads are started */
+	start = startuptime_start();
+	init_updown_helpers(nr_updown_helpers);
+	startuptime_stop(&start, "updown helpers");
+
+	/*
+	 * The algorithm self-tests only need NSS; run them alongside
+	 * the rest of initialization.  They must pass before pluto
+	 * serves anything.
+	 */
+	pthread_t ike_alg_tests;
+	bool ike_alg_tests_threaded =
+		pthread_create(&ike_alg_tests, NULL, test_ike_alg_thread, NULL) == 0;
+	if (!ike_alg_tests_threaded) {
+		test_ike_alg_thread(NULL);
+	}
+
+	start = startuptime_start();
 	init_crypto_helpers(nhelpers);
+	startuptime_stop(&start, "helper threads");
+
+	start = startuptime_start();
 	init_demux();
 	init_kernel();
+	startuptime_stop(&start, "kernel");
+
 	init_vendorid();
 #if defined(LIBCURL) || defined(LIBLDAP)
+	start = startuptime_start();
 	init_fetch();
+	startuptime_stop(&start, "CRL fetch");
 #endif
 #ifdef HAVE_LABELED_IPSEC
 	init_avc();
@@ -1775,12 +1927,21 @@ int main(int argc, char **argv)
 #endif
 
 #ifdef USE_DNSSEC
+	start = startuptime_start();
 	if (!unbound_event_init(get_pluto_event_base(), do_dnssec,
 		pluto_dnssec_rootfile, pluto_dnssec_trusted)) {
 			exit_pluto(PLUTO_EXIT_UNBOUND_FAIL);
 	}
+	startuptime_stop(&start, "DNSSEC");
 #endif
 
+	if (ike_alg_tests_threaded) {
+		start = startuptime_start();
+		int e = pthread_join(ike_alg_tests, NULL);
+		passert(e == 0);
+		startuptime_stop(&start, "waiting for algorithm self-tests");
+	}
+
 	call_server();
 	return -1;	/* Shouldn't ever reach this */
 }
@@ -1816,7 +1977,11 @@ void exit_pluto(int status)
  #endif
 	free_preshared_secrets();
 	free_remembered_public_keys();
+	free_initiate_queue();
 	delete_every_connection();
+	free_oe_cache();
+	free_proposal_cache();
+	free_debug_selectors();
 
 	/*
 	 * free memory allocated by initialization routines.  Please don't
@@ -1831,6 +1996,7 @@ void exit_pluto(int status)
 
 	free_ifaces();	/* free interface list from memory */
 	free_md_pool();	/* free the md pool */
+	flush_nss_cert_cache();
 	lsw_nss_shutdown();
 	delete_lock();	/* delete any lock files */
 	free_virtual_ip();	/* virtual_private= */
@@ -1851,6 +2017,86 @@ void exit_pluto(int status)
 	exit(status);	/* exit, with our error code */
 }
 
+/*
+ * Shut down gracefully: delete the states (sending Deletes, running
+ * updown, removing kernel SAs) a batch at a time from the event loop
+ * so that pluto stays responsive, then exit.  Give up waiting after
+ * --shutdown-deadline seconds.
+ */
+
+bool shutting_down_pluto = false;
+
+static struct pluto_event *shutdown_deadline_event = NULL;
+
+static state_job_select_cb select_every_state;	/* type assertion */
+
+static bool select_every_state(struct state *st UNUSED, void *context UNUSED)
+{
+	return true;
+}
+
+static void shutdown_exit_cb(evutil_socket_t fd UNUSED,
+			     const short event UNUSED,
+			     void *arg UNUSED)
+{
+	exit_pluto(PLUTO_EXIT_OK);
+}
+
+static state_job_done_cb shutdown_done;	/* type assertion */
+
+static void shutdown_done(void *context UNUSED)
+{
+	/*
+	 * Exit from a fresh event: the job's now-event is only
+	 * released after this returns.
+	 */
+	delete_pluto_event(&shutdown_deadline_event);
+	deltatime_t no_delay = deltatime(0);
+	shutdown_deadline_event = pluto_event_add(NULL_FD, EV_TIMEOUT,
+						  shutdown_exit_cb, NULL,
+						  &no_delay, "PLUTO_SHUTDOWN");
+}
+
+static void shutdown_deadline_cb(evutil_socket_t fd UNUSED,
+				 const short event UNUSED,
+				 void *arg UNUSED)
+{
+	unsigned remaining = 0;
+	struct state *st;
+	FOR_EACH_STATE_NEW2OLD(st) {
+		/* no time left to tell the peer */
+		st->st_suppress_del_notify = TRUE;
+		remaining++;
+	}
+	loglog(RC_LOG_SERIOUS,
+	       "shutdown deadline of %u seconds passed; abandoning %u states",
+	       shutdown_deadline, remaining);
+	/*
+	 * Nor to tidy up the kernel (one by one) or run updown for
+	 * what is left; "ipsec stop" flushes the IPsec stack.
+	 */
+	abandon_kernel_state = true;
+	exit_pluto(PLUTO_EXIT_OK);
+}
+
+void shutdown_pluto(fd_t whackfd)
+{
+	if (shutdown_deadline == 0) {
+		exit_pluto(PLUTO_EXIT_OK);
+	}
+	if (shutdown_deadline_event != NULL) {
+		libreswan_log("already shutting down");
+		return;
+	}
+	shutting_down_pluto = true;
+	deltatime_t delay = deltatime(shutdown_deadline);
+	shutdown_deadline_event = pluto_event_add(NULL_FD, EV_TIMEOUT,
+						  shutdown_deadline_cb, NULL,
+						  &delay, "PLUTO_SHUTDOWN_DEADLINE");
+	delete_states_in_background("shutting down", whackfd,
+				    select_every_state, shutdown_done, NULL);
+}
+
 void show_setup_plutomain(void)
 {
 	whack_log(RC_COMMENT, "config setup options:");	/* spacer */
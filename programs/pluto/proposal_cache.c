@@ -0,0 +1,342 @@
+/* share parsed and compiled proposals between connections, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Thousands of connections typically share a handful of ike= and
+ * esp= strings.  Rather than have each parse its own alg_info, and
+ * compile its own IKEv2 proposals (or IKEv1 SA payloads) from that,
+ * the results are interned here keyed by the (lower-cased) string
+ * and the policy bits that change the result.
+ *
+ * An entry lives for as long as a connection references its
+ * alg_info.  The alg_info's ref_cnt does the counting: the cache
+ * holds one reference and each connection, via
+ * unshare_connection(), one more.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include <libreswan.h>
+
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+#include "alg_info.h"
+
+#include "defs.h"
+#include "log.h"
+#include "connections.h"
+#include "state.h"
+#include "packet.h"
+#include "demux.h"
+#include "ikev2.h"
+#include "spdb.h"
+#include "hash_table.h"
+#include "proposal_cache.h"
+
+#define PROPOSAL_CACHE_TABLE_SIZE 251
+
+/* esp=/ah= bits that change the parse or the compiled proposals */
+#define CHILD_POLICY_MASK (POLICY_ENCRYPT | POLICY_AUTHENTICATE | \
+			   POLICY_ESN_NO | POLICY_ESN_YES | \
+			   POLICY_MSDH_DOWNGRADE)
+
+struct proposal_entry {
+	/* the key */
+	char *str;		/* lower case */
+	bool ikev1;
+	bool ikev2;
+	bool pfs;
+	bool (*alg_is_ok)(const struct ike_alg *alg);
+	lset_t child_policy;	/* CHILD_POLICY_MASK bits */
+	/* the value */
+	struct alg_info *ai;
+	struct ikev2_proposals *v2_proposals;
+	struct v1_sa_template *v1_sa_templates;
+	struct list_entry str_entry;
+	struct list_entry ai_entry;
+};
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+} proposal_stats;
+
+/* for connections without ike= or esp= */
+static struct v1_sa_template *default_v1_sa_templates;
+
+static size_t log_proposal_entry(struct lswlog *buf, void *data)
+{
+	if (data == NULL) {
+		return lswlogs(buf, "proposal cache entry");
+	}
+	struct proposal_entry *e = data;
+	return lswlogf(buf, "proposal cache entry \"%s\"", e->str);
+}
+
+static size_t proposal_str_hasher(const char *str)
+{
+	return hash_table_bytes(str, strlen(str));
+}
+
+static size_t proposal_str_hash(void *data)
+{
+	struct proposal_entry *e = data;
+	return proposal_str_hasher(e->str);
+}
+
+static size_t proposal_ai_hasher(const struct alg_info *ai)
+{
+	return hash_table_bytes(&ai, sizeof(ai));
+}
+
+static size_t proposal_ai_hash(void *data)
+{
+	struct proposal_entry *e = data;
+	return proposal_ai_hasher(e->ai);
+}
+
+static struct list_head proposal_str_slots[PROPOSAL_CACHE_TABLE_SIZE];
+static struct hash_table proposal_str_table = {
+	.info = {
+		.name = "proposal cache string table",
+		.log = log_proposal_entry,
+	},
+	.hash = proposal_str_hash,
+	.nr_slots = PROPOSAL_CACHE_TABLE_SIZE,
+	.slots = proposal_str_slots,
+};
+
+static struct list_head proposal_ai_slots[PROPOSAL_CACHE_TABLE_SIZE];
+static struct hash_table proposal_ai_table = {
+	.info = {
+		.name = "proposal cache alg_info table",
+		.log = log_proposal_entry,
+	},
+	.hash = proposal_ai_hash,
+	.nr_slots = PROPOSAL_CACHE_TABLE_SIZE,
+	.slots = proposal_ai_slots,
+};
+
+static struct proposal_entry *proposal_entry_by_key(const struct proposal_entry *key)
+{
+	struct list_head *slot = hash_table_slot_by_hash(&proposal_str_table,
+							 proposal_str_hasher(key->str));
+	struct proposal_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(slot, e) {
+		if (streq(e->str, key->str) &&
+		    e->ikev1 == key->ikev1 &&
+		    e->ikev2 == key->ikev2 &&
+		    e->pfs == key->pfs &&
+		    e->alg_is_ok == key->alg_is_ok &&
+		    e->child_policy == key->child_policy) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static struct proposal_entry *proposal_entry_by_ai(const struct alg_info *ai)
+{
+	struct list_head *slot = hash_table_slot_by_hash(&proposal_ai_table,
+							 proposal_ai_hasher(ai));
+	struct proposal_entry *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(slot, e) {
+		if (e->ai == ai) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void free_proposal_entry(struct proposal_entry *e)
+{
+	dbg("proposal cache: forgetting \"%s\"", e->str);
+	del_hash_table_entry(&proposal_str_table, &e->str_entry);
+	del_hash_table_entry(&proposal_ai_table, &e->ai_entry);
+	free_ikev2_proposals(&e->v2_proposals);
+	free_v1_sa_templates(&e->v1_sa_templates);
+	alg_info_delref(e->ai);
+	pfree(e->str);
+	pfree(e);
+}
+
+/*
+ * Look up STR, or parse it with PARSE and remember the result.
+ */
+static struct alg_info *intern_alg_info(const struct proposal_policy *policy,
+					lset_t child_policy, const char *str,
+					struct alg_info *(*parse)(const struct proposal_policy *policy,
+								  const char *str,
+								  char *err_buf, size_t err_buf_len),
+					char *err_buf, size_t err_buf_len)
+{
+	char *lower = clone_str(str, "proposal cache string");
+	for (char *p = lower; *p != '\0'; p++) {
+		*p = tolower((unsigned char)*p);
+	}
+
+	struct proposal_entry key = {
+		.str = lower,
+		.ikev1 = policy->ikev1,
+		.ikev2 = policy->ikev2,
+		.pfs = policy->pfs,
+		.alg_is_ok = policy->alg_is_ok,
+		.child_policy = child_policy & CHILD_POLICY_MASK,
+	};
+
+	struct proposal_entry *e = proposal_entry_by_key(&key);
+	if (e != NULL) {
+		dbg("proposal cache: sharing \"%s\"", e->str);
+		proposal_stats.hits++;
+		pfree(lower);
+		return e->ai;
+	}
+
+	struct alg_info *ai = parse(policy, str, err_buf, err_buf_len);
+	if (ai == NULL) {
+		pfree(lower);
+		return NULL;
+	}
+	proposal_stats.misses++;
+
+	e = clone_thing(key, "proposal cache entry");
+	e->ai = ai;
+	alg_info_addref(ai);	/* the cache's */
+	add_hash_table_entry(&proposal_str_table, e, &e->str_entry);
+	add_hash_table_entry(&proposal_ai_table, e, &e->ai_entry);
+	return ai;
+}
+
+static struct alg_info *parse_ike(const struct proposal_policy *policy,
+				  const char *str,
+				  char *err_buf, size_t err_buf_len)
+{
+	struct alg_info_ike *ike = alg_info_ike_create_from_str(policy, str,
+								 err_buf, err_buf_len);
+	return ike == NULL ? NULL : &ike->ai;
+}
+
+static struct alg_info *parse_esp(const struct proposal_policy *policy,
+				  const char *str,
+				  char *err_buf, size_t err_buf_len)
+{
+	struct alg_info_esp *esp = alg_info_esp_create_from_str(policy, str,
+								 err_buf, err_buf_len);
+	return esp == NULL ? NULL : &esp->ai;
+}
+
+static struct alg_info *parse_ah(const struct proposal_policy *policy,
+				 const char *str,
+				 char *err_buf, size_t err_buf_len)
+{
+	struct alg_info_esp *ah = alg_info_ah_create_from_str(policy, str,
+							       err_buf, err_buf_len);
+	return ah == NULL ? NULL : &ah->ai;
+}
+
+struct alg_info_ike *intern_alg_info_ike(const struct proposal_policy *policy,
+					 const char *str,
+					 char *err_buf, size_t err_buf_len)
+{
+	struct alg_info *ai = intern_alg_info(policy, LEMPTY, str, parse_ike,
+					      err_buf, err_buf_len);
+	return ai == NULL ? NULL : (struct alg_info_ike *)ai;
+}
+
+struct alg_info_esp *intern_alg_info_esp(const struct proposal_policy *policy,
+					 lset_t child_policy,
+					 const char *str,
+					 char *err_buf, size_t err_buf_len)
+{
+	struct alg_info *ai = intern_alg_info(policy, child_policy, str,
+					      (child_policy & POLICY_ENCRYPT) ? parse_esp : parse_ah,
+					      err_buf, err_buf_len);
+	return ai == NULL ? NULL : (struct alg_info_esp *)ai;
+}
+
+void forget_alg_info(struct alg_info *ai)
+{
+	struct proposal_entry *e = proposal_entry_by_ai(ai);
+	if (e == NULL) {
+		alg_info_free(ai);
+	} else if (ai->ref_cnt == 1) {
+		free_proposal_entry(e);
+	}
+}
+
+void release_alg_info(struct alg_info *ai)
+{
+	struct proposal_entry *e = proposal_entry_by_ai(ai);
+	alg_info_delref(ai);
+	if (e != NULL && ai->ref_cnt == 1) {
+		free_proposal_entry(e);
+	}
+}
+
+struct ikev2_proposals **shared_v2_proposals(const struct alg_info *ai,
+					     lset_t policy)
+{
+	struct proposal_entry *e = proposal_entry_by_ai(ai);
+	if (e == NULL) {
+		return NULL;
+	}
+	if (e->child_policy != LEMPTY &&
+	    e->child_policy != (policy & CHILD_POLICY_MASK)) {
+		dbg("proposal cache: policy changed since \"%s\" was interned; not sharing",
+		    e->str);
+		return NULL;
+	}
+	return &e->v2_proposals;
+}
+
+struct v1_sa_template **shared_v1_sa_templates(const struct alg_info *ai)
+{
+	if (ai == NULL) {
+		return &default_v1_sa_templates;
+	}
+	struct proposal_entry *e = proposal_entry_by_ai(ai);
+	return e == NULL ? NULL : &e->v1_sa_templates;
+}
+
+void init_proposal_cache(void)
+{
+	init_hash_table(&proposal_str_table);
+	init_hash_table(&proposal_ai_table);
+}
+
+void free_proposal_cache(void)
+{
+	for (unsigned long i = 0; i < proposal_str_table.nr_slots; i++) {
+		struct proposal_entry *e;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(&proposal_str_table.slots[i], e) {
+			free_proposal_entry(e);
+		}
+	}
+	free_v1_sa_templates(&default_v1_sa_templates);
+}
+
+void show_proposal_cache_hash_status(void)
+{
+	show_hash_table_status("proposals", &proposal_str_table);
+}
+
+void show_proposal_cache_status(void)
+{
+	whack_log(RC_COMMENT, "proposal cache: %ld entries, shared=%lu, parsed=%lu",
+		  proposal_str_table.nr_entries,
+		  proposal_stats.hits, proposal_stats.misses);
+	whack_log(RC_COMMENT, " ");	/* spacer */
+}
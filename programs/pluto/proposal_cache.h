@@ -0,0 +1,87 @@
+/* share parsed and compiled proposals between connections, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PROPOSAL_CACHE_H
+#define PROPOSAL_CACHE_H
+
+#include <stddef.h>
+
+#include "lset.h"
+
+struct alg_info;
+struct alg_info_ike;
+struct alg_info_esp;
+struct proposal_policy;
+struct ikev2_proposals;
+struct v1_sa_template;
+
+extern void init_proposal_cache(void);
+extern void free_proposal_cache(void);
+
+/*
+ * Return the parsed ike= (or esp=/ah=) string STR, sharing it with
+ * any other connection that used the same string (ignoring case)
+ * and POLICY.
+ *
+ * For esp=/ah=, CHILD_POLICY is the connection's policy; its
+ * ENCRYPT/AUTHENTICATE bits select the parser and its ESN and
+ * MSDH_DOWNGRADE bits, which change the compiled proposals, are also
+ * part of the key.
+ *
+ * The cache holds one reference; unshare_connection() takes the
+ * connection's.  Returns NULL, and fills in ERR_BUF, when STR doesn't
+ * parse; that isn't cached.
+ */
+extern struct alg_info_ike *intern_alg_info_ike(const struct proposal_policy *policy,
+						const char *str,
+						char *err_buf, size_t err_buf_len);
+extern struct alg_info_esp *intern_alg_info_esp(const struct proposal_policy *policy,
+						lset_t child_policy,
+						const char *str,
+						char *err_buf, size_t err_buf_len);
+
+/*
+ * Drop a connection's reference to AI; once only the cache's
+ * reference remains the entry, and its compiled proposals, are
+ * freed.
+ *
+ * forget_alg_info() is for add_connection() failing before the
+ * connection took its reference.
+ */
+extern void release_alg_info(struct alg_info *ai);
+extern void forget_alg_info(struct alg_info *ai);
+
+/*
+ * Where to find (or save) the IKEv2 proposals compiled from AI: the
+ * IKE SA proposals for ike=; the IKE_AUTH CHILD SA proposals for
+ * esp=/ah=.  The slot holds its own reference (see
+ * addref_ikev2_proposals()).
+ *
+ * Returns NULL when AI isn't in the cache, or POLICY no longer
+ * matches the bits it was compiled for; the caller then compiles its
+ * own.
+ */
+extern struct ikev2_proposals **shared_v2_proposals(const struct alg_info *ai,
+						    lset_t policy);
+
+/*
+ * Where ikev1_out_sa() saves the SA proposals it emitted using AI;
+ * a NULL AI (the built-in defaults) has a slot of its own.  Returns
+ * NULL when AI isn't in the cache.
+ */
+extern struct v1_sa_template **shared_v1_sa_templates(const struct alg_info *ai);
+
+extern void show_proposal_cache_status(void);
+extern void show_proposal_cache_hash_status(void);
+
+#endif
@@ -79,6 +79,7 @@
 #include "pluto_sd.h"
 
 #include "pluto_stats.h"
+#include "initiate_queue.h"
 
 /* bits loading keys from asynchronous DNS */
 
@@ -155,11 +156,23 @@ static void do_whacklisten(void)
 #endif
 	libreswan_log("listening for IKE messages");
 	listening = TRUE;
+	/*
+	 * Both report to the whack client, which only the main thread
+	 * can do; so these can't run alongside each other.
+	 */
+	startuptime_t start = startuptime_start();
 	find_ifaces(TRUE /* remove dead interfaces */);
+	startuptime_stop(&start, "interfaces");
+	start = startuptime_start();
 	load_preshared_secrets();
+	startuptime_stop(&start, "secrets");
 	load_groups();
+	/* the first --listen completes startup */
+	bool started = startup_ready();
 #ifdef USE_SYSTEMD_WATCHDOG
-	pluto_sd(PLUTO_SD_READY, SD_REPORT_NO_STATUS);
+	pluto_sd(started ? PLUTO_SD_START : PLUTO_SD_READY, SD_REPORT_NO_STATUS);
+#else
+	(void)started;
 #endif
 }
 
@@ -280,7 +293,25 @@ void whack_process(fd_t whackfd, const struct whack_message *const m)
 				}
 			}
 #endif
-			if (m->name == NULL) {
+			if (m->whack_debug_peer || m->debug_serialno != 0) {
+				set_debug_selector(m->whack_debug_peer ? &m->debug_peer : NULL,
+						   m->debug_serialno, m->debugging);
+				LSWDBGP(DBG_CONTROL, buf) {
+					lswlogs(buf, "debug selector ");
+					if (m->whack_debug_peer) {
+						ip_subnet_buf b;
+						lswlogf(buf, "peer %s ",
+							str_subnet(&m->debug_peer, &b));
+					}
+					if (m->debug_serialno != 0) {
+						lswlogf(buf, "state #%lu ",
+							m->debug_serialno);
+					}
+					lswlogs(buf, "= ");
+					lswlog_lmod(buf, &debug_names,
+						    "+", m->debugging);
+				}
+			} else if (m->name == NULL) {
 				/*
 				 * This is done in two two-steps so
 				 * that if either old or new would
@@ -567,13 +598,18 @@ void whack_process(fd_t whackfd, const struct whack_message *const m)
 					pass_remote = TRUE;
 				}
 			}
-			initiate_connection(m->name,
-					    (m->whack_async ?
-					     null_fd :
-					     dup_any(whackfd)),
-					    m->debugging,
-					    m->impairing,
-					    pass_remote ? m->remote_host : NULL);
+			if (!m->whack_async || pass_remote ||
+			    !queue_initiate_connection(m->name,
+						       m->debugging,
+						       m->impairing)) {
+				initiate_connection(m->name,
+						    (m->whack_async ?
+						     null_fd :
+						     dup_any(whackfd)),
+						    m->debugging,
+						    m->impairing,
+						    pass_remote ? m->remote_host : NULL);
+			}
 		}
 	}
 
@@ -601,7 +637,7 @@ void whack_process(fd_t whackfd, const struct whack_message *const m)
 	}
 
 	if (m->whack_status)
-		show_status();
+		show_status(&m->status_filter);
 
 	if (m->whack_global_status)
 		show_global_status();
@@ -610,7 +646,7 @@ void whack_process(fd_t whackfd, const struct whack_message *const m)
 		clear_pluto_stats();
 
 	if (m->whack_traffic_status)
-		show_traffic_status(m->name);
+		show_traffic_status(m->name, &m->status_filter);
 
 	if (m->whack_shunt_status)
 		show_shunt_status();
@@ -672,7 +708,7 @@ void whack_process(fd_t whackfd, const struct whack_message *const m)
 
 	if (m->whack_shutdown) {
 		libreswan_log("shutting down");
-		exit_pluto(PLUTO_EXIT_OK); /* delete lock and leave, with 0 status */
+		shutdown_pluto(whackfd); /* eventually delete lock and leave, with 0 status */
 	}
 
 done:
@@ -756,12 +792,12 @@ static void whack_handle(int whackctlfd)
 			if (msg.whack_shutdown) {
 				libreswan_log("shutting down%s",
 				    (msg.magic != WHACK_BASIC_MAGIC) ?  " despite whacky magic" : "");
-				exit_pluto(PLUTO_EXIT_OK);  /* delete lock and leave, with 0 status */
+				shutdown_pluto(whackfd);  /* eventually delete lock and leave, with 0 status */
 			}
 			if (msg.magic == WHACK_BASIC_MAGIC) {
 				/* Only basic commands.  Simpler inter-version compatibility. */
 				if (msg.whack_status)
-					show_status();
+					show_status(NULL);
 
 				ugh = "";               /* bail early, but without complaint */
 			} else {
@@ -14,6 +14,8 @@
  * for more details.
  */
 
+#include <stdlib.h>		/* for rand() */
+
 #include "defs.h"
 #include "state.h"
 #include "connections.h"
@@ -22,6 +24,10 @@
 #include "deltatime.h"
 #include "server.h"
 #include "log.h"
+#include "pluto_stats.h"
+
+unsigned retransmit_jitter = 0;		/* percent */
+unsigned retransmit_budget = 0;		/* per second; 0 is unlimited */
 
 size_t lswlog_retransmit_prefix(struct lswlog *buf, struct state *st)
 {
@@ -69,6 +75,75 @@ static void double_delay(retransmit_t *rt, unsigned long nr_retransmits)
 	}
 }
 
+/*
+ * Randomly vary DELAY by up to +/- RETRANSMIT_JITTER percent.
+ */
+static deltatime_t jitter_delay(deltatime_t delay)
+{
+	if (retransmit_jitter == 0) {
+		return delay;
+	}
+	intmax_t ms = deltamillisecs(delay);
+	intmax_t range = ms * retransmit_jitter / 100;
+	if (range == 0) {
+		return delay;
+	}
+	/* uniform in [-range, +range] */
+	intmax_t offset = (intmax_t)((2 * range + 1) *
+				     (rand() / (RAND_MAX + 1.E0))) - range;
+	return deltatime_ms(ms + offset);
+}
+
+/*
+ * Retransmits sent during the current second.
+ */
+static struct {
+	intmax_t second;
+	unsigned sent;
+} budget;
+
+enum budget_verdict {
+	BUDGET_SEND,
+	BUDGET_DEFER,
+	BUDGET_DROP,
+};
+
+/*
+ * Is there room in this second's budget for another retransmit?
+ *
+ * Once the budget is spent, requests on an established IKE SA (a
+ * rekey, DPD, a delete, ...) are still sent until twice the budget
+ * and after that deferred to a later second; while half-open
+ * exchanges, which are cheap to restart and are what floods the
+ * network after an outage, have their retransmit dropped.
+ */
+static enum budget_verdict check_budget(struct state *st)
+{
+	if (retransmit_budget == 0) {
+		return BUDGET_SEND;
+	}
+	intmax_t second = monosecs(mononow());
+	if (budget.second != second) {
+		budget.second = second;
+		budget.sent = 0;
+	}
+	if (budget.sent < retransmit_budget) {
+		budget.sent++;
+		return BUDGET_SEND;
+	}
+	struct state *ike = (IS_CHILD_SA(st)
+			     ? state_with_serialno(st->st_clonedfrom)
+			     : st);
+	if (ike != NULL && IS_IKE_SA_ESTABLISHED(ike)) {
+		if (budget.sent < 2 * retransmit_budget) {
+			budget.sent++;
+			return BUDGET_SEND;
+		}
+		return BUDGET_DEFER;
+	}
+	return BUDGET_DROP;
+}
+
 /*
  * If there is still space, increment the retransmit counter.
  *
@@ -142,12 +217,13 @@ void start_retransmits(struct state *st)
 		}
 	}
 	rt->start = mononow();
-	rt->delays = rt->delay;
-	event_schedule(EVENT_RETRANSMIT, rt->delay, st);
+	deltatime_t delay = jitter_delay(rt->delay);
+	rt->delays = delay;
+	event_schedule(EVENT_RETRANSMIT, delay, st);
 	LSWDBGP(DBG_RETRANSMITS, buf) {
 		lswlog_retransmit_prefix(buf, st);
 		lswlogs(buf, "first event in ");
-		lswlog_deltatime(buf, rt->delay);
+		lswlog_deltatime(buf, delay);
 		lswlogs(buf, " seconds; timeout in ");
 		lswlog_deltatime(buf, rt->timeout);
 		lswlogf(buf, " seconds; limit of %lu retransmits; current time is ", rt->limit);
@@ -265,14 +341,53 @@ enum retransmit_status retransmit(struct state *st)
 		return RETRANSMITS_TIMED_OUT;
 	}
 
+	enum budget_verdict verdict = check_budget(st);
+	if (verdict == BUDGET_DEFER) {
+		/*
+		 * Try again in about a second; the wait counts
+		 * towards the timeout but not the retransmit limit.
+		 */
+		deltatime_t delay = jitter_delay(deltatime(1));
+		rt->delays = deltatime_add(rt->delays, delay);
+		event_schedule(EVENT_RETRANSMIT, delay, st);
+		pstats_ike_retransmits_deferred++;
+		LSWDBGP(DBG_RETRANSMITS, buf) {
+			lswlog_retransmit_prefix(buf, st);
+			lswlogf(buf, "budget of %u per second exceeded; deferring for ",
+				retransmit_budget);
+			lswlog_deltatime(buf, delay);
+			lswlogs(buf, " seconds");
+		}
+		return RETRANSMIT_NO;
+	}
+
+	/*
+	 * When dropped, carry on backing off as if the packet had
+	 * been sent.
+	 */
 	double_delay(rt, nr_retransmits);
 	rt->nr_retransmits++;
- 	rt->delays = deltatime_add(rt->delays, rt->delay);
-	event_schedule(EVENT_RETRANSMIT, rt->delay, st);
+	deltatime_t delay = jitter_delay(rt->delay);
+ 	rt->delays = deltatime_add(rt->delays, delay);
+	event_schedule(EVENT_RETRANSMIT, delay, st);
+
+	if (verdict == BUDGET_DROP) {
+		pstats_ike_retransmits_dropped++;
+		LSWDBGP(DBG_RETRANSMITS, buf) {
+			lswlog_retransmit_prefix(buf, st);
+			lswlogf(buf, "budget of %u per second exceeded; dropping retransmit of half-open exchange; will wait ",
+				retransmit_budget);
+			lswlog_deltatime(buf, delay);
+			lswlogs(buf, " seconds");
+		}
+		return RETRANSMIT_NO;
+	}
+
+	pstats_ike_retransmits++;
 	LSWLOG_RC(RC_RETRANSMISSION, buf) {
 		lswlogf(buf, "%s: retransmission; will wait ",
 			st->st_finite_state->fs_name);
-		lswlog_deltatime(buf, rt->delay);
+		lswlog_deltatime(buf, delay);
 		lswlogs(buf, " seconds for response");
 	}
 	return RETRANSMIT_YES;
@@ -31,6 +31,20 @@ typedef struct {
 	unsigned long limit;
 } retransmit_t;
 
+/*
+ * Global tuning, set from the command line.
+ *
+ * RETRANSMIT_JITTER: randomly vary each delay by up to +/- this
+ * percentage so that states started together (for instance after an
+ * outage) don't retransmit in lock-step.
+ *
+ * RETRANSMIT_BUDGET: the number of retransmits to send per second;
+ * when exceeded requests on an established IKE SA are favoured over
+ * half-open exchanges.  Zero means unlimited.
+ */
+extern unsigned retransmit_jitter;
+extern unsigned retransmit_budget;
+
 unsigned long retransmit_count(struct state *st);
 
 bool count_duplicate(struct state *st, unsigned long limit);
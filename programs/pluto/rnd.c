@@ -63,6 +63,11 @@
  *
  * - 4 bytes per Message ID we need to generate.  One per Quick Mode
  *   exchange.  Eventually, one per informational exchange.
+ *
+ * Values that go out in the clear (SPIs, CPIs, message IDs, IVs, DPD
+ * sequence numbers) use get_public_rnd_bytes(), which draws from a
+ * per-thread buffer so that the main thread and the crypto helpers
+ * don't queue on NSS's RNG lock for a few bytes at a time.
  */
 
 void get_rnd_bytes(u_char *buffer, int length)
@@ -81,6 +86,22 @@ void fill_rnd_chunk(chunk_t chunk)
 	get_rnd_bytes(chunk.ptr, chunk.len);
 }
 
+void get_public_rnd_bytes(void *buffer, size_t length)
+{
+	SECStatus rv = lsw_nss_buffered_random(buffer, length);
+	if (rv != SECSuccess) {
+		LSWLOG_PASSERT(buf) {
+			lswlogs(buf, "NSS RNG failed");
+			lswlog_nss_error(buf);
+		}
+	}
+}
+
+void fill_public_rnd_chunk(chunk_t chunk)
+{
+	get_public_rnd_bytes(chunk.ptr, chunk.len);
+}
+
 void init_secret(void)
 {
 	/*
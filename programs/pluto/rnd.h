@@ -24,6 +24,10 @@
 extern void fill_rnd_chunk(chunk_t chunk);
 extern void get_rnd_bytes(uint8_t *buffer, int length);
 
+/* buffered; only for values that are sent in the clear */
+extern void fill_public_rnd_chunk(chunk_t chunk);
+extern void get_public_rnd_bytes(void *buffer, size_t length);
+
 extern void init_secret(void);
 
 #endif
@@ -112,7 +112,29 @@ struct iface_list interface_dev;
 /* pluto's main Libevent event_base */
 static struct event_base *pluto_eb =  NULL;
 
-static  struct pluto_event *pluto_events_head = NULL;
+/*
+ * All pluto events, most recent first.
+ *
+ * Every state transition deletes and (re)schedules at least one
+ * event so, with many states, unlinking an event must not involve
+ * walking the list.
+ */
+
+static size_t log_pluto_event(struct lswlog *buf, void *data)
+{
+	if (data == NULL) {
+		return lswlogs(buf, "no event");
+	}
+	struct pluto_event *e = data;
+	return lswlogf(buf, "%s-pe@%p", e->ev_name, e);
+}
+
+static const struct list_info pluto_events_info = {
+	.name = "pluto events",
+	.log = log_pluto_event,
+};
+
+static struct list_head pluto_events;
 
 /* control (whack) socket */
 int ctl_fd = NULL_FD;   /* file descriptor of control (whack) socket */
@@ -227,6 +249,25 @@ static void free_dead_iface_dev(struct iface_dev *id)
 	}
 }
 
+/*
+ * Free interfaces that have been unlinked from INTERFACES once the
+ * states using them are gone.
+ */
+
+static state_job_done_cb free_dead_iface_ports;	/* type assertion */
+
+static void free_dead_iface_ports(void *context)
+{
+	struct iface_port *p = context;
+	while (p != NULL) {
+		struct iface_port *next = p->next;
+		close(p->fd);
+		free_dead_iface_dev(p->ip_dev);
+		pfree(p);
+		p = next;
+	}
+}
+
 static void free_dead_ifaces(void)
 {
 	struct iface_port *p;
@@ -249,20 +290,24 @@ static void free_dead_ifaces(void)
 
 	if (some_dead) {
 		struct iface_port **pp;
+		struct iface_port *dead = NULL;
 
 		release_dead_interfaces();
-		delete_states_dead_interfaces();
+		/*
+		 * Stop listening now, but keep the ports around
+		 * until the states using them have been deleted.
+		 */
 		for (pp = &interfaces; (p = *pp) != NULL; ) {
 			if (p->change == IFN_DELETE) {
 				*pp = p->next; /* advance *pp */
 				delete_pluto_event(&p->pev);
-				close(p->fd);
-				free_dead_iface_dev(p->ip_dev);
-				pfree(p);
+				p->next = dead;
+				dead = p;
 			} else {
 				pp = &p->next; /* advance pp */
 			}
 		}
+		delete_states_dead_interfaces(free_dead_iface_ports, dead);
 	}
 
 	/* this must be done after the release_dead_interfaces
@@ -417,12 +462,140 @@ int create_socket(struct raw_iface *ifp, const char *v_name, int port)
 	return fd;
 }
 
-static struct pluto_event *free_event_entry(struct pluto_event **evp)
+static void add_raw_iface_port(struct iface_dev *id, const ip_address *addr,
+			       int fd, int port, bool ike_float)
+{
+	struct iface_port *q = alloc_thing(struct iface_port,
+					   "struct iface_port");
+	ipstr_buf b;
+
+	q->ip_dev = id;
+	id->id_count++;
+	q->ip_addr = *addr;
+	if (ike_float)
+		setportof(htons(port), &q->ip_addr);
+	q->port = port;
+	q->fd = fd;
+	q->next = interfaces;
+	q->change = IFN_ADD;
+	q->ike_float = ike_float;
+	interfaces = q;
+
+	libreswan_log("adding interface %s/%s %s:%d",
+		      id->id_vname, id->id_rname,
+		      ipstr(&q->ip_addr, &b), q->port);
+}
+
+/*
+ * For stacks without virtual interfaces (BSD KAME, no kernel): listen
+ * on every real interface, or just the --listen one, adding a NAT-T
+ * port for IPv4 when NAT_T.  Consumes RIFACES.
+ */
+void listen_on_raw_ifaces(struct raw_iface *rifaces, bool nat_t)
+{
+	ip_address lip;	/* --listen filter option */
+
+	if (pluto_listen != NULL) {
+		err_t e = ttoaddr_num(pluto_listen, 0, AF_UNSPEC, &lip);
+
+		if (e != NULL) {
+			DBG_log("invalid listen= option ignored: %s", e);
+			pluto_listen = NULL;
+		}
+	}
+
+	for (struct raw_iface *ifp = rifaces; ifp != NULL; ifp = ifp->next) {
+		bool after = FALSE; /* has vfp passed ifp on the list? */
+		bool bad = FALSE;
+
+		for (struct raw_iface *vfp = rifaces; vfp != NULL; vfp = vfp->next) {
+			if (vfp == ifp) {
+				after = TRUE;
+			} else if (sameaddr(&ifp->addr, &vfp->addr)) {
+				if (after) {
+					ipstr_buf b;
+
+					loglog(RC_LOG_SERIOUS,
+					       "IP interfaces %s and %s share address %s!",
+					       ifp->name, vfp->name,
+					       ipstr(&ifp->addr, &b));
+				}
+				bad = TRUE;
+			}
+		}
+
+		if (bad)
+			continue;
+
+		/* ignore if --listen is specified and we do not match */
+		if (pluto_listen != NULL && !sameaddr(&lip, &ifp->addr)) {
+			ipstr_buf b;
+
+			libreswan_log("skipping interface %s with %s",
+				      ifp->name, ipstr(&ifp->addr, &b));
+			continue;
+		}
+
+		/* search old interfaces list for this one */
+		bool found = FALSE;
+
+		for (struct iface_port *q = interfaces; q != NULL; q = q->next) {
+			if (streq(q->ip_dev->id_rname, ifp->name) &&
+			    sameaddr(&q->ip_addr, &ifp->addr)) {
+				/* matches -- rejuvinate old entry (and NAT-T twin) */
+				q->change = IFN_KEEP;
+				found = TRUE;
+			}
+		}
+
+		if (found)
+			continue;
+
+		/* matches nothing -- create a new entry */
+		int fd = create_socket(ifp, ifp->name, pluto_port);
+
+		if (fd < 0)
+			continue;
+
+		struct iface_dev *id = alloc_thing(struct iface_dev,
+						   "struct iface_dev");
+
+		LIST_INSERT_HEAD(&interface_dev, id, id_entry);
+		id->id_rname = clone_str(ifp->name, "real device name");
+		id->id_vname = clone_str(ifp->name, "virtual device name");
+
+		add_raw_iface_port(id, &ifp->addr, fd, pluto_port, FALSE);
+
+		/*
+		 * right now, we do not support NAT-T on IPv6, because
+		 * the kernel did not support it, and gave an error
+		 * it one tried to turn it on.
+		 */
+		if (nat_t && addrtypeof(&ifp->addr) == AF_INET) {
+			fd = create_socket(ifp, id->id_vname, pluto_nat_port);
+			if (fd < 0)
+				continue;
+			nat_traversal_espinudp_socket(fd, "IPv4");
+			add_raw_iface_port(id, &ifp->addr, fd,
+					   pluto_nat_port, TRUE);
+		}
+	}
+
+	/* delete the raw interfaces list */
+	while (rifaces != NULL) {
+		struct raw_iface *t = rifaces;
+
+		rifaces = t->next;
+		pfree(t);
+	}
+}
+
+static void free_event_entry(struct pluto_event **evp)
 {
 	struct pluto_event *e = *evp;
-	struct pluto_event *next = e->next;
 
 	/* unlink this pluto_event from the list */
+	remove_list_entry(&e->ev_entry);
 	if (e->ev != NULL) {
 		event_free(e->ev);
 		e->ev  = NULL;
@@ -434,39 +607,29 @@ static struct pluto_event *free_event_entry(struct pluto_event **evp)
 
 	pfree(e);
 	*evp = NULL;
-	return next;
 }
 
 void free_pluto_event_list(void)
 {
-	struct pluto_event **head = &pluto_events_head;
-	while (*head != NULL)
-		*head = free_event_entry(head);
-
+	struct pluto_event *e;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(&pluto_events, e) {
+		struct pluto_event *p = e;
+		free_event_entry(&p);
+	}
 }
 
 void link_pluto_event_list(struct pluto_event *e) {
-	e->next = pluto_events_head;
-	pluto_events_head = e;
+	e->ev_entry = list_entry(&pluto_events_info, e);
+	insert_list_entry(&pluto_events, &e->ev_entry);
 }
 
 /* delete pluto event (if any); leave *evp == NULL */
 void delete_pluto_event(struct pluto_event **evp)
 {
 	if (*evp != NULL) {
-		for (struct pluto_event **pp = &pluto_events_head; ; ) {
-			struct pluto_event *p = *pp;
-
-			passert(p != NULL);
-
-			if (p == *evp) {
-				/* found it; unlink this from the list */
-				*pp = free_event_entry(evp);
-				break;
-			}
-			pp = &p->next;
-		}
-		*evp = NULL;
+		/* the event must still be on the list */
+		passert((*evp)->ev_entry.newer != NULL);
+		free_event_entry(evp);
 	}
 }
 
@@ -612,9 +775,10 @@ struct pluto_event *pluto_event_add(evutil_socket_t fd, short events,
 void timer_list(void)
 {
 	monotime_t nw;
-	struct pluto_event *ev = pluto_events_head;
+	struct pluto_event *ev;
 
-	if (ev == NULL) {
+	if (pluto_events.head.newer == NULL ||
+	    pluto_events.head.newer == &pluto_events.head) {
 		/* Just paranoid */
 		whack_log(RC_LOG, "no events are queued");
 		return;
@@ -625,7 +789,7 @@ void timer_list(void)
 	whack_log(RC_LOG, "It is now: %jd seconds since monotonic epoch",
 		  monosecs(nw));
 
-	while (ev != NULL) {
+	FOR_EACH_LIST_ENTRY_NEW2OLD(&pluto_events, ev) {
 		struct state *st = ev->ev_state;
 		char buf[256] = "not timer based";
 
@@ -645,8 +809,6 @@ void timer_list(void)
 		} else {
 			whack_log(RC_LOG, "event %s is %s", ev->ev_name, buf);
 		}
-
-		ev = ev->next;
 	}
 }
 
@@ -747,7 +909,7 @@ static void huphandler_cb(int unused UNUSED, const short event UNUSED, void *arg
 
 static void termhandler_cb(int unused UNUSED, const short event UNUSED, void *arg UNUSED)
 {
-	exit_pluto(PLUTO_EXIT_OK);
+	shutdown_pluto(null_fd);
 }
 
 #ifdef HAVE_SECCOMP
@@ -972,6 +1134,9 @@ void init_event_base(void) {
 	int r = evthread_use_pthreads();
 	passert(r >= 0);
 	/* now do anything */
+	init_list(&pluto_events_info, &pluto_events);
+	/* pluto_fork() is used before call_server(); see updown.c */
+	init_hash_table(&pids_hash_table);
 	pluto_eb = event_base_new();
 	passert(pluto_eb != NULL);
 	int s = evthread_make_base_notifiable(pluto_eb);
@@ -983,8 +1148,6 @@ void init_event_base(void) {
  */
 void call_server(void)
 {
-	init_hash_table(&pids_hash_table);
-
 	/*
 	 * setup basic events, CTL and SIGNALs
 	 */
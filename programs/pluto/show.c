@@ -42,6 +42,11 @@
 #include "plutoalg.h"
 #include "crypto.h"
 #include "db_ops.h"
+#include "initiate_queue.h"
+#include "oe_cache.h"
+#include "proposal_cache.h"
+#include "nss_cert_load.h"
+#include "state_db.h"
 
 static void show_system_security(void)
 {
@@ -72,10 +77,15 @@ static void show_system_security(void)
 void show_global_status(void)
 {
 	show_globalstate_status();
+	show_startup_status();
+	show_state_db_status();
+	show_oe_cache_hash_status();
+	show_proposal_cache_hash_status();
+	show_nss_cert_cache_hash_status();
 	show_pluto_stats();
 }
 
-void show_status(void)
+void show_status(const struct whack_status_filter *filter)
 {
 	show_kernel_interface();
 	show_ifaces_status();
@@ -87,8 +97,13 @@ void show_status(void)
 	kernel_alg_show_status();
 	ike_alg_show_status();
 	db_ops_show_status();
-	show_connections_status();
-	show_states_status();
+	show_proposal_cache_status();
+	show_nss_cert_cache_status();
+	show_connections_status(filter);
+	show_initiate_queue_status();
+	show_oe_cache_status();
+	show_debug_selectors();
+	show_states_status(filter);
 #if defined(NETKEY_SUPPORT) || defined(KLIPS)
 	show_shunt_status();
 #endif
@@ -142,6 +142,10 @@ extern bool ikev1_out_sa(pb_stream *outs,
 		   bool aggressive_mode,
 		   enum next_payload_types_ikev1 np);
 
+/* proposals saved by ikev1_out_sa(); see proposal_cache.h */
+struct v1_sa_template;
+extern void free_v1_sa_templates(struct v1_sa_template **templates);
+
 extern lset_t preparse_isakmp_sa_body(pb_stream sa_pbs /* by value! */);
 
 extern notification_t parse_isakmp_sa_body(pb_stream *sa_pbs,           /* body of input SA Payload */
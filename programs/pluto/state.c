@@ -70,10 +70,13 @@
 #include "pluto_crypt.h"  /* for pluto_crypto_req & pluto_crypto_req_cont */
 #include "ikev2.h"
 #include "ikev2_redirect.h"
+#include "ikev2_send.h"		/* for open_v2_delete_batch() */
 #include "secrets.h"    /* unreference_key() */
 #include "enum_names.h"
 #include "crypt_dh.h"
 #include "hostpair.h"
+#include "server.h"		/* for pluto_event_now() */
+#include "oe_cache.h"
 
 #include <nss.h>
 #include <pk11pub.h>
@@ -82,6 +85,7 @@
 #include "pluto_stats.h"
 #include "ikev2_ipseckey.h"
 #include "ip_address.h"
+#include "status_filter.h"
 
 bool uniqueIDs = FALSE;
 
@@ -794,15 +798,28 @@ void delete_state(struct state *st)
 		if (!orphan_holdpass(c, &c->spd, c->spd.this.protocol, failure_shunt)) {
 			loglog(RC_LOG_SERIOUS, "orphan_holdpass() failure ignored");
 		}
+
+		/* a missing IPSECKEY was recorded when the lookup failed */
+		if (!exiting_pluto && !shutting_down_pluto &&
+		    !st->st_oe_failure_recorded) {
+			oe_cache_record(&c->spd.that.host_addr,
+					(st->st_state == STATE_PARENT_I1 ?
+					 OE_NO_RESPONSE : OE_AUTH_FAILED));
+		}
 	}
 
 	if (IS_IPSEC_SA_ESTABLISHED(st)) {
-		/* pull in the traffic counters into state before they're lost */
-		if (!get_sa_info(st, FALSE, NULL)) {
-			libreswan_log("failed to pull traffic counters from outbound IPsec SA");
-		}
-		if (!get_sa_info(st, TRUE, NULL)) {
-			libreswan_log("failed to pull traffic counters from inbound IPsec SA");
+		/*
+		 * pull in the traffic counters into state before
+		 * they're lost (unless there's no time to ask)
+		 */
+		if (!abandon_kernel_state) {
+			if (!get_sa_info(st, FALSE, NULL)) {
+				libreswan_log("failed to pull traffic counters from outbound IPsec SA");
+			}
+			if (!get_sa_info(st, TRUE, NULL)) {
+				libreswan_log("failed to pull traffic counters from inbound IPsec SA");
+			}
 		}
 
 		/*
@@ -1133,7 +1150,11 @@ static void foreach_state_by_connection_func_delete(struct connection *c,
 	 * This allows Delete Notifications to be sent.
 	 * ?? We could probably double the performance by caching any
 	 * ISAKMP SA states found in the first pass, avoiding a second.
+	 *
+	 * Child SA Delete notifications are batched; those for an IKE
+	 * SA deleted in the second pass are dropped.
 	 */
+	open_v2_delete_batch();
 	for (int pass = 0; pass != 2; pass++) {
 		DBG(DBG_CONTROL, DBG_log("pass %d", pass));
 		struct state *this = NULL;
@@ -1161,29 +1182,216 @@ static void foreach_state_by_connection_func_delete(struct connection *c,
 			}
 		}
 	}
+	close_v2_delete_batch();
 }
 
 /*
- * Delete all states that have somehow not ben deleted yet
- * but using interfaces that are going down
+ * Delete lots of states (for instance, all of them during shutdown)
+ * a batch at a time from the event loop.
+ *
+ * Deleting a state involves the kernel, updown, and sending a Delete;
+ * doing 100k of them in one go leaves pluto unresponsive for
+ * minutes.  Instead, the matching states are recorded up front (IKE
+ * SAs first so that each family is deleted together, and its
+ * children's Deletes are covered by the IKE SA's) and then deleted
+ * STATE_JOB_BATCH per event-loop iteration.  States that disappear in
+ * the meantime are skipped.
  */
 
-void delete_states_dead_interfaces(void)
-{
-	struct state *this = NULL;
-	FOR_EACH_STATE_NEW2OLD(this) {
-		if (this->st_interface &&
-		    this->st_interface->change == IFN_DELETE) {
-			libreswan_log(
-				"deleting lasting state #%lu on interface (%s) which is shutting down",
-				this->st_serialno,
-				this->st_interface->ip_dev->id_vname);
-			delete_state(this);
-			/* note: no md->st to clear */
+#define STATE_JOB_BATCH 64
+
+struct state_job {
+	const char *name;
+	so_serial_t *serialnos;
+	unsigned nr;
+	unsigned next;
+	unsigned deleted;
+	fd_t whackfd;
+	monotime_t last_report;
+	state_job_done_cb *done;
+	void *context;
+};
+
+static void state_job_report(struct state_job *job, bool final)
+{
+	monotime_t now = mononow();
+	if (!final &&
+	    deltasecs(monotimediff(now, job->last_report)) < 1) {
+		return;
+	}
+	job->last_report = now;
+	if (fd_p(job->whackfd)) {
+		whack_log_fd = job->whackfd;
+		whack_log(RC_COMMENT, "%s: deleted %u states, %u of %u processed",
+			  job->name, job->deleted, job->next, job->nr);
+		whack_log_fd = null_fd;
+	}
+	dbg("%s: deleted %u states, %u of %u processed",
+	    job->name, job->deleted, job->next, job->nr);
+}
+
+static void state_job_finish(struct state_job *job)
+{
+	state_job_report(job, true);
+	close_any(&job->whackfd);
+	pfreeany(job->serialnos);
+	state_job_done_cb *done = job->done;
+	void *context = job->context;
+	pfree(job);
+	if (done != NULL) {
+		done(context);
+	}
+}
+
+/* returns true when there is more to do */
+static bool state_job_batch(struct state_job *job)
+{
+	unsigned batch = 0;
+	open_v2_delete_batch();
+	while (job->next < job->nr && batch < STATE_JOB_BATCH) {
+		struct state *st = state_with_serialno(job->serialnos[job->next++]);
+		if (st == NULL) {
+			continue;
 		}
+		so_serial_t old_serialno = push_cur_state(st);
+		if (IS_IKE_SA(st)) {
+			delete_my_family(st, FALSE);
+		} else {
+			delete_state(st);
+		}
+		pop_cur_state(old_serialno);
+		job->deleted++;
+		batch++;
+	}
+	close_v2_delete_batch();
+	return job->next < job->nr;
+}
+
+static pluto_event_now_cb state_job_cb;	/* type assertion */
+
+static void state_job_cb(struct state *unused_st UNUSED,
+			 struct msg_digest **unused_mdp UNUSED,
+			 void *context)
+{
+	struct state_job *job = context;
+	if (state_job_batch(job)) {
+		state_job_report(job, false);
+		pluto_event_now(job->name, SOS_NOBODY, state_job_cb, job);
+	} else {
+		state_job_finish(job);
+	}
+}
+
+static struct state_job *new_state_job(const char *name, fd_t whackfd,
+				       state_job_select_cb *select,
+				       state_job_done_cb *done, void *context)
+{
+	struct state_job *job = alloc_thing(struct state_job, name);
+	job->name = name;
+	job->whackfd = dup_any(whackfd);
+	job->last_report = mononow();
+	job->done = done;
+	job->context = context;
+
+	/* count, then record: IKE SAs first */
+	struct state *st;
+	FOR_EACH_STATE_NEW2OLD(st) {
+		if (select(st, context)) {
+			job->nr++;
+		}
+	}
+	if (job->nr > 0) {
+		job->serialnos = alloc_things(so_serial_t, job->nr, name);
+		unsigned i = 0;
+		for (int pass = 0; pass < 2; pass++) {
+			FOR_EACH_STATE_NEW2OLD(st) {
+				if (IS_IKE_SA(st) == (pass == 0) &&
+				    select(st, context)) {
+					passert(i < job->nr);
+					job->serialnos[i++] = st->st_serialno;
+				}
+			}
+		}
+		job->nr = i;
+	}
+	return job;
+}
+
+static void run_state_job_now(struct state_job *job)
+{
+	while (state_job_batch(job))
+		;
+	state_job_finish(job);
+}
+
+void delete_states_in_background(const char *name, fd_t whackfd,
+				 state_job_select_cb *select,
+				 state_job_done_cb *done, void *context)
+{
+	struct state_job *job = new_state_job(name, whackfd, select,
+					      done, context);
+
+	if (exiting_pluto) {
+		/* the event loop is gone; do it all now */
+		run_state_job_now(job);
+		return;
+	}
+
+	libreswan_log("%s: deleting %u states in the background", name, job->nr);
+	if (job->nr == 0) {
+		state_job_finish(job);
+	} else {
+		pluto_event_now(name, SOS_NOBODY, state_job_cb, job);
 	}
 }
 
+/*
+ * Delete all states that have somehow not ben deleted yet
+ * but using interfaces that are going down
+ */
+
+static state_job_select_cb on_dead_interface;	/* type assertion */
+
+static bool on_dead_interface(struct state *st, void *context UNUSED)
+{
+	return (st->st_interface != NULL &&
+		st->st_interface->change == IFN_DELETE);
+}
+
+struct dead_interfaces_job {
+	state_job_done_cb *done;
+	void *context;
+};
+
+static state_job_done_cb dead_interfaces_done;	/* type assertion */
+
+static void dead_interfaces_done(void *context)
+{
+	struct dead_interfaces_job *dj = context;
+
+	/*
+	 * States can pick up a dead interface after the job took its
+	 * list (a child created by an IKE SA using one, say); delete
+	 * those too before the interfaces are freed.
+	 */
+	run_state_job_now(new_state_job("deleting late states on dead interfaces",
+					null_fd, on_dead_interface,
+					NULL, NULL));
+	dj->done(dj->context);
+	pfree(dj);
+}
+
+void delete_states_dead_interfaces(state_job_done_cb *done, void *context)
+{
+	struct dead_interfaces_job *dj = alloc_thing(struct dead_interfaces_job,
+						     "dead interfaces job");
+	dj->done = done;
+	dj->context = context;
+	delete_states_in_background("deleting states on dead interfaces",
+				    null_fd, on_dead_interface,
+				    dead_interfaces_done, dj);
+}
+
 /*
  * delete all states that were created for a given connection.
  * if relations == TRUE, then also delete states that share
@@ -2276,46 +2484,6 @@ static int state_compare_connection(const void *a, const void *b)
 	return state_compare_serial(a, b);
 }
 
-/*
- * NULL terminated array of state pointers.
- */
-static struct state **sort_states(int (*sort_fn)(const void *, const void *))
-{
-	/* COUNT the number of states. */
-	int count = 0;
-	{
-		struct state *st;
-		FOR_EACH_STATE_NEW2OLD(st) {
-			count++;
-		}
-	}
-
-	if (count == 0) {
-		return NULL;
-	}
-
-	/*
-	 * Create an array of COUNT+1 (NULL terminal) state pointers.
-	 */
-	struct state **array = alloc_things(struct state *, count + 1, "sorted state");
-	{
-		int p = 0;
-
-		struct state *st;
-		FOR_EACH_STATE_NEW2OLD(st) {
-			passert(st != NULL);
-			array[p++] = st;
-		}
-		passert(p == count);
-		array[p] = NULL;
-	}
-
-	/* sort it!  */
-	qsort(array, count, sizeof(struct state *), sort_fn);
-
-	return array;
-}
-
 static int log_trafic_state(struct connection *c, void *arg UNUSED)
 {
 	char state_buf[LOG_WIDTH];
@@ -2331,22 +2499,45 @@ static int log_trafic_state(struct connection *c, void *arg UNUSED)
 	return 1;
 }
 
-void show_traffic_status(const char *name)
+/*
+ * Select, in SORT_FN order, the page of states matching FILTER.
+ */
+static void page_states(struct status_page *page,
+			const struct whack_status_filter *filter,
+			int (*sort_fn)(const void *, const void *))
+{
+	size_t count = 0;
+	struct state *st;
+	FOR_EACH_STATE_NEW2OLD(st) {
+		count++;
+	}
+
+	init_status_page(page, filter, sort_fn, count);
+	FOR_EACH_STATE_NEW2OLD(st) {
+		if (state_matches_status_filter(st, filter)) {
+			status_page_add(page, st);
+		}
+	}
+}
+
+void show_traffic_status(const char *name,
+			 const struct whack_status_filter *filter)
 {
 	if (name == NULL) {
-		struct state **array = sort_states(state_compare_serial);
+		struct status_page page;
+		page_states(&page, filter, state_compare_serial);
 
 		/* now print sorted results */
-		if (array != NULL) {
-			int i;
-			for (i = 0; array[i] != NULL; i++) {
-				char state_buf[LOG_WIDTH];
-				fmt_list_traffic(array[i], state_buf, sizeof(state_buf));
-				if (state_buf[0] != '\0')
-					whack_log(RC_INFORMATIONAL_TRAFFIC, "%s", state_buf);
-			}
-			pfree(array);
+		size_t nr;
+		void **items = status_page_items(&page, &nr);
+		for (size_t i = 0; i < nr; i++) {
+			char state_buf[LOG_WIDTH];
+			fmt_list_traffic(items[i], state_buf, sizeof(state_buf));
+			if (state_buf[0] != '\0')
+				whack_log(RC_INFORMATIONAL_TRAFFIC, "%s", state_buf);
 		}
+		show_status_page_summary(&page, filter, "states");
+		free_status_page(&page);
 	} else {
 		struct connection *c = conn_by_name(name, TRUE, TRUE);
 
@@ -2362,7 +2553,7 @@ void show_traffic_status(const char *name)
 	}
 }
 
-void show_states_status(void)
+void show_states_status(const struct whack_status_filter *filter)
 {
 	whack_log(RC_COMMENT, " ");             /* spacer */
 	whack_log(RC_COMMENT, "State Information: DDoS cookies %s, %s new IKE connections",
@@ -2381,14 +2572,16 @@ void show_states_status(void)
 		  cat_count_child_sa[CAT_ANONYMOUS]);
 	whack_log(RC_COMMENT, " ");             /* spacer */
 
-	struct state **array = sort_states(state_compare_connection);
+	struct status_page page;
+	page_states(&page, filter, state_compare_connection);
 
-	if (array != NULL) {
+	size_t nr;
+	void **items = status_page_items(&page, &nr);
+	if (nr > 0) {
 		monotime_t n = mononow();
 		/* now print sorted results */
-		int i;
-		for (i = 0; array[i] != NULL; i++) {
-			struct state *st = array[i];
+		for (size_t i = 0; i < nr; i++) {
+			struct state *st = items[i];
 
 			char state_buf[LOG_WIDTH];
 			char state_buf2[LOG_WIDTH];
@@ -2404,8 +2597,9 @@ void show_states_status(void)
 		}
 
 		whack_log(RC_COMMENT, " "); /* spacer */
-		pfree(array);
 	}
+	show_status_page_summary(&page, filter, "states");
+	free_status_page(&page);
 }
 
 /*
@@ -2470,7 +2664,7 @@ startover:
 ipsec_spi_t uniquify_his_cpi(ipsec_spi_t cpi, const struct state *st, int tries)
 {
 	/* cpi is in network order so first two bytes are the high order ones */
-	get_rnd_bytes((u_char *)&cpi, 2);
+	get_public_rnd_bytes(&cpi, 2);
 
 	/*
 	 * Make sure that the result is unique.
@@ -2778,6 +2972,8 @@ void delete_my_family(struct state *pst, bool v2_responder_state)
 	struct delete_filter delete_filter = {
 		.v2_responder_state = v2_responder_state,
 	};
+	/* the IKE SA's Delete covers the children */
+	open_v2_delete_batch();
 	state_by_ike_spis(pst->st_ike_version, pst->st_serialno,
 			  NULL /* ignore MSGID */, &pst->st_ike_spis,
 			  delete_predicate, &delete_filter,
@@ -2791,6 +2987,7 @@ void delete_my_family(struct state *pst, bool v2_responder_state)
 		change_state(pst, STATE_IKESA_DEL);
 	}
 	delete_state(pst);
+	close_v2_delete_batch();
 	/* note: no md->st to clear */
 }
 
@@ -415,6 +415,7 @@ struct state {
 
 	struct p_dns_req *ipseckey_dnsr;    /* ipseckey of that end */
 	struct p_dns_req *ipseckey_fwd_dnsr;/* validate IDi that IP in forward A/AAAA */
+	bool st_oe_failure_recorded;	/* OE failure already in the oe_cache */
 
 	char *st_active_redirect_gw;	/* needed for sending of REDIRECT in informational */
 
@@ -791,8 +792,10 @@ extern void initialize_new_state(struct state *st,
 				 int try,
 				 fd_t whack_sock);
 
-extern void show_traffic_status(const char *name);
-extern void show_states_status(void);
+struct whack_status_filter;
+extern void show_traffic_status(const char *name,
+				const struct whack_status_filter *filter);
+extern void show_states_status(const struct whack_status_filter *filter);
 
 void v2_migrate_children(struct ike_sa *from, struct child_sa *to);
 
@@ -818,7 +821,26 @@ extern void set_state_ike_endpoints(struct state *st,
 				    struct connection *c);
 
 extern void delete_cryptographic_continuation(struct state *st);
-extern void delete_states_dead_interfaces(void);
+
+/*
+ * Delete the states selected by SELECT, a batch at a time, from the
+ * event loop; then call DONE.  Progress is reported to WHACKFD.
+ */
+typedef bool state_job_select_cb(struct state *st, void *context);
+typedef void state_job_done_cb(void *context);
+extern void delete_states_in_background(const char *name, fd_t whackfd,
+					state_job_select_cb *select,
+					state_job_done_cb *done, void *context);
+
+/*
+ * Delete states using interfaces that are going down (their
+ * iface_port structures must remain valid until DONE is called).
+ * Any state found using one when the job ends is deleted there and
+ * then, so the interfaces can be freed by DONE.
+ */
+extern void delete_states_dead_interfaces(state_job_done_cb *done,
+					  void *context);
+
 extern bool dpd_active_locally(const struct state *st);
 
 /*
@@ -13,6 +13,8 @@
  * for more details.
  */
 
+#include <string.h>
+
 #include "defs.h"
 
 #include "state_db.h"
@@ -20,8 +22,6 @@
 #include "lswlog.h"
 #include "hash_table.h"
 
-#define STATE_TABLE_SIZE 499
-
 static size_t log_state(struct lswlog *buf, void *data)
 {
 	if (data == NULL) {
@@ -94,18 +94,15 @@ struct state *state_by_serialno(so_serial_t serialno)
  * Hash table indexed by just the IKE SPIi.
  */
 
+/*
+ * The initiator chooses SPIi so the hash is keyed; otherwise a peer
+ * could fill a single slot.
+ */
+
 static size_t ike_initiator_spi_hasher(const ike_spi_t *ike_initiator_spi)
 {
-	/*
-	 * 251 is a prime close to 256 (so like <<8).
-	 *
-	 * There's no real rationale for doing this.
-	 */
-	size_t hash = 0;
-	for (unsigned j = 0; j < sizeof(ike_initiator_spi->bytes); j++) {
-		hash = hash * 251 + ike_initiator_spi->bytes[j];
-	}
-	return hash;
+	return hash_table_bytes(ike_initiator_spi->bytes,
+				sizeof(ike_initiator_spi->bytes));
 }
 
 static size_t ike_initiator_spi_hash(void *data)
@@ -159,19 +156,15 @@ static struct list_head *ike_initiator_spi_slot(const ike_spi_t *initiator)
 
 static size_t ike_spis_hasher(const ike_spis_t *ike_spis)
 {
-	/*
-	 * 251 is a prime close to 256 aka <<8.  65521 is a prime
-	 * close to 65536 aka <<16.
-	 *
-	 * There's no real rationale for doing this.
-	 */
-	size_t hash = 0;
-	for (unsigned j = 0; j < sizeof(ike_spis->initiator.bytes); j++) {
-		hash = (hash * 65521 +
-			ike_spis->initiator.bytes[j] * 251 +
-			ike_spis->responder.bytes[j]);
-	}
-	return hash;
+	uint8_t bytes[sizeof(ike_spis->initiator.bytes) +
+		      sizeof(ike_spis->responder.bytes)];
+
+	memcpy(bytes, ike_spis->initiator.bytes,
+	       sizeof(ike_spis->initiator.bytes));
+	memcpy(bytes + sizeof(ike_spis->initiator.bytes),
+	       ike_spis->responder.bytes,
+	       sizeof(ike_spis->responder.bytes));
+	return hash_table_bytes(bytes, sizeof(bytes));
 }
 
 static size_t ike_spis_hash(void *data)
@@ -387,3 +380,10 @@ void init_state_db(void)
 	init_hash_table(&ike_spis_hash_table);
 	init_hash_table(&ike_initiator_spi_hash_table);
 }
+
+void show_state_db_status(void)
+{
+	show_hash_table_status("serialno", &serialno_hash_table);
+	show_hash_table_status("ike_spii", &ike_initiator_spi_hash_table);
+	show_hash_table_status("ike_spis", &ike_spis_hash_table);
+}
@@ -21,7 +21,11 @@
 struct state;
 struct list_entry;
 
+/* slots in each of the state hash tables */
+#define STATE_TABLE_SIZE 499
+
 void init_state_db(void);
+void show_state_db_status(void);
 
 void add_state_to_db(struct state *st);
 void rehash_state_cookies_in_db(struct state *st);
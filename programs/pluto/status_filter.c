@@ -0,0 +1,205 @@
+/* filter and page status listings, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * With hundreds of thousands of states, "ipsec status" spent seconds
+ * of main-loop time sorting and formatting everything.  The filters
+ * here are applied before anything is formatted, and a page (offset
+ * and limit) is selected without sorting the entire list.
+ */
+
+#include <fnmatch.h>
+#include <stdlib.h>
+
+#include <libreswan.h>
+
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+
+#include "defs.h"
+#include "log.h"
+#include "connections.h"
+#include "state.h"
+#include "whack.h"
+#include "status_filter.h"
+
+bool status_filter_active(const struct whack_status_filter *filter)
+{
+	return filter != NULL &&
+		(filter->name != NULL || filter->state != NULL ||
+		 filter->has_peer || filter->ike_version != 0 ||
+		 filter->offset != 0 || filter->limit != 0);
+}
+
+static bool name_matches(const char *pattern, const char *name)
+{
+	return pattern == NULL || fnmatch(pattern, name, 0) == 0;
+}
+
+static bool peer_matches(const struct whack_status_filter *filter,
+			 const ip_address *peer)
+{
+	return !filter->has_peer || addrinsubnet(peer, &filter->peer);
+}
+
+bool connection_matches_status_filter(const struct connection *c,
+				      const struct whack_status_filter *filter)
+{
+	if (filter == NULL) {
+		return true;
+	}
+	if (!name_matches(filter->name, c->name)) {
+		return false;
+	}
+	if (!peer_matches(filter, &c->spd.that.host_addr)) {
+		return false;
+	}
+	switch (filter->ike_version) {
+	case IKEv1:
+		return (c->policy & POLICY_IKEV1_ALLOW) != LEMPTY;
+	case IKEv2:
+		return (c->policy & POLICY_IKEV2_ALLOW) != LEMPTY;
+	default:
+		return true;
+	}
+}
+
+bool state_matches_status_filter(const struct state *st,
+				 const struct whack_status_filter *filter)
+{
+	if (filter == NULL) {
+		return true;
+	}
+	if (filter->ike_version != 0 && st->st_ike_version != filter->ike_version) {
+		return false;
+	}
+	if (!name_matches(filter->state, st->st_state_name)) {
+		return false;
+	}
+	if (!name_matches(filter->name, st->st_connection->name)) {
+		return false;
+	}
+	return peer_matches(filter, &st->st_remoteaddr);
+}
+
+void init_status_page(struct status_page *page,
+		      const struct whack_status_filter *filter,
+		      int (*cmp)(const void *, const void *),
+		      size_t max)
+{
+	*page = (struct status_page) {
+		.cmp = cmp,
+		.keep = max,
+	};
+	if (filter != NULL) {
+		page->offset = filter->offset;
+		/* no more than OFFSET+LIMIT, watching for overflow */
+		if (filter->limit != 0 && filter->offset < max &&
+		    filter->limit < max - filter->offset) {
+			page->keep = filter->offset + filter->limit;
+			page->heap = true;
+		}
+	}
+	page->items = page->keep == 0 ? NULL :
+		alloc_things(void *, page->keep, "status page");
+}
+
+static int item_cmp(const struct status_page *page, size_t a, size_t b)
+{
+	return page->cmp(&page->items[a], &page->items[b]);
+}
+
+static void swap_items(struct status_page *page, size_t a, size_t b)
+{
+	void *t = page->items[a];
+	page->items[a] = page->items[b];
+	page->items[b] = t;
+}
+
+void status_page_add(struct status_page *page, void *item)
+{
+	page->matched++;
+
+	if (!page->heap) {
+		passert(page->nr < page->keep);
+		page->items[page->nr++] = item;
+		return;
+	}
+
+	if (page->nr < page->keep) {
+		/* sift up */
+		size_t i = page->nr++;
+		page->items[i] = item;
+		while (i > 0 && item_cmp(page, (i - 1) / 2, i) < 0) {
+			swap_items(page, (i - 1) / 2, i);
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	/* full; replace the largest if ITEM comes before it */
+	if (page->cmp(&item, &page->items[0]) >= 0) {
+		return;
+	}
+	page->items[0] = item;
+	size_t i = 0;
+	for (;;) {
+		size_t largest = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+		if (l < page->nr && item_cmp(page, l, largest) > 0)
+			largest = l;
+		if (r < page->nr && item_cmp(page, r, largest) > 0)
+			largest = r;
+		if (largest == i)
+			break;
+		swap_items(page, i, largest);
+		i = largest;
+	}
+}
+
+void **status_page_items(struct status_page *page, size_t *nr)
+{
+	if (page->nr == 0 || page->offset >= page->nr) {
+		*nr = 0;
+		return NULL;
+	}
+	qsort(page->items, page->nr, sizeof(page->items[0]), page->cmp);
+	*nr = page->nr - page->offset;
+	return page->items + page->offset;
+}
+
+void show_status_page_summary(const struct status_page *page,
+			      const struct whack_status_filter *filter,
+			      const char *what)
+{
+	if (!status_filter_active(filter)) {
+		return;
+	}
+	size_t listed = page->nr > page->offset ? page->nr - page->offset : 0;
+	if (listed == 0) {
+		whack_log(RC_COMMENT, "listed 0 of %zu matching %s",
+			  page->matched, what);
+	} else {
+		whack_log(RC_COMMENT, "listed %zu-%zu of %zu matching %s",
+			  page->offset + 1, page->offset + listed,
+			  page->matched, what);
+	}
+}
+
+void free_status_page(struct status_page *page)
+{
+	pfreeany(page->items);
+}
@@ -0,0 +1,68 @@
+/* filter and page status listings, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef STATUS_FILTER_H
+#define STATUS_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct whack_status_filter;
+struct connection;
+struct state;
+
+/*
+ * A NULL filter, as used by plain "whack --status", matches
+ * everything.
+ */
+extern bool status_filter_active(const struct whack_status_filter *filter);
+extern bool connection_matches_status_filter(const struct connection *c,
+					     const struct whack_status_filter *filter);
+extern bool state_matches_status_filter(const struct state *st,
+					const struct whack_status_filter *filter);
+
+/*
+ * The items, in CMP (qsort() style) order, to list.
+ *
+ * When the filter has a limit, only the first OFFSET+LIMIT items are
+ * kept (in a max-heap), so adding N items costs O(N log
+ * (OFFSET+LIMIT)) and only those kept are sorted.
+ */
+struct status_page {
+	int (*cmp)(const void *, const void *);
+	size_t offset;
+	size_t keep;		/* size of items[] */
+	size_t nr;		/* in items[] */
+	size_t matched;		/* passed to status_page_add() */
+	bool heap;		/* items[] is a heap of the first KEEP */
+	void **items;
+};
+
+/* MAX is an upper bound on the number of items that will be added */
+extern void init_status_page(struct status_page *page,
+			     const struct whack_status_filter *filter,
+			     int (*cmp)(const void *, const void *),
+			     size_t max);
+extern void status_page_add(struct status_page *page, void *item);
+
+/* sort the page; return its first item and set *NR */
+extern void **status_page_items(struct status_page *page, size_t *nr);
+
+/* "listed X-Y of N matching WHAT", when there is a filter */
+extern void show_status_page_summary(const struct status_page *page,
+				     const struct whack_status_filter *filter,
+				     const char *what);
+
+extern void free_status_page(struct status_page *page);
+
+#endif
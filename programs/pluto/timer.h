@@ -21,6 +21,7 @@
 
 #include "deltatime.h"
 #include "monotime.h"
+#include "list_entry.h"
 
 struct state;   /* forward declaration */
 
@@ -30,7 +31,7 @@ struct pluto_event {
 	struct state   *ev_state;       /* Pointer to relevant state (if any) */
 	struct event *ev;               /* libevent data structure */
 	monotime_t ev_time;
-	struct pluto_event *next;
+	struct list_entry ev_entry;	/* on server.c's list of all events */
 };
 
 extern void event_schedule(enum event_type type, deltatime_t delay,
@@ -0,0 +1,565 @@
+/* run updown commands using helper processes, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Running the updown script using popen() from pluto means that,
+ * for every prepare, route, up, down, and unroute event, pluto (with
+ * its potentially large address space) forks a shell and then blocks
+ * until the script exits.
+ *
+ * Instead, a small pool of helper processes is forked during startup
+ * and each command (the PLUTO_* environment is part of the command
+ * string) is passed to a helper over a socket.  The helper runs the
+ * command using popen() and sends back its output and exit status.
+ *
+ * Each helper runs its commands in order.  Commands are assigned to
+ * a helper using the SPD's client subnets so that the commands for
+ * the one tunnel (for instance an unroute by the old owner followed by
+ * a route by the new owner) can't overtake each other.
+ *
+ * Verbs whose result pluto ignores are run asynchronously (their
+ * output and status are logged when they arrive).  For the rest pluto
+ * still waits for the result, so they are not queued behind other
+ * tunnels' commands: unless the tunnel has commands outstanding they
+ * go to an idle helper or, when every helper is busy, are run
+ * directly.
+ *
+ * Pluto remembers each command until its exit status arrives; if the
+ * helper dies, the commands it hadn't finished are run directly.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>		/* for WIFEXITED() et.al. */
+#include <unistd.h>
+
+#include <libreswan.h>
+
+#include "sysdep.h"
+#include "constants.h"
+#include "lswlog.h"
+#include "lswalloc.h"
+
+#include "defs.h"
+#include "log.h"
+#include "connections.h"
+#include "server.h"
+#include "whack.h"      /* for RC_LOG_SERIOUS */
+#include "kernel.h"	/* for popen_command() */
+#include "updown.h"
+
+/*
+ * Commands are at most a few kilobytes; see *_do_command().
+ */
+#define UPDOWN_MAX_TEXT 8192
+
+enum updown_type {
+	UPDOWN_RUN,	/* pluto->helper: run text */
+	UPDOWN_OUTPUT,	/* helper->pluto: text is a line of output */
+	UPDOWN_EXIT,	/* helper->pluto: status is from pclose() */
+	UPDOWN_FAILED,	/* helper->pluto: status is errno */
+};
+
+/*
+ * The socket is SOCK_SEQPACKET so each message, a header followed
+ * by NUL terminated text, is read in one go.
+ */
+struct updown_msg {
+	uint32_t id;
+	enum updown_type type;
+	int status;
+	char verb[20];
+	char verb_suffix[20];
+};
+
+/*
+ * A command sent to a helper but not yet finished.
+ */
+struct updown_pending {
+	struct updown_pending *next;
+	uint32_t id;
+	unsigned long hash;	/* of the tunnel; see tunnel_hash() */
+	bool waited_on;		/* freed by updown_helper_command() */
+	bool done;
+	bool ok;
+	char verb[20];
+	char verb_suffix[20];
+	char *cmd;
+};
+
+struct updown_helper {
+	pid_t pid;
+	int fd;		/* pluto's end; -1 when the helper is gone */
+	int child_fd;	/* helper's end */
+	struct pluto_event *pev;
+	/* in the order sent */
+	struct updown_pending *pending;
+	struct updown_pending **pending_tail;
+};
+
+static struct updown_helper *helpers;
+static unsigned nr_helpers;
+static uint32_t updown_id;
+
+/*
+ * Verbs where the caller ignores the result (beyond logging it).
+ */
+static const char *const async_verbs[] = {
+	"prepare",
+	"down",
+	"unroute",
+};
+
+static bool send_msg(int fd, const struct updown_msg *msg, const char *text)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)msg, .iov_len = sizeof(*msg), },
+		{ .iov_base = (void *)text, .iov_len = strlen(text) + 1, },
+	};
+	struct msghdr mh = {
+		.msg_iov = iov,
+		.msg_iovlen = elemsof(iov),
+	};
+	ssize_t n;
+	do {
+		n = sendmsg(fd, &mh, 0);
+	} while (n < 0 && errno == EINTR);
+	return n >= 0;
+}
+
+/*
+ * Read a message; return the number of bytes read, zero for EOF, or
+ * -1 (errno set).
+ */
+static ssize_t recv_msg(int fd, int flags, struct updown_msg *msg,
+			char *text)
+{
+	char buf[sizeof(*msg) + UPDOWN_MAX_TEXT + 1];
+	ssize_t n = recv(fd, buf, sizeof(buf) - 1, flags);
+	if (n <= 0) {
+		return n;
+	}
+	if ((size_t)n < sizeof(*msg)) {
+		errno = EPROTO;
+		return -1;
+	}
+	buf[n] = '\0';
+	memcpy(msg, buf, sizeof(*msg));
+	msg->verb[sizeof(msg->verb) - 1] = '\0';
+	msg->verb_suffix[sizeof(msg->verb_suffix) - 1] = '\0';
+	strcpy(text, buf + sizeof(*msg));
+	return n;
+}
+
+/*
+ * The helper.
+ */
+
+static void helper_run(int fd, const struct updown_msg *req, const char *cmd)
+{
+	struct updown_msg reply = *req;
+
+	FILE *f = popen(cmd, "r");
+	if (f == NULL) {
+		reply.type = UPDOWN_FAILED;
+		reply.status = errno;
+		send_msg(fd, &reply, "");
+		return;
+	}
+
+	/*
+	 * if response doesn't fit in this buffer, it will be folded
+	 */
+	char resp[256];
+	reply.type = UPDOWN_OUTPUT;
+	while (fgets(resp, sizeof(resp), f) != NULL) {
+		char *e = resp + strlen(resp);
+		if (e > resp && e[-1] == '\n')
+			e[-1] = '\0'; /* trim trailing '\n' */
+		send_msg(fd, &reply, resp);
+	}
+
+	int r = pclose(f);
+	if (r == -1) {
+		reply.type = UPDOWN_FAILED;
+		reply.status = errno;
+	} else {
+		reply.type = UPDOWN_EXIT;
+		reply.status = r;
+	}
+	send_msg(fd, &reply, "");
+}
+
+static int updown_helper(void *context)
+{
+	struct updown_helper *h = context;
+	int fd = h->child_fd;
+
+	/* the commands should only inherit stdin/stdout/stderr */
+	for (int i = getdtablesize() - 1; i > 2; i--) {
+		if (i != fd) {
+			close(i);
+		}
+	}
+	/* undo pluto's handlers; pclose() needs SIGCHLD */
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	while (true) {
+		struct updown_msg req;
+		static char cmd[UPDOWN_MAX_TEXT + 1];
+		ssize_t n = recv_msg(fd, 0, &req, cmd);
+		if (n == 0) {
+			/* pluto has exited */
+			return 0;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		if (req.type == UPDOWN_RUN) {
+			helper_run(fd, &req, cmd);
+		}
+	}
+}
+
+/*
+ * Pluto.
+ */
+
+static void free_pending(struct updown_pending *p)
+{
+	pfree(p->cmd);
+	pfree(p);
+}
+
+/*
+ * P is finished; unlink it from H and, unless someone is waiting on
+ * it, free it.
+ */
+static void finish_pending(struct updown_helper *h, struct updown_pending *p,
+			   bool ok)
+{
+	for (struct updown_pending **pp = &h->pending; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == p) {
+			*pp = p->next;
+			if (h->pending_tail == &p->next) {
+				h->pending_tail = pp;
+			}
+			break;
+		}
+	}
+	p->next = NULL;
+	p->done = true;
+	p->ok = ok;
+	if (!p->waited_on) {
+		free_pending(p);
+	}
+}
+
+static void helper_gone(struct updown_helper *h)
+{
+	if (h->pev != NULL) {
+		delete_pluto_event(&h->pev);
+	}
+	if (h->fd >= 0) {
+		close(h->fd);
+		h->fd = -1;
+	}
+	/*
+	 * Whatever the helper was part way through (or hadn't
+	 * started) is run here, in the order it was sent.
+	 */
+	while (h->pending != NULL) {
+		struct updown_pending *p = h->pending;
+		libreswan_log("updown helper pid %d gone; running %s%s command %u directly",
+			      h->pid, p->verb, p->verb_suffix, p->id);
+		finish_pending(h, p, popen_command(p->verb, p->verb_suffix, p->cmd));
+	}
+}
+
+static pluto_fork_cb helper_exited; /* type assertion */
+
+static void helper_exited(struct state *null_st UNUSED,
+			  struct msg_digest **null_mdp UNUSED,
+			  int status, void *context)
+{
+	struct updown_helper *h = context;
+	loglog(RC_LOG_SERIOUS,
+	       "updown helper pid %d exited (status %d); updown commands will be run directly",
+	       h->pid, status);
+	helper_gone(h);
+}
+
+bool updown_command_status(const char *verb, const char *verb_suffix,
+			   int r)
+{
+	if (WIFEXITED(r)) {
+		if (WEXITSTATUS(r) != 0) {
+			loglog(RC_LOG_SERIOUS,
+			       "%s%s command exited with status %d",
+			       verb, verb_suffix,
+			       WEXITSTATUS(r));
+			return FALSE;
+		}
+	} else if (WIFSIGNALED(r)) {
+		loglog(RC_LOG_SERIOUS,
+		       "%s%s command exited with signal %d",
+		       verb, verb_suffix, WTERMSIG(r));
+		return FALSE;
+	} else {
+		loglog(RC_LOG_SERIOUS,
+		       "%s%s command exited with unknown status %d",
+		       verb, verb_suffix, r);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Read and log one message from H, finishing the pending command it
+ * completes.  Return false when there is nothing to read (or the
+ * helper has gone).
+ */
+static bool read_reply(struct updown_helper *h, bool wait)
+{
+	struct updown_msg reply;
+	static char text[UPDOWN_MAX_TEXT + 1];
+	ssize_t n = recv_msg(h->fd, wait ? 0 : MSG_DONTWAIT, &reply, text);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			LOG_ERRNO(errno, "reading updown helper pid %d failed",
+				  h->pid);
+			helper_gone(h);
+		}
+		return false;
+	}
+	if (n == 0) {
+		libreswan_log("updown helper pid %d closed its socket", h->pid);
+		helper_gone(h);
+		return false;
+	}
+
+	bool ok;
+	switch (reply.type) {
+	case UPDOWN_OUTPUT:
+		libreswan_log("%s%s output: %s",
+			      reply.verb, reply.verb_suffix, text);
+		return true;
+	case UPDOWN_EXIT:
+		ok = updown_command_status(reply.verb, reply.verb_suffix,
+					   reply.status);
+		break;
+	case UPDOWN_FAILED:
+		LOG_ERRNO(reply.status, "unable to run %s%s command",
+			  reply.verb, reply.verb_suffix);
+		ok = FALSE;
+		break;
+	default:
+		loglog(RC_LOG_SERIOUS, "updown helper pid %d sent unknown message type %d",
+		       h->pid, reply.type);
+		return true;
+	}
+
+	DBG(DBG_CONTROL,
+	    DBG_log("updown helper pid %d: %s%s command %u %s",
+		    h->pid, reply.verb, reply.verb_suffix,
+		    reply.id, ok ? "succeeded" : "failed"));
+	for (struct updown_pending *p = h->pending; p != NULL; p = p->next) {
+		if (p->id == reply.id) {
+			finish_pending(h, p, ok);
+			break;
+		}
+	}
+	return true;
+}
+
+static void updown_helper_cb(evutil_socket_t fd UNUSED, const short event UNUSED,
+			     void *arg)
+{
+	struct updown_helper *h = arg;
+	while (h->fd >= 0 && read_reply(h, false)) {
+	}
+}
+
+static unsigned long tunnel_hash(const struct spd_route *sr)
+{
+	/*
+	 * Hash both client subnets; connections that fight over the
+	 * same route have the same clients.
+	 */
+	char this_client[SUBNETTOT_BUF];
+	char that_client[SUBNETTOT_BUF];
+	subnettot(&sr->this.client, 0, this_client, sizeof(this_client));
+	subnettot(&sr->that.client, 0, that_client, sizeof(that_client));
+	unsigned long hash = 0;
+	for (const char *p = this_client; *p != '\0'; p++) {
+		hash = hash * 31 + *p;
+	}
+	for (const char *p = that_client; *p != '\0'; p++) {
+		hash = hash * 31 + *p;
+	}
+	return hash;
+}
+
+static bool has_pending(const struct updown_helper *h, unsigned long hash)
+{
+	for (const struct updown_pending *p = h->pending; p != NULL; p = p->next) {
+		if (p->hash == hash) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Asynchronous commands always go to the tunnel's own helper, so
+ * they run in order.  Waiting for a command queued behind other
+ * tunnels' commands would stall pluto so, unless this tunnel's
+ * earlier commands are still queued there, use an idle helper.
+ */
+static struct updown_helper *pick_helper(unsigned long hash, bool async)
+{
+	struct updown_helper *h = &helpers[hash % nr_helpers];
+	if (h->fd < 0) {
+		return NULL;
+	}
+	if (async || h->pending == NULL || has_pending(h, hash)) {
+		return h;
+	}
+	for (unsigned i = 0; i < nr_helpers; i++) {
+		if (helpers[i].fd >= 0 && helpers[i].pending == NULL) {
+			return &helpers[i];
+		}
+	}
+	return NULL;
+}
+
+bool updown_helper_command(const struct spd_route *sr,
+			   const char *verb, const char *verb_suffix,
+			   const char *cmd, bool *ok)
+{
+	if (nr_helpers == 0) {
+		return false;
+	}
+	if (strlen(cmd) > UPDOWN_MAX_TEXT ||
+	    strlen(verb) >= sizeof(((struct updown_msg *)NULL)->verb) ||
+	    strlen(verb_suffix) >= sizeof(((struct updown_msg *)NULL)->verb_suffix)) {
+		/* let the caller deal with it */
+		return false;
+	}
+
+	bool async = false;
+	for (unsigned i = 0; i < elemsof(async_verbs); i++) {
+		if (streq(verb, async_verbs[i])) {
+			async = true;
+			break;
+		}
+	}
+
+	unsigned long hash = tunnel_hash(sr);
+	struct updown_helper *h = pick_helper(hash, async);
+	if (h == NULL) {
+		return false;
+	}
+
+	struct updown_msg req = {
+		.id = ++updown_id,
+		.type = UPDOWN_RUN,
+	};
+	jam_str(req.verb, sizeof(req.verb), verb);
+	jam_str(req.verb_suffix, sizeof(req.verb_suffix), verb_suffix);
+
+	/* this blocks when the helper has a backlog */
+	if (!send_msg(h->fd, &req, cmd)) {
+		LOG_ERRNO(errno, "sending %s%s command to updown helper pid %d failed",
+			  verb, verb_suffix, h->pid);
+		/* runs anything outstanding first */
+		helper_gone(h);
+		return false;
+	}
+
+	struct updown_pending *p = alloc_thing(struct updown_pending,
+					       "updown pending");
+	p->id = req.id;
+	p->hash = hash;
+	p->waited_on = !async;
+	jam_str(p->verb, sizeof(p->verb), verb);
+	jam_str(p->verb_suffix, sizeof(p->verb_suffix), verb_suffix);
+	p->cmd = clone_str(cmd, "updown pending command");
+	*h->pending_tail = p;
+	h->pending_tail = &p->next;
+
+	if (async) {
+		DBG(DBG_CONTROL,
+		    DBG_log("updown helper pid %d: %s%s command %u queued",
+			    h->pid, verb, verb_suffix, req.id));
+		*ok = TRUE;
+		return true;
+	}
+
+	/*
+	 * Wait for this command's result; if the helper dies first,
+	 * helper_gone() runs it directly.
+	 */
+	DBG(DBG_CONTROL,
+	    DBG_log("updown helper pid %d: waiting for %s%s command %u",
+		    h->pid, verb, verb_suffix, req.id));
+	while (!p->done) {
+		read_reply(h, true);
+	}
+	*ok = p->ok;
+	free_pending(p);
+	return true;
+}
+
+void init_updown_helpers(unsigned nr)
+{
+	if (nr == 0) {
+		return;
+	}
+	helpers = alloc_things(struct updown_helper, nr, "updown helpers");
+	for (unsigned i = 0; i < nr; i++) {
+		struct updown_helper *h = &helpers[nr_helpers];
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+			LOG_ERRNO(errno, "socketpair() for updown helper failed");
+			break;
+		}
+		h->fd = fds[0];
+		h->child_fd = fds[1];
+		h->pending = NULL;
+		h->pending_tail = &h->pending;
+		h->pid = pluto_fork("updown helper", SOS_NOBODY,
+				    updown_helper, helper_exited, h);
+		close(h->child_fd);
+		h->child_fd = -1;
+		if (h->pid < 0) {
+			close(h->fd);
+			h->fd = -1;
+			break;
+		}
+		h->pev = pluto_event_add(h->fd, EV_READ | EV_PERSIST,
+					 updown_helper_cb, h, NULL,
+					 "PLUTO_UPDOWN_HELPER");
+		nr_helpers++;
+	}
+	libreswan_log("started %u updown helper processes", nr_helpers);
+}
@@ -0,0 +1,49 @@
+/* run updown commands using helper processes, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef UPDOWN_H
+#define UPDOWN_H
+
+#include <stdbool.h>
+
+struct spd_route;
+
+/*
+ * Fork NR_HELPERS long lived processes that run the updown commands
+ * on pluto's behalf.  Zero means popen() each command from pluto.
+ *
+ * Call this early, before threads are created and while pluto's
+ * address space is still small.
+ */
+extern void init_updown_helpers(unsigned nr_helpers);
+
+/*
+ * Run CMD using an updown helper.
+ *
+ * Returns false, leaving *OK untouched, when there is no (idle)
+ * helper and the caller needs to run the command itself.  Otherwise
+ * *OK is set to the command's result; verbs whose result pluto
+ * ignores are run asynchronously and always succeed.  Should the
+ * helper die, its unfinished commands are run using popen_command().
+ */
+extern bool updown_helper_command(const struct spd_route *sr,
+				  const char *verb, const char *verb_suffix,
+				  const char *cmd, bool *ok);
+
+/*
+ * Interpret STATUS, as returned by pclose(), logging any failure.
+ */
+extern bool updown_command_status(const char *verb, const char *verb_suffix,
+				  int status);
+
+#endif
@@ -57,6 +57,125 @@ static int private_net_incl_len = 0;
 static ip_subnet *private_net_excl = NULL;	/* [private_net_excl_len] */
 static int private_net_excl_len = 0;
 
+/*
+ * Binary prefix tries, one root per address family.  A subnet is the
+ * node reached by following the first maskbits bits of its network
+ * address, so finding the subnets that contain, or are contained by,
+ * a subnet costs at most its prefix length.
+ *
+ * PRIVATE_NETS is virtual-private= compiled; IN_USE indexes every
+ * connection by its spd.that.client.
+ */
+
+#define F_NET_INCL	1
+#define F_NET_EXCL	2
+
+struct net_node {
+	struct net_node *child[2];
+	struct net_node *parent;
+	unsigned short flags;	/* F_NET_* */
+	struct virtual_net_entry *entries;
+};
+
+struct net_trie {
+	struct net_node *root[2];	/* IPv4, IPv6 */
+};
+
+struct virtual_net_entry {
+	struct connection *c;
+	ip_subnet client;	/* as indexed */
+	struct net_node *node;
+	struct virtual_net_entry *next;
+};
+
+static struct net_trie private_nets;
+static struct net_trie in_use;
+
+struct net_path {
+	ip_address net;
+	const unsigned char *bytes;
+	int bits;
+};
+
+static struct net_node **net_root(struct net_trie *t, const ip_subnet *sn,
+				  struct net_path *path)
+{
+	networkof(sn, &path->net);
+	addrbytesptr_read(&path->net, &path->bytes);
+	path->bits = sn->maskbits;
+	return &t->root[subnettypeof(sn) == AF_INET6 ? 1 : 0];
+}
+
+static unsigned net_bit(const struct net_path *path, int bit)
+{
+	return (path->bytes[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static struct net_node *add_net_node(struct net_trie *t, const ip_subnet *sn)
+{
+	struct net_path path;
+	struct net_node **np = net_root(t, sn, &path);
+	struct net_node *parent = NULL;
+
+	for (int bit = 0; ; bit++) {
+		if (*np == NULL) {
+			*np = alloc_thing(struct net_node, "virtual net node");
+			(*np)->parent = parent;
+		}
+		if (bit == path.bits)
+			return *np;
+		parent = *np;
+		np = &parent->child[net_bit(&path, bit)];
+	}
+}
+
+/* free N and any of its ancestors that are no longer needed */
+static void prune_net_node(struct net_trie *t, struct net_node *n)
+{
+	while (n != NULL && n->flags == 0 && n->entries == NULL &&
+	       n->child[0] == NULL && n->child[1] == NULL) {
+		struct net_node *parent = n->parent;
+		struct net_node **np;
+
+		if (parent == NULL)
+			np = t->root[0] == n ? &t->root[0] : &t->root[1];
+		else
+			np = parent->child[0] == n ? &parent->child[0] : &parent->child[1];
+		*np = NULL;
+		pfree(n);
+		n = parent;
+	}
+}
+
+static void free_net_node(struct net_node *n)
+{
+	if (n != NULL) {
+		passert(n->entries == NULL);
+		free_net_node(n->child[0]);
+		free_net_node(n->child[1]);
+		pfree(n);
+	}
+}
+
+/*
+ * Is SN inside any of the subnets in T that are marked FLAG?
+ */
+static bool net_in_trie(struct net_trie *t, const ip_subnet *sn,
+			unsigned short flag)
+{
+	struct net_path path;
+	const struct net_node *n = *net_root(t, sn, &path);
+
+	for (int bit = 0; n != NULL; bit++) {
+		if (n->flags & flag)
+			return TRUE;
+		if (bit == path.bits)
+			break;
+		n = n->child[net_bit(&path, bit)];
+	}
+	return FALSE;
+}
+
 /*
  * Read a subnet (IPv4/IPv6)
  * inclusion form: %v4:x.x.x.x/y or %v6:xxxxxxxxx/yy
@@ -114,6 +233,11 @@ static bool read_subnet(const char *src, size_t len,
 
 void free_virtual_ip(void)
 {
+	for (unsigned i = 0; i < elemsof(private_nets.root); i++) {
+		free_net_node(private_nets.root[i]);
+		private_nets.root[i] = NULL;
+	}
+
 	/* These might be NULL if empty in ipsec.conf */
 	private_net_incl_len = 0;
 	pfreeany(private_net_incl);
@@ -188,6 +312,11 @@ void init_virtual_ip(const char *private_list)
 			}
 			str = *next != '\0' ? next + 1 : NULL;
 		}
+
+		for (int i = 0; i < private_net_incl_len; i++)
+			add_net_node(&private_nets, &private_net_incl[i])->flags |= F_NET_INCL;
+		for (int i = 0; i < private_net_excl_len; i++)
+			add_net_node(&private_nets, &private_net_excl[i])->flags |= F_NET_EXCL;
 	} else {
 		loglog(RC_LOG_SERIOUS,
 		       "%d bad entries in virtual-private - none loaded", ign);
@@ -399,10 +528,8 @@ err_t check_virtual_net_allowed(const struct connection *c,
 	}
 
 	if (virt->flags & F_VIRTUAL_PRIVATE) {
-		if (net_in_list(peer_net, private_net_incl,
-				private_net_incl_len) &&
-		    !net_in_list(peer_net, private_net_excl,
-				private_net_excl_len))
+		if (net_in_trie(&private_nets, peer_net, F_NET_INCL) &&
+		    !net_in_trie(&private_nets, peer_net, F_NET_EXCL))
 			return NULL;
 
 		why = "a private network virtual IP was required, but the proposed IP did not match our list (virtual-private=), or our list excludes their IP (e.g. %v4!...) since it is in use elsewhere";
@@ -427,6 +554,77 @@ err_t check_virtual_net_allowed(const struct connection *c,
 	return why;
 }
 
+void remove_virtual_net_index(struct connection *c)
+{
+	struct virtual_net_entry *e = c->virtual_net;
+
+	if (e != NULL) {
+		struct virtual_net_entry **ep = &e->node->entries;
+
+		while (*ep != e)
+			ep = &(*ep)->next;
+		*ep = e->next;
+		prune_net_node(&in_use, e->node);
+		pfree(e);
+		c->virtual_net = NULL;
+	}
+}
+
+void update_virtual_net_index(struct connection *c)
+{
+	struct virtual_net_entry *e = c->virtual_net;
+
+	if (e != NULL) {
+		passert(e->c == c);
+		if (samesubnet(&e->client, &c->spd.that.client))
+			return;
+		remove_virtual_net_index(c);
+	}
+
+	e = alloc_thing(struct virtual_net_entry, "virtual net entry");
+	e->c = c;
+	e->client = c->spd.that.client;
+	e->node = add_net_node(&in_use, &e->client);
+	e->next = e->node->entries;
+	e->node->entries = e;
+	c->virtual_net = e;
+}
+
+static bool net_node_entries(const struct net_node *n,
+			     virtual_net_overlap_cb *cb, void *arg)
+{
+	for (struct virtual_net_entry *e = n->entries; e != NULL; e = e->next) {
+		if (cb(e->c, arg))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static bool net_node_subtree(const struct net_node *n,
+			     virtual_net_overlap_cb *cb, void *arg)
+{
+	return n != NULL &&
+		(net_node_entries(n, cb, arg) ||
+		 net_node_subtree(n->child[0], cb, arg) ||
+		 net_node_subtree(n->child[1], cb, arg));
+}
+
+bool foreach_virtual_net_overlap(const ip_subnet *net,
+				 virtual_net_overlap_cb *cb, void *arg)
+{
+	struct net_path path;
+	const struct net_node *n = *net_root(&in_use, net, &path);
+
+	/* connections whose client contains NET */
+	for (int bit = 0; n != NULL && bit < path.bits; bit++) {
+		if (net_node_entries(n, cb, arg))
+			return TRUE;
+		n = n->child[net_bit(&path, bit)];
+	}
+	/* and those whose client is inside NET */
+	return net_node_subtree(n, cb, arg);
+}
+
 static void show_virtual_private_kind(const char *kind,
 	const ip_subnet *private_net,
 	int private_net_len)
@@ -38,5 +38,24 @@ extern err_t check_virtual_net_allowed(const struct connection *c,
 	const ip_subnet *peer_net,
 	const ip_address *his_addr);
 
+/*
+ * Index of connections by their peer's client (spd.that.client), used
+ * to find virtual IPs that are already in use.
+ *
+ * update_virtual_net_index() must be called whenever a connection is
+ * added to the connections list or its spd.that.client changes;
+ * remove_virtual_net_index() when it is deleted.
+ */
+extern void update_virtual_net_index(struct connection *c);
+extern void remove_virtual_net_index(struct connection *c);
+
+/*
+ * Call CB for each indexed connection whose client contains, or is
+ * contained by, NET; stop, returning TRUE, when CB returns TRUE.
+ */
+typedef bool virtual_net_overlap_cb(struct connection *d, void *arg);
+extern bool foreach_virtual_net_overlap(const ip_subnet *net,
+					virtual_net_overlap_cb *cb, void *arg);
+
 #endif /* _VIRTUAL_IP_H */
 
@@ -171,7 +171,8 @@ static void help(void)
 		"debug: whack [--name <connection_name>] \\\n"
 		"	[--debug-none] | [--debug-all] | \\\n"
 		"	[--debug <class>] | [--debug private] \\\n"
-		"	[--debug list]\n"
+		"	[--debug list] \\\n"
+		"	[--debug-peer <ip-address>[/<mask>]] [--debug-state <state_object_number>]\n"
 		"\n"
 		"testcases: [--whackrecord <file>] [--whackstoprecord]\n"
 		"\n"
@@ -189,10 +190,17 @@ static void help(void)
 		"purge: whack --purgeocsp\n"
 		"\n"
 		"reread: whack [--rereadsecrets] [--fetchcrls] [--rereadall]\n"
+		"	(--rereadsecrets also refreshes the cached NSS certificates\n"
+		"	and keys; adding a connection refreshes its own)\n"
 		"\n"
 		"status: whack [--status] | [--trafficstatus] | [--globalstatus] | \\\n"
 		"	[--clearstats] | [--shuntstatus] | [--fipsstatus]\n"
 		"\n"
+		"status filters: whack (--status | --trafficstatus) \\\n"
+		"	[--status-name <pattern>] [--status-state <pattern>] \\\n"
+		"	[--status-peer <ip-address>[/<mask>]] [--status-ike-version 1|2] \\\n"
+		"	[--status-offset <n>] [--status-limit <n>]\n"
+		"\n"
 #ifdef HAVE_SECCOMP
 		"status: whack --seccomp-crashtest (CAREFUL!)\n"
 		"\n"
@@ -338,7 +346,14 @@ enum option_enums {
 	OPT_WHACKRECORD,
 	OPT_WHACKSTOPRECORD,
 
-#define OPT_LAST2 OPT_WHACKSTOPRECORD	/* last "normal" option, range 2 */
+	OPT_STATUS_NAME,
+	OPT_STATUS_STATE,
+	OPT_STATUS_PEER,
+	OPT_STATUS_IKE_VERSION,
+	OPT_STATUS_OFFSET,
+	OPT_STATUS_LIMIT,
+
+#define OPT_LAST2 OPT_STATUS_LIMIT	/* last "normal" option, range 2 */
 
 /* List options */
 
@@ -485,8 +500,10 @@ enum option_enums {
 	DBGOPT_DEBUG,
 	DBGOPT_IMPAIR,
 	DBGOPT_NO_IMPAIR,
+	DBGOPT_PEER,
+	DBGOPT_STATE,
 
-	DBGOPT_LAST = DBGOPT_NO_IMPAIR,
+	DBGOPT_LAST = DBGOPT_STATE,
 
 #define	OPTION_ENUMS_LAST	DBGOPT_LAST
 };
@@ -557,6 +574,12 @@ static const struct option long_opts[] = {
 	{ "trafficstatus", no_argument, NULL, OPT_TRAFFIC_STATUS + OO },
 	{ "shuntstatus", no_argument, NULL, OPT_SHUNT_STATUS + OO },
 	{ "fipsstatus", no_argument, NULL, OPT_FIPS_STATUS + OO },
+	{ "status-name", required_argument, NULL, OPT_STATUS_NAME + OO },
+	{ "status-state", required_argument, NULL, OPT_STATUS_STATE + OO },
+	{ "status-peer", required_argument, NULL, OPT_STATUS_PEER + OO },
+	{ "status-ike-version", required_argument, NULL, OPT_STATUS_IKE_VERSION + OO + NUMERIC_ARG },
+	{ "status-offset", required_argument, NULL, OPT_STATUS_OFFSET + OO + NUMERIC_ARG },
+	{ "status-limit", required_argument, NULL, OPT_STATUS_LIMIT + OO + NUMERIC_ARG },
 #ifdef HAVE_SECCOMP
 	{ "seccomp-crashtest", no_argument, NULL, OPT_SECCOMP_CRASHTEST + OO },
 #endif
@@ -765,6 +788,8 @@ static const struct option long_opts[] = {
 	{ "debug-none", no_argument, NULL, DBGOPT_NONE + OO },
 	{ "debug-all", no_argument, NULL, DBGOPT_ALL + OO },
 	{ "debug", required_argument, NULL, DBGOPT_DEBUG + OO, },
+	{ "debug-peer", required_argument, NULL, DBGOPT_PEER + OO, },
+	{ "debug-state", required_argument, NULL, DBGOPT_STATE + OO + NUMERIC_ARG, },
 	{ "impair", required_argument, NULL, DBGOPT_IMPAIR + OO, },
 	{ "no-impair", required_argument, NULL, DBGOPT_NO_IMPAIR + OO, },
 
@@ -903,6 +928,7 @@ int main(int argc, char **argv)
 	assert(OPTION_OFFSET + OPTION_ENUMS_LAST < NUMERIC_ARG);
 	assert(OPT_LAST1 - OPT_FIRST1 < LELEM_ROOF);
 	assert(OPT_LAST2 - OPT_FIRST2 < LELEM_ROOF);
+	assert(OPT_LAST2 < LELEM_ROOF);	/* opts2_seen uses LELEM(c) */
 	assert(LST_LAST - LST_FIRST < LELEM_ROOF);
 	assert(END_LAST - END_FIRST < LELEM_ROOF);
 	assert(CD_LAST - CD_FIRST < LELEM_ROOF);
@@ -1386,6 +1412,41 @@ int main(int argc, char **argv)
 			msg.whack_async = TRUE;
 			continue;
 
+		case OPT_STATUS_NAME:	/* --status-name <pattern> */
+			msg.status_filter.name = optarg;
+			continue;
+
+		case OPT_STATUS_STATE:	/* --status-state <pattern> */
+			msg.status_filter.state = optarg;
+			continue;
+
+		case OPT_STATUS_PEER:	/* --status-peer <ip-address>[/<mask>] */
+			if (strchr(optarg, '/') != NULL) {
+				diagq(ttosubnet(optarg, 0, AF_UNSPEC,
+						&msg.status_filter.peer), optarg);
+			} else {
+				ip_address peer;
+
+				diagq(ttoaddr(optarg, 0, AF_UNSPEC, &peer), optarg);
+				diagq(addrtosubnet(&peer, &msg.status_filter.peer), optarg);
+			}
+			msg.status_filter.has_peer = TRUE;
+			continue;
+
+		case OPT_STATUS_IKE_VERSION:	/* --status-ike-version 1|2 */
+			if (opt_whole != 1 && opt_whole != 2)
+				diagq("--status-ike-version must be 1 or 2", optarg);
+			msg.status_filter.ike_version = opt_whole;
+			continue;
+
+		case OPT_STATUS_OFFSET:	/* --status-offset <n> */
+			msg.status_filter.offset = opt_whole;
+			continue;
+
+		case OPT_STATUS_LIMIT:	/* --status-limit <n> */
+			msg.status_filter.limit = opt_whole;
+			continue;
+
 		/* List options */
 
 		case LST_UTC:	/* --utc */
@@ -2270,6 +2331,23 @@ int main(int argc, char **argv)
 			}
 			continue;
 
+		case DBGOPT_PEER:	/* --debug-peer <ip-address>[/<mask>] */
+			if (strchr(optarg, '/') != NULL) {
+				diagq(ttosubnet(optarg, 0, AF_UNSPEC,
+						&msg.debug_peer), optarg);
+			} else {
+				ip_address peer;
+
+				diagq(ttoaddr(optarg, 0, AF_UNSPEC, &peer), optarg);
+				diagq(addrtosubnet(&peer, &msg.debug_peer), optarg);
+			}
+			msg.whack_debug_peer = TRUE;
+			continue;
+
+		case DBGOPT_STATE:	/* --debug-state <state_object_number> */
+			msg.debug_serialno = opt_whole;
+			continue;
+
 		default:
 			bad_case(c);
 			break;
@@ -2390,6 +2468,14 @@ int main(int argc, char **argv)
 			diag("no reason for --name");
 	}
 
+	if (!LDISJOINT(opts2_seen,
+		       LELEM(OPT_STATUS_NAME) | LELEM(OPT_STATUS_STATE) |
+		       LELEM(OPT_STATUS_PEER) | LELEM(OPT_STATUS_IKE_VERSION) |
+		       LELEM(OPT_STATUS_OFFSET) | LELEM(OPT_STATUS_LIMIT)) &&
+	    !msg.whack_status && !msg.whack_traffic_status) {
+		diag("--status-* options can only be used with --status or --trafficstatus");
+	}
+
 	if (!LDISJOINT(opts1_seen, LELEM(OPT_REMOTE_HOST))) {
 		if (!LHAS(opts1_seen, OPT_INITIATE))
 			diag("--remote-host can only be used with --initiate");
@@ -0,0 +1,238 @@
+/* state table hash micro-benchmark, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Check SipHash against known answers, then compare the unkeyed
+ * polynomial that used to hash IKE SPIi into pluto's state table
+ * against the keyed SipHash-1-3 now used, with random SPIs and with
+ * SPIs an attacker chose to all land in one slot of the old hash.
+ * For each, report the longest chain and the cost of looking up
+ * every SPI.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "siphash.h"
+
+#include "defs.h"
+#include "ike_spi.h"
+#include "state_db.h"		/* for STATE_TABLE_SIZE */
+
+#define NR_SLOTS STATE_TABLE_SIZE
+#define NR_SPIS 20000
+
+typedef ike_spi_t spi_t;
+
+static spi_t spis[NR_SPIS];
+static unsigned next[NR_SPIS];
+static unsigned slots[NR_SLOTS];	/* index+1; 0 is empty */
+
+static struct siphash_key key;
+
+/*
+ * Known answers: key 00 01 .. 0f, message 00 01 .. N-1.  The
+ * SipHash-2-4 values are the paper's (appendix A; read as
+ * little-endian); the SipHash-1-3 values were checked against other
+ * implementations of that variant.  Lengths 0-15 cover every tail
+ * length, with and without a whole block.
+ */
+
+static const struct {
+	uint64_t siphash13;
+	uint64_t siphash24;
+} known_answers[] = {
+	{ UINT64_C(0xabac0158050fc4dc), UINT64_C(0x726fdb47dd0e0e31), },	/* 0 */
+	{ UINT64_C(0xc9f49bf37d57ca93), UINT64_C(0x74f839c593dc67fd), },	/* 1 */
+	{ UINT64_C(0x82cb9b024dc7d44d), UINT64_C(0x0d6c8009d9a94f5a), },	/* 2 */
+	{ UINT64_C(0x8bf80ab8e7ddf7fb), UINT64_C(0x85676696d7fb7e2d), },	/* 3 */
+	{ UINT64_C(0xcf75576088d38328), UINT64_C(0xcf2794e0277187b7), },	/* 4 */
+	{ UINT64_C(0xdef9d52f49533b67), UINT64_C(0x18765564cd99a68d), },	/* 5 */
+	{ UINT64_C(0xc50d2b50c59f22a7), UINT64_C(0xcbc9466e58fee3ce), },	/* 6 */
+	{ UINT64_C(0xd3927d989bb11140), UINT64_C(0xab0200f58b01d137), },	/* 7 */
+	{ UINT64_C(0x369095118d299a8e), UINT64_C(0x93f5f5799a932462), },	/* 8 */
+	{ UINT64_C(0x25a48eb36c063de4), UINT64_C(0x9e0082df0ba9e4b0), },	/* 9 */
+	{ UINT64_C(0x79de85ee92ff097f), UINT64_C(0x7a5dbbc594ddb9f3), },	/* 10 */
+	{ UINT64_C(0x70c118c1f94dc352), UINT64_C(0xf4b32f46226bada7), },	/* 11 */
+	{ UINT64_C(0x78a384b157b4d9a2), UINT64_C(0x751e8fbc860ee5fb), },	/* 12 */
+	{ UINT64_C(0x306f760c1229ffa7), UINT64_C(0x14ea5627c0843d90), },	/* 13 */
+	{ UINT64_C(0x605aa111c0f95d34), UINT64_C(0xf723ca908e7af2ee), },	/* 14 */
+	{ UINT64_C(0xd320d86d2a519956), UINT64_C(0xa129ca6149be45e5), },	/* 15 */
+};
+
+static bool check_known_answers(void)
+{
+	/* k0 and k1 are the key bytes read as little-endian */
+	const struct siphash_key ka_key = {
+		.k = {
+			UINT64_C(0x0706050403020100),
+			UINT64_C(0x0f0e0d0c0b0a0908),
+		},
+	};
+	uint8_t msg[elemsof(known_answers)];
+	bool ok = true;
+	for (unsigned len = 0; len < elemsof(known_answers); len++) {
+		msg[len] = len;
+		uint64_t h13 = siphash13(&ka_key, msg, len);
+		uint64_t h24 = siphash24(&ka_key, msg, len);
+		if (h13 != known_answers[len].siphash13) {
+			fprintf(stderr, "hashcheck: SipHash-1-3 of %u bytes: 0x%016" PRIx64 ", expecting 0x%016" PRIx64 "\n",
+				len, h13, known_answers[len].siphash13);
+			ok = false;
+		}
+		if (h24 != known_answers[len].siphash24) {
+			fprintf(stderr, "hashcheck: SipHash-2-4 of %u bytes: 0x%016" PRIx64 ", expecting 0x%016" PRIx64 "\n",
+				len, h24, known_answers[len].siphash24);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/*
+ * The unkeyed polynomial pluto used before the tables were keyed.
+ * It is no longer in pluto, so it lives here as the attacker's model.
+ */
+
+static size_t old_hash(const spi_t *spi)
+{
+	size_t hash = 0;
+	for (unsigned j = 0; j < sizeof(spi->bytes); j++) {
+		hash = hash * 251 + spi->bytes[j];
+	}
+	return hash;
+}
+
+static size_t keyed_hash(const spi_t *spi)
+{
+	return siphash13(&key, spi->bytes, sizeof(spi->bytes));
+}
+
+static void random_bytes(void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	for (size_t i = 0; i < len; i++) {
+		p[i] = random() & 0xff;
+	}
+}
+
+static void random_spis(void)
+{
+	for (unsigned i = 0; i < NR_SPIS; i++) {
+		random_bytes(spis[i].bytes, sizeof(spis[i].bytes));
+	}
+}
+
+/* what a peer can do: only send SPIs that, unkeyed, hash to slot 0 */
+static void adversarial_spis(void)
+{
+	for (unsigned i = 0; i < NR_SPIS; i++) {
+		do {
+			random_bytes(spis[i].bytes, sizeof(spis[i].bytes));
+		} while (old_hash(&spis[i]) % NR_SLOTS != 0);
+	}
+}
+
+static unsigned fill(size_t (*hash)(const spi_t *))
+{
+	memset(slots, 0, sizeof(slots));
+	for (unsigned i = 0; i < NR_SPIS; i++) {
+		unsigned s = hash(&spis[i]) % NR_SLOTS;
+		next[i] = slots[s];
+		slots[s] = i + 1;
+	}
+	unsigned max_chain = 0;
+	for (unsigned s = 0; s < NR_SLOTS; s++) {
+		unsigned chain = 0;
+		for (unsigned e = slots[s]; e != 0; e = next[e - 1]) {
+			chain++;
+		}
+		if (chain > max_chain) {
+			max_chain = chain;
+		}
+	}
+	return max_chain;
+}
+
+static double lookups(size_t (*hash)(const spi_t *))
+{
+	clock_t start = clock();
+	unsigned found = 0;
+	for (unsigned i = 0; i < NR_SPIS; i++) {
+		unsigned s = hash(&spis[i]) % NR_SLOTS;
+		for (unsigned e = slots[s]; e != 0; e = next[e - 1]) {
+			if (memcmp(spis[e - 1].bytes, spis[i].bytes,
+				   sizeof(spis[i].bytes)) == 0) {
+				found++;
+				break;
+			}
+		}
+	}
+	if (found != NR_SPIS) {
+		fprintf(stderr, "hashcheck: only found %u of %u SPIs\n",
+			found, NR_SPIS);
+		exit(1);
+	}
+	/* nanoseconds per lookup */
+	return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / NR_SPIS;
+}
+
+static unsigned run(const char *spi_kind, const char *hash_kind,
+		    size_t (*hash)(const spi_t *))
+{
+	unsigned max_chain = fill(hash);
+	double ns = lookups(hash);
+	printf("%-12s %-8s max chain %6u  %8.1f ns/lookup\n",
+	       spi_kind, hash_kind, max_chain, ns);
+	return max_chain;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 1;
+	}
+
+	if (!check_known_answers()) {
+		return 1;
+	}
+	printf("SipHash known answers: %zu passed\n", 2 * elemsof(known_answers));
+
+	srandom(time(NULL));
+	random_bytes(&key, sizeof(key));
+
+	printf("%u SPIs, %u slots, average chain %u\n",
+	       NR_SPIS, NR_SLOTS, NR_SPIS / NR_SLOTS);
+
+	random_spis();
+	run("random", "old", old_hash);
+	unsigned random_max = run("random", "keyed", keyed_hash);
+
+	adversarial_spis();
+	run("adversarial", "old", old_hash);
+	unsigned adversarial_max = run("adversarial", "keyed", keyed_hash);
+
+	/* the attacker can't tell the keyed hash from random */
+	if (adversarial_max > 2 * random_max) {
+		fprintf(stderr, "hashcheck: keyed hash max chain %u, random %u\n",
+			adversarial_max, random_max);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,9 @@
+../../guestbin/swan-prep
+ipsec start
+/testing/pluto/bin/wait-until-pluto-started
+ipsec whack --debug all --debug-peer 192.1.2.23
+ipsec whack --debug private --debug-state 3
+ipsec whack --status | grep '^000 debug '
+ipsec whack --debug none --debug-peer 192.1.2.23
+ipsec whack --debug none --debug-state 3
+ipsec whack --status | grep '^000 debug ' || echo no debug selectors
@@ -0,0 +1,520 @@
+#!/usr/bin/env python3
+
+# Run pluto scale benchmarks, for libreswan
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; either version 2 of the License, or (at your
+# option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+
+# Each scenario starts a fresh pair of pluto daemons (an initiator and
+# a responder) on the loopback interface using --use-nostack, so that
+# no kernel IPsec support is needed, drives them using whack, and
+# appends one JSON record per scenario to the results file.
+#
+# The script re-runs itself in a private network namespace (as root in
+# a user namespace when not already root) where it gives the loopback
+# interface one extra address per connection.  The responder listens
+# on 127.0.0.1 only; the initiator listens on every address and uses a
+# different one for each connection, so that each connection has its
+# own host pair and so its own IKE SA.  With --use-nostack pluto
+# orients a connection by matching both the address and the IKE port,
+# so the different --ikeport of each end tells them apart on
+# 127.0.0.1.
+
+import argparse
+import json
+import os
+import re
+import resource
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+from datetime import datetime
+
+
+SCENARIOS = ["load", "establish", "rekey", "ikerekey", "delete", "dpd", "status"]
+
+PSK = "scale-benchmark-secret"
+
+
+class Pluto:
+
+    def __init__(self, args, name, ikeport, natikeport, listen=None):
+        self.args = args
+        self.name = name
+        self.ikeport = ikeport
+        self.natikeport = natikeport
+        self.listen = listen
+        self.dir = os.path.join(args.workdir, name)
+        self.rundir = os.path.join(self.dir, "run")
+        self.libexecdir = os.path.join(self.dir, "libexec")
+        self.nssdir = os.path.join(self.dir, "nss")
+        self.logfile = os.path.join(self.dir, "pluto.log")
+        self.process = None
+
+    def install(self):
+        # pluto runs "addconn --autoall" from its own directory at
+        # startup; give this copy a dummy one since the connections
+        # are added, and --listen sent, using whack.
+        os.makedirs(self.libexecdir, exist_ok=True)
+        pluto = os.path.join(self.libexecdir, "pluto")
+        shutil.copy2(self.args.pluto, pluto)
+        addconn = os.path.join(self.libexecdir, "addconn")
+        with open(addconn, "w") as f:
+            f.write("#!/bin/sh\nexit 0\n")
+        os.chmod(addconn, 0o755)
+        return pluto
+
+    def start(self):
+        os.makedirs(self.rundir, exist_ok=True)
+        os.makedirs(self.nssdir, exist_ok=True)
+        pluto = self.install()
+        secrets = os.path.join(self.dir, "ipsec.secrets")
+        with open(secrets, "w") as f:
+            f.write(": PSK \"%s\"\n" % PSK)
+        if shutil.which("certutil") and not os.path.exists(os.path.join(self.nssdir, "cert9.db")):
+            subprocess.run(["certutil", "-N", "-d", "sql:" + self.nssdir,
+                            "--empty-password"], check=True)
+        command = [pluto,
+                   "--nofork",
+                   "--use-nostack",
+                   "--ikeport", str(self.ikeport),
+                   "--natikeport", str(self.natikeport),
+                   "--rundir", self.rundir,
+                   "--dumpdir", self.dir,
+                   "--ipsecdir", self.dir,
+                   "--nssdir", self.nssdir,
+                   "--secretsfile", secrets,
+                   "--logfile", self.logfile]
+        if self.listen:
+            command += ["--listen", self.listen]
+        if self.args.debug:
+            command += ["--debug-all"]
+        self.process = subprocess.Popen(command, stdin=subprocess.DEVNULL)
+        # wait for the control socket, then have pluto find its
+        # interfaces (normally addconn does this)
+        ctl = os.path.join(self.rundir, "pluto.ctl")
+        deadline = time.monotonic() + 30
+        while True:
+            if self.process.poll() is not None:
+                raise Exception("%s: pluto exited with %s; see %s"
+                                % (self.name, self.process.returncode, self.logfile))
+            if os.path.exists(ctl):
+                result = self.whack("--listen", check=False, returncode=True)
+                if result.returncode == 0:
+                    break
+            if time.monotonic() > deadline:
+                raise Exception("%s: timeout waiting for %s" % (self.name, ctl))
+            time.sleep(0.1)
+        if "no public interfaces found" in result.stdout:
+            raise Exception("%s: pluto found no interfaces; see %s"
+                            % (self.name, self.logfile))
+
+    def stop(self):
+        if not self.process:
+            return
+        if self.process.poll() is None:
+            self.whack("--shutdown", check=False)
+            try:
+                self.process.wait(timeout=self.args.timeout)
+            except subprocess.TimeoutExpired:
+                self.process.send_signal(signal.SIGKILL)
+                self.process.wait()
+        self.process = None
+
+    def whack(self, *args, check=True, returncode=False):
+        result = subprocess.run([self.args.whack, "--rundir", self.rundir] + list(args),
+                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                universal_newlines=True)
+        if check and result.returncode != 0:
+            raise Exception("%s: whack %s failed: %s"
+                            % (self.name, " ".join(args), result.stdout))
+        return result if returncode else result.stdout
+
+    def globalstatus(self):
+        status = {}
+        for line in self.whack("--globalstatus").splitlines():
+            match = re.match(r"^(?:[0-9]+ )?([a-z0-9_.]+)=([0-9]+)$", line)
+            if match:
+                status[match.group(1)] = int(match.group(2))
+        return status
+
+    def rss_kb(self):
+        with open("/proc/%d/status" % self.process.pid) as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1])
+        return None
+
+    def cpu_seconds(self):
+        with open("/proc/%d/stat" % self.process.pid) as f:
+            # skip "pid (comm)", which may contain spaces
+            fields = f.read().rsplit(")", 1)[1].split()
+        # utime and stime are fields 14 and 15
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def client(base, n):
+    return "10.%d.%d.%d/32" % (base + ((n >> 16) & 0x7f), (n >> 8) & 0xff, n & 0xff)
+
+
+RESPONDER_ADDRESS = "127.0.0.1"
+
+def initiator_address(n):
+    # 127.1.0.1 onwards; all of 127/8 is on the loopback interface
+    n += 1
+    return "127.%d.%d.%d" % (1 + (n >> 16), (n >> 8) & 0xff, n & 0xff)
+
+
+def connection_name(n):
+    return "scale-%d" % n
+
+
+def add_connection(args, pluto, peer, n, initiator, extra):
+    this = 0 if initiator else 128
+    that = 128 if initiator else 0
+    this_host = initiator_address(n) if initiator else RESPONDER_ADDRESS
+    that_host = RESPONDER_ADDRESS if initiator else initiator_address(n)
+    pluto.whack("--name", connection_name(n),
+                "--id", "@%s" % pluto.name,
+                "--host", this_host,
+                "--ikeport", str(pluto.ikeport),
+                "--client", client(this, n),
+                "--to",
+                "--id", "@%s" % peer.name,
+                "--host", that_host,
+                "--ikeport", str(peer.ikeport),
+                "--client", client(that, n),
+                "--psk", "--encrypt", "--tunnel", "--ikev2-allow",
+                "--ike", args.ike, "--esp", args.esp,
+                *extra)
+
+
+class Benchmark:
+
+    def __init__(self, args, scenario):
+        self.args = args
+        self.scenario = scenario
+        self.initiator = Pluto(args, "initiator", args.port, args.port + 2)
+        self.responder = Pluto(args, "responder", args.port + 1, args.port + 3,
+                               listen=RESPONDER_ADDRESS)
+        self.phases = {}
+        self.throughput = {}
+        self.counters = {}
+
+    def phase(self, name, start, count=None):
+        seconds = time.monotonic() - start
+        self.phases[name] = round(seconds, 6)
+        if count is not None and seconds > 0:
+            self.throughput[name] = round(count / seconds, 3)
+        if self.args.verbose:
+            print("%s: %s: %.3fs" % (self.scenario, name, seconds))
+
+    def wait_for(self, pluto, what, key, target):
+        deadline = time.monotonic() + self.args.timeout
+        while True:
+            value = pluto.globalstatus().get(key, 0)
+            if value >= target:
+                return value
+            if time.monotonic() > deadline:
+                raise Exception("%s: timeout waiting for %s; %s=%d, expecting %d"
+                                % (pluto.name, what, key, value, target))
+            time.sleep(self.args.poll)
+
+    def load(self, extra=()):
+        start = time.monotonic()
+        for n in range(self.args.connections):
+            add_connection(self.args, self.responder, self.initiator, n, False, extra)
+        self.phase("load-responder", start, self.args.connections)
+        start = time.monotonic()
+        for n in range(self.args.connections):
+            add_connection(self.args, self.initiator, self.responder, n, True, extra)
+        self.phase("load-initiator", start, self.args.connections)
+
+    def establish(self):
+        start = time.monotonic()
+        for n in range(self.args.sas):
+            self.initiator.whack("--name", connection_name(n),
+                                 "--initiate", "--asynchronous")
+        self.phase("initiate", start, self.args.sas)
+        self.wait_for(self.initiator, "established Child SAs",
+                      "current.states.ipsec", self.args.sas)
+        self.phase("establish", start, self.args.sas)
+        self.counters["ike-sas"] = self.initiator.globalstatus().get("current.states.ike", 0)
+
+    def wait_for_increase(self, pluto, what, key, baseline, target, deadline):
+        while True:
+            value = pluto.globalstatus().get(key, 0) - baseline
+            if value >= target:
+                return value
+            if time.monotonic() > deadline:
+                raise Exception("%s: timeout waiting for %s; %d of %d"
+                                % (pluto.name, what, value, target))
+            time.sleep(self.args.poll)
+
+    def run(self):
+        args = self.args
+        self.initiator.start()
+        self.responder.start()
+        try:
+            getattr(self, "scenario_" + self.scenario)()
+            record = {
+                "timestamp": datetime.utcnow().isoformat() + "Z",
+                "version": version(args),
+                "scenario": self.scenario,
+                "parameters": {
+                    "connections": args.connections,
+                    "sas": args.sas,
+                    "ike": args.ike,
+                    "esp": args.esp,
+                },
+                "phases": self.phases,
+                "throughput": self.throughput,
+                "counters": self.counters,
+                "rss_kb": {
+                    "initiator": self.initiator.rss_kb(),
+                    "responder": self.responder.rss_kb(),
+                },
+                "cpu_seconds": {
+                    "initiator": self.initiator.cpu_seconds(),
+                    "responder": self.responder.cpu_seconds(),
+                },
+            }
+        finally:
+            self.initiator.stop()
+            self.responder.stop()
+        return record
+
+    def scenario_load(self):
+        self.load()
+
+    def scenario_establish(self):
+        self.load()
+        self.establish()
+
+    def scenario_rekey(self):
+        # Arrange for all the Child SAs to be replaced together (no
+        # fuzz); the rekey phase runs from when the first replacement
+        # falls due (the earliest possible establish time plus the
+        # lifetime less the margin) until the last has completed.
+        lifetime = self.args.lifetime
+        margin = lifetime // 2
+        self.load(("--ipseclifetime", str(lifetime),
+                   "--rekeymargin", str(margin),
+                   "--rekeyfuzz", "0"))
+        due = time.monotonic() + lifetime - margin
+        self.establish()
+        baseline = self.initiator.globalstatus().get("total.ipsec.type.all", 0)
+        self.wait_for_increase(self.initiator, "Child SA rekeys",
+                               "total.ipsec.type.all", baseline,
+                               self.args.sas, due + self.args.timeout)
+        self.phase("rekey", due, self.args.sas)
+
+    def scenario_ikerekey(self):
+        # As for rekey, but it is the IKE SAs (one per connection)
+        # that are replaced; each replaced IKE SA is then deleted,
+        # which counts as completed.
+        lifetime = self.args.lifetime
+        margin = lifetime // 2
+        self.load(("--ikelifetime", str(lifetime),
+                   "--rekeymargin", str(margin),
+                   "--rekeyfuzz", "0"))
+        due = time.monotonic() + lifetime - margin
+        self.establish()
+        baseline = self.initiator.globalstatus().get("total.ike.ikev2.completed", 0)
+        self.wait_for_increase(self.initiator, "IKE SA rekeys",
+                               "total.ike.ikev2.completed", baseline,
+                               self.args.sas, due + self.args.timeout)
+        self.phase("ikerekey", due, self.args.sas)
+        self.counters["ike-sas-after-rekey"] = \
+            self.initiator.globalstatus().get("current.states.ike", 0)
+
+    def scenario_delete(self):
+        self.load()
+        self.establish()
+        start = time.monotonic()
+        for n in range(self.args.connections):
+            self.initiator.whack("--name", connection_name(n), "--delete")
+        self.phase("delete", start, self.args.connections)
+        deadline = time.monotonic() + self.args.timeout
+        while self.responder.globalstatus().get("current.states.all", 0) > 0:
+            if time.monotonic() > deadline:
+                raise Exception("timeout waiting for the responder's states to be deleted")
+            time.sleep(self.args.poll)
+        self.phase("drain", start, self.args.sas)
+
+    def scenario_dpd(self):
+        self.load(("--dpddelay", "1", "--dpdtimeout", str(self.args.duration * 2),
+                   "--dpdaction", "hold"))
+        self.establish()
+        before = {
+            "initiator": self.initiator.cpu_seconds(),
+            "responder": self.responder.cpu_seconds(),
+        }
+        traffic = self.responder.globalstatus().get("total.ike.traffic.in", 0)
+        time.sleep(self.args.duration)
+        self.phase("dpd", time.monotonic() - self.args.duration)
+        self.counters["dpd-cpu-seconds"] = {
+            "initiator": self.initiator.cpu_seconds() - before["initiator"],
+            "responder": self.responder.cpu_seconds() - before["responder"],
+        }
+        self.counters["dpd-bytes-in"] = \
+            self.responder.globalstatus().get("total.ike.traffic.in", 0) - traffic
+        status = self.initiator.globalstatus()
+        self.counters["ipsec-sas-after-dpd"] = status.get("current.states.ipsec", 0)
+
+    def scenario_status(self):
+        self.load()
+        self.establish()
+        start = time.monotonic()
+        output = self.initiator.whack("--status")
+        self.phase("status", start)
+        self.counters["status-bytes"] = len(output)
+        self.counters["status-lines"] = output.count("\n")
+        self.counters["states"] = self.initiator.globalstatus().get("current.states.all", 0)
+
+
+NETNS = "SCALE_NETNS"
+
+def enter_netns():
+    # Re-run this script in a private network namespace; unless
+    # already root, also in a user namespace where it is root.
+    command = ["unshare", "--net"]
+    if os.geteuid() != 0:
+        command += ["--user", "--map-root-user"]
+    command += [sys.executable, os.path.abspath(__file__)] + sys.argv[1:]
+    os.environ[NETNS] = "1"
+    try:
+        os.execvp(command[0], command)
+    except OSError as e:
+        sys.exit("%s: %s" % (" ".join(command[0:3]), e))
+
+
+def setup_netns(args):
+    subprocess.run(["ip", "link", "set", "lo", "up"], check=True)
+    addresses = "".join("address add %s/32 dev lo\n" % initiator_address(n)
+                        for n in range(args.connections))
+    subprocess.run(["ip", "-batch", "-"], input=addresses,
+                   universal_newlines=True, check=True)
+    # the initiator has an IKE and a NAT-T socket per address
+    need = 2 * args.connections + 256
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < need:
+        if hard != resource.RLIM_INFINITY and hard < need:
+            sys.exit("%d connections need %d file descriptors but the limit is %d"
+                     % (args.connections, need, hard))
+        resource.setrlimit(resource.RLIMIT_NOFILE, (need, hard))
+
+
+_version = None
+
+def version(args):
+    global _version
+    if _version is None:
+        try:
+            _version = subprocess.run([args.pluto, "--version"],
+                                      stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                      universal_newlines=True).stdout.strip()
+        except OSError:
+            _version = "unknown"
+    return _version
+
+
+def main():
+
+    parser = argparse.ArgumentParser(description="run pluto scale benchmarks",
+                                     epilog="Each scenario starts a fresh initiator/responder pair of pluto daemons, in a private network namespace, on the loopback interface using --use-nostack (no kernel IPsec needed) and appends a JSON record containing per-phase timings, throughput, RSS and CPU use to the results file.")
+    parser.add_argument("--verbose", "-v", action="count", default=0)
+    parser.add_argument("--debug", action="store_true",
+                        help="run pluto with --debug-all (slow)")
+    parser.add_argument("--builddir", metavar="DIRECTORY",
+                        help="directory containing the built programs/pluto and programs/whack (default: guess from OBJDIR)")
+    parser.add_argument("--pluto", metavar="PROGRAM", help="pluto program")
+    parser.add_argument("--whack", metavar="PROGRAM", help="whack program")
+    parser.add_argument("--workdir", metavar="DIRECTORY",
+                        help="directory for the daemons' state and logs (default: a temporary directory)")
+    parser.add_argument("--results", metavar="FILE", default="scale-results.json",
+                        help="file to append JSON records to (default: %(default)s)")
+    parser.add_argument("--port", type=int, default=15500,
+                        help="first of four consecutive UDP ports to use (default: %(default)s)")
+    parser.add_argument("--connections", "-n", type=int, default=100,
+                        help="connections to load (default: %(default)s)")
+    parser.add_argument("--sas", "-m", type=int,
+                        help="connections to establish (default: all)")
+    parser.add_argument("--ike", default="aes_gcm256-sha2_256-dh19",
+                        help="IKE proposal (default: %(default)s)")
+    parser.add_argument("--esp", default="aes_gcm256",
+                        help="ESP proposal (default: %(default)s)")
+    parser.add_argument("--lifetime", type=int, default=60,
+                        help="Child SA, or IKE SA, lifetime used by the rekey and ikerekey scenarios (default: %(default)s)")
+    parser.add_argument("--duration", type=int, default=30,
+                        help="seconds to run the dpd scenario (default: %(default)s)")
+    parser.add_argument("--timeout", type=int, default=300,
+                        help="seconds to wait for a phase to complete (default: %(default)s)")
+    parser.add_argument("--poll", type=float, default=0.5,
+                        help="seconds between status polls (default: %(default)s)")
+    parser.add_argument("scenarios", metavar="SCENARIO", nargs="*",
+                        help="scenarios to run: %s (default: all)" % " ".join(SCENARIOS))
+    args = parser.parse_args()
+
+    for scenario in args.scenarios:
+        if scenario not in SCENARIOS:
+            parser.error("unknown scenario '%s'" % scenario)
+    if not args.scenarios:
+        args.scenarios = SCENARIOS
+
+    if args.sas is None or args.sas > args.connections:
+        args.sas = args.connections
+
+    if not args.builddir:
+        # see mk/objdir.mk
+        top_srcdir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+        uname = os.uname()
+        objdir = os.getenv("OBJDIR") or "OBJ.%s.%s" % (uname.sysname.lower(), uname.machine)
+        args.builddir = os.path.join(top_srcdir, objdir)
+    if not args.pluto:
+        args.pluto = os.path.join(args.builddir, "programs", "pluto", "pluto")
+    if not args.whack:
+        args.whack = os.path.join(args.builddir, "programs", "whack", "whack")
+
+    if not os.getenv(NETNS):
+        enter_netns()
+    setup_netns(args)
+
+    cleanup = None
+    if not args.workdir:
+        cleanup = args.workdir = tempfile.mkdtemp(prefix="scale.")
+
+    status = 0
+    try:
+        for scenario in args.scenarios:
+            try:
+                record = Benchmark(args, scenario).run()
+            except Exception as e:
+                print("%s: failed: %s" % (scenario, e), file=sys.stderr)
+                status = 1
+                continue
+            with open(args.results, "a") as f:
+                f.write(json.dumps(record, sort_keys=True) + "\n")
+            if args.verbose:
+                print(json.dumps(record, indent=2, sort_keys=True))
+    finally:
+        if cleanup and status == 0:
+            shutil.rmtree(cleanup)
+        elif cleanup:
+            print("logs left in %s" % cleanup, file=sys.stderr)
+
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())